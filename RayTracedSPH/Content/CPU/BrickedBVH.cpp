@@ -0,0 +1,237 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "BrickedBVH.h"
+
+using namespace std;
+using namespace DirectX;
+
+BrickedBVH::BrickedBVH() :
+	m_stats(),
+	m_domainMin(0.0f, 0.0f, 0.0f),
+	m_brickSize(0.0f),
+	m_invBrickSize(0.0f),
+	m_dims(),
+	m_radius(0.0f),
+	m_margin(0.0f),
+	m_clusterSize(1)
+{
+}
+
+BrickedBVH::~BrickedBVH()
+{
+}
+
+void BrickedBVH::Init(const XMFLOAT3& domainMin, const XMFLOAT3& domainMax, float brickSize,
+	float radius, float margin, uint32_t clusterSize)
+{
+	m_domainMin = domainMin;
+	m_brickSize = brickSize;
+	m_invBrickSize = 1.0f / brickSize;
+	m_radius = radius;
+	m_margin = margin;
+	m_clusterSize = clusterSize;
+
+	const float size[] = { domainMax.x - domainMin.x, domainMax.y - domainMin.y, domainMax.z - domainMin.z };
+	for (uint8_t i = 0; i < 3; ++i) m_dims[i] = (max)(static_cast<int32_t>(ceil(size[i] * m_invBrickSize)), 1);
+
+	m_bricks = vector<Brick>(static_cast<size_t>(m_dims[0]) * m_dims[1] * m_dims[2]);
+	m_brickStates.resize(m_bricks.size());
+	Reset();
+}
+
+void BrickedBVH::Reset()
+{
+	m_particleBricks.clear();
+	m_refitPositions.clear();
+	m_topLevelNodes.clear();
+	m_topLevelBricks.clear();
+	for (auto& brick : m_bricks) brick.Particles.clear();
+}
+
+const BrickedBVH::UpdateStats& BrickedBVH::Update(const XMFLOAT3* positions, uint32_t numParticles)
+{
+	// Everything is rebuilt for a new set of particles, after Reset() or with a different number.
+	if (m_particleBricks.size() != numParticles)
+	{
+		m_particleBricks.assign(numParticles, UINT32_MAX);
+		m_refitPositions.assign(positions, positions + numParticles);
+	}
+
+	// Classify the bricks by the particle motion
+	const auto marginSq = m_margin * m_margin;
+	fill(m_brickStates.begin(), m_brickStates.end(), static_cast<uint8_t>(BRICK_SKIPPED));
+	for (auto i = 0u; i < numParticles; ++i)
+	{
+		const auto& pos = positions[i];
+		auto& brick = m_particleBricks[i];
+		if (brick == UINT32_MAX || !isInBrick(pos, brick))
+		{
+			if (brick != UINT32_MAX) m_brickStates[brick] = BRICK_REBUILT;
+			brick = getBrick(pos);
+			m_brickStates[brick] = BRICK_REBUILT;
+		}
+		else
+		{
+			const auto& refitPos = m_refitPositions[i];
+			const auto dx = pos.x - refitPos.x;
+			const auto dy = pos.y - refitPos.y;
+			const auto dz = pos.z - refitPos.z;
+			if (dx * dx + dy * dy + dz * dz > marginSq)
+				m_brickStates[brick] = (max)(m_brickStates[brick], static_cast<uint8_t>(BRICK_REFIT));
+		}
+	}
+
+	// Regather the particles of the rebuilt bricks
+	const auto numBricks = GetNumBricks();
+	for (auto b = 0u; b < numBricks; ++b)
+		if (m_brickStates[b] == BRICK_REBUILT) m_bricks[b].Particles.clear();
+	for (auto i = 0u; i < numParticles; ++i)
+	{
+		const auto brick = m_particleBricks[i];
+		if (m_brickStates[brick] == BRICK_REBUILT) m_bricks[brick].Particles.push_back(i);
+	}
+
+	m_stats = {};
+	for (auto b = 0u; b < numBricks; ++b)
+	{
+		auto& brick = m_bricks[b];
+		switch (m_brickStates[b])
+		{
+		case BRICK_REBUILT:
+			brick.BVH.Build(positions, brick.Particles.data(), static_cast<uint32_t>(brick.Particles.size()),
+				m_radius, m_clusterSize, m_margin);
+			++m_stats.NumRebuilt;
+			break;
+		case BRICK_REFIT:
+			brick.BVH.Refit(positions);
+			++m_stats.NumRefit;
+			break;
+		default:
+			// The bounds and the hierarchy stay, but the queries test the current positions.
+			if (brick.Particles.empty()) break;
+			brick.BVH.UpdatePositions(positions);
+			++m_stats.NumSkipped;
+			m_stats.NumSkippedParticles += static_cast<uint32_t>(brick.Particles.size());
+		}
+
+		// The refit positions are the reference of the margin test.
+		if (m_brickStates[b] != BRICK_SKIPPED)
+			for (const auto& i : brick.Particles) m_refitPositions[i] = positions[i];
+	}
+
+	// The top level is tiny, so it is rebuilt whenever any brick has changed.
+	if (m_stats.NumRebuilt > 0 || m_stats.NumRefit > 0) buildTopLevel();
+
+	return m_stats;
+}
+
+size_t BrickedBVH::GetMemorySize() const
+{
+	auto size = sizeof(ParticleBVH::Node) * m_topLevelNodes.size() + sizeof(uint32_t) * m_topLevelBricks.size();
+	for (const auto& brick : m_bricks) size += brick.BVH.GetMemorySize() + sizeof(uint32_t) * brick.Particles.size();
+
+	return size;
+}
+
+uint32_t BrickedBVH::GetNumBricks() const
+{
+	return static_cast<uint32_t>(m_bricks.size());
+}
+
+uint32_t BrickedBVH::getBrick(const XMFLOAT3& pos) const
+{
+	// The particles slightly outside the walls are clamped to the border bricks.
+	const float p[] = { pos.x - m_domainMin.x, pos.y - m_domainMin.y, pos.z - m_domainMin.z };
+
+	int32_t coord[3];
+	for (uint8_t i = 0; i < 3; ++i)
+		coord[i] = (min)((max)(static_cast<int32_t>(floor(p[i] * m_invBrickSize)), 0), m_dims[i] - 1);
+
+	return (coord[2] * m_dims[1] + coord[1]) * m_dims[0] + coord[0];
+}
+
+bool BrickedBVH::isInBrick(const XMFLOAT3& pos, uint32_t brick) const
+{
+	const auto x = brick % m_dims[0];
+	const auto y = brick / m_dims[0] % m_dims[1];
+	const auto z = brick / (m_dims[0] * m_dims[1]);
+
+	// The border bricks also hold the particles beyond the domain.
+	const auto isInRange = [this](float p, uint32_t coord, int32_t dim)
+	{
+		const auto hysteresis = 0.25f * m_brickSize;
+		const auto lo = coord > 0 ? m_brickSize * coord - hysteresis : -FLT_MAX;
+		const auto hi = static_cast<int32_t>(coord) < dim - 1 ? m_brickSize * (coord + 1) + hysteresis : FLT_MAX;
+
+		return p >= lo && p <= hi;
+	};
+
+	return isInRange(pos.x - m_domainMin.x, x, m_dims[0]) && isInRange(pos.y - m_domainMin.y, y, m_dims[1]) &&
+		isInRange(pos.z - m_domainMin.z, z, m_dims[2]);
+}
+
+void BrickedBVH::buildTopLevel()
+{
+	// Bounds of the non-empty bricks from their roots
+	m_topLevelBricks.clear();
+	for (auto b = 0u; b < GetNumBricks(); ++b)
+		if (!m_bricks[b].Particles.empty()) m_topLevelBricks.push_back(b);
+
+	const auto getBounds = [this](uint32_t b) -> const ParticleBVH::Node& { return m_bricks[b].BVH.GetNodes()[0]; };
+	const auto getCenter = [&](uint32_t b, uint8_t axis)
+	{
+		const auto& root = getBounds(b);
+
+		return (&root.Min.x)[axis] + (&root.Max.x)[axis];
+	};
+
+	m_topLevelNodes.clear();
+	if (m_topLevelBricks.empty()) return;
+	m_topLevelNodes.reserve(2 * m_topLevelBricks.size());
+	m_topLevelNodes.emplace_back();
+
+	// Top-down median split along the longest axis
+	struct Task { uint32_t Node, First, Count; };
+	vector<Task> tasks(1, { 0, 0, static_cast<uint32_t>(m_topLevelBricks.size()) });
+	while (!tasks.empty())
+	{
+		const auto task = tasks.back();
+		tasks.pop_back();
+
+		ParticleBVH::Node bounds = getBounds(m_topLevelBricks[task.First]);
+		for (auto i = task.First + 1; i < task.First + task.Count; ++i)
+		{
+			const auto& root = getBounds(m_topLevelBricks[i]);
+			bounds.Min = XMFLOAT3((min)(bounds.Min.x, root.Min.x), (min)(bounds.Min.y, root.Min.y), (min)(bounds.Min.z, root.Min.z));
+			bounds.Max = XMFLOAT3((max)(bounds.Max.x, root.Max.x), (max)(bounds.Max.y, root.Max.y), (max)(bounds.Max.z, root.Max.z));
+		}
+
+		auto& node = m_topLevelNodes[task.Node];
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+		node.Next = m_topLevelBricks[task.First];
+		node.Count = task.Count;
+		if (task.Count <= 1) continue;
+
+		const float extent[] = { bounds.Max.x - bounds.Min.x, bounds.Max.y - bounds.Min.y, bounds.Max.z - bounds.Min.z };
+		const auto axis = static_cast<uint8_t>(max_element(extent, extent + 3) - extent);
+		const auto first = m_topLevelBricks.begin() + task.First;
+		const auto mid = task.Count / 2;
+		nth_element(first, first + mid, first + task.Count,
+			[&](uint32_t a, uint32_t b) { return getCenter(a, axis) < getCenter(b, axis); });
+
+		// Children are adjacent
+		const auto leftChild = static_cast<uint32_t>(m_topLevelNodes.size());
+		m_topLevelNodes[task.Node].Next = leftChild;
+		m_topLevelNodes[task.Node].Count = 0;
+		m_topLevelNodes.emplace_back();
+		m_topLevelNodes.emplace_back();
+		tasks.push_back({ leftChild, task.First, mid });
+		tasks.push_back({ leftChild + 1, task.First + mid, task.Count - mid });
+	}
+}
@@ -0,0 +1,131 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "ParticleBVH.h"
+
+// Particle BVH split into bricks of the domain, each with its own small BVH, under a top-level BVH
+// over the brick bounds, which mirrors a TLAS with one instance per brick BLAS. On each update, only
+// the bricks that particles entered or left are rebuilt, where a particle only leaves its brick after
+// straying a quarter brick beyond it, so that the particles jiggling on the borders keep the bricks
+// clean. The bricks whose particles moved farther than the margin of the fattened AABBs are refit,
+// and the others, such as the settled regions, only update the positions that the queries test,
+// the same as the intersection shaders reading the particle buffer under an unchanged BLAS. The brick
+// BVHs are built over the global particle indices, so they read the positions in place. An update
+// still costs O(N) in a settled domain: each particle is classified against its brick, and each
+// skipped brick copies the positions of its particles into the SoA lanes of its clusters.
+class BrickedBVH
+{
+public:
+	struct UpdateStats
+	{
+		uint32_t NumRebuilt;
+		uint32_t NumRefit;
+		uint32_t NumSkipped;	// Non-empty bricks only
+		uint32_t NumSkippedParticles;	// Whose positions the skipped bricks update
+	};
+
+	BrickedBVH();
+	virtual ~BrickedBVH();
+
+	void Init(const DirectX::XMFLOAT3& domainMin, const DirectX::XMFLOAT3& domainMax, float brickSize,
+		float radius, float margin, uint32_t clusterSize);
+	// Rebuild every brick on the next update, for a new set of particles. The update also does it by
+	// itself when the number of particles changes, but not for a new set of the same number.
+	void Reset();
+	const UpdateStats& Update(const DirectX::XMFLOAT3* positions, uint32_t numParticles);
+
+	// Call func(particleIndex, r_sq) for each particle within the radius of the point, counted in the
+	// neighbor stats if any as a single query over all the bricks, with the top-level nodes visited
+	template<typename TFunc>
+	void Query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats = nullptr,
+		NeighborStats* pNeighborStats = nullptr) const;
+
+	size_t GetMemorySize() const;
+	uint32_t GetNumBricks() const;
+
+protected:
+	enum BrickState : uint8_t
+	{
+		BRICK_SKIPPED,
+		BRICK_REFIT,
+		BRICK_REBUILT
+	};
+
+	struct Brick
+	{
+		ParticleBVH BVH;	// Over the global particle indices
+		std::vector<uint32_t> Particles;
+	};
+
+	template<typename TFunc>
+	void query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats) const;
+	uint32_t getBrick(const DirectX::XMFLOAT3& pos) const;
+	bool isInBrick(const DirectX::XMFLOAT3& pos, uint32_t brick) const;
+	void buildTopLevel();
+
+	std::vector<Brick>		m_bricks;
+	std::vector<uint8_t>	m_brickStates;
+	std::vector<uint32_t>	m_particleBricks;	// Brick of each particle at the last update
+	std::vector<DirectX::XMFLOAT3> m_refitPositions;	// Positions at the last build or refit of the brick
+
+	std::vector<ParticleBVH::Node> m_topLevelNodes;	// A leaf holds a brick in Next
+	std::vector<uint32_t>	m_topLevelBricks;
+
+	UpdateStats				m_stats;
+	DirectX::XMFLOAT3		m_domainMin;
+	float					m_brickSize;
+	float					m_invBrickSize;
+	int32_t					m_dims[3];
+	float					m_radius;
+	float					m_margin;
+	uint32_t				m_clusterSize;
+};
+
+//--------------------------------------------------------------------------------------
+// Implementations
+//--------------------------------------------------------------------------------------
+
+template<typename TFunc>
+void BrickedBVH::Query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats,
+	NeighborStats* pNeighborStats) const
+{
+	if (pNeighborStats) ParticleBVH::CountQuery(func, pStats, *pNeighborStats,
+		[&](const auto& countedFunc, ParticleBVH::QueryStats* pQueryStats) { query(pos, countedFunc, pQueryStats); });
+	else query(pos, func, pStats);
+}
+
+template<typename TFunc>
+void BrickedBVH::query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats) const
+{
+	const auto isInside = [&pos](const ParticleBVH::Node& node)
+	{
+		return pos.x >= node.Min.x && pos.x <= node.Max.x && pos.y >= node.Min.y &&
+			pos.y <= node.Max.y && pos.z >= node.Min.z && pos.z <= node.Max.z;
+	};
+
+	uint32_t stack[ParticleBVH::StackSize];
+	uint32_t stackSize = 0;
+	uint64_t nodesVisited = 1;
+	if (!m_topLevelNodes.empty() && isInside(m_topLevelNodes[0])) stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const auto& node = m_topLevelNodes[stack[--stackSize]];
+		if (node.Count > 0)
+		{
+			// Descend into the brick BVH, whose particles have the global indices
+			m_bricks[node.Next].BVH.Query(pos, func, pStats);
+		}
+		else
+		{
+			nodesVisited += 2;
+			if (isInside(m_topLevelNodes[node.Next + 1])) stack[stackSize++] = node.Next + 1;
+			if (isInside(m_topLevelNodes[node.Next])) stack[stackSize++] = node.Next;
+		}
+	}
+
+	if (pStats) pStats->NodesVisited += nodesVisited;
+}
@@ -0,0 +1,118 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <cmath>
+#include "CompressedBVH.h"
+
+using namespace std;
+using namespace DirectX;
+
+// The same rounding as the decoding in the queries
+static float decodeBound(float origin, int8_t exponent, int32_t q)
+{
+	return origin + static_cast<float>(q) * getQuantizationScale(exponent);
+}
+
+// The smallest power of 2 with which 255 steps cover the extent
+static int8_t getQuantizationExponent(float extent)
+{
+	auto exponent = extent > 0.0f ? static_cast<int32_t>(ceil(log2(extent / 255.0f))) : -126;
+	exponent = (max)(exponent, -126);
+	while (exponent < 127 && ldexp(255.0f, exponent) < extent) ++exponent;
+
+	return static_cast<int8_t>(exponent);
+}
+
+// Round the child bounds outwards onto the grid of the parent
+static void quantizeBounds(float origin, int8_t exponent, float minPt, float maxPt, uint8_t& qMin, uint8_t& qMax)
+{
+	const auto scale = getQuantizationScale(exponent);
+	auto qLo = static_cast<int32_t>(floor((minPt - origin) / scale));
+	auto qHi = static_cast<int32_t>(ceil((maxPt - origin) / scale));
+	qLo = (min)((max)(qLo, 0), 255);
+	qHi = (min)((max)(qHi, 0), 255);
+	while (qLo > 0 && decodeBound(origin, exponent, qLo) > minPt) --qLo;
+	while (qHi < 255 && decodeBound(origin, exponent, qHi) < maxPt) ++qHi;
+
+	qMin = static_cast<uint8_t>(qLo);
+	qMax = static_cast<uint8_t>(qHi);
+}
+
+template<uint8_t W>
+CompressedWideBVH<W>::CompressedWideBVH() :
+	m_pBVH(nullptr)
+{
+}
+
+template<uint8_t W>
+CompressedWideBVH<W>::~CompressedWideBVH()
+{
+}
+
+template<uint8_t W>
+void CompressedWideBVH<W>::Compress(const WideBVH<W>& wideBVH)
+{
+	m_pBVH = wideBVH.GetBVH();
+	const auto& wideNodes = wideBVH.GetNodes();
+	m_nodes.resize(wideNodes.size());
+
+	for (size_t n = 0; n < wideNodes.size(); ++n)
+	{
+		const auto& wideNode = wideNodes[n];
+		auto& node = m_nodes[n];
+
+		// The parent box is the union of the non-empty children.
+		XMFLOAT3 minPt(FLT_MAX, FLT_MAX, FLT_MAX), maxPt(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (uint8_t i = 0; i < W; ++i)
+		{
+			if (wideNode.MinX[i] > wideNode.MaxX[i]) continue;
+			minPt = XMFLOAT3((min)(minPt.x, wideNode.MinX[i]), (min)(minPt.y, wideNode.MinY[i]), (min)(minPt.z, wideNode.MinZ[i]));
+			maxPt = XMFLOAT3((max)(maxPt.x, wideNode.MaxX[i]), (max)(maxPt.y, wideNode.MaxY[i]), (max)(maxPt.z, wideNode.MaxZ[i]));
+		}
+		if (minPt.x > maxPt.x) minPt = maxPt = XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+		node.Origin[0] = minPt.x;
+		node.Origin[1] = minPt.y;
+		node.Origin[2] = minPt.z;
+		node.Exponents[0] = getQuantizationExponent(maxPt.x - minPt.x);
+		node.Exponents[1] = getQuantizationExponent(maxPt.y - minPt.y);
+		node.Exponents[2] = getQuantizationExponent(maxPt.z - minPt.z);
+		node.Padding = 0;
+
+		for (uint8_t i = 0; i < W; ++i)
+		{
+			// Empty slots have inverted bounds.
+			if (wideNode.MinX[i] > wideNode.MaxX[i])
+			{
+				node.QMinX[i] = node.QMinY[i] = node.QMinZ[i] = 255;
+				node.QMaxX[i] = node.QMaxY[i] = node.QMaxZ[i] = 0;
+			}
+			else
+			{
+				quantizeBounds(node.Origin[0], node.Exponents[0], wideNode.MinX[i], wideNode.MaxX[i], node.QMinX[i], node.QMaxX[i]);
+				quantizeBounds(node.Origin[1], node.Exponents[1], wideNode.MinY[i], wideNode.MaxY[i], node.QMinY[i], node.QMaxY[i]);
+				quantizeBounds(node.Origin[2], node.Exponents[2], wideNode.MinZ[i], wideNode.MaxZ[i], node.QMinZ[i], node.QMaxZ[i]);
+			}
+
+			// Each leaf of the binary BVH holds one cluster.
+			node.Children[i] = wideNode.Children[i];
+			node.Counts[i] = static_cast<uint8_t>(wideNode.Counts[i]);
+		}
+	}
+}
+
+template<uint8_t W>
+const vector<typename CompressedWideBVH<W>::Node>& CompressedWideBVH<W>::GetNodes() const
+{
+	return m_nodes;
+}
+
+template<uint8_t W>
+size_t CompressedWideBVH<W>::GetMemorySize() const
+{
+	return sizeof(Node) * m_nodes.size();
+}
+
+template class CompressedWideBVH<4>;
+template class CompressedWideBVH<8>;
@@ -0,0 +1,174 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstring>
+#include "WideBVH.h"
+
+// W-wide BVH with the child bounds quantized to 8 bits relative to the parent node, as the compressed
+// wide BVHs of Ylitie et al. Each node stores the origin of its box and a power-of-2 scale per axis,
+// and the child bounds are rounded outwards, so a decoded child box always contains the full-precision
+// one. The nodes shrink to about 40% of the wide nodes, for BVH4 from 128 to 60 bytes and for BVH8
+// from 256 to 104 bytes, at the cost of decoding the boxes and the false positives of the rounding.
+template<uint8_t W>
+class CompressedWideBVH
+{
+public:
+	struct Node
+	{
+		float Origin[3];
+		int8_t Exponents[3];	// Scale of the quantization grid, 2^Exponent
+		uint8_t Padding;
+		uint8_t QMinX[W];
+		uint8_t QMinY[W];
+		uint8_t QMinZ[W];
+		uint8_t QMaxX[W];
+		uint8_t QMaxY[W];
+		uint8_t QMaxZ[W];
+		uint32_t Children[W];	// Compressed node for an interior child, or the first cluster for a leaf
+		uint8_t Counts[W];		// Number of clusters, 0 for an interior child or an empty slot
+	};
+
+	CompressedWideBVH();
+	virtual ~CompressedWideBVH();
+
+	// The nodes keep the order of the wide BVH, whose binary BVH must outlive this one.
+	void Compress(const WideBVH<W>& wideBVH);
+
+	// Call func(particleIndex, r_sq) for each particle within the radius of the point, counted in the
+	// neighbor stats if any, as ParticleBVH::Query does
+	template<typename TFunc>
+	void Query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats = nullptr,
+		NeighborStats* pNeighborStats = nullptr) const;
+
+	const std::vector<Node>& GetNodes() const;
+	size_t GetMemorySize() const;	// Of the compressed nodes only, since the clusters are shared
+
+	static const uint32_t StackSize = WideBVH<W>::StackSize;
+
+protected:
+	template<typename TFunc>
+	void query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats) const;
+	uint32_t testChildren(const Node& node, const DirectX::XMFLOAT3& pos) const;
+
+	std::vector<Node>		m_nodes;
+	const ParticleBVH*		m_pBVH;
+};
+
+using CompressedBVH4 = CompressedWideBVH<4>;
+using CompressedBVH8 = CompressedWideBVH<8>;
+
+//--------------------------------------------------------------------------------------
+// Implementations
+//--------------------------------------------------------------------------------------
+
+template<uint8_t W>
+template<typename TFunc>
+void CompressedWideBVH<W>::Query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats,
+	NeighborStats* pNeighborStats) const
+{
+	if (pNeighborStats) ParticleBVH::CountQuery(func, pStats, *pNeighborStats,
+		[&](const auto& countedFunc, ParticleBVH::QueryStats* pQueryStats) { query(pos, countedFunc, pQueryStats); });
+	else query(pos, func, pStats);
+}
+
+template<uint8_t W>
+template<typename TFunc>
+void CompressedWideBVH<W>::query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats) const
+{
+	uint32_t stack[StackSize];
+	uint32_t stackSize = 0;
+	uint64_t nodesVisited = 0, clustersTested = 0;
+	if (!m_nodes.empty()) stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const auto& node = m_nodes[stack[--stackSize]];
+		++nodesVisited;
+
+		for (auto mask = testChildren(node, pos); mask; mask &= mask - 1)
+		{
+			auto i = 0u;
+			while (!((mask >> i) & 1)) ++i;
+
+			const uint32_t count = node.Counts[i];
+			if (count > 0)
+			{
+				for (auto j = 0u; j < count; ++j) m_pBVH->TestCluster(node.Children[i] + j, pos, func);
+				clustersTested += count;
+			}
+			else stack[stackSize++] = node.Children[i];
+		}
+	}
+
+	if (pStats)
+	{
+		pStats->NodesVisited += nodesVisited;
+		pStats->ClustersTested += clustersTested;
+		pStats->ParticlesTested += clustersTested * m_pBVH->GetClusterSize();
+	}
+}
+
+// The product of an 8-bit integer and a power of 2 is exact, so the decoded bounds round only once
+// in the addition, the same as in CompressedWideBVH::Compress with or without FMA.
+static inline __m128 decodeBounds4(const uint8_t* q, __m128 origin, __m128 scale)
+{
+	int32_t bits;
+	memcpy(&bits, q, sizeof(int32_t));
+
+	return _mm_add_ps(origin, _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bits))), scale));
+}
+
+static inline __m256 decodeBounds8(const uint8_t* q, __m256 origin, __m256 scale)
+{
+	int64_t bits;
+	memcpy(&bits, q, sizeof(int64_t));
+
+	return _mm256_add_ps(origin, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_cvtsi64_si128(bits))), scale));
+}
+
+static inline float getQuantizationScale(int8_t exponent)
+{
+	const auto bits = static_cast<uint32_t>(exponent + 127) << 23;
+	float scale;
+	memcpy(&scale, &bits, sizeof(float));
+
+	return scale;
+}
+
+template<>
+inline uint32_t CompressedWideBVH<4>::testChildren(const Node& node, const DirectX::XMFLOAT3& pos) const
+{
+	const auto ox = _mm_set1_ps(node.Origin[0]), sx = _mm_set1_ps(getQuantizationScale(node.Exponents[0]));
+	const auto oy = _mm_set1_ps(node.Origin[1]), sy = _mm_set1_ps(getQuantizationScale(node.Exponents[1]));
+	const auto oz = _mm_set1_ps(node.Origin[2]), sz = _mm_set1_ps(getQuantizationScale(node.Exponents[2]));
+	const auto px = _mm_set1_ps(pos.x);
+	const auto py = _mm_set1_ps(pos.y);
+	const auto pz = _mm_set1_ps(pos.z);
+	const auto inX = _mm_and_ps(_mm_cmpge_ps(px, decodeBounds4(node.QMinX, ox, sx)), _mm_cmple_ps(px, decodeBounds4(node.QMaxX, ox, sx)));
+	const auto inY = _mm_and_ps(_mm_cmpge_ps(py, decodeBounds4(node.QMinY, oy, sy)), _mm_cmple_ps(py, decodeBounds4(node.QMaxY, oy, sy)));
+	const auto inZ = _mm_and_ps(_mm_cmpge_ps(pz, decodeBounds4(node.QMinZ, oz, sz)), _mm_cmple_ps(pz, decodeBounds4(node.QMaxZ, oz, sz)));
+
+	return _mm_movemask_ps(_mm_and_ps(_mm_and_ps(inX, inY), inZ));
+}
+
+template<>
+inline uint32_t CompressedWideBVH<8>::testChildren(const Node& node, const DirectX::XMFLOAT3& pos) const
+{
+	const auto ox = _mm256_set1_ps(node.Origin[0]), sx = _mm256_set1_ps(getQuantizationScale(node.Exponents[0]));
+	const auto oy = _mm256_set1_ps(node.Origin[1]), sy = _mm256_set1_ps(getQuantizationScale(node.Exponents[1]));
+	const auto oz = _mm256_set1_ps(node.Origin[2]), sz = _mm256_set1_ps(getQuantizationScale(node.Exponents[2]));
+	const auto px = _mm256_set1_ps(pos.x);
+	const auto py = _mm256_set1_ps(pos.y);
+	const auto pz = _mm256_set1_ps(pos.z);
+	const auto inX = _mm256_and_ps(_mm256_cmp_ps(px, decodeBounds8(node.QMinX, ox, sx), _CMP_GE_OQ),
+		_mm256_cmp_ps(px, decodeBounds8(node.QMaxX, ox, sx), _CMP_LE_OQ));
+	const auto inY = _mm256_and_ps(_mm256_cmp_ps(py, decodeBounds8(node.QMinY, oy, sy), _CMP_GE_OQ),
+		_mm256_cmp_ps(py, decodeBounds8(node.QMaxY, oy, sy), _CMP_LE_OQ));
+	const auto inZ = _mm256_and_ps(_mm256_cmp_ps(pz, decodeBounds8(node.QMinZ, oz, sz), _CMP_GE_OQ),
+		_mm256_cmp_ps(pz, decodeBounds8(node.QMaxZ, oz, sz), _CMP_LE_OQ));
+
+	return _mm256_movemask_ps(_mm256_and_ps(_mm256_and_ps(inX, inY), inZ));
+}
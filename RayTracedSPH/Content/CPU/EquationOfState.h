@@ -0,0 +1,55 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "SPHKernels.h"
+
+// Equations of state of the CPU solver, where only compression is resisted as on the GPU.
+
+//--------------------------------------------------------------------------------------
+// Tait equation with the exponent of 3, the same as the GPU solver
+//--------------------------------------------------------------------------------------
+struct EOSTait
+{
+	EOSTait(float stiffness, float restDensity) :
+		m_stiffness(stiffness),
+		m_invRestDensity(1.0f / restDensity)
+	{
+	}
+
+	// Implements this equation:
+	// Pressure = B * ((rho / rho_0)^3 - 1)
+	SPH_INLINE float Pressure(float density) const
+	{
+		const auto rhoRatio = density * m_invRestDensity;
+
+		return m_stiffness * (std::max)(rhoRatio * rhoRatio * rhoRatio - 1.0f, 0.0f);
+	}
+
+	float m_stiffness;
+	float m_invRestDensity;
+};
+
+//--------------------------------------------------------------------------------------
+// Linear (weakly compressible ideal gas) equation
+//--------------------------------------------------------------------------------------
+struct EOSLinear
+{
+	EOSLinear(float stiffness, float restDensity) :
+		m_stiffness(stiffness),
+		m_invRestDensity(1.0f / restDensity)
+	{
+	}
+
+	// Implements this equation:
+	// Pressure = B * (rho / rho_0 - 1)
+	SPH_INLINE float Pressure(float density) const
+	{
+		return m_stiffness * (std::max)(density * m_invRestDensity - 1.0f, 0.0f);
+	}
+
+	float m_stiffness;
+	float m_invRestDensity;
+};
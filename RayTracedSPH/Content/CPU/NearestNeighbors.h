@@ -0,0 +1,74 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+// A particle found by the k-nearest-neighbor and the radius queries of the BVH and the grid
+struct NearestNeighbor
+{
+	uint32_t Index;
+	float R_sq;
+};
+
+// Order by the distance, and by the index for the ties, so the k nearest neighbors are the same
+// whichever structure and order they are found in
+inline bool operator<(const NearestNeighbor& a, const NearestNeighbor& b)
+{
+	return a.R_sq < b.R_sq || (a.R_sq == b.R_sq && a.Index < b.Index);
+}
+
+// The k nearest neighbors found so far, kept as a max-heap in the array of the caller, so the farthest
+// one is replaced first and its distance bounds the rest of the search once the heap is full. k must be
+// positive, so the queries return early for 0.
+class NearestNeighborHeap
+{
+public:
+	NearestNeighborHeap(NearestNeighbor* neighbors, uint32_t k, float maxRadius) :
+		m_neighbors(neighbors),
+		m_k(k),
+		m_size(0),
+		m_maxRSq(maxRadius * maxRadius)
+	{
+	}
+
+	// Squared distance beyond which no particle can enter the heap
+	float GetBound() const
+	{
+		return m_size < m_k ? m_maxRSq : m_neighbors[0].R_sq;
+	}
+
+	void Push(uint32_t index, float r_sq)
+	{
+		const NearestNeighbor neighbor = { index, r_sq };
+		if (r_sq >= m_maxRSq) return;
+		if (m_size < m_k)
+		{
+			m_neighbors[m_size++] = neighbor;
+			std::push_heap(m_neighbors, m_neighbors + m_size);
+		}
+		else if (neighbor < m_neighbors[0])
+		{
+			std::pop_heap(m_neighbors, m_neighbors + m_size);
+			m_neighbors[m_size - 1] = neighbor;
+			std::push_heap(m_neighbors, m_neighbors + m_size);
+		}
+	}
+
+	// Sort the neighbors from the nearest, and return their number
+	uint32_t Finish()
+	{
+		std::sort_heap(m_neighbors, m_neighbors + m_size);
+
+		return m_size;
+	}
+
+protected:
+	NearestNeighbor*	m_neighbors;
+	uint32_t			m_k;
+	uint32_t			m_size;
+	float				m_maxRSq;
+};
@@ -0,0 +1,408 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "NeighborGrid.h"
+
+using namespace std;
+
+const uint32_t GRID_PARTICLE_BLOCK_SIZE = 4096;
+const uint32_t GRID_CELL_BLOCK_SIZE = 1024;
+
+template<uint8_t N>
+NeighborGrid<N>::NeighborGrid() :
+	m_domainMin(),
+	m_domainSize(),
+	m_invCellSize(),
+	m_dims(),
+	m_stencilOffsets(),
+	m_periodicAxes(0),
+	m_isDeterministic(false)
+{
+	// The stencil offsets are the base-3 digits of the stencil index, with x varying fastest.
+	for (auto s = 0u; s < NumStencilCells; ++s)
+		for (auto a = 0u, digits = s; a < N; ++a, digits /= 3)
+			m_stencilOffsets[s][a] = static_cast<int8_t>(digits % 3) - 1;
+}
+
+template<uint8_t N>
+NeighborGrid<N>::~NeighborGrid()
+{
+}
+
+template<uint8_t N>
+bool NeighborGrid<N>::Init(const Vector& domainMin, const Vector& domainMax, float cellSize, uint8_t periodicAxes)
+{
+	m_periodicAxes = periodicAxes;
+
+	// The cells divide the domain evenly, so that the stencil wraps exactly along the periodic axes.
+	const auto pMin = &domainMin.x;
+	const auto pMax = &domainMax.x;
+	size_t numCells = 1;
+	for (uint8_t i = 0; i < N; ++i)
+	{
+		m_domainMin[i] = pMin[i];
+		m_domainSize[i] = pMax[i] - pMin[i];
+		m_dims[i] = (max)(static_cast<int32_t>(floor(m_domainSize[i] / cellSize)), 1);
+		m_invCellSize[i] = m_dims[i] / m_domainSize[i];
+		numCells *= m_dims[i];
+
+		// A periodic axis needs 3 cells at least to avoid visiting a neighbor cell twice.
+		if ((periodicAxes >> i) & 1 && m_dims[i] < 3) return false;
+	}
+
+	m_cellStarts.resize(numCells + 1);
+	m_cellOffsets.resize(numCells);
+	m_cellCounters.reset(new atomic<uint32_t>[numCells]);
+
+	return true;
+}
+
+template<uint8_t N>
+const vector<uint32_t>& NeighborGrid<N>::Build(const Vector* positions, uint32_t numParticles,
+	ThreadPool& threadPool, const uint32_t* particleIds)
+{
+	ResetBins(numParticles, particleIds != nullptr);
+
+	const auto numParticleBlocks = (numParticles + GRID_PARTICLE_BLOCK_SIZE - 1) / GRID_PARTICLE_BLOCK_SIZE;
+	threadPool.Run(numParticleBlocks, [&](uint32_t block, uint32_t)
+	{
+		const auto end = (min)((block + 1) * GRID_PARTICLE_BLOCK_SIZE, numParticles);
+		for (auto i = block * GRID_PARTICLE_BLOCK_SIZE; i < end; ++i) BinParticle(i, positions[i]);
+	});
+
+	return BuildBinned(numParticles, threadPool, particleIds);
+}
+
+template<uint8_t N>
+void NeighborGrid<N>::ResetBins(uint32_t numParticles, bool isDeterministic)
+{
+	m_particleCells.resize(numParticles);
+	m_sortedIndices.resize(numParticles);
+	m_isDeterministic = isDeterministic;
+	if (isDeterministic) return;
+
+	const auto numCells = GetNumCells();
+	for (auto c = 0u; c < numCells; ++c) m_cellCounters[c].store(0, memory_order_relaxed);
+}
+
+template<uint8_t N>
+void NeighborGrid<N>::BinParticle(uint32_t index, const Vector& pos)
+{
+	// The counts are the same in any order of the threads, unlike the offsets of the scatter.
+	m_particleCells[index] = GetCell(pos);
+	if (!m_isDeterministic) m_cellCounters[m_particleCells[index]].fetch_add(1, memory_order_relaxed);
+}
+
+template<uint8_t N>
+const vector<uint32_t>& NeighborGrid<N>::BuildBinned(uint32_t numParticles, ThreadPool& threadPool,
+	const uint32_t* particleIds)
+{
+	const auto numCells = GetNumCells();
+	const auto numParticleBlocks = (numParticles + GRID_PARTICLE_BLOCK_SIZE - 1) / GRID_PARTICLE_BLOCK_SIZE;
+	const auto getBlockEnd = [numParticles](uint32_t block)
+	{
+		return (min)((block + 1) * GRID_PARTICLE_BLOCK_SIZE, numParticles);
+	};
+
+	if (m_isDeterministic)
+	{
+		// Counting sort in the order of the indices, whose counts are shifted by a cell for the scan
+		fill(m_cellStarts.begin(), m_cellStarts.end(), 0);
+		for (auto i = 0u; i < numParticles; ++i) ++m_cellStarts[m_particleCells[i] + 1];
+		for (auto c = 0u; c < numCells; ++c) m_cellStarts[c + 1] += m_cellStarts[c];
+
+		copy(m_cellStarts.cbegin(), m_cellStarts.cend() - 1, m_cellOffsets.begin());
+		for (auto i = 0u; i < numParticles; ++i) m_sortedIndices[m_cellOffsets[m_particleCells[i]]++] = i;
+	}
+	else
+	{
+		// Exclusive scan of the counts, which become the scatter offsets
+		m_cellStarts[0] = 0;
+		for (auto c = 0u; c < numCells; ++c)
+		{
+			m_cellStarts[c + 1] = m_cellStarts[c] + m_cellCounters[c].load(memory_order_relaxed);
+			m_cellCounters[c].store(m_cellStarts[c], memory_order_relaxed);
+		}
+
+		threadPool.Run(numParticleBlocks, [&](uint32_t block, uint32_t)
+		{
+			for (auto i = block * GRID_PARTICLE_BLOCK_SIZE; i < getBlockEnd(block); ++i)
+				m_sortedIndices[m_cellCounters[m_particleCells[i]].fetch_add(1, memory_order_relaxed)] = i;
+		});
+	}
+
+	if (particleIds)
+	{
+		// Fix the neighbor iteration order by the particle IDs
+		const auto numCellBlocks = (numCells + GRID_CELL_BLOCK_SIZE - 1) / GRID_CELL_BLOCK_SIZE;
+		threadPool.Run(numCellBlocks, [&](uint32_t block, uint32_t)
+		{
+			const auto cellEnd = (min)((block + 1) * GRID_CELL_BLOCK_SIZE, numCells);
+			for (auto c = block * GRID_CELL_BLOCK_SIZE; c < cellEnd; ++c)
+				sort(m_sortedIndices.begin() + m_cellStarts[c], m_sortedIndices.begin() + m_cellStarts[c + 1],
+					[particleIds](uint32_t a, uint32_t b) { return particleIds[a] < particleIds[b]; });
+		});
+	}
+
+	return m_sortedIndices;
+}
+
+template<uint8_t N>
+uint32_t NeighborGrid<N>::GetNeighborCells(uint32_t cell, NeighborCell neighborCells[NumStencilCells]) const
+{
+	int32_t coord[N];
+	for (uint8_t a = 0; a < N; ++a)
+	{
+		coord[a] = static_cast<int32_t>(cell % m_dims[a]);
+		cell /= m_dims[a];
+	}
+
+	auto numNeighborCells = 0u;
+	for (auto s = 0u; s < NumStencilCells; ++s)
+	{
+		int32_t neighbor[N];
+		float shift[N] = {};
+		auto isValid = true;
+		for (uint8_t a = 0; a < N; ++a)
+		{
+			neighbor[a] = coord[a] + m_stencilOffsets[s][a];
+			if (neighbor[a] >= 0 && neighbor[a] < m_dims[a]) continue;
+
+			// Wrap around to the periodic image, or skip the cell outside the domain
+			if ((m_periodicAxes >> a) & 1)
+			{
+				const auto sign = neighbor[a] < 0 ? -1.0f : 1.0f;
+				neighbor[a] -= static_cast<int32_t>(sign) * m_dims[a];
+				shift[a] = sign * m_domainSize[a];
+			}
+			else isValid = false;
+		}
+
+		if (isValid)
+		{
+			auto n = 0;
+			for (auto a = N; a-- > 0;) n = n * m_dims[a] + neighbor[a];
+
+			auto& neighborCell = neighborCells[numNeighborCells++];
+			neighborCell.Begin = m_cellStarts[n];
+			neighborCell.End = m_cellStarts[n + 1];
+			for (uint8_t a = 0; a < N; ++a) (&neighborCell.Shift.x)[a] = shift[a];
+		}
+	}
+
+	return numNeighborCells;
+}
+
+template<uint8_t N>
+uint32_t NeighborGrid<N>::GetCellBegin(uint32_t cell) const
+{
+	return m_cellStarts[cell];
+}
+
+template<uint8_t N>
+uint32_t NeighborGrid<N>::GetCellEnd(uint32_t cell) const
+{
+	return m_cellStarts[cell + 1];
+}
+
+template<uint8_t N>
+uint32_t NeighborGrid<N>::GetNumCells() const
+{
+	return static_cast<uint32_t>(m_cellStarts.size() - 1);
+}
+
+template<uint8_t N>
+uint32_t NeighborGrid<N>::GetCell(const Vector& pos) const
+{
+	// The particles slightly outside the walls are clamped to the border cells.
+	const auto pPos = &pos.x;
+
+	auto cell = 0;
+	for (auto i = N; i-- > 0;)
+	{
+		auto coord = static_cast<int32_t>(floor((pPos[i] - m_domainMin[i]) * m_invCellSize[i]));
+		coord = (min)((max)(coord, 0), m_dims[i] - 1);
+		cell = cell * m_dims[i] + coord;
+	}
+
+	return cell;
+}
+
+template<uint8_t N>
+uint32_t NeighborGrid<N>::QueryKNN(const Vector* positions, const Vector& pos, uint32_t k, float maxRadius, NearestNeighbor* neighbors) const
+{
+	if (k == 0) return 0;
+
+	NearestNeighborHeap heap(neighbors, k, maxRadius);
+	forEachCellOutwards(pos, [&heap]() { return heap.GetBound(); }, [&](const NeighborCell& cell)
+	{
+		float offset[N];
+		for (uint8_t a = 0; a < N; ++a) offset[a] = (&cell.Shift.x)[a] - (&pos.x)[a];
+		for (auto j = cell.Begin; j < cell.End; ++j)
+		{
+			auto r_sq = 0.0f;
+			for (uint8_t a = 0; a < N; ++a)
+			{
+				const auto d = (&positions[j].x)[a] + offset[a];
+				r_sq += d * d;
+			}
+			heap.Push(j, r_sq);
+		}
+
+		return true;
+	});
+
+	return heap.Finish();
+}
+
+template<uint8_t N>
+uint32_t NeighborGrid<N>::QueryRadius(const Vector* positions, const Vector& pos, float radius,
+	uint32_t maxNeighbors, NearestNeighbor* neighbors) const
+{
+	if (maxNeighbors == 0) return 0;
+
+	const auto radiusSq = radius * radius;
+	auto numNeighbors = 0u;
+	forEachCellOutwards(pos, [radiusSq]() { return radiusSq; }, [&](const NeighborCell& cell)
+	{
+		float offset[N];
+		for (uint8_t a = 0; a < N; ++a) offset[a] = (&cell.Shift.x)[a] - (&pos.x)[a];
+		for (auto j = cell.Begin; j < cell.End; ++j)
+		{
+			auto r_sq = 0.0f;
+			for (uint8_t a = 0; a < N; ++a)
+			{
+				const auto d = (&positions[j].x)[a] + offset[a];
+				r_sq += d * d;
+			}
+
+			if (r_sq < radiusSq)
+			{
+				neighbors[numNeighbors++] = { j, r_sq };
+				if (numNeighbors == maxNeighbors) return false;
+			}
+		}
+
+		return true;
+	});
+
+	return numNeighbors;
+}
+
+template<uint8_t N>
+template<typename TFunc, typename TBound>
+void NeighborGrid<N>::forEachCellOutwards(const Vector& pos, const TBound& getBound, const TFunc& func) const
+{
+	const auto pPos = &pos.x;
+	int32_t coord[N];
+	float cellSize[N], slack[N];
+	auto cell = GetCell(pos);
+	for (uint8_t a = 0; a < N; ++a)
+	{
+		coord[a] = static_cast<int32_t>(cell % m_dims[a]);
+		cell /= m_dims[a];
+
+		// The cell boxes are widened by 1/1024 of a cell for the rounding of the binning.
+		cellSize[a] = m_domainSize[a] / m_dims[a];
+		slack[a] = cellSize[a] / 1024.0f;
+	}
+
+	for (auto shell = 0;; ++shell)
+	{
+		int32_t first[N], last[N];
+		auto numCells = 1u;
+		for (uint8_t a = 0; a < N; ++a)
+		{
+			getShellRange(a, coord[a], shell, first[a], last[a]);
+			numCells *= last[a] - first[a] + 1;
+		}
+
+		// The box of the offsets also holds the inner shells, which are skipped.
+		for (auto i = 0u; i < numCells; ++i)
+		{
+			int32_t offset[N];
+			auto isOnShell = false;
+			auto rest = i;
+			for (uint8_t a = 0; a < N; ++a)
+			{
+				const auto size = static_cast<uint32_t>(last[a] - first[a] + 1);
+				offset[a] = first[a] + static_cast<int32_t>(rest % size);
+				rest /= size;
+				isOnShell = isOnShell || offset[a] == shell || offset[a] == -shell;
+			}
+			if (!isOnShell) continue;
+
+			NeighborCell neighborCell;
+			auto n = 0;
+			auto boxRSq = 0.0f;
+			for (auto a = N; a-- > 0;)
+			{
+				// The border cells extend beyond the walls, where the particles are clamped into them.
+				auto neighbor = coord[a] + offset[a];
+				const auto isPeriodic = (m_periodicAxes >> a) & 1;
+				const auto boxMin = !isPeriodic && neighbor == 0 ? -FLT_MAX : m_domainMin[a] + neighbor * cellSize[a] - slack[a];
+				const auto boxMax = !isPeriodic && neighbor == m_dims[a] - 1 ? FLT_MAX : m_domainMin[a] + (neighbor + 1) * cellSize[a] + slack[a];
+				const auto d = (max)((max)(boxMin - pPos[a], pPos[a] - boxMax), 0.0f);
+				boxRSq += d * d;
+
+				// Wrap around to the periodic image
+				auto shift = 0.0f;
+				if (neighbor < 0)
+				{
+					neighbor += m_dims[a];
+					shift = -m_domainSize[a];
+				}
+				else if (neighbor >= m_dims[a])
+				{
+					neighbor -= m_dims[a];
+					shift = m_domainSize[a];
+				}
+				(&neighborCell.Shift.x)[a] = shift;
+				n = n * m_dims[a] + neighbor;
+			}
+
+			neighborCell.Begin = m_cellStarts[n];
+			neighborCell.End = m_cellStarts[n + 1];
+			if (neighborCell.Begin == neighborCell.End || boxRSq > getBound()) continue;
+			if (!func(neighborCell)) return;
+		}
+
+		// The next shell lies beyond the faces of the box that it grows on, and there is none once the box
+		// covers the whole grid.
+		auto distance = FLT_MAX;
+		for (uint8_t a = 0; a < N; ++a)
+		{
+			int32_t nextFirst, nextLast;
+			getShellRange(a, coord[a], shell + 1, nextFirst, nextLast);
+			if (nextFirst < first[a]) distance = (min)(distance, pPos[a] - m_domainMin[a] - (coord[a] + first[a]) * cellSize[a] - slack[a]);
+			if (nextLast > last[a]) distance = (min)(distance, m_domainMin[a] + (coord[a] + last[a] + 1) * cellSize[a] - pPos[a] - slack[a]);
+		}
+		if (distance == FLT_MAX) return;
+
+		distance = (max)(distance, 0.0f);
+		if (distance * distance > getBound()) return;
+	}
+}
+
+template<uint8_t N>
+void NeighborGrid<N>::getShellRange(uint8_t axis, int32_t coord, int32_t shell, int32_t& first, int32_t& last) const
+{
+	if ((m_periodicAxes >> axis) & 1)
+	{
+		// Within a single period, so no cell is visited twice
+		first = -(min)(shell, (m_dims[axis] - 1) / 2);
+		last = (min)(shell, m_dims[axis] / 2);
+	}
+	else
+	{
+		first = (max)(-shell, -coord);
+		last = (min)(shell, m_dims[axis] - 1 - coord);
+	}
+}
+
+template class NeighborGrid<2>;
+template class NeighborGrid<3>;
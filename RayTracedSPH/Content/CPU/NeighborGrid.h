@@ -0,0 +1,89 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "NearestNeighbors.h"
+#include "SPHSolverCPU.h"
+#include "ThreadPool.h"
+
+// Uniform grid in N dimensions for the CPU neighbor search, whose cells are no smaller than the smoothing radius.
+// The particles are sorted by cell, so that each neighbor cell is a contiguous range.
+// Along the periodic axes, the 3^N-cell stencil wraps around with the shift to the periodic image.
+// The k-nearest-neighbor and the radius queries of any size search the shells of cells outwards instead.
+template<uint8_t N>
+class NeighborGrid
+{
+public:
+	using Vector = typename SPHVector<N>::Type;
+
+	static const uint32_t NumStencilCells = N == 2 ? 9 : 27;
+
+	struct NeighborCell
+	{
+		uint32_t Begin;
+		uint32_t End;
+		Vector Shift;	// Added to the neighbor positions in the cell
+	};
+
+	NeighborGrid();
+	virtual ~NeighborGrid();
+
+	bool Init(const Vector& domainMin, const Vector& domainMax, float cellSize, uint8_t periodicAxes);
+
+	// Sort the particles by cell, and return the permutation from the sorted to the original order.
+	// With the particle IDs, the cells are counted and scattered serially without atomics and each cell
+	// is sorted by ID, so the order is deterministic. Otherwise, the particles are binned with atomic
+	// counters in the order of the thread timing.
+	const std::vector<uint32_t>& Build(const Vector* positions, uint32_t numParticles,
+		ThreadPool& threadPool, const uint32_t* particleIds = nullptr);
+
+	// Bin the particles ahead of the build from the pass that moves them, so that the build needs no
+	// sweep over the positions: reset the cell counts, bin each particle at its new position from any
+	// thread, and then sort the binned particles the same as Build. The deterministic binning only records
+	// the cells, which the build counts serially, and the build must then get the particle IDs.
+	void ResetBins(uint32_t numParticles, bool isDeterministic = false);
+	void BinParticle(uint32_t index, const Vector& pos);
+	const std::vector<uint32_t>& BuildBinned(uint32_t numParticles, ThreadPool& threadPool,
+		const uint32_t* particleIds = nullptr);
+
+	// Get the particle range and the neighbor cells of a cell, where the particles are in the sorted order
+	uint32_t GetNeighborCells(uint32_t cell, NeighborCell neighborCells[NumStencilCells]) const;
+	uint32_t GetCell(const Vector& pos) const;	// Clamped to the border cells outside the domain
+	uint32_t GetCellBegin(uint32_t cell) const;
+	uint32_t GetCellEnd(uint32_t cell) const;
+	uint32_t GetNumCells() const;
+
+	// Find the k nearest particles of the point within the max radius, sorted from the nearest, and return
+	// their number, where the positions and the neighbor indices are in the sorted order
+	uint32_t QueryKNN(const Vector* positions, const Vector& pos, uint32_t k, float maxRadius, NearestNeighbor* neighbors) const;
+	// Find the particles within any radius of the point in no particular order, and stop at the max number
+	uint32_t QueryRadius(const Vector* positions, const Vector& pos, float radius, uint32_t maxNeighbors, NearestNeighbor* neighbors) const;
+
+protected:
+	// Call func(neighborCell) for the cells around the point shell by shell, culling the cells beyond
+	// getBound() by their boxes, until the next shell is beyond it as well or func returns false
+	template<typename TFunc, typename TBound>
+	void forEachCellOutwards(const Vector& pos, const TBound& getBound, const TFunc& func) const;
+	// Offsets of the cells of a shell along an axis, clamped to the walls or to a single period
+	void getShellRange(uint8_t axis, int32_t coord, int32_t shell, int32_t& first, int32_t& last) const;
+
+	std::vector<uint32_t>	m_cellStarts;
+	std::vector<uint32_t>	m_particleCells;
+	std::vector<uint32_t>	m_sortedIndices;
+	std::vector<uint32_t>	m_cellOffsets;		// Serial scatter offsets of the deterministic build
+	std::unique_ptr<std::atomic<uint32_t>[]> m_cellCounters;
+
+	float					m_domainMin[N];
+	float					m_domainSize[N];
+	float					m_invCellSize[N];
+	int32_t					m_dims[N];
+	int8_t					m_stencilOffsets[NumStencilCells][N];
+	uint8_t					m_periodicAxes;
+	bool					m_isDeterministic;
+};
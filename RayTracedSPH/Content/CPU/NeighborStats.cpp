@@ -0,0 +1,47 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "NeighborStats.h"
+
+using namespace std;
+
+void NeighborStats::Merge(const NeighborStats& stats)
+{
+	NumQueries += stats.NumQueries;
+	NumNeighbors += stats.NumNeighbors;
+	NumCandidates += stats.NumCandidates;
+	NumNodesVisited += stats.NumNodesVisited;
+	MaxNeighbors = (max)(MaxNeighbors, stats.MaxNeighbors);
+	for (auto i = 0u; i < NumHistogramBins; ++i) Histogram[i] += stats.Histogram[i];
+}
+
+uint64_t NeighborStats::GetNumRejected() const
+{
+	return NumCandidates - NumNeighbors;
+}
+
+NeighborStatsCounters::NeighborStatsCounters()
+{
+}
+
+NeighborStatsCounters::~NeighborStatsCounters()
+{
+}
+
+void NeighborStatsCounters::Reset(uint32_t numThreads)
+{
+	m_slots.resize(numThreads);
+	for (auto& slot : m_slots) slot.Stats.Reset();
+}
+
+NeighborStats& NeighborStatsCounters::GetThreadStats(uint32_t thread)
+{
+	return m_slots[thread].Stats;
+}
+
+void NeighborStatsCounters::Reduce(NeighborStats& stats) const
+{
+	stats.Reset();
+	for (const auto& slot : m_slots) stats.Merge(slot.Stats);
+}
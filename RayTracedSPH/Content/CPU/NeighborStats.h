@@ -0,0 +1,79 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Counters of the neighbor search over the queries of a step, the same for the grid stencil, the BVH
+// traversal and the emulated rays. The candidates are the particles tested against the support (all the
+// particles in the stencil cells, or the AABBs the intersection shader is called for), so the ones that
+// fail the sphere test are the rejected candidates. The neighbors include the particle itself.
+struct NeighborStats
+{
+	static const uint32_t NumHistogramBins = 32;
+	static const uint32_t HistogramBinWidth = 4;	// The last bin also holds the larger counts
+
+	uint64_t NumQueries;
+	uint64_t NumNeighbors;
+	uint64_t NumCandidates;
+	uint64_t NumNodesVisited;	// Stencil cells, or BVH nodes
+	uint32_t MaxNeighbors;
+	uint32_t Histogram[NumHistogramBins];
+
+	void Reset()
+	{
+		*this = {};
+	}
+
+	void AddQuery(uint32_t numNeighbors, uint32_t numCandidates, uint32_t numNodesVisited)
+	{
+		AddQueries(1, numCandidates, numNodesVisited);
+		AddNeighbors(numNeighbors);
+	}
+
+	// The same in two halves, for the queries that share their candidates and nodes, such as the particles
+	// of a grid cell, which add those once for all of them
+	void AddQueries(uint32_t numQueries, uint32_t numCandidates, uint32_t numNodesVisited)
+	{
+		NumQueries += numQueries;
+		NumCandidates += static_cast<uint64_t>(numQueries) * numCandidates;
+		NumNodesVisited += static_cast<uint64_t>(numQueries) * numNodesVisited;
+	}
+
+	void AddNeighbors(uint32_t numNeighbors)
+	{
+		NumNeighbors += numNeighbors;
+		MaxNeighbors = (std::max)(MaxNeighbors, numNeighbors);
+		++Histogram[(std::min)(numNeighbors / HistogramBinWidth, NumHistogramBins - 1)];
+	}
+
+	void Merge(const NeighborStats& stats);
+	uint64_t GetNumRejected() const;
+};
+
+// One slot of the counters per thread, which the thread updates without atomics. The slots are padded
+// apart by a cache line, so the threads do not share any line they write to.
+class NeighborStatsCounters
+{
+public:
+	NeighborStatsCounters();
+	virtual ~NeighborStatsCounters();
+
+	void Reset(uint32_t numThreads);
+	NeighborStats& GetThreadStats(uint32_t thread);
+	// Sum the slots in the thread order, which does not change the integer totals
+	void Reduce(NeighborStats& stats) const;
+
+protected:
+	struct Slot
+	{
+		NeighborStats Stats;
+		uint8_t Padding[64];
+	};
+
+	std::vector<Slot> m_slots;
+};
@@ -0,0 +1,829 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "ThreadPool.h"
+#include "ParticleBVH.h"
+
+using namespace std;
+using namespace DirectX;
+
+#define BVH_BLOCK_SIZE 4096
+#define BVH_RADIX_BITS 8
+
+const uint32_t BVH_NUM_DIGITS = 1 << BVH_RADIX_BITS;
+const uint8_t BVH_NUM_BINS = 12;
+
+// Run func(first, end) on the blocks of the items, on the thread pool if any
+template<typename TFunc>
+static void forEachBlock(ThreadPool* pThreadPool, uint32_t numItems, const TFunc& func)
+{
+	const auto numBlocks = (numItems + BVH_BLOCK_SIZE - 1) / BVH_BLOCK_SIZE;
+	const auto runBlock = [&](uint32_t block)
+	{
+		const auto first = block * BVH_BLOCK_SIZE;
+		func(first, (min)(first + BVH_BLOCK_SIZE, numItems));
+	};
+
+	if (pThreadPool) pThreadPool->Run(numBlocks, [&](uint32_t block, uint32_t) { runBlock(block); });
+	else for (auto i = 0u; i < numBlocks; ++i) runBlock(i);
+}
+
+static uint32_t countLeadingZeros(uint64_t v)
+{
+#ifdef _MSC_VER
+	unsigned long bit;
+
+	return _BitScanReverse64(&bit, v) ? 63 - bit : 64;
+#else
+	return v ? __builtin_clzll(v) : 64;
+#endif
+}
+
+// Spread the lower 10 bits so that there are 2 zero bits between each
+static uint32_t expandBits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+
+	return v;
+}
+
+static void growAABB(ParticleBVH::AABB& aabb, const ParticleBVH::AABB& other)
+{
+	aabb.Min = XMFLOAT3((min)(aabb.Min.x, other.Min.x), (min)(aabb.Min.y, other.Min.y), (min)(aabb.Min.z, other.Min.z));
+	aabb.Max = XMFLOAT3((max)(aabb.Max.x, other.Max.x), (max)(aabb.Max.y, other.Max.y), (max)(aabb.Max.z, other.Max.z));
+}
+
+ParticleBVH::ParticleBVH() :
+	m_radius(0.0f),
+	m_margin(0.0f),
+	m_inflationScale(1.0f, 1.0f, 1.0f),
+	m_clusterSize(1),
+	m_laneStride(1),
+	m_traversal(TRAVERSAL_STACK),
+	m_lbvhVisitCapacity(0)
+{
+}
+
+ParticleBVH::~ParticleBVH()
+{
+}
+
+void ParticleBVH::Build(const XMFLOAT3* positions, uint32_t numParticles, float radius, uint32_t clusterSize,
+	float margin, BuildMethod method, ThreadPool* pThreadPool)
+{
+	Build(positions, nullptr, numParticles, radius, clusterSize, margin, method, pThreadPool);
+}
+
+void ParticleBVH::Build(const XMFLOAT3* positions, const uint32_t* particleIndices, uint32_t numParticles,
+	float radius, uint32_t clusterSize, float margin, BuildMethod method, ThreadPool* pThreadPool)
+{
+	m_radius = radius;
+	m_margin = margin;
+	m_clusterSize = (max)(clusterSize, 1u);
+	m_laneStride = m_clusterSize > 1 ? (m_clusterSize + 3) & ~3u : 1;
+
+	sortByMorton(positions, particleIndices, numParticles, pThreadPool);
+	buildClusters(positions, numParticles, pThreadPool);
+
+	switch (method)
+	{
+	case BUILD_SAH:
+		buildHierarchySAH();
+		break;
+	case BUILD_LBVH:
+		buildHierarchyLBVH(pThreadPool);
+		break;
+	default:
+		buildHierarchy();
+	}
+
+	buildSkipLinks();
+}
+
+void ParticleBVH::Refit(const XMFLOAT3* positions)
+{
+	updateClusters(positions);
+
+	// Bottom-up in the post order, since the linear BVH may place the children before their parents
+	struct Entry { uint32_t Node; bool IsExpanded; };
+	Entry stack[2 * StackSize];
+	uint32_t stackSize = 0;
+	if (!m_nodes.empty() && GetNumClusters() > 0) stack[stackSize++] = { 0, false };
+
+	while (stackSize > 0)
+	{
+		const auto entry = stack[--stackSize];
+		auto& node = m_nodes[entry.Node];
+		if (node.Count == 0 && !entry.IsExpanded)
+		{
+			stack[stackSize++] = { entry.Node, true };
+			stack[stackSize++] = { node.Next + 1, false };
+			stack[stackSize++] = { node.Next, false };
+			continue;
+		}
+
+		AABB bounds;
+		if (node.Count > 0)
+		{
+			bounds = m_clusterAABBs[node.Next];
+			for (auto i = 1u; i < node.Count; ++i) growAABB(bounds, m_clusterAABBs[node.Next + i]);
+		}
+		else
+		{
+			bounds = { m_nodes[node.Next].Min, m_nodes[node.Next].Max };
+			growAABB(bounds, { m_nodes[node.Next + 1].Min, m_nodes[node.Next + 1].Max });
+		}
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+	}
+}
+
+void ParticleBVH::UpdatePositions(const XMFLOAT3* positions)
+{
+	const auto numClusters = GetNumClusters();
+	for (auto c = 0u; c < numClusters; ++c)
+	{
+		const auto pLanes = &m_clusterLanes[static_cast<size_t>(c) * 3 * m_laneStride];
+		const auto pIndices = &m_particleIndices[static_cast<size_t>(c) * m_laneStride];
+		for (auto i = 0u; i < m_laneStride && pIndices[i] != UINT32_MAX; ++i)
+		{
+			const auto& p = positions[pIndices[i]];
+			pLanes[i] = p.x;
+			pLanes[m_laneStride + i] = p.y;
+			pLanes[2 * m_laneStride + i] = p.z;
+		}
+	}
+}
+
+void ParticleBVH::SetInflationScale(const XMFLOAT3& scale)
+{
+	m_inflationScale = scale;
+}
+
+void ParticleBVH::SetTraversal(Traversal traversal)
+{
+	m_traversal = traversal;
+}
+
+const vector<ParticleBVH::Node>& ParticleBVH::GetNodes() const
+{
+	return m_nodes;
+}
+
+const vector<uint32_t>& ParticleBVH::GetSkipLinks() const
+{
+	return m_skipLinks;
+}
+
+const vector<ParticleBVH::AABB>& ParticleBVH::GetClusterAABBs() const
+{
+	return m_clusterAABBs;
+}
+
+const vector<uint32_t>& ParticleBVH::GetParticleIndices() const
+{
+	return m_particleIndices;
+}
+
+uint32_t ParticleBVH::GetClusterSize() const
+{
+	return m_clusterSize;
+}
+
+uint32_t ParticleBVH::GetLaneStride() const
+{
+	return m_laneStride;
+}
+
+uint32_t ParticleBVH::GetNumClusters() const
+{
+	return static_cast<uint32_t>(m_clusterAABBs.size());
+}
+
+size_t ParticleBVH::GetMemorySize() const
+{
+	return sizeof(Node) * m_nodes.size() + sizeof(uint32_t) * m_skipLinks.size() + sizeof(AABB) * m_clusterAABBs.size() +
+		sizeof(float) * m_clusterLanes.size() + sizeof(uint32_t) * m_particleIndices.size();
+}
+
+float ParticleBVH::GetSAHCost() const
+{
+	if (m_nodes.empty() || GetNumClusters() == 0) return 0.0f;
+
+	// Implements this equation:
+	// C = SUM_interior(A(n) / A(root) * C_node) + SUM_leaf(A(n) / A(root) * count(n) * C_cluster)
+	// with C_node = 1 for the 2 child box tests, and C_cluster = 1 for a cluster test
+	const auto area = [](const Node& node)
+	{
+		const auto x = node.Max.x - node.Min.x, y = node.Max.y - node.Min.y, z = node.Max.z - node.Min.z;
+
+		return x * y + y * z + z * x;
+	};
+
+	auto cost = 0.0;
+	for (const auto& node : m_nodes) cost += area(node) * (node.Count > 0 ? node.Count : 1);
+
+	return static_cast<float>(cost / area(m_nodes[0]));
+}
+
+uint32_t ParticleBVH::QueryKNN(const XMFLOAT3& pos, uint32_t k, float maxRadius,
+	NearestNeighbor* neighbors, QueryStats* pStats) const
+{
+	if (k == 0 || GetNumClusters() == 0) return 0;
+
+	// Depth first with the nearer child on the top of the stack, where each entry keeps the distance
+	// to its node, so the nodes beyond the kth neighbor found since they were pushed are skipped.
+	NearestNeighborHeap heap(neighbors, k, maxRadius);
+	struct Entry { uint32_t Node; float R_sq; };
+	Entry stack[StackSize];
+	uint32_t stackSize = 0;
+	uint64_t nodesVisited = 1, clustersTested = 0;
+	const auto rootRSq = getDistanceSq(m_nodes[0], pos);
+	if (rootRSq < heap.GetBound()) stack[stackSize++] = { 0, rootRSq };
+
+	while (stackSize > 0)
+	{
+		const auto entry = stack[--stackSize];
+		if (entry.R_sq > heap.GetBound()) continue;
+
+		const auto& node = m_nodes[entry.Node];
+		if (node.Count > 0)
+		{
+			// The ties with the kth neighbor pass the test, where the lower index wins.
+			for (auto i = 0u; i < node.Count; ++i)
+				testCluster(node.Next + i, pos, nextafter(heap.GetBound(), FLT_MAX), [&heap](uint32_t j, float r_sq) { heap.Push(j, r_sq); });
+			clustersTested += node.Count;
+		}
+		else
+		{
+			nodesVisited += 2;
+			Entry left = { node.Next, getDistanceSq(m_nodes[node.Next], pos) };
+			Entry right = { node.Next + 1, getDistanceSq(m_nodes[node.Next + 1], pos) };
+			if (right.R_sq < left.R_sq) swap(left, right);
+			const auto bound = heap.GetBound();
+			if (right.R_sq <= bound) stack[stackSize++] = right;
+			if (left.R_sq <= bound) stack[stackSize++] = left;
+		}
+	}
+
+	if (pStats)
+	{
+		pStats->NodesVisited += nodesVisited;
+		pStats->ClustersTested += clustersTested;
+		pStats->ParticlesTested += clustersTested * m_clusterSize;
+	}
+
+	return heap.Finish();
+}
+
+uint32_t ParticleBVH::QueryRadius(const XMFLOAT3& pos, float radius, uint32_t maxNeighbors,
+	NearestNeighbor* neighbors, QueryStats* pStats) const
+{
+	if (maxNeighbors == 0 || GetNumClusters() == 0) return 0;
+
+	const auto radiusSq = radius * radius;
+	uint32_t stack[StackSize];
+	uint32_t stackSize = 0;
+	uint64_t nodesVisited = 1, clustersTested = 0;
+	auto numNeighbors = 0u;
+	if (getDistanceSq(m_nodes[0], pos) < radiusSq) stack[stackSize++] = 0;
+
+	// Stop at the first leaf that fills the neighbors
+	while (stackSize > 0 && numNeighbors < maxNeighbors)
+	{
+		const auto& node = m_nodes[stack[--stackSize]];
+		if (node.Count > 0)
+		{
+			for (auto i = 0u; i < node.Count; ++i)
+				testCluster(node.Next + i, pos, radiusSq, [&](uint32_t j, float r_sq)
+				{
+					if (numNeighbors < maxNeighbors) neighbors[numNeighbors++] = { j, r_sq };
+				});
+			clustersTested += node.Count;
+		}
+		else
+		{
+			nodesVisited += 2;
+			if (getDistanceSq(m_nodes[node.Next + 1], pos) < radiusSq) stack[stackSize++] = node.Next + 1;
+			if (getDistanceSq(m_nodes[node.Next], pos) < radiusSq) stack[stackSize++] = node.Next;
+		}
+	}
+
+	if (pStats)
+	{
+		pStats->NodesVisited += nodesVisited;
+		pStats->ClustersTested += clustersTested;
+		pStats->ParticlesTested += clustersTested * m_clusterSize;
+	}
+
+	return numNeighbors;
+}
+
+void ParticleBVH::QueryKNN(const XMFLOAT3* points, uint32_t numPoints, uint32_t k, float maxRadius,
+	NearestNeighbor* neighbors, uint32_t* counts, ThreadPool* pThreadPool) const
+{
+	forEachBlock(pThreadPool, numPoints, [&](uint32_t first, uint32_t end)
+	{
+		for (auto i = first; i < end; ++i)
+			counts[i] = QueryKNN(points[i], k, maxRadius, &neighbors[static_cast<size_t>(i) * k]);
+	});
+}
+
+void ParticleBVH::QueryRadius(const XMFLOAT3* points, const float* radii, uint32_t numPoints, uint32_t maxNeighbors,
+	NearestNeighbor* neighbors, uint32_t* counts, ThreadPool* pThreadPool) const
+{
+	forEachBlock(pThreadPool, numPoints, [&](uint32_t first, uint32_t end)
+	{
+		for (auto i = first; i < end; ++i)
+			counts[i] = QueryRadius(points[i], radii[i], maxNeighbors, &neighbors[static_cast<size_t>(i) * maxNeighbors]);
+	});
+}
+
+void ParticleBVH::sortByMorton(const XMFLOAT3* positions, const uint32_t* particleIndices, uint32_t numParticles,
+	ThreadPool* pThreadPool)
+{
+	// The keys hold the indices into the full positions, which the clusters take from them.
+	const auto getIndex = [particleIndices](uint32_t i) { return particleIndices ? particleIndices[i] : i; };
+
+	// Bounds per block, reduced in the block order
+	const auto numBlocks = (numParticles + BVH_BLOCK_SIZE - 1) / BVH_BLOCK_SIZE;
+	m_blockBounds.resize(2 * static_cast<size_t>(numBlocks));
+	forEachBlock(pThreadPool, numParticles, [&](uint32_t first, uint32_t end)
+	{
+		XMFLOAT3 boundsMin(FLT_MAX, FLT_MAX, FLT_MAX), boundsMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (auto i = first; i < end; ++i)
+		{
+			const auto& p = positions[getIndex(i)];
+			boundsMin = XMFLOAT3((min)(boundsMin.x, p.x), (min)(boundsMin.y, p.y), (min)(boundsMin.z, p.z));
+			boundsMax = XMFLOAT3((max)(boundsMax.x, p.x), (max)(boundsMax.y, p.y), (max)(boundsMax.z, p.z));
+		}
+
+		const auto block = first / BVH_BLOCK_SIZE;
+		m_blockBounds[2 * block] = boundsMin;
+		m_blockBounds[2 * block + 1] = boundsMax;
+	});
+
+	AABB bounds = { XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+	for (auto b = 0u; b < numBlocks; ++b) growAABB(bounds, { m_blockBounds[2 * b], m_blockBounds[2 * b + 1] });
+
+	// 10 bits per axis in the cube around the particles
+	const auto extent = (max)((max)(bounds.Max.x - bounds.Min.x, bounds.Max.y - bounds.Min.y), bounds.Max.z - bounds.Min.z);
+	const auto scale = extent > 0.0f ? 1023.0f / extent : 0.0f;
+	m_mortonKeys.resize(numParticles);
+	forEachBlock(pThreadPool, numParticles, [&](uint32_t first, uint32_t end)
+	{
+		for (auto i = first; i < end; ++i)
+		{
+			const auto index = getIndex(i);
+			const auto& p = positions[index];
+			const auto x = expandBits(static_cast<uint32_t>((p.x - bounds.Min.x) * scale));
+			const auto y = expandBits(static_cast<uint32_t>((p.y - bounds.Min.y) * scale));
+			const auto z = expandBits(static_cast<uint32_t>((p.z - bounds.Min.z) * scale));
+			m_mortonKeys[i] = (static_cast<uint64_t>((x << 2) | (y << 1) | z) << 32) | index;
+		}
+	});
+
+	// Stable LSD radix sort on the 30-bit codes, which keeps the particle indices ascending within a code.
+	// Each pass counts the digits per block, and the blocks scatter to their own offsets in parallel.
+	m_sortBuffer.resize(numParticles);
+	m_digitOffsets.resize(static_cast<size_t>(numBlocks) * BVH_NUM_DIGITS);
+	for (auto shift = 32u; shift < 62u; shift += BVH_RADIX_BITS)
+	{
+		forEachBlock(pThreadPool, numParticles, [&](uint32_t first, uint32_t end)
+		{
+			const auto pCounts = &m_digitOffsets[static_cast<size_t>(first / BVH_BLOCK_SIZE) * BVH_NUM_DIGITS];
+			fill(pCounts, pCounts + BVH_NUM_DIGITS, 0u);
+			for (auto i = first; i < end; ++i) ++pCounts[(m_mortonKeys[i] >> shift) & (BVH_NUM_DIGITS - 1)];
+		});
+
+		// Exclusive prefix sum in the digit-major order
+		auto offset = 0u;
+		for (auto d = 0u; d < BVH_NUM_DIGITS; ++d)
+		{
+			for (auto b = 0u; b < numBlocks; ++b)
+			{
+				auto& count = m_digitOffsets[static_cast<size_t>(b) * BVH_NUM_DIGITS + d];
+				const auto blockCount = count;
+				count = offset;
+				offset += blockCount;
+			}
+		}
+
+		forEachBlock(pThreadPool, numParticles, [&](uint32_t first, uint32_t end)
+		{
+			const auto pOffsets = &m_digitOffsets[static_cast<size_t>(first / BVH_BLOCK_SIZE) * BVH_NUM_DIGITS];
+			for (auto i = first; i < end; ++i)
+			{
+				const auto key = m_mortonKeys[i];
+				m_sortBuffer[pOffsets[(key >> shift) & (BVH_NUM_DIGITS - 1)]++] = key;
+			}
+		});
+
+		m_mortonKeys.swap(m_sortBuffer);
+	}
+}
+
+void ParticleBVH::buildClusters(const XMFLOAT3* positions, uint32_t numParticles, ThreadPool* pThreadPool)
+{
+	// Group every K consecutive particles in the Morton order
+	const auto numClusters = (numParticles + m_clusterSize - 1) / m_clusterSize;
+	m_clusterAABBs.resize(numClusters);
+	m_clusterLanes.assign(static_cast<size_t>(numClusters) * 3 * m_laneStride, FLT_MAX);
+	m_particleIndices.assign(static_cast<size_t>(numClusters) * m_laneStride, UINT32_MAX);
+
+	forEachBlock(pThreadPool, numClusters, [&](uint32_t firstCluster, uint32_t endCluster)
+	{
+		for (auto c = firstCluster; c < endCluster; ++c)
+		{
+			const auto pIndices = &m_particleIndices[static_cast<size_t>(c) * m_laneStride];
+			const auto first = c * m_clusterSize;
+			const auto count = (min)(m_clusterSize, numParticles - first);
+			for (auto i = 0u; i < count; ++i) pIndices[i] = static_cast<uint32_t>(m_mortonKeys[first + i]);
+		}
+	});
+
+	updateClusters(positions, pThreadPool);
+}
+
+void ParticleBVH::updateClusters(const XMFLOAT3* positions, ThreadPool* pThreadPool)
+{
+	const auto extent = m_radius + m_margin;
+	const XMFLOAT3 inflation(extent * m_inflationScale.x, extent * m_inflationScale.y, extent * m_inflationScale.z);
+	forEachBlock(pThreadPool, GetNumClusters(), [&](uint32_t first, uint32_t end)
+	{
+		for (auto c = first; c < end; ++c) updateCluster(c, positions, inflation);
+	});
+}
+
+void ParticleBVH::updateCluster(uint32_t c, const XMFLOAT3* positions, const XMFLOAT3& inflation)
+{
+	auto& aabb = m_clusterAABBs[c];
+	aabb.Min = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+	aabb.Max = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	// The padded lanes keep their far-away positions.
+	const auto pLanes = &m_clusterLanes[static_cast<size_t>(c) * 3 * m_laneStride];
+	const auto pIndices = &m_particleIndices[static_cast<size_t>(c) * m_laneStride];
+	for (auto i = 0u; i < m_laneStride && pIndices[i] != UINT32_MAX; ++i)
+	{
+		const auto& p = positions[pIndices[i]];
+		pLanes[i] = p.x;
+		pLanes[m_laneStride + i] = p.y;
+		pLanes[2 * m_laneStride + i] = p.z;
+		growAABB(aabb, { p, p });
+	}
+
+	aabb.Min = XMFLOAT3(aabb.Min.x - inflation.x, aabb.Min.y - inflation.y, aabb.Min.z - inflation.z);
+	aabb.Max = XMFLOAT3(aabb.Max.x + inflation.x, aabb.Max.y + inflation.y, aabb.Max.z + inflation.z);
+}
+
+void ParticleBVH::buildSkipLinks()
+{
+	// The skip link of a left child is its sibling, and a right child inherits the link of its parent.
+	m_skipLinks.resize(m_nodes.size());
+	struct Entry { uint32_t Node, Skip; };
+	Entry stack[2 * StackSize];
+	uint32_t stackSize = 0;
+	if (!m_nodes.empty()) stack[stackSize++] = { 0, UINT32_MAX };
+
+	while (stackSize > 0)
+	{
+		const auto entry = stack[--stackSize];
+		const auto& node = m_nodes[entry.Node];
+		m_skipLinks[entry.Node] = entry.Skip;
+		if (node.Count == 0 && GetNumClusters() > 0)
+		{
+			stack[stackSize++] = { node.Next + 1, entry.Skip };
+			stack[stackSize++] = { node.Next, node.Next + 1 };
+		}
+	}
+}
+
+float ParticleBVH::getDistanceSq(const Node& node, const XMFLOAT3& pos) const
+{
+	// The margin stays in the box, since the particles may have moved that far since the last refit, and
+	// 1/1024 of the radius as well, for the rounding of the inflation, so the box still holds its particles.
+	const auto deflation = m_radius * (1.0f - 1.0f / 1024.0f);
+	const XMFLOAT3 extent(deflation * m_inflationScale.x, deflation * m_inflationScale.y, deflation * m_inflationScale.z);
+	const auto dx = (max)((max)(node.Min.x + extent.x - pos.x, pos.x - node.Max.x + extent.x), 0.0f);
+	const auto dy = (max)((max)(node.Min.y + extent.y - pos.y, pos.y - node.Max.y + extent.y), 0.0f);
+	const auto dz = (max)((max)(node.Min.z + extent.z - pos.z, pos.z - node.Max.z + extent.z), 0.0f);
+
+	return dx * dx + dy * dy + dz * dz;
+}
+
+void ParticleBVH::buildHierarchy()
+{
+	const auto numClusters = GetNumClusters();
+
+	// Root, which no query overlaps without particles
+	m_nodes.clear();
+	m_nodes.reserve((max)(2 * numClusters, 1u));
+	m_nodes.push_back({ XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), 0, XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX), numClusters });
+
+	// Top-down, halving the clusters in the Morton order, whose neighbors are close in space already
+	struct Task { uint32_t Node, First, Count; };
+	vector<Task> tasks;
+	if (numClusters > 0) tasks.push_back({ 0, 0, numClusters });
+	while (!tasks.empty())
+	{
+		const auto task = tasks.back();
+		tasks.pop_back();
+
+		AABB bounds = m_clusterAABBs[task.First];
+		for (auto i = task.First + 1; i < task.First + task.Count; ++i) growAABB(bounds, m_clusterAABBs[i]);
+
+		auto& node = m_nodes[task.Node];
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+		node.Next = task.First;
+		node.Count = task.Count;
+		if (task.Count <= 1) continue;
+
+		// Children are adjacent
+		const auto mid = task.First + task.Count / 2;
+		const auto leftChild = static_cast<uint32_t>(m_nodes.size());
+		m_nodes[task.Node].Next = leftChild;
+		m_nodes[task.Node].Count = 0;
+		m_nodes.emplace_back();
+		m_nodes.emplace_back();
+		tasks.push_back({ leftChild, task.First, mid - task.First });
+		tasks.push_back({ leftChild + 1, mid, task.First + task.Count - mid });
+	}
+}
+
+void ParticleBVH::buildHierarchySAH()
+{
+	const auto numClusters = GetNumClusters();
+
+	// Root, which no query overlaps without particles
+	m_nodes.clear();
+	m_nodes.reserve((max)(2 * numClusters, 1u));
+	m_nodes.push_back({ XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), 0, XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX), numClusters });
+
+	// A leaf holds a single cluster, so the clusters can be partitioned through their IDs in place of a reorder.
+	vector<uint32_t> clusterIds(numClusters);
+	for (auto c = 0u; c < numClusters; ++c) clusterIds[c] = c;
+
+	const auto getCentroid = [this](uint32_t c, uint8_t axis)
+	{
+		const auto& aabb = m_clusterAABBs[c];
+
+		return 0.5f * ((&aabb.Min.x)[axis] + (&aabb.Max.x)[axis]);
+	};
+
+	const AABB emptyAABB = { XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX) };
+	const auto area = [](const AABB& aabb)
+	{
+		const auto x = aabb.Max.x - aabb.Min.x, y = aabb.Max.y - aabb.Min.y, z = aabb.Max.z - aabb.Min.z;
+
+		return x < 0.0f ? 0.0f : x * y + y * z + z * x;
+	};
+
+	// Top-down build with the binned surface area heuristic
+	struct Task { uint32_t Node, First, Count, Depth; };
+	vector<Task> tasks;
+	if (numClusters > 0) tasks.push_back({ 0, 0, numClusters, 0 });
+	while (!tasks.empty())
+	{
+		const auto task = tasks.back();
+		tasks.pop_back();
+
+		AABB bounds = m_clusterAABBs[clusterIds[task.First]];
+		float centroidMin[3], centroidMax[3];
+		for (uint8_t axis = 0; axis < 3; ++axis)
+			centroidMin[axis] = centroidMax[axis] = getCentroid(clusterIds[task.First], axis);
+		for (auto i = task.First + 1; i < task.First + task.Count; ++i)
+		{
+			growAABB(bounds, m_clusterAABBs[clusterIds[i]]);
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				const auto centroid = getCentroid(clusterIds[i], axis);
+				centroidMin[axis] = (min)(centroidMin[axis], centroid);
+				centroidMax[axis] = (max)(centroidMax[axis], centroid);
+			}
+		}
+
+		auto& node = m_nodes[task.Node];
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+		node.Next = clusterIds[task.First];
+		node.Count = task.Count;
+		if (task.Count <= 1) continue;
+
+		// The SAH splits may be lopsided, so the median splits take over once only they can still reach
+		// the single clusters within the max depth.
+		auto numMedianLevels = 0u;
+		for (auto count = task.Count; count > 1; count = (count + 1) / 2) ++numMedianLevels;
+		const auto isMedianSplit = task.Depth + numMedianLevels >= MaxDepth;
+
+		// Find the best split plane among the bin borders of all axes
+		auto bestCost = FLT_MAX;
+		uint8_t bestAxis = 0, bestSplit = 0;
+		for (uint8_t axis = 0; axis < 3 && !isMedianSplit; ++axis)
+		{
+			const auto extent = centroidMax[axis] - centroidMin[axis];
+			if (extent <= 0.0f) continue;
+
+			AABB binBounds[BVH_NUM_BINS];
+			uint32_t binCounts[BVH_NUM_BINS] = {};
+			for (auto& binAABB : binBounds) binAABB = emptyAABB;
+			const auto scale = BVH_NUM_BINS / extent;
+			for (auto i = task.First; i < task.First + task.Count; ++i)
+			{
+				const auto b = (min)(static_cast<uint8_t>((getCentroid(clusterIds[i], axis) - centroidMin[axis]) * scale),
+					static_cast<uint8_t>(BVH_NUM_BINS - 1));
+				growAABB(binBounds[b], m_clusterAABBs[clusterIds[i]]);
+				++binCounts[b];
+			}
+
+			// Sweep from both sides
+			float leftAreas[BVH_NUM_BINS - 1];
+			uint32_t leftCounts[BVH_NUM_BINS - 1];
+			auto left = emptyAABB;
+			uint32_t leftCount = 0;
+			for (uint8_t b = 0; b < BVH_NUM_BINS - 1; ++b)
+			{
+				growAABB(left, binBounds[b]);
+				leftCount += binCounts[b];
+				leftAreas[b] = area(left);
+				leftCounts[b] = leftCount;
+			}
+
+			auto right = emptyAABB;
+			uint32_t rightCount = 0;
+			for (uint8_t b = BVH_NUM_BINS - 1; b > 0; --b)
+			{
+				growAABB(right, binBounds[b]);
+				rightCount += binCounts[b];
+				const auto cost = leftCounts[b - 1] * leftAreas[b - 1] + rightCount * area(right);
+				if (leftCounts[b - 1] > 0 && rightCount > 0 && cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		// Partition the clusters, or halve them at the median along the widest axis of the centroids
+		auto mid = task.First + task.Count / 2;
+		if (isMedianSplit)
+		{
+			const float extent[] = { centroidMax[0] - centroidMin[0], centroidMax[1] - centroidMin[1], centroidMax[2] - centroidMin[2] };
+			const auto axis = static_cast<uint8_t>(max_element(extent, extent + 3) - extent);
+			nth_element(clusterIds.begin() + task.First, clusterIds.begin() + mid, clusterIds.begin() + task.First + task.Count,
+				[&](uint32_t a, uint32_t b) { return getCentroid(a, axis) < getCentroid(b, axis); });
+		}
+		else if (bestCost < FLT_MAX)
+		{
+			const auto scale = BVH_NUM_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+			const auto pMid = partition(clusterIds.begin() + task.First, clusterIds.begin() + task.First + task.Count,
+				[&](uint32_t c)
+				{
+					const auto b = (min)(static_cast<uint8_t>((getCentroid(c, bestAxis) - centroidMin[bestAxis]) * scale),
+						static_cast<uint8_t>(BVH_NUM_BINS - 1));
+
+					return b < bestSplit;
+				});
+			mid = static_cast<uint32_t>(pMid - clusterIds.begin());
+		}
+
+		// Children are adjacent
+		const auto leftChild = static_cast<uint32_t>(m_nodes.size());
+		m_nodes[task.Node].Next = leftChild;
+		m_nodes[task.Node].Count = 0;
+		m_nodes.emplace_back();
+		m_nodes.emplace_back();
+		tasks.push_back({ leftChild, task.First, mid - task.First, task.Depth + 1 });
+		tasks.push_back({ leftChild + 1, mid, task.First + task.Count - mid, task.Depth + 1 });
+	}
+}
+
+void ParticleBVH::buildHierarchyLBVH(ThreadPool* pThreadPool)
+{
+	const auto numClusters = GetNumClusters();
+
+	m_nodes.resize((max)(2 * numClusters, 2u) - 1);
+	if (numClusters <= 1)
+	{
+		// A single leaf, or the root that no query overlaps without particles
+		m_nodes[0] = numClusters > 0 ? Node{ m_clusterAABBs[0].Min, 0, m_clusterAABBs[0].Max, 1 } :
+			Node{ XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), 0, XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX), 0 };
+
+		return;
+	}
+
+	// The key of a cluster is that of its first particle, which is unique with the particle index.
+	// Implements this equation:
+	// delta(i, j) = clz(key_i ^ key_j), or -1 if j is out of [0, n)
+	const auto numInternals = numClusters - 1;
+	const auto delta = [&](uint32_t i, int64_t j) -> int32_t
+	{
+		if (j < 0 || j >= numClusters) return -1;
+
+		return countLeadingZeros(m_mortonKeys[static_cast<size_t>(i) * m_clusterSize] ^
+			m_mortonKeys[static_cast<size_t>(j) * m_clusterSize]);
+	};
+
+	// Internal node i has its children in the slots 2i + 1 and 2i + 2, so that they are adjacent and
+	// every node emits its children independently. The root is internal node 0 in slot 0.
+	m_lbvhParents.resize(static_cast<size_t>(numInternals) + numClusters);
+	m_lbvhSlots.resize(numInternals);
+	m_lbvhParents[0] = UINT32_MAX;
+	m_lbvhSlots[0] = 0;
+	forEachBlock(pThreadPool, numInternals, [&](uint32_t first, uint32_t end)
+	{
+		for (auto i = first; i < end; ++i)
+		{
+			// Direction of the range from the neighboring keys
+			const auto d = delta(i, i + 1) > delta(i, static_cast<int64_t>(i) - 1) ? 1 : -1;
+
+			// Upper bound of the range length, then the other end by binary search
+			const auto deltaMin = delta(i, static_cast<int64_t>(i) - d);
+			int64_t lengthMax = 2;
+			while (delta(i, i + lengthMax * d) > deltaMin) lengthMax *= 2;
+			int64_t length = 0;
+			for (auto t = lengthMax / 2; t >= 1; t /= 2)
+				if (delta(i, i + (length + t) * d) > deltaMin) length += t;
+			const int64_t j = i + length * d;
+
+			// Split position by binary search on the common prefix of the range
+			const auto deltaNode = delta(i, j);
+			int64_t split = 0;
+			auto t = length;
+			do
+			{
+				t = (t + 1) / 2;
+				if (delta(i, i + (split + t) * d) > deltaNode) split += t;
+			} while (t > 1);
+			const auto gamma = static_cast<uint32_t>(i + split * d + (min)(d, 0));
+
+			// The leaves get their bounds right away, and the internal nodes in the bottom-up pass.
+			const auto emitChild = [&](uint32_t slot, uint32_t child, bool isLeaf)
+			{
+				auto& node = m_nodes[slot];
+				if (isLeaf)
+				{
+					node = { m_clusterAABBs[child].Min, child, m_clusterAABBs[child].Max, 1 };
+					m_lbvhParents[numInternals + child] = i;
+				}
+				else
+				{
+					node.Next = 2 * child + 1;
+					node.Count = 0;
+					m_lbvhParents[child] = i;
+					m_lbvhSlots[child] = slot;
+				}
+			};
+
+			emitChild(2 * i + 1, gamma, (min)(static_cast<int64_t>(i), j) == gamma);
+			emitChild(2 * i + 2, gamma + 1, (max)(static_cast<int64_t>(i), j) == gamma + 1);
+		}
+	});
+	m_nodes[0].Next = 1;
+	m_nodes[0].Count = 0;
+
+	// Bottom-up bounds and heights from every leaf, where the second child to arrive at a node unites its
+	// children. Their heights are written before the arrivals, so the second one sees both.
+	m_lbvhHeights.resize(m_nodes.size());
+	if (m_lbvhVisitCapacity < numInternals)
+	{
+		m_lbvhVisitCapacity = numInternals;
+		m_lbvhVisits.reset(new atomic<uint32_t>[numInternals]);
+	}
+	for (auto i = 0u; i < numInternals; ++i) m_lbvhVisits[i].store(0, memory_order_relaxed);
+
+	forEachBlock(pThreadPool, numClusters, [&](uint32_t first, uint32_t end)
+	{
+		for (auto c = first; c < end; ++c)
+		{
+			auto parent = m_lbvhParents[numInternals + c];
+			while (parent != UINT32_MAX && m_lbvhVisits[parent].fetch_add(1, memory_order_acq_rel) > 0)
+			{
+				auto& node = m_nodes[m_lbvhSlots[parent]];
+				AABB bounds = { m_nodes[node.Next].Min, m_nodes[node.Next].Max };
+				growAABB(bounds, { m_nodes[node.Next + 1].Min, m_nodes[node.Next + 1].Max });
+				node.Min = bounds.Min;
+				node.Max = bounds.Max;
+
+				const auto getHeight = [this](uint32_t slot) { return m_nodes[slot].Count > 0 ? 0 : m_lbvhHeights[slot]; };
+				m_lbvhHeights[m_lbvhSlots[parent]] = (max)(getHeight(node.Next), getHeight(node.Next + 1)) + 1;
+				parent = m_lbvhParents[parent];
+			}
+		}
+	});
+
+	// The depth only follows the key bits, up to 64 for the clustered particles at the same point, so
+	// the clusters are halved in the Morton order instead, which limits the depth to log2 of their number.
+	if (m_lbvhHeights[0] > MaxDepth) buildHierarchy();
+}
@@ -0,0 +1,439 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <DirectXMath.h>
+#include <xmmintrin.h>
+#include "NearestNeighbors.h"
+#include "NeighborStats.h"
+
+// BVH over the particles for the CPU neighbor queries, where each leaf primitive bounds a cluster of
+// particles that are consecutive in the Morton order, instead of one AABB per particle. The cluster
+// AABBs are inflated by the query radius and stored in the D3D12_RAYTRACING_AABB layout, so they can
+// be the primitives of a BLAS as well, with primitive i covering the particle indices of cluster i.
+// The positions of each cluster are stored in SoA lanes, which a leaf tests 4 at a time with SSE.
+// The hierarchy over the clusters is built by halving them in the Morton order, by the binned SAH,
+// or by the linear BVH builder of Karras, whose every step runs in parallel on the thread pool.
+// Beyond the fixed-radius queries of SPH, the same BVH serves the k-nearest-neighbor queries and the
+// radius queries of any size, by the distances to the node boxes deflated back to the particles.
+class ThreadPool;
+
+class ParticleBVH
+{
+public:
+	enum BuildMethod : uint8_t
+	{
+		BUILD_MEDIAN,
+		BUILD_SAH,
+		BUILD_LBVH
+	};
+
+	// The stackless traversal follows the skip link of each node to the next node of the preorder
+	// after its subtree, so a query holds only the current node instead of a stack.
+	enum Traversal : uint8_t
+	{
+		TRAVERSAL_STACK,
+		TRAVERSAL_STACKLESS
+	};
+
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		uint32_t Next;		// Left child for an interior node, or the cluster for a leaf
+		DirectX::XMFLOAT3 Max;
+		uint32_t Count;		// Number of clusters, 0 for an interior node
+	};
+
+	struct AABB
+	{
+		DirectX::XMFLOAT3 Min;
+		DirectX::XMFLOAT3 Max;
+	};
+
+	struct QueryStats
+	{
+		uint64_t NodesVisited;
+		uint64_t ClustersTested;
+		uint64_t ParticlesTested;
+	};
+
+	ParticleBVH();
+	virtual ~ParticleBVH();
+
+	// The margin fattens the AABBs, so that a refit can be skipped until a particle moves farther.
+	// Without a thread pool, the build runs on the calling thread.
+	void Build(const DirectX::XMFLOAT3* positions, uint32_t numParticles, float radius, uint32_t clusterSize,
+		float margin = 0.0f, BuildMethod method = BUILD_MEDIAN, ThreadPool* pThreadPool = nullptr);
+	// Build over the particles of the given indices only, which the refits, the position updates and
+	// the queries then take as the indices into the full positions
+	void Build(const DirectX::XMFLOAT3* positions, const uint32_t* particleIndices, uint32_t numParticles,
+		float radius, uint32_t clusterSize, float margin = 0.0f, BuildMethod method = BUILD_MEDIAN,
+		ThreadPool* pThreadPool = nullptr);
+	// Update the bounds for the same particles at the new positions, keeping the clusters and the topology
+	void Refit(const DirectX::XMFLOAT3* positions);
+	// Update only the positions for the tests, where the fattened bounds must still cover the particles
+	void UpdatePositions(const DirectX::XMFLOAT3* positions);
+	// Scale the inflation of the AABBs per axis from the next build, such as the half-height AABBs of
+	// the BLAS for the z-oriented ray segments. The queries of this class need the default of 1.
+	void SetInflationScale(const DirectX::XMFLOAT3& scale);
+	void SetTraversal(Traversal traversal);
+
+	// Call func(particleIndex, r_sq) for each particle within the radius of the point. The neighbor stats,
+	// such as the slot of the calling thread, count the query with the particles tested as the candidates.
+	template<typename TFunc>
+	void Query(const DirectX::XMFLOAT3& pos, const TFunc& func, QueryStats* pStats = nullptr,
+		NeighborStats* pNeighborStats = nullptr) const;
+	// Traverse the nearby points together with a shared stack, where each entry holds the mask of the
+	// points inside the node, and call func(point, particleIndex, r_sq) for each neighbor of each point.
+	// The points are split into packets of up to MaxPacketSize, which each traverse on their own.
+	template<typename TFunc>
+	void QueryPacket(const DirectX::XMFLOAT3* points, uint32_t numPoints, const TFunc& func, QueryStats* pStats = nullptr) const;
+	// Call func(particleIndex, r_sq) for each particle of the cluster within the radius of the point
+	template<typename TFunc>
+	void TestCluster(uint32_t cluster, const DirectX::XMFLOAT3& pos, const TFunc& func) const;
+
+	// Find the k nearest particles of the point within the max radius, which may exceed the build radius,
+	// sorted from the nearest, and return their number. The nearer child is visited first, and the nodes
+	// farther than the kth neighbor so far are culled.
+	uint32_t QueryKNN(const DirectX::XMFLOAT3& pos, uint32_t k, float maxRadius,
+		NearestNeighbor* neighbors, QueryStats* pStats = nullptr) const;
+	// Find the particles within any radius of the point in no particular order, and stop at the max number
+	uint32_t QueryRadius(const DirectX::XMFLOAT3& pos, float radius, uint32_t maxNeighbors,
+		NearestNeighbor* neighbors, QueryStats* pStats = nullptr) const;
+	// The same queries in parallel blocks of the points on the thread pool if any, with k or the max number
+	// of neighbors per point in the array of the caller, and the number found per point in the counts
+	void QueryKNN(const DirectX::XMFLOAT3* points, uint32_t numPoints, uint32_t k, float maxRadius,
+		NearestNeighbor* neighbors, uint32_t* counts, ThreadPool* pThreadPool = nullptr) const;
+	void QueryRadius(const DirectX::XMFLOAT3* points, const float* radii, uint32_t numPoints, uint32_t maxNeighbors,
+		NearestNeighbor* neighbors, uint32_t* counts, ThreadPool* pThreadPool = nullptr) const;
+
+	// Run traverse(countedFunc, pQueryStats) of a single point, which calls countedFunc for each neighbor,
+	// and add it to the neighbor stats, for the Query of each BVH
+	template<typename TFunc, typename TQuery>
+	static void CountQuery(const TFunc& func, QueryStats* pStats, NeighborStats& neighborStats, const TQuery& traverse);
+
+	const std::vector<Node>& GetNodes() const;
+	const std::vector<uint32_t>& GetSkipLinks() const;	// UINT32_MAX past the last subtree
+	const std::vector<AABB>& GetClusterAABBs() const;
+	const std::vector<uint32_t>& GetParticleIndices() const;
+	uint32_t GetClusterSize() const;
+	uint32_t GetLaneStride() const;		// Entries of each cluster in the particle indices
+	uint32_t GetNumClusters() const;
+	size_t GetMemorySize() const;
+	float GetSAHCost() const;	// Expected cost of a random query relative to the root, for the build quality
+
+	// The traversals keep a far child per level on a stack, so the builds limit the depth of the leaves.
+	static const uint8_t StackSize = 64;
+	static const uint8_t MaxDepth = StackSize - 1;
+	static const uint8_t MaxPacketSize = 16;
+
+protected:
+	void sortByMorton(const DirectX::XMFLOAT3* positions, const uint32_t* particleIndices, uint32_t numParticles,
+		ThreadPool* pThreadPool);
+	void buildClusters(const DirectX::XMFLOAT3* positions, uint32_t numParticles, ThreadPool* pThreadPool);
+	void buildHierarchy();
+	void buildHierarchySAH();
+	void buildHierarchyLBVH(ThreadPool* pThreadPool);
+	void updateClusters(const DirectX::XMFLOAT3* positions, ThreadPool* pThreadPool = nullptr);
+	void updateCluster(uint32_t cluster, const DirectX::XMFLOAT3* positions, const DirectX::XMFLOAT3& inflation);
+	void buildSkipLinks();
+	// Squared distance from the point to the node box without the inflation by the radius
+	float getDistanceSq(const Node& node, const DirectX::XMFLOAT3& pos) const;
+
+	template<typename TFunc>
+	void query(const DirectX::XMFLOAT3& pos, const TFunc& func, QueryStats* pStats) const;
+	template<typename TFunc>
+	void queryPacket(const DirectX::XMFLOAT3* points, uint32_t numPoints, const TFunc& func, QueryStats* pStats) const;
+	template<typename TFunc>
+	void queryStackless(const DirectX::XMFLOAT3& pos, const TFunc& func, QueryStats* pStats) const;
+	template<typename TFunc>
+	void testCluster(uint32_t cluster, const DirectX::XMFLOAT3& pos, float radiusSq, const TFunc& func) const;
+
+	std::vector<Node>		m_nodes;
+	std::vector<uint32_t>	m_skipLinks;
+	std::vector<AABB>		m_clusterAABBs;
+	std::vector<float>		m_clusterLanes;		// x[K], y[K], z[K] of each cluster, padded to 4 lanes
+	std::vector<uint32_t>	m_particleIndices;	// K per cluster, and UINT32_MAX for the padding
+	std::vector<uint64_t>	m_mortonKeys;		// Morton code in the high and particle index in the low 32 bits
+
+	float					m_radius;
+	float					m_margin;
+	DirectX::XMFLOAT3		m_inflationScale;
+	uint32_t				m_clusterSize;
+	uint32_t				m_laneStride;
+	Traversal				m_traversal;
+
+	// Scratch of the parallel build
+	std::vector<uint64_t>	m_sortBuffer;
+	std::vector<uint32_t>	m_digitOffsets;		// Per block and digit of a radix sort pass
+	std::vector<DirectX::XMFLOAT3> m_blockBounds;	// Min and max per block
+	std::vector<uint32_t>	m_lbvhParents;		// Parents of the internal nodes, then of the leaves
+	std::vector<uint32_t>	m_lbvhSlots;		// Slot of each internal node in m_nodes
+	std::vector<uint32_t>	m_lbvhHeights;		// Height of the subtree in each slot of an internal node
+	std::unique_ptr<std::atomic<uint32_t>[]> m_lbvhVisits;
+	uint32_t				m_lbvhVisitCapacity;
+};
+
+//--------------------------------------------------------------------------------------
+// Implementations
+//--------------------------------------------------------------------------------------
+
+template<typename TFunc>
+void ParticleBVH::Query(const DirectX::XMFLOAT3& pos, const TFunc& func, QueryStats* pStats, NeighborStats* pNeighborStats) const
+{
+	if (pNeighborStats) CountQuery(func, pStats, *pNeighborStats,
+		[&](const auto& countedFunc, QueryStats* pQueryStats) { query(pos, countedFunc, pQueryStats); });
+	else query(pos, func, pStats);
+}
+
+template<typename TFunc, typename TQuery>
+void ParticleBVH::CountQuery(const TFunc& func, QueryStats* pStats, NeighborStats& neighborStats, const TQuery& traverse)
+{
+	QueryStats queryStats = {};
+	uint32_t numNeighbors = 0;
+	traverse([&](uint32_t i, float r_sq)
+	{
+		++numNeighbors;
+		func(i, r_sq);
+	}, &queryStats);
+
+	neighborStats.AddQuery(numNeighbors, static_cast<uint32_t>(queryStats.ParticlesTested),
+		static_cast<uint32_t>(queryStats.NodesVisited));
+	if (pStats)
+	{
+		pStats->NodesVisited += queryStats.NodesVisited;
+		pStats->ClustersTested += queryStats.ClustersTested;
+		pStats->ParticlesTested += queryStats.ParticlesTested;
+	}
+}
+
+template<typename TFunc>
+void ParticleBVH::query(const DirectX::XMFLOAT3& pos, const TFunc& func, QueryStats* pStats) const
+{
+	if (m_traversal == TRAVERSAL_STACKLESS) return queryStackless(pos, func, pStats);
+
+	// The AABBs are inflated by the radius, so a node is a candidate if it contains the point.
+	const auto isInside = [&pos](const Node& node)
+	{
+		return pos.x >= node.Min.x && pos.x <= node.Max.x && pos.y >= node.Min.y &&
+			pos.y <= node.Max.y && pos.z >= node.Min.z && pos.z <= node.Max.z;
+	};
+
+	uint32_t stack[StackSize];
+	uint32_t stackSize = 0;
+	uint64_t nodesVisited = 1, clustersTested = 0;
+	if (!m_nodes.empty() && isInside(m_nodes[0])) stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const auto& node = m_nodes[stack[--stackSize]];
+		if (node.Count > 0)
+		{
+			for (auto i = 0u; i < node.Count; ++i) TestCluster(node.Next + i, pos, func);
+			clustersTested += node.Count;
+		}
+		else
+		{
+			nodesVisited += 2;
+			if (isInside(m_nodes[node.Next + 1])) stack[stackSize++] = node.Next + 1;
+			if (isInside(m_nodes[node.Next])) stack[stackSize++] = node.Next;
+		}
+	}
+
+	if (pStats)
+	{
+		pStats->NodesVisited += nodesVisited;
+		pStats->ClustersTested += clustersTested;
+		pStats->ParticlesTested += clustersTested * m_clusterSize;
+	}
+}
+
+template<typename TFunc>
+void ParticleBVH::queryStackless(const DirectX::XMFLOAT3& pos, const TFunc& func, QueryStats* pStats) const
+{
+	const auto isInside = [&pos](const Node& node)
+	{
+		return pos.x >= node.Min.x && pos.x <= node.Max.x && pos.y >= node.Min.y &&
+			pos.y <= node.Max.y && pos.z >= node.Min.z && pos.z <= node.Max.z;
+	};
+
+	// Descend to the left child of an overlapped interior node, and skip the subtree otherwise
+	uint64_t nodesVisited = 0, clustersTested = 0;
+	auto n = m_nodes.empty() ? UINT32_MAX : 0u;
+	while (n != UINT32_MAX)
+	{
+		const auto& node = m_nodes[n];
+		++nodesVisited;
+		if (!isInside(node)) n = m_skipLinks[n];
+		else if (node.Count > 0)
+		{
+			for (auto i = 0u; i < node.Count; ++i) TestCluster(node.Next + i, pos, func);
+			clustersTested += node.Count;
+			n = m_skipLinks[n];
+		}
+		else n = node.Next;
+	}
+
+	if (pStats)
+	{
+		pStats->NodesVisited += nodesVisited;
+		pStats->ClustersTested += clustersTested;
+		pStats->ParticlesTested += clustersTested * m_clusterSize;
+	}
+}
+
+template<typename TFunc>
+void ParticleBVH::QueryPacket(const DirectX::XMFLOAT3* points, uint32_t numPoints, const TFunc& func, QueryStats* pStats) const
+{
+	if (numPoints <= MaxPacketSize)
+	{
+		if (numPoints > 0) queryPacket(points, numPoints, func, pStats);
+
+		return;
+	}
+
+	// The masks and the SoA lanes of a packet hold up to MaxPacketSize points.
+	for (auto first = 0u; first < numPoints; first += MaxPacketSize)
+		queryPacket(&points[first], (std::min)(numPoints - first, static_cast<uint32_t>(MaxPacketSize)),
+			[&](uint32_t point, uint32_t i, float r_sq) { func(first + point, i, r_sq); }, pStats);
+}
+
+template<typename TFunc>
+void ParticleBVH::queryPacket(const DirectX::XMFLOAT3* points, uint32_t numPoints, const TFunc& func, QueryStats* pStats) const
+{
+	// Points in SoA, where the padded lanes are never inside a node
+	float px[MaxPacketSize], py[MaxPacketSize], pz[MaxPacketSize];
+	const auto numLanes = (numPoints + 3) & ~3u;
+	for (auto i = 0u; i < numLanes; ++i)
+	{
+		px[i] = i < numPoints ? points[i].x : FLT_MAX;
+		py[i] = i < numPoints ? points[i].y : FLT_MAX;
+		pz[i] = i < numPoints ? points[i].z : FLT_MAX;
+	}
+
+	// Mask of the active points inside the node, 4 at a time
+	const auto testNode = [&](const Node& node, uint32_t activeMask)
+	{
+		const auto minX = _mm_set1_ps(node.Min.x), maxX = _mm_set1_ps(node.Max.x);
+		const auto minY = _mm_set1_ps(node.Min.y), maxY = _mm_set1_ps(node.Max.y);
+		const auto minZ = _mm_set1_ps(node.Min.z), maxZ = _mm_set1_ps(node.Max.z);
+
+		auto mask = 0u;
+		for (auto i = 0u; i < numLanes; i += 4)
+		{
+			if (((activeMask >> i) & 0xF) == 0) continue;
+			const auto x = _mm_loadu_ps(&px[i]);
+			const auto y = _mm_loadu_ps(&py[i]);
+			const auto z = _mm_loadu_ps(&pz[i]);
+			const auto inX = _mm_and_ps(_mm_cmpge_ps(x, minX), _mm_cmple_ps(x, maxX));
+			const auto inY = _mm_and_ps(_mm_cmpge_ps(y, minY), _mm_cmple_ps(y, maxY));
+			const auto inZ = _mm_and_ps(_mm_cmpge_ps(z, minZ), _mm_cmple_ps(z, maxZ));
+			mask |= static_cast<uint32_t>(_mm_movemask_ps(_mm_and_ps(_mm_and_ps(inX, inY), inZ))) << i;
+		}
+
+		return mask & activeMask;
+	};
+
+	struct Entry { uint32_t Node, Mask; };
+	Entry stack[StackSize];
+	uint32_t stackSize = 0;
+	uint64_t nodesVisited = 1, particlesTested = 0;
+	if (!m_nodes.empty())
+	{
+		const auto mask = testNode(m_nodes[0], (1u << numPoints) - 1);
+		if (mask) stack[stackSize++] = { 0, mask };
+	}
+
+	while (stackSize > 0)
+	{
+		const auto entry = stack[--stackSize];
+		const auto& node = m_nodes[entry.Node];
+		if (node.Count > 0)
+		{
+			// The leaf clusters are tested point by point.
+			for (auto mask = entry.Mask; mask; mask &= mask - 1)
+			{
+				auto point = 0u;
+				while (!((mask >> point) & 1)) ++point;
+				for (auto i = 0u; i < node.Count; ++i)
+					TestCluster(node.Next + i, points[point], [&](uint32_t j, float r_sq) { func(point, j, r_sq); });
+				particlesTested += node.Count * m_clusterSize;
+			}
+		}
+		else
+		{
+			nodesVisited += 2;
+			const auto rightMask = testNode(m_nodes[node.Next + 1], entry.Mask);
+			const auto leftMask = testNode(m_nodes[node.Next], entry.Mask);
+			if (rightMask) stack[stackSize++] = { node.Next + 1, rightMask };
+			if (leftMask) stack[stackSize++] = { node.Next, leftMask };
+		}
+	}
+
+	if (pStats)
+	{
+		pStats->NodesVisited += nodesVisited;
+		pStats->ClustersTested += particlesTested / m_clusterSize;
+		pStats->ParticlesTested += particlesTested;
+	}
+}
+
+template<typename TFunc>
+void ParticleBVH::TestCluster(uint32_t cluster, const DirectX::XMFLOAT3& pos, const TFunc& func) const
+{
+	testCluster(cluster, pos, m_radius * m_radius, func);
+}
+
+template<typename TFunc>
+void ParticleBVH::testCluster(uint32_t cluster, const DirectX::XMFLOAT3& pos, float radiusSq, const TFunc& func) const
+{
+	const auto pLanes = &m_clusterLanes[static_cast<size_t>(cluster) * 3 * m_laneStride];
+	const auto pIndices = &m_particleIndices[static_cast<size_t>(cluster) * m_laneStride];
+
+	if (m_laneStride % 4)
+	{
+		// Single particles
+		for (auto i = 0u; i < m_laneStride; ++i)
+		{
+			const auto dx = pLanes[i] - pos.x;
+			const auto dy = pLanes[m_laneStride + i] - pos.y;
+			const auto dz = pLanes[2 * m_laneStride + i] - pos.z;
+			const auto r_sq = dx * dx + dy * dy + dz * dz;
+			if (r_sq < radiusSq) func(pIndices[i], r_sq);
+		}
+
+		return;
+	}
+
+	// 4 lanes at a time, where the padded lanes are far away
+	const auto px = _mm_set1_ps(pos.x);
+	const auto py = _mm_set1_ps(pos.y);
+	const auto pz = _mm_set1_ps(pos.z);
+	const auto rSq = _mm_set1_ps(radiusSq);
+	for (auto i = 0u; i < m_laneStride; i += 4)
+	{
+		const auto dx = _mm_sub_ps(_mm_loadu_ps(&pLanes[i]), px);
+		const auto dy = _mm_sub_ps(_mm_loadu_ps(&pLanes[m_laneStride + i]), py);
+		const auto dz = _mm_sub_ps(_mm_loadu_ps(&pLanes[2 * m_laneStride + i]), pz);
+		const auto r_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		auto mask = _mm_movemask_ps(_mm_cmplt_ps(r_sq, rSq));
+		if (mask == 0) continue;
+
+		float dists[4];
+		_mm_storeu_ps(dists, r_sq);
+		for (; mask; mask &= mask - 1)
+		{
+			auto lane = 0u;
+			while (!((mask >> lane) & 1)) ++lane;
+			func(pIndices[i + lane], dists[lane]);
+		}
+	}
+}
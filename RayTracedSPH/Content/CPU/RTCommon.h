@@ -0,0 +1,181 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "../SharedConst.h"
+#include "RayTracingEmulator.h"
+
+// C++ port of RTCommon.hlsli and the parts of Common.hlsli and KernelCommon.hlsli that the neighbor
+// queries use, for running the shader logic through the DXR emulation. The shader constants and
+// resources are the public g_ members, and the POINT_QUERY define is the g_isPointQuery switch, so
+// that both modes run in the same build.
+namespace RTEmulation
+{
+	struct Particle
+	{
+		float3 Pos;
+		float3 Velocity;
+		float MassRatio;	// In units of the initial particle mass, 0 for a dead particle
+		float SmoothRadius;
+	};
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	class RTCommon : public RayTracingShader<TShader, TPayload, THitAttributes>
+	{
+	public:
+		// cbSimulation and cbPerFrame
+		float	g_smoothRadius;
+		float	g_pressureStiffness;
+		float	g_restDensity;
+		float	g_densityCoef;
+		float	g_pressureGradCoef;
+		float	g_viscosityLaplaceCoef;
+		float	g_sleepSpeedSq;
+		uint	g_sleepSteps;
+		float	g_maxSmoothRadius;
+		float3	g_periodMin;
+		float3	g_periodSize;
+		uint	g_periodicAxes;	// Bit mask of the axes with periodic boundaries
+		uint	g_kernelType;	// Analytic, or the row + 1 of the kernel table
+		bool	g_isPointQuery;
+
+		// Resources
+		const Particle*					g_roParticles;
+		const AccelerationStructure*	g_bvhParticles;
+		const DirectX::XMFLOAT4*		g_txKernelTable;	// KERNEL_TABLE_SIZE texels per row
+
+	protected:
+		//--------------------------------------------------------------------------------------
+		// Get the support radius of a particle pair, which is symmetric
+		//--------------------------------------------------------------------------------------
+		static float GetPairSmoothRadius(float smoothRadius, float adjSmoothRadius)
+		{
+			return 0.5f * (smoothRadius + adjSmoothRadius);
+		}
+
+		//--------------------------------------------------------------------------------------
+		// Get the mask of the periodic axes
+		//--------------------------------------------------------------------------------------
+		float3 GetPeriodicMask() const
+		{
+			return float3(static_cast<float>(g_periodicAxes & 1), static_cast<float>((g_periodicAxes >> 1) & 1),
+				static_cast<float>((g_periodicAxes >> 2) & 1));
+		}
+
+		//--------------------------------------------------------------------------------------
+		// Generate ray
+		//--------------------------------------------------------------------------------------
+		RayDesc GenerateRay(Particle particle) const
+		{
+			RayDesc ray;
+			ray.Origin = particle.Pos;
+			ray.Direction = float3(0.0f, 0.0f, 1.0f);
+			ray.TMin = 0.0f;
+			if (g_isPointQuery)
+			{
+				// 0-length ray for point query
+				ray.TMax = 0.0f;
+			}
+			else
+			{
+				// z-oriented ray segment with g_smoothRadius length
+				ray.Origin.z -= g_smoothRadius * 0.5f;
+				ray.TMax = g_smoothRadius;
+			}
+
+			return ray;
+		}
+
+		//--------------------------------------------------------------------------------------
+		// Get the shift of the ray origin to the periodic image across each periodic face
+		// within the radius, which is 0 along the other axes
+		//--------------------------------------------------------------------------------------
+		float3 GetPeriodicShift(float3 pos, float radius) const
+		{
+			float3 shift;
+			for (uint i = 0; i < 3; ++i)
+			{
+				const float nearMin = pos[i] - g_periodMin[i] < radius;
+				const float nearMax = g_periodMin[i] + g_periodSize[i] - pos[i] < radius;
+				shift[i] = (nearMin - nearMax) * g_periodSize[i];
+			}
+
+			return GetPeriodicMask() * shift;
+		}
+
+		//--------------------------------------------------------------------------------------
+		// Shift the ray origin to one of the up to 7 periodic images, where the bits of the
+		// image select the shifted axes
+		//--------------------------------------------------------------------------------------
+		bool ShiftToPeriodicImage(uint image, float3 shift, float3& origin) const
+		{
+			auto isValid = true;
+			for (uint i = 0; i < 3; ++i)
+			{
+				const auto isShifted = ((image >> i) & 1) != 0;
+				if (isShifted) origin[i] += shift[i];
+				isValid = isValid && (!isShifted || shift[i] != 0.0f);
+			}
+
+			return isValid;
+		}
+
+		//--------------------------------------------------------------------------------------
+		// Get THit
+		//--------------------------------------------------------------------------------------
+		float GetTHit() const
+		{
+			// 0-length ray for point query, or the center of the z-oriented ray segment
+			return g_isPointQuery ? 0.0f : g_smoothRadius * 0.5f;
+		}
+
+		//--------------------------------------------------------------------------------------
+		// Calculate displacement between 2 particles
+		//--------------------------------------------------------------------------------------
+		float3 CalculateParticleDisplacement(float thit) const
+		{
+			const Particle hitParticle = g_roParticles[this->PrimitiveIndex()];
+
+			float3 rayPos = this->WorldRayOrigin();
+			rayPos.z += thit;
+
+			return hitParticle.Pos - rayPos;
+		}
+
+		//--------------------------------------------------------------------------------------
+		// Look up the kernels at r^2 / h^2 with the linear filtering of the clamping sampler,
+		// whose values are scaled to the units of the analytic poly6, spiky and viscosity kernels
+		// x: (h^2 - r^2)^3 / h^6, y: (h - r)^2 / h^2, z: (h - r) / h
+		//--------------------------------------------------------------------------------------
+		float3 LookupKernels(float r_sq, float h) const
+		{
+			const auto pRow = &g_txKernelTable[(g_kernelType - 1) * KERNEL_TABLE_SIZE];
+			const auto x = (std::min)(r_sq / (h * h), 1.0f) * (KERNEL_TABLE_SIZE - 1);
+			const auto i = (std::min)(static_cast<uint>(x), static_cast<uint>(KERNEL_TABLE_SIZE - 2));
+			const auto w = x - i;
+			const auto& t0 = pRow[i];
+			const auto& t1 = pRow[i + 1];
+
+			return float3(t0.x + w * (t1.x - t0.x), t0.y + w * (t1.y - t0.y), t0.z + w * (t1.z - t0.z));
+		}
+	};
+}
+
+//--------------------------------------------------------------------------------------
+// Trace the ray of the particle, and its periodic images near the periodic faces
+//--------------------------------------------------------------------------------------
+#define TRACE_NEIGHBOR_RAYS(particle, ray, payload) \
+	TraceRay(g_bvhParticles, RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, ~0u, 0, 1, 0, ray, payload); \
+	if (g_periodicAxes) \
+	{ \
+		const float3 shift = GetPeriodicShift(particle.Pos, \
+			GetPairSmoothRadius(particle.SmoothRadius, g_maxSmoothRadius)); \
+		for (uint image = 1; image < 8; ++image) \
+		{ \
+			RayDesc imageRay = ray; \
+			if (ShiftToPeriodicImage(image, shift, imageRay.Origin)) \
+				TraceRay(g_bvhParticles, RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, ~0u, 0, 1, 0, imageRay, payload); \
+		} \
+	}
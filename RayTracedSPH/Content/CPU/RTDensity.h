@@ -0,0 +1,146 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "RTCommon.h"
+
+// C++ port of RTDensity.hlsl
+namespace RTEmulation
+{
+	namespace RTDensity
+	{
+		//--------------------------------------------------------------------------------------
+		// Structs
+		//--------------------------------------------------------------------------------------
+		struct RayPayload
+		{
+			float Density;
+			float NumberDensity;
+			bool IsMoving;
+			bool IsSettled;
+		};
+
+		struct HitAttributes
+		{
+			float R_sq;
+			float H;
+		};
+
+		class Shader : public RTCommon<Shader, RayPayload, HitAttributes>
+		{
+		public:
+			//--------------------------------------------------------------------------------------
+			// Buffers
+			//--------------------------------------------------------------------------------------
+			float* g_rwDensities;
+			uint* g_rwSleepCounters;
+			float* g_rwNumberDensities;
+
+			//--------------------------------------------------------------------------------------
+			// Ray generation
+			//--------------------------------------------------------------------------------------
+			void raygenMain()
+			{
+				const uint index = DispatchRaysIndex().x;
+
+				// A sleeping particle keeps its density.
+				const uint sleepCounter = g_rwSleepCounters[index];
+				if (sleepCounter >= g_sleepSteps) return;
+
+				const Particle particle = g_roParticles[index];
+				if (particle.MassRatio <= 0.0f) return;
+
+				const RayDesc ray = GenerateRay(particle);
+
+				// Trace the ray.
+				RayPayload payload;
+				payload.Density = 0.0f;
+				payload.NumberDensity = 0.0f;
+				payload.IsMoving = dot(particle.Velocity, particle.Velocity) >= g_sleepSpeedSq;
+				payload.IsSettled = true;
+				TRACE_NEIGHBOR_RAYS(particle, ray, payload);
+
+				g_rwDensities[index] = payload.Density;
+				g_rwNumberDensities[index] = payload.NumberDensity;
+
+				// Fall asleep after the last calm step if all the neighbors are calm or asleep as well, unless a
+				// moving neighbor has woken the particle up meanwhile, which resets the counter for the comparison
+				if (sleepCounter + 1 == g_sleepSteps && payload.IsSettled)
+					InterlockedCompareStore(g_rwSleepCounters[index], sleepCounter, g_sleepSteps);
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Ray intersection
+			//--------------------------------------------------------------------------------------
+			void intersectionMain()
+			{
+				const float thit = GetTHit();
+				const float3 disp = CalculateParticleDisplacement(thit);
+				const float r_sq = dot(disp, disp);
+				const float h = GetPairSmoothRadius(g_roParticles[DispatchRaysIndex().x].SmoothRadius,
+					g_roParticles[PrimitiveIndex()].SmoothRadius);
+
+				if (r_sq < h * h)
+				{
+					const HitAttributes attr = { r_sq, h };
+					ReportHit(thit, /*hitKind*/ 0, attr);
+				}
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Density calculation
+			//--------------------------------------------------------------------------------------
+			float CalculateDensity(float r_sq, float h, float adjMassRatio) const
+			{
+				// Implements this equation:
+				// W_poly6(r, h) = 315 / (64 * pi * h^9) * (h^2 - r^2)^3
+				// g_densityCoef = particleMass * 315.0f / (64.0f * PI * g_smoothRadius^9)
+				// The coefficient is rescaled to the mass of the neighbor and the pair smoothing radius.
+				const float hScale = g_smoothRadius / h;
+				const float hScale3 = hScale * hScale * hScale;
+				const float coef = g_densityCoef * adjMassRatio * hScale3 * hScale3 * hScale3;
+
+				float d_sq = h * h;
+				if (g_kernelType != KERNEL_ANALYTIC) return coef * d_sq * d_sq * d_sq * LookupKernels(r_sq, h).x;
+
+				d_sq -= r_sq;
+
+				return coef * d_sq * d_sq * d_sq;
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Ray any hit
+			//--------------------------------------------------------------------------------------
+			void anyHitMain(RayPayload& payload, HitAttributes attr)
+			{
+				// The number density is in units of the initial particle mass, as if the neighbor had that mass.
+				const uint hitIndex = PrimitiveIndex();
+				const float density = CalculateDensity(attr.R_sq, attr.H, 1.0f);
+				payload.Density += density * g_roParticles[hitIndex].MassRatio;
+				payload.NumberDensity += density;
+
+				if (hitIndex != DispatchRaysIndex().x)
+				{
+					const uint hitSleepCounter = g_rwSleepCounters[hitIndex];
+					const bool isHitSettled = hitSleepCounter + 1 >= g_sleepSteps;
+
+					// A moving particle wakes up its settled neighbors (including those about to sleep). The atomic
+					// wake-up wins over their own decision to fall asleep, in either order.
+					if (payload.IsMoving && isHitSettled) InterlockedMin(g_rwSleepCounters[hitIndex], 0u);
+					payload.IsSettled = payload.IsSettled && isHitSettled;
+				}
+
+				IgnoreHit();
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Ray miss
+			//--------------------------------------------------------------------------------------
+			void missMain(RayPayload&)
+			{
+			}
+		};
+	}
+}
@@ -0,0 +1,186 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "RTCommon.h"
+
+// C++ port of RTForce.hlsl
+namespace RTEmulation
+{
+	namespace RTForce
+	{
+		//--------------------------------------------------------------------------------------
+		// Structs
+		//--------------------------------------------------------------------------------------
+		struct RayPayload
+		{
+			float Pressure;
+			float3 Force;
+			float3 Velocity;
+			float MinDensity;
+		};
+
+		struct HitAttributes
+		{
+			float3 Disp;
+			float R_sq;
+			float H;
+		};
+
+		class Shader : public RTCommon<Shader, RayPayload, HitAttributes>
+		{
+		public:
+			//--------------------------------------------------------------------------------------
+			// Buffers
+			//--------------------------------------------------------------------------------------
+			float3* g_rwAccelerations;
+			float* g_rwMinDensityRatios;
+			const float* g_roDensities;
+			const uint* g_roSleepCounters;
+
+			//--------------------------------------------------------------------------------------
+			// Pressure calculation
+			//--------------------------------------------------------------------------------------
+			float CalculatePressure(float density) const
+			{
+				// Implements this equation:
+				// Pressure = B * ((rho / rho_0)^y - 1)
+				const float rhoRatio = density / g_restDensity;
+
+				return g_pressureStiffness * (std::max)(rhoRatio * rhoRatio * rhoRatio - 1.0f, 0.0f);
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Ray generation
+			//--------------------------------------------------------------------------------------
+			void raygenMain()
+			{
+				const uint index = DispatchRaysIndex().x;
+
+				// A sleeping particle is not integrated.
+				if (g_roSleepCounters[index] >= g_sleepSteps) return;
+
+				const Particle particle = g_roParticles[index];
+				if (particle.MassRatio <= 0.0f) return;
+
+				const float density = g_roDensities[index];
+				const RayDesc ray = GenerateRay(particle);
+
+				// Trace the ray.
+				RayPayload payload;
+				payload.Pressure = CalculatePressure(density);
+				payload.Velocity = particle.Velocity;
+				payload.Force = 0.0f;
+				payload.MinDensity = density;
+				TRACE_NEIGHBOR_RAYS(particle, ray, payload);
+
+				g_rwAccelerations[index] = density > 0.0f ? payload.Force / density : float3(0.0f);
+
+				// The kernel deficiency around the free surface lowers the densities of the particles nearby.
+				g_rwMinDensityRatios[index] = payload.MinDensity / g_restDensity;
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Ray intersection
+			//--------------------------------------------------------------------------------------
+			void intersectionMain()
+			{
+				const float thit = GetTHit();
+				const float3 disp = CalculateParticleDisplacement(thit);
+				const float r_sq = dot(disp, disp);
+				const uint hitIndex = PrimitiveIndex();
+				const uint index = DispatchRaysIndex().x;
+				const float h = GetPairSmoothRadius(g_roParticles[index].SmoothRadius, g_roParticles[hitIndex].SmoothRadius);
+
+				if (r_sq < h * h
+					&& index != hitIndex)
+				{
+					const HitAttributes attr = { disp, r_sq, h };
+					ReportHit(thit, /*hitKind*/ 0, attr);
+				}
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Pressure gradient calculation
+			//--------------------------------------------------------------------------------------
+			float3 CalculateGradPressure(float gradScale, float coefScale, float pressure, float adjPressure, float adjDensity, float3 disp) const
+			{
+				const float avgPressure = 0.5f * (adjPressure + pressure);
+				// Implements this equation:
+				// W_spkiey(r, h) = 15 / (pi * h^6) * (h - r)^3
+				// GRAD(W_spikey(r, h)) = -45 / (pi * h^6) * (h - r)^2
+				// g_pressureGradCoef = particleMass * -45.0f / (PI * g_smoothRadius^6)
+				// gradScale = (h - r)^2 / r
+
+				return g_pressureGradCoef * coefScale * avgPressure * gradScale * disp / adjDensity;
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Velocity Laplacian calculation
+			//--------------------------------------------------------------------------------------
+			float3 CalculateVelocityLaplace(float laplaceScale, float coefScale, float3 velocity, float3 adjVelocity, float adjDensity) const
+			{
+				float3 velDisp = (adjVelocity - velocity);
+				// Implements this equation:
+				// W_viscosity(r, h) = 15 / (2 * pi * h^3) * (-r^3 / (2 * h^3) + r^2 / h^2 + h / (2 * r) - 1)
+				// LAPLACIAN(W_viscosity(r, h)) = 45 / (pi * h^6) * (h - r)
+				// g_viscosityLaplaceCoef = particleMass * viscosity * 45.0f / (PI * g_smoothRadius^6)
+				// laplaceScale = h - r
+
+				return g_viscosityLaplaceCoef * coefScale * laplaceScale * velDisp / adjDensity;
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Ray any hit
+			//--------------------------------------------------------------------------------------
+			void anyHitMain(RayPayload& payload, HitAttributes attr)
+			{
+				const uint hitIndex = PrimitiveIndex();
+				const Particle hitParticle = g_roParticles[hitIndex];
+
+				// The kernel table leaves a single rsqrt per pair.
+				float gradScale, laplaceScale;
+				if (g_kernelType != KERNEL_ANALYTIC)
+				{
+					const float3 kernels = LookupKernels(attr.R_sq, attr.H);
+					gradScale = attr.H * attr.H * kernels.y * rsqrt(attr.R_sq);
+					laplaceScale = attr.H * kernels.z;
+				}
+				else
+				{
+					const float r = sqrt(attr.R_sq);
+					const float d = attr.H - r;
+					gradScale = d * d / r;
+					laplaceScale = d;
+				}
+
+				const float hitDensity = g_roDensities[hitIndex];
+				const float hitPressure = CalculatePressure(hitDensity);
+
+				// Both coefficients scale with the mass of the neighbor and 1 / h^6 of the pair.
+				const float hScale = g_smoothRadius / attr.H;
+				const float hScale3 = hScale * hScale * hScale;
+				const float coefScale = hitParticle.MassRatio * hScale3 * hScale3;
+
+				// Pressure term
+				payload.Force += CalculateGradPressure(gradScale, coefScale, payload.Pressure, hitPressure, hitDensity, attr.Disp);
+
+				// Viscosity term
+				payload.Force += CalculateVelocityLaplace(laplaceScale, coefScale, payload.Velocity, hitParticle.Velocity, hitDensity);
+
+				payload.MinDensity = (std::min)(payload.MinDensity, hitDensity);
+
+				IgnoreHit();
+			}
+
+			//--------------------------------------------------------------------------------------
+			// Ray miss
+			//--------------------------------------------------------------------------------------
+			void missMain(RayPayload&)
+			{
+			}
+		};
+	}
+}
@@ -0,0 +1,58 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "RayTracingEmulator.h"
+
+using namespace std;
+using namespace DirectX;
+using namespace RTEmulation;
+
+AccelerationStructure::AccelerationStructure()
+{
+}
+
+AccelerationStructure::~AccelerationStructure()
+{
+}
+
+void AccelerationStructure::Build(const XMFLOAT3* positions, uint32_t numParticles, float extent, bool isHalfHeight)
+{
+	// One particle per cluster, whose inflated AABB is the procedural primitive
+	m_bvh.SetInflationScale(XMFLOAT3(1.0f, 1.0f, isHalfHeight ? 0.5f : 1.0f));
+	m_bvh.Build(positions, numParticles, extent, 1, 0.0f, ParticleBVH::BUILD_LBVH);
+}
+
+const ParticleBVH& AccelerationStructure::GetBVH() const
+{
+	return m_bvh;
+}
+
+bool AccelerationStructure::intersectBox(const RayDesc& ray, float tMax, const XMFLOAT3& boxMin, const XMFLOAT3& boxMax)
+{
+	// Slab test, where the axes the ray is parallel to only need the origin inside
+	const float bMin[] = { boxMin.x, boxMin.y, boxMin.z };
+	const float bMax[] = { boxMax.x, boxMax.y, boxMax.z };
+	auto t0 = ray.TMin, t1 = tMax;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const auto o = ray.Origin[i];
+		const auto d = ray.Direction[i];
+		if (d == 0.0f)
+		{
+			if (o < bMin[i] || o > bMax[i]) return false;
+			continue;
+		}
+
+		const auto invD = 1.0f / d;
+		auto tNear = (bMin[i] - o) * invD;
+		auto tFar = (bMax[i] - o) * invD;
+		if (tNear > tFar) swap(tNear, tFar);
+		t0 = (max)(t0, tNear);
+		t1 = (min)(t1, tFar);
+		if (t0 > t1) return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,335 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include "NeighborStats.h"
+#include "ParticleBVH.h"
+
+// CPU emulation of the DXR procedural-primitive flow used by the neighbor queries, so that the C++
+// ports of the ray tracing shaders run on any machine. TraceRay walks a BLAS of the particle AABBs,
+// calls the intersection shader for each AABB that the ray overlaps within [TMin, TCurrent], and
+// ReportHit runs the any-hit shader, which may call IgnoreHit or AcceptHitAndEndSearch. A hit that
+// is not ignored is committed and shortens the ray, and the miss shader runs if none is committed.
+namespace RTEmulation
+{
+	using uint = uint32_t;
+
+	//--------------------------------------------------------------------------------------
+	// HLSL vector type with the operators used by the shaders
+	//--------------------------------------------------------------------------------------
+	struct float3
+	{
+		float x, y, z;
+
+		float3() = default;
+		float3(float v) : x(v), y(v), z(v) {}
+		float3(float x, float y, float z) : x(x), y(y), z(z) {}
+		float3(const DirectX::XMFLOAT3& v) : x(v.x), y(v.y), z(v.z) {}
+
+		float& operator[](uint32_t i) { return (&x)[i]; }
+		float operator[](uint32_t i) const { return (&x)[i]; }
+
+		float3& operator+=(const float3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+		float3& operator-=(const float3& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+	};
+
+	inline float3 operator+(const float3& a, const float3& b) { return float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+	inline float3 operator-(const float3& a, const float3& b) { return float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+	inline float3 operator*(const float3& a, const float3& b) { return float3(a.x * b.x, a.y * b.y, a.z * b.z); }
+	inline float3 operator/(const float3& a, const float3& b) { return float3(a.x / b.x, a.y / b.y, a.z / b.z); }
+	inline float3 operator*(const float3& a, float s) { return float3(a.x * s, a.y * s, a.z * s); }
+	inline float3 operator*(float s, const float3& a) { return a * s; }
+	inline float3 operator/(const float3& a, float s) { return float3(a.x / s, a.y / s, a.z / s); }
+	inline float dot(const float3& a, const float3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	inline float rsqrt(float v) { return 1.0f / std::sqrt(v); }
+	using std::sqrt;
+
+	// The rays run one after another, so the atomics are plain read-modify-writes.
+	inline void InterlockedMin(uint& dest, uint value) { dest = (std::min)(dest, value); }
+	inline void InterlockedCompareStore(uint& dest, uint compareValue, uint value) { if (dest == compareValue) dest = value; }
+
+	//--------------------------------------------------------------------------------------
+	// Ray
+	//--------------------------------------------------------------------------------------
+	struct RayDesc
+	{
+		float3 Origin;
+		float TMin;
+		float3 Direction;
+		float TMax;
+	};
+
+	enum RayFlag : uint32_t
+	{
+		RAY_FLAG_NONE = 0,
+		RAY_FLAG_SKIP_CLOSEST_HIT_SHADER = 0x8
+	};
+
+	struct TraversalStats
+	{
+		uint64_t NumRays;
+		uint64_t NumBoxTests;		// Nodes and primitive AABBs
+		uint64_t NumIntersections;	// Intersection shader invocations
+		uint64_t NumAnyHits;		// Any-hit shader invocations
+	};
+
+	//--------------------------------------------------------------------------------------
+	// Bottom-level acceleration structure of one AABB per particle
+	//--------------------------------------------------------------------------------------
+	class AccelerationStructure
+	{
+	public:
+		AccelerationStructure();
+		virtual ~AccelerationStructure();
+
+		// The AABB of each particle extends by the same distance, which covers all of its pairs, and
+		// by half of it along z for the half-height AABBs that the z-oriented ray segments need.
+		void Build(const DirectX::XMFLOAT3* positions, uint32_t numParticles, float extent, bool isHalfHeight = false);
+
+		// Call intersect(primitiveIndex) for each AABB overlapped by the ray within [TMin, tCurrent],
+		// where the intersection may shorten tCurrent or set isTerminated.
+		template<typename TFunc>
+		void Traverse(const RayDesc& ray, const float& tCurrent, const bool& isTerminated,
+			const TFunc& intersect, TraversalStats* pStats) const;
+
+		const ParticleBVH& GetBVH() const;
+
+	protected:
+		static bool intersectBox(const RayDesc& ray, float tMax, const DirectX::XMFLOAT3& boxMin, const DirectX::XMFLOAT3& boxMax);
+
+		ParticleBVH m_bvh;
+	};
+
+	//--------------------------------------------------------------------------------------
+	// Base of the C++ ports of the ray tracing shaders, which provides the DXR intrinsics.
+	// TShader implements raygenMain(), intersectionMain(), anyHitMain(payload, attr) and
+	// missMain(payload), the same as the HLSL entries.
+	//--------------------------------------------------------------------------------------
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	class RayTracingShader
+	{
+	public:
+		RayTracingShader();
+		virtual ~RayTracingShader();
+
+		// Run the ray generation shader for each index, one after another. The neighbor stats count
+		// the any-hits of each ray as its neighbors and the intersection calls as its candidates.
+		void DispatchRays(uint32_t width, TraversalStats* pStats = nullptr, NeighborStats* pNeighborStats = nullptr);
+
+	protected:
+		DirectX::XMUINT3 DispatchRaysIndex() const;
+		uint PrimitiveIndex() const;
+		float3 WorldRayOrigin() const;
+		float3 WorldRayDirection() const;
+		float RayTMin() const;
+		float RayTCurrent() const;
+
+		void TraceRay(const AccelerationStructure* pAccelerationStructure, uint rayFlags, uint instanceInclusionMask,
+			uint rayContributionToHitGroupIndex, uint multiplierForGeometryContributionToHitGroupIndex,
+			uint missShaderIndex, const RayDesc& ray, TPayload& payload);
+		bool ReportHit(float tHit, uint hitKind, const THitAttributes& attr);
+
+		// In HLSL, these end the any-hit shader, so they must be its last statements here.
+		void IgnoreHit();
+		void AcceptHitAndEndSearch();
+
+	private:
+		enum HitState : uint8_t
+		{
+			HIT_ACCEPTED,
+			HIT_IGNORED,
+			HIT_ACCEPTED_AND_ENDED
+		};
+
+		TraversalStats*	m_pStats;
+		TPayload*		m_pPayload;
+		RayDesc			m_ray;
+		float			m_tCurrent;
+		uint32_t		m_dispatchIndex;
+		uint32_t		m_primitiveIndex;
+		HitState		m_hitState;
+		bool			m_isCommitted;
+		bool			m_isTerminated;
+	};
+
+	//--------------------------------------------------------------------------------------
+	// Implementations
+	//--------------------------------------------------------------------------------------
+
+	template<typename TFunc>
+	void AccelerationStructure::Traverse(const RayDesc& ray, const float& tCurrent, const bool& isTerminated,
+		const TFunc& intersect, TraversalStats* pStats) const
+	{
+		const auto& nodes = m_bvh.GetNodes();
+		const auto& aabbs = m_bvh.GetClusterAABBs();
+		const auto& indices = m_bvh.GetParticleIndices();
+
+		uint32_t stack[ParticleBVH::StackSize];
+		uint32_t stackSize = 0;
+		uint64_t numBoxTests = 1;
+		if (!nodes.empty() && intersectBox(ray, tCurrent, nodes[0].Min, nodes[0].Max)) stack[stackSize++] = 0;
+
+		while (stackSize > 0 && !isTerminated)
+		{
+			const auto& node = nodes[stack[--stackSize]];
+			if (node.Count > 0)
+			{
+				// A cluster holds a single particle, whose AABB is the procedural primitive.
+				for (auto i = node.Next; i < node.Next + node.Count && !isTerminated; ++i)
+				{
+					++numBoxTests;
+					if (intersectBox(ray, tCurrent, aabbs[i].Min, aabbs[i].Max)) intersect(indices[i]);
+				}
+			}
+			else
+			{
+				numBoxTests += 2;
+				const auto& left = nodes[node.Next];
+				const auto& right = nodes[node.Next + 1];
+				if (intersectBox(ray, tCurrent, right.Min, right.Max)) stack[stackSize++] = node.Next + 1;
+				if (intersectBox(ray, tCurrent, left.Min, left.Max)) stack[stackSize++] = node.Next;
+			}
+		}
+
+		if (pStats) pStats->NumBoxTests += numBoxTests;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	RayTracingShader<TShader, TPayload, THitAttributes>::RayTracingShader() :
+		m_pStats(nullptr),
+		m_pPayload(nullptr),
+		m_ray(),
+		m_tCurrent(0.0f),
+		m_dispatchIndex(0),
+		m_primitiveIndex(0),
+		m_hitState(HIT_ACCEPTED),
+		m_isCommitted(false),
+		m_isTerminated(false)
+	{
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	RayTracingShader<TShader, TPayload, THitAttributes>::~RayTracingShader()
+	{
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	void RayTracingShader<TShader, TPayload, THitAttributes>::DispatchRays(uint32_t width, TraversalStats* pStats,
+		NeighborStats* pNeighborStats)
+	{
+		TraversalStats stats = {};
+		m_pStats = pStats || pNeighborStats ? &stats : nullptr;
+		for (m_dispatchIndex = 0; m_dispatchIndex < width; ++m_dispatchIndex)
+		{
+			const auto prevStats = stats;
+			static_cast<TShader*>(this)->raygenMain();
+			if (pNeighborStats) pNeighborStats->AddQuery(static_cast<uint32_t>(stats.NumAnyHits - prevStats.NumAnyHits),
+				static_cast<uint32_t>(stats.NumIntersections - prevStats.NumIntersections),
+				static_cast<uint32_t>(stats.NumBoxTests - prevStats.NumBoxTests));
+		}
+		m_pStats = nullptr;
+
+		if (pStats)
+		{
+			pStats->NumRays += stats.NumRays;
+			pStats->NumBoxTests += stats.NumBoxTests;
+			pStats->NumIntersections += stats.NumIntersections;
+			pStats->NumAnyHits += stats.NumAnyHits;
+		}
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	DirectX::XMUINT3 RayTracingShader<TShader, TPayload, THitAttributes>::DispatchRaysIndex() const
+	{
+		return DirectX::XMUINT3(m_dispatchIndex, 0, 0);
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	uint RayTracingShader<TShader, TPayload, THitAttributes>::PrimitiveIndex() const
+	{
+		return m_primitiveIndex;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	float3 RayTracingShader<TShader, TPayload, THitAttributes>::WorldRayOrigin() const
+	{
+		return m_ray.Origin;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	float3 RayTracingShader<TShader, TPayload, THitAttributes>::WorldRayDirection() const
+	{
+		return m_ray.Direction;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	float RayTracingShader<TShader, TPayload, THitAttributes>::RayTMin() const
+	{
+		return m_ray.TMin;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	float RayTracingShader<TShader, TPayload, THitAttributes>::RayTCurrent() const
+	{
+		return m_tCurrent;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	void RayTracingShader<TShader, TPayload, THitAttributes>::TraceRay(const AccelerationStructure* pAccelerationStructure,
+		uint, uint, uint, uint, uint, const RayDesc& ray, TPayload& payload)
+	{
+		// The ports have a single hit group and miss shader, and no closest-hit shaders, so the flags
+		// and the indices select nothing.
+		m_ray = ray;
+		m_tCurrent = ray.TMax;
+		m_pPayload = &payload;
+		m_isCommitted = false;
+		m_isTerminated = false;
+		if (m_pStats) ++m_pStats->NumRays;
+
+		const auto pShader = static_cast<TShader*>(this);
+		pAccelerationStructure->Traverse(m_ray, m_tCurrent, m_isTerminated, [&](uint32_t primitiveIndex)
+		{
+			m_primitiveIndex = primitiveIndex;
+			if (m_pStats) ++m_pStats->NumIntersections;
+			pShader->intersectionMain();
+		}, m_pStats);
+
+		if (!m_isCommitted) pShader->missMain(payload);
+		m_pPayload = nullptr;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	bool RayTracingShader<TShader, TPayload, THitAttributes>::ReportHit(float tHit, uint, const THitAttributes& attr)
+	{
+		if (tHit < m_ray.TMin || tHit > m_tCurrent) return false;
+
+		m_hitState = HIT_ACCEPTED;
+		if (m_pStats) ++m_pStats->NumAnyHits;
+		static_cast<TShader*>(this)->anyHitMain(*m_pPayload, attr);
+		if (m_hitState == HIT_IGNORED) return false;
+
+		// Commit the hit
+		m_tCurrent = tHit;
+		m_isCommitted = true;
+		m_isTerminated = m_hitState == HIT_ACCEPTED_AND_ENDED;
+
+		return true;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	void RayTracingShader<TShader, TPayload, THitAttributes>::IgnoreHit()
+	{
+		m_hitState = HIT_IGNORED;
+	}
+
+	template<typename TShader, typename TPayload, typename THitAttributes>
+	void RayTracingShader<TShader, TPayload, THitAttributes>::AcceptHitAndEndSearch()
+	{
+		m_hitState = HIT_ACCEPTED_AND_ENDED;
+	}
+}
@@ -0,0 +1,174 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <DirectXMath.h>
+
+#ifdef _MSC_VER
+#define SPH_INLINE __forceinline
+#else
+#define SPH_INLINE inline __attribute__((always_inline))
+#endif
+
+// Smoothing-kernel families of the CPU solver, which all have the support radius h.
+// Density(r^2) returns W(r), and Gradient(r^2) returns dW/dr / r, so that GRAD_i(W) = Gradient * (x_i - x_j).
+// The values vanish outside the support by clamping, which keeps the inner loops free of branches.
+// N is the number of dimensions (2 or 3), which only changes the normalization coefficients.
+
+// Minimum distance for the gradients with 1 / r, where the displacement is 0 anyway
+static const float KERNEL_MIN_DIST = 1.0e-12f;
+
+//--------------------------------------------------------------------------------------
+// Viscosity Laplacian shared by all the families
+//--------------------------------------------------------------------------------------
+template<uint8_t N>
+struct KernelViscosity
+{
+	explicit KernelViscosity(float h) :
+		m_h(h),
+		m_laplaceCoef(N == 2 ? 40.0f / (DirectX::XM_PI * std::pow(h, 5.0f)) :
+			45.0f / (DirectX::XM_PI * std::pow(h, 6.0f)))
+	{
+	}
+
+	// Implements this equation:
+	// LAPLACIAN(W_viscosity(r, h)) = 45 / (pi * h^6) * (h - r) in 3D, or 40 / (pi * h^5) * (h - r) in 2D
+	SPH_INLINE float ViscosityLaplace(float r_sq) const
+	{
+		return m_laplaceCoef * (std::max)(m_h - std::sqrt(r_sq), 0.0f);
+	}
+
+	float m_h;
+	float m_laplaceCoef;
+};
+
+//--------------------------------------------------------------------------------------
+// Poly6 density and spiky gradient, the same as the GPU solver
+//--------------------------------------------------------------------------------------
+template<uint8_t N>
+struct KernelPoly6Spiky : KernelViscosity<N>
+{
+	explicit KernelPoly6Spiky(float h) :
+		KernelViscosity<N>(h),
+		m_hSq(h * h),
+		m_densityCoef(N == 2 ? 4.0f / (DirectX::XM_PI * std::pow(h, 8.0f)) :
+			315.0f / (64.0f * DirectX::XM_PI * std::pow(h, 9.0f))),
+		m_gradCoef(N == 2 ? -30.0f / (DirectX::XM_PI * std::pow(h, 5.0f)) :
+			-45.0f / (DirectX::XM_PI * std::pow(h, 6.0f)))
+	{
+	}
+
+	// Implements this equation:
+	// W_poly6(r, h) = 315 / (64 * pi * h^9) * (h^2 - r^2)^3 in 3D, or 4 / (pi * h^8) * (h^2 - r^2)^3 in 2D
+	SPH_INLINE float Density(float r_sq) const
+	{
+		const auto d_sq = (std::max)(m_hSq - r_sq, 0.0f);
+
+		return m_densityCoef * d_sq * d_sq * d_sq;
+	}
+
+	// Implements this equation:
+	// dW_spiky(r, h)/dr / r = -45 / (pi * h^6) * (h - r)^2 / r in 3D, or -30 / (pi * h^5) * (h - r)^2 / r in 2D
+	SPH_INLINE float Gradient(float r_sq) const
+	{
+		const auto r = std::sqrt(r_sq);
+		const auto d = (std::max)(this->m_h - r, 0.0f);
+
+		return m_gradCoef * d * d / (std::max)(r, KERNEL_MIN_DIST);
+	}
+
+	float m_hSq;
+	float m_densityCoef;
+	float m_gradCoef;
+};
+
+//--------------------------------------------------------------------------------------
+// Cubic B-spline
+//--------------------------------------------------------------------------------------
+template<uint8_t N>
+struct KernelCubicSpline : KernelViscosity<N>
+{
+	explicit KernelCubicSpline(float h) :
+		KernelViscosity<N>(h),
+		m_invH(1.0f / h),
+		m_densityCoef((N == 2 ? 40.0f / 7.0f : 8.0f) / (DirectX::XM_PI * std::pow(h, static_cast<float>(N)))),
+		m_gradCoef(m_densityCoef / h)
+	{
+	}
+
+	// Implements this equation:
+	// W_cubic(r, h) = sigma * (2 * (1 - q)^3 - 8 * (1 / 2 - q)^3), where q = r / h,
+	// sigma = 8 / (pi * h^3) in 3D or 40 / (7 * pi * h^2) in 2D, and the terms are clamped at 0
+	SPH_INLINE float Density(float r_sq) const
+	{
+		const auto q = std::sqrt(r_sq) * m_invH;
+		const auto a = (std::max)(1.0f - q, 0.0f);
+		const auto b = (std::max)(0.5f - q, 0.0f);
+
+		return m_densityCoef * (2.0f * a * a * a - 8.0f * b * b * b);
+	}
+
+	// Implements this equation:
+	// dW_cubic(r, h)/dr / r = sigma / h * (-6 * (1 - q)^2 + 24 * (1 / 2 - q)^2) / r
+	SPH_INLINE float Gradient(float r_sq) const
+	{
+		const auto r = std::sqrt(r_sq);
+		const auto q = r * m_invH;
+		const auto a = (std::max)(1.0f - q, 0.0f);
+		const auto b = (std::max)(0.5f - q, 0.0f);
+
+		return m_gradCoef * (24.0f * b * b - 6.0f * a * a) / (std::max)(r, KERNEL_MIN_DIST);
+	}
+
+	float m_invH;
+	float m_densityCoef;
+	float m_gradCoef;
+};
+
+//--------------------------------------------------------------------------------------
+// Wendland C4, whose gradient has no singularity at r = 0
+//--------------------------------------------------------------------------------------
+template<uint8_t N>
+struct KernelWendlandC4 : KernelViscosity<N>
+{
+	explicit KernelWendlandC4(float h) :
+		KernelViscosity<N>(h),
+		m_invH(1.0f / h),
+		m_densityCoef((N == 2 ? 9.0f : 495.0f / 32.0f) / (DirectX::XM_PI * std::pow(h, static_cast<float>(N)))),
+		m_gradCoef(-56.0f / 3.0f * m_densityCoef / (h * h))
+	{
+	}
+
+	// Implements this equation:
+	// W_C4(r, h) = sigma * (1 - q)^6 * (1 + 6 * q + 35 / 3 * q^2), where q = r / h,
+	// and sigma = 495 / (32 * pi * h^3) in 3D or 9 / (pi * h^2) in 2D
+	SPH_INLINE float Density(float r_sq) const
+	{
+		const auto q_sq = r_sq * m_invH * m_invH;
+		const auto q = std::sqrt(q_sq);
+		const auto d = (std::max)(1.0f - q, 0.0f);
+		const auto d_sq = d * d;
+
+		return m_densityCoef * d_sq * d_sq * d_sq * (1.0f + 6.0f * q + 35.0f / 3.0f * q_sq);
+	}
+
+	// Implements this equation:
+	// dW_C4(r, h)/dr / r = -56 / 3 * sigma / h^2 * (1 - q)^5 * (1 + 5 * q)
+	SPH_INLINE float Gradient(float r_sq) const
+	{
+		const auto q = std::sqrt(r_sq) * m_invH;
+		const auto d = (std::max)(1.0f - q, 0.0f);
+		const auto d_sq = d * d;
+
+		return m_gradCoef * d_sq * d_sq * d * (1.0f + 5.0f * q);
+	}
+
+	float m_invH;
+	float m_densityCoef;
+	float m_gradCoef;
+};
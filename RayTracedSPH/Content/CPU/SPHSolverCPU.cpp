@@ -0,0 +1,57 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SPHSolverCPU_T.h"
+
+using namespace std;
+
+// Dispatch table of the specialized solvers, indexed by the kernel family and the equation of state
+template<uint8_t N, template<uint8_t> class TKernel, typename TEOS>
+static SPHSolverCPUBase<N>* createSolver()
+{
+	return new SPHSolverCPU_T<N, TKernel<N>, TEOS>;
+}
+
+template<uint8_t N>
+static SPHSolverCPUBase<N>* createSolver(SPHSolverCPUTypes::KernelType kernelType, SPHSolverCPUTypes::EOSType eosType)
+{
+	using CreateSolverFunc = SPHSolverCPUBase<N>* (*)();
+	static const CreateSolverFunc createSolverFuncs[SPHSolverCPUTypes::NUM_KERNEL_TYPE][SPHSolverCPUTypes::NUM_EOS_TYPE] =
+	{
+		{ createSolver<N, KernelPoly6Spiky, EOSTait>, createSolver<N, KernelPoly6Spiky, EOSLinear> },
+		{ createSolver<N, KernelCubicSpline, EOSTait>, createSolver<N, KernelCubicSpline, EOSLinear> },
+		{ createSolver<N, KernelWendlandC4, EOSTait>, createSolver<N, KernelWendlandC4, EOSLinear> }
+	};
+
+	return createSolverFuncs[kernelType][eosType]();
+}
+
+const char* SPHSolverCPUTypes::GetKernelName(KernelType kernelType)
+{
+	static const char* names[] = { "poly6/spiky", "cubic spline", "Wendland C4" };
+
+	return names[kernelType];
+}
+
+const char* SPHSolverCPUTypes::GetEOSName(EOSType eosType)
+{
+	static const char* names[] = { "Tait", "linear" };
+
+	return names[eosType];
+}
+
+template<uint8_t N>
+typename SPHSolverCPUBase<N>::uptr SPHSolverCPUBase<N>::MakeUnique(KernelType kernelType, EOSType eosType)
+{
+	return uptr(createSolver<N>(kernelType, eosType));
+}
+
+template<uint8_t N>
+typename SPHSolverCPUBase<N>::sptr SPHSolverCPUBase<N>::MakeShared(KernelType kernelType, EOSType eosType)
+{
+	return sptr(createSolver<N>(kernelType, eosType));
+}
+
+template class SPHSolverCPUBase<2>;
+template class SPHSolverCPUBase<3>;
@@ -0,0 +1,142 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <DirectXMath.h>
+#include "NearestNeighbors.h"
+#include "NeighborStats.h"
+
+// Vector of the particle attributes, which is XMFLOAT2 for the 2D slices and XMFLOAT3 for the 3D scenes
+template<uint8_t N> struct SPHVector;
+template<> struct SPHVector<2> { using Type = DirectX::XMFLOAT2; };
+template<> struct SPHVector<3> { using Type = DirectX::XMFLOAT3; };
+
+// Options shared by the CPU solvers of all dimensions
+class SPHSolverCPUTypes
+{
+public:
+	enum KernelType : uint8_t
+	{
+		KERNEL_POLY6_SPIKY,
+		KERNEL_CUBIC_SPLINE,
+		KERNEL_WENDLAND_C4,
+
+		NUM_KERNEL_TYPE
+	};
+
+	enum EOSType : uint8_t
+	{
+		EOS_TAIT,
+		EOS_LINEAR,
+
+		NUM_EOS_TYPE
+	};
+
+	enum PeriodicAxis : uint8_t
+	{
+		PERIODIC_X = (1 << 0),
+		PERIODIC_Y = (1 << 1),
+		PERIODIC_Z = (1 << 2)
+	};
+
+	// The deterministic mode is bitwise reproducible regardless of the thread count: the particles are
+	// sorted by ID within each cell, the reductions run in a fixed block order, and nothing is accumulated
+	// with atomics. The fast mode bins the particles with atomics, so their order and the rounding vary.
+	enum ExecutionMode : uint8_t
+	{
+		EXECUTION_FAST,
+		EXECUTION_DETERMINISTIC
+	};
+
+	static const char* GetKernelName(KernelType kernelType);
+	static const char* GetEOSName(EOSType eosType);
+};
+
+// CPU SPH solver in N dimensions, which is specialized at compile time for each combination of the
+// smoothing-kernel family and the equation of state. The combination is chosen once at creation through
+// a dispatch table. The 2D mode shares the same code, with a 9-cell stencil and the walls of a square.
+template<uint8_t N>
+class SPHSolverCPUBase :
+	public SPHSolverCPUTypes
+{
+public:
+	using Vector = typename SPHVector<N>::Type;
+
+	struct Desc
+	{
+		uint32_t NumParticles;
+		float SmoothRadius;
+		float RestDensity;
+		float PressureStiffness;
+		float Viscosity;
+		float WallStiffness;
+		Vector Gravity;
+		Vector DomainMin;
+		Vector DomainMax;
+		Vector FluidMin;		// The initial block of fluid
+		Vector FluidMax;
+		uint8_t PeriodicAxes;
+		ExecutionMode Execution;
+		uint32_t NumThreads;	// 0 for one per hardware thread
+	};
+
+	struct Particle
+	{
+		Vector Pos;
+		Vector Velocity;
+	};
+
+	// Fields interpolated at a probe point, where the pressure and the velocity are normalized by the
+	// kernel-weighted volume of the neighbors, so they do not fade near the free surface
+	struct ProbeSample
+	{
+		float Density;
+		float Pressure;
+		Vector Velocity;
+	};
+
+	virtual ~SPHSolverCPUBase() {};
+
+	virtual bool Init(const Desc& desc) = 0;
+	virtual void Simulate(float timeStep) = 0;
+
+	virtual const Particle* GetParticles() const = 0;
+	virtual const float* GetDensities() const = 0;
+	virtual const uint32_t* GetParticleIds() const = 0;
+	virtual uint32_t GetNumParticles() const = 0;
+
+	// Order-independent hash of the particle states by ID after the last step, for bisecting divergences
+	virtual uint64_t GetChecksum() const = 0;
+	virtual float GetKineticEnergy() const = 0;
+
+	// Interpolate the fields at the points with the kernels of the solver over the neighbor grid of the
+	// last step, in parallel, and write them into the samples of the caller without any staging copy
+	virtual void Probe(const Vector* points, uint32_t numPoints, ProbeSample* samples) = 0;
+
+	// Find the k nearest particles of each point within the max radius, or the particles within the radius
+	// of each point up to the max number, over the neighbor grid of the last step in parallel. Each point has
+	// k or the max number of entries in the neighbors of the caller, and the number found in the counts.
+	// The neighbor indices are those of GetParticles(), at the positions of the density pass.
+	virtual void QueryKNN(const Vector* points, uint32_t numPoints, uint32_t k, float maxRadius,
+		NearestNeighbor* neighbors, uint32_t* counts) = 0;
+	virtual void QueryRadius(const Vector* points, const float* radii, uint32_t numPoints, uint32_t maxNeighbors,
+		NearestNeighbor* neighbors, uint32_t* counts) = 0;
+
+	// Count the neighbors from the next step in the force pass, whose stencil and positions are those of
+	// the density pass, with per-thread counters
+	virtual void EnableNeighborStats(bool enable) = 0;
+	virtual const NeighborStats& GetNeighborStats() const = 0;	// Of the last step
+
+	using uptr = std::unique_ptr<SPHSolverCPUBase>;
+	using sptr = std::shared_ptr<SPHSolverCPUBase>;
+
+	static uptr MakeUnique(KernelType kernelType, EOSType eosType);
+	static sptr MakeShared(KernelType kernelType, EOSType eosType);
+};
+
+using SPHSolverCPU = SPHSolverCPUBase<3>;
+using SPHSolverCPU2D = SPHSolverCPUBase<2>;
@@ -0,0 +1,591 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <cstring>
+#include <vector>
+#include "SPHSolverCPU.h"
+#include "SPHKernels.h"
+#include "EquationOfState.h"
+#include "NeighborGrid.h"
+
+// Work is split into the fixed blocks of particles and cells, so that the deterministic reductions
+// combine the same partial results in the same order regardless of the thread count.
+static const uint32_t SPH_PARTICLE_BLOCK_SIZE = 1024;
+static const uint32_t SPH_CELL_BLOCK_SIZE = 256;
+
+// Vector helpers of the inner loops, which are written out per dimension to keep them fully inlined
+SPH_INLINE float getDisplacement(DirectX::XMFLOAT2& disp, const DirectX::XMFLOAT2& adjPos, const DirectX::XMFLOAT2& offset)
+{
+	disp.x = adjPos.x + offset.x;
+	disp.y = adjPos.y + offset.y;
+
+	return disp.x * disp.x + disp.y * disp.y;
+}
+
+SPH_INLINE float getDisplacement(DirectX::XMFLOAT3& disp, const DirectX::XMFLOAT3& adjPos, const DirectX::XMFLOAT3& offset)
+{
+	disp.x = adjPos.x + offset.x;
+	disp.y = adjPos.y + offset.y;
+	disp.z = adjPos.z + offset.z;
+
+	return disp.x * disp.x + disp.y * disp.y + disp.z * disp.z;
+}
+
+SPH_INLINE void accumulateForce(DirectX::XMFLOAT2& force, float pressureTerm, const DirectX::XMFLOAT2& disp,
+	float viscosityTerm, const DirectX::XMFLOAT2& adjVelocity, const DirectX::XMFLOAT2& velocity)
+{
+	force.x += pressureTerm * disp.x + viscosityTerm * (adjVelocity.x - velocity.x);
+	force.y += pressureTerm * disp.y + viscosityTerm * (adjVelocity.y - velocity.y);
+}
+
+SPH_INLINE void accumulateForce(DirectX::XMFLOAT3& force, float pressureTerm, const DirectX::XMFLOAT3& disp,
+	float viscosityTerm, const DirectX::XMFLOAT3& adjVelocity, const DirectX::XMFLOAT3& velocity)
+{
+	force.x += pressureTerm * disp.x + viscosityTerm * (adjVelocity.x - velocity.x);
+	force.y += pressureTerm * disp.y + viscosityTerm * (adjVelocity.y - velocity.y);
+	force.z += pressureTerm * disp.z + viscosityTerm * (adjVelocity.z - velocity.z);
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+class SPHSolverCPU_T :
+	public SPHSolverCPUBase<N>
+{
+public:
+	using typename SPHSolverCPUBase<N>::Vector;
+	using typename SPHSolverCPUBase<N>::Desc;
+	using typename SPHSolverCPUBase<N>::Particle;
+	using typename SPHSolverCPUBase<N>::ProbeSample;
+
+	SPHSolverCPU_T();
+	virtual ~SPHSolverCPU_T();
+
+	bool Init(const Desc& desc) override;
+	void Simulate(float timeStep) override;
+
+	const Particle* GetParticles() const override;
+	const float* GetDensities() const override;
+	const uint32_t* GetParticleIds() const override;
+	uint32_t GetNumParticles() const override;
+
+	uint64_t GetChecksum() const override;
+	float GetKineticEnergy() const override;
+
+	void Probe(const Vector* points, uint32_t numPoints, ProbeSample* samples) override;
+	void QueryKNN(const Vector* points, uint32_t numPoints, uint32_t k, float maxRadius,
+		NearestNeighbor* neighbors, uint32_t* counts) override;
+	void QueryRadius(const Vector* points, const float* radii, uint32_t numPoints, uint32_t maxNeighbors,
+		NearestNeighbor* neighbors, uint32_t* counts) override;
+
+	void EnableNeighborStats(bool enable) override;
+	const NeighborStats& GetNeighborStats() const override;
+
+protected:
+	using Grid = NeighborGrid<N>;
+
+	void sortParticles();
+	void computeDensities();
+	template<bool IsCounted>
+	void computeAccelerations();
+	void integrate(float timeStep);
+
+	template<typename TFunc>
+	void forEachParticleBlock(const TFunc& func);
+	template<typename TFunc>
+	void forEachCellBlock(const TFunc& func);
+	template<typename TFunc>
+	void forEachCell(const TFunc& func);
+
+	static uint64_t hashParticle(uint32_t id, const Particle& particle);
+
+	std::vector<Particle>	m_particles;
+	std::vector<Particle>	m_sortedParticles;
+	std::vector<uint32_t>	m_particleIds;
+	std::vector<uint32_t>	m_sortedParticleIds;
+	std::vector<Vector>		m_positions;
+	std::vector<float>		m_densities;
+	std::vector<float>		m_pressures;
+	std::vector<Vector>		m_accelerations;
+
+	// Partial reductions per particle block (deterministic mode) or per thread (fast mode)
+	std::vector<float>		m_partialEnergies;
+	std::vector<uint64_t>	m_partialChecksums;
+
+	NeighborStatsCounters	m_neighborStatsCounters;
+	NeighborStats			m_neighborStats;
+
+	Grid					m_grid;
+	ThreadPool				m_threadPool;
+	Desc					m_desc;
+	TKernel					m_kernel;
+	TEOS					m_eos;
+	float					m_mass;
+	float					m_kineticEnergy;
+	uint64_t				m_checksum;
+	bool					m_isNeighborStatsEnabled;
+};
+
+//--------------------------------------------------------------------------------------
+// Implementations
+//--------------------------------------------------------------------------------------
+
+template<uint8_t N, typename TKernel, typename TEOS>
+SPHSolverCPU_T<N, TKernel, TEOS>::SPHSolverCPU_T() :
+	m_neighborStats(),
+	m_desc(),
+	m_kernel(1.0f),
+	m_eos(1.0f, 1.0f),
+	m_mass(0.0f),
+	m_kineticEnergy(0.0f),
+	m_checksum(0),
+	m_isNeighborStatsEnabled(false)
+{
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+SPHSolverCPU_T<N, TKernel, TEOS>::~SPHSolverCPU_T()
+{
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+bool SPHSolverCPU_T<N, TKernel, TEOS>::Init(const Desc& desc)
+{
+	m_desc = desc;
+	m_kernel = TKernel(desc.SmoothRadius);
+	m_eos = TEOS(desc.PressureStiffness, desc.RestDensity);
+
+	if (!m_grid.Init(desc.DomainMin, desc.DomainMax, desc.SmoothRadius, desc.PeriodicAxes)) return false;
+	m_threadPool.Init(desc.NumThreads);
+
+	// Fill the initial block of fluid with a lattice, the same as the GPU solver
+	const auto pFluidMin = &desc.FluidMin.x;
+	const auto pFluidMax = &desc.FluidMax.x;
+	auto dimSize = static_cast<uint32_t>(std::pow(static_cast<float>(desc.NumParticles), 1.0f / N));
+	while (static_cast<uint64_t>(std::pow(static_cast<double>(dimSize), N)) < desc.NumParticles) ++dimSize;
+	m_particles.resize(desc.NumParticles);
+	m_particleIds.resize(desc.NumParticles);
+	for (auto i = 0u; i < desc.NumParticles; ++i)
+	{
+		const auto pPos = &m_particles[i].Pos.x;
+		const auto pVelocity = &m_particles[i].Velocity.x;
+		auto n = i;
+		for (uint8_t a = 0; a < N; ++a)
+		{
+			const auto t = (n % dimSize) / static_cast<float>(dimSize);
+			pPos[a] = pFluidMin[a] + (pFluidMax[a] - pFluidMin[a]) * t;
+			pVelocity[a] = 0.0f;
+			n /= dimSize;
+		}
+		m_particleIds[i] = i;
+	}
+
+	auto fluidVolume = 1.0f;
+	for (uint8_t a = 0; a < N; ++a) fluidVolume *= pFluidMax[a] - pFluidMin[a];
+	m_mass = desc.RestDensity * fluidVolume / desc.NumParticles;
+
+	m_sortedParticles.resize(desc.NumParticles);
+	m_sortedParticleIds.resize(desc.NumParticles);
+	m_positions.resize(desc.NumParticles);
+	m_densities.resize(desc.NumParticles);
+	m_pressures.resize(desc.NumParticles);
+	m_accelerations.resize(desc.NumParticles);
+
+	const auto numBlocks = (desc.NumParticles + SPH_PARTICLE_BLOCK_SIZE - 1) / SPH_PARTICLE_BLOCK_SIZE;
+	const auto numPartials = desc.Execution == SPHSolverCPUTypes::EXECUTION_DETERMINISTIC ? numBlocks : m_threadPool.GetNumThreads();
+	m_partialEnergies.resize(numPartials);
+	m_partialChecksums.resize(numPartials);
+
+	// Bin the lattice for the first step, as the integration does for the later ones
+	m_grid.ResetBins(desc.NumParticles, desc.Execution == SPHSolverCPUTypes::EXECUTION_DETERMINISTIC);
+	forEachParticleBlock([this](uint32_t begin, uint32_t end, uint32_t, uint32_t)
+	{
+		for (auto i = begin; i < end; ++i) m_grid.BinParticle(i, m_particles[i].Pos);
+	});
+
+	return true;
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::Simulate(float timeStep)
+{
+	sortParticles();
+	computeDensities();
+	if (m_isNeighborStatsEnabled) computeAccelerations<true>();
+	else computeAccelerations<false>();
+	integrate(timeStep);
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+const typename SPHSolverCPU_T<N, TKernel, TEOS>::Particle* SPHSolverCPU_T<N, TKernel, TEOS>::GetParticles() const
+{
+	return m_particles.data();
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+const float* SPHSolverCPU_T<N, TKernel, TEOS>::GetDensities() const
+{
+	return m_densities.data();
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+const uint32_t* SPHSolverCPU_T<N, TKernel, TEOS>::GetParticleIds() const
+{
+	return m_particleIds.data();
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+uint32_t SPHSolverCPU_T<N, TKernel, TEOS>::GetNumParticles() const
+{
+	return static_cast<uint32_t>(m_particles.size());
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+uint64_t SPHSolverCPU_T<N, TKernel, TEOS>::GetChecksum() const
+{
+	return m_checksum;
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+float SPHSolverCPU_T<N, TKernel, TEOS>::GetKineticEnergy() const
+{
+	return m_kineticEnergy;
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::Probe(const Vector* points, uint32_t numPoints, ProbeSample* samples)
+{
+	// The grid, positions, densities and pressures are those of the density pass of the last step, with
+	// the velocities after it. Each probe gathers from the stencil of its cell, so the probes are independent.
+	const auto numBlocks = (numPoints + SPH_PARTICLE_BLOCK_SIZE - 1) / SPH_PARTICLE_BLOCK_SIZE;
+	m_threadPool.Run(numBlocks, [&](uint32_t block, uint32_t)
+	{
+		typename Grid::NeighborCell neighborCells[Grid::NumStencilCells];
+		const auto end = (std::min)((block + 1) * SPH_PARTICLE_BLOCK_SIZE, numPoints);
+		for (auto p = block * SPH_PARTICLE_BLOCK_SIZE; p < end; ++p)
+		{
+			const auto pPos = &points[p].x;
+			const auto numNeighborCells = m_grid.GetNeighborCells(m_grid.GetCell(points[p]), neighborCells);
+
+			// Implements this equation:
+			// rho(x) = SUM_j(m * W(x - x_j)), and A(x) = SUM_j(m / rho_j * A_j * W(x - x_j)) / SUM_j(m / rho_j * W(x - x_j))
+			auto density = 0.0f, pressure = 0.0f, volume = 0.0f;
+			Vector velocity = {};
+			const auto pVelocity = &velocity.x;
+			for (auto n = 0u; n < numNeighborCells; ++n)
+			{
+				const auto& cell = neighborCells[n];
+				Vector offset, disp;
+				for (uint8_t a = 0; a < N; ++a) (&offset.x)[a] = (&cell.Shift.x)[a] - pPos[a];
+				for (auto j = cell.Begin; j < cell.End; ++j)
+				{
+					const auto w = m_kernel.Density(getDisplacement(disp, m_positions[j], offset));
+					const auto v = w / m_densities[j];
+					const auto pAdjVelocity = &m_particles[j].Velocity.x;
+					density += w;
+					pressure += v * m_pressures[j];
+					volume += v;
+					for (uint8_t a = 0; a < N; ++a) pVelocity[a] += v * pAdjVelocity[a];
+				}
+			}
+
+			// The mass cancels out in the normalized fields, which are 0 without any neighbor.
+			const auto invVolume = volume > 0.0f ? 1.0f / volume : 0.0f;
+			auto& sample = samples[p];
+			sample.Density = m_mass * density;
+			sample.Pressure = invVolume * pressure;
+			for (uint8_t a = 0; a < N; ++a) (&sample.Velocity.x)[a] = invVolume * pVelocity[a];
+		}
+	});
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::QueryKNN(const Vector* points, uint32_t numPoints, uint32_t k, float maxRadius,
+	NearestNeighbor* neighbors, uint32_t* counts)
+{
+	// The sorted positions of the density pass are in the order of the particles after the last step.
+	const auto numBlocks = (numPoints + SPH_PARTICLE_BLOCK_SIZE - 1) / SPH_PARTICLE_BLOCK_SIZE;
+	m_threadPool.Run(numBlocks, [&](uint32_t block, uint32_t)
+	{
+		const auto end = (std::min)((block + 1) * SPH_PARTICLE_BLOCK_SIZE, numPoints);
+		for (auto p = block * SPH_PARTICLE_BLOCK_SIZE; p < end; ++p)
+			counts[p] = m_grid.QueryKNN(m_positions.data(), points[p], k, maxRadius, &neighbors[static_cast<size_t>(p) * k]);
+	});
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::QueryRadius(const Vector* points, const float* radii, uint32_t numPoints,
+	uint32_t maxNeighbors, NearestNeighbor* neighbors, uint32_t* counts)
+{
+	const auto numBlocks = (numPoints + SPH_PARTICLE_BLOCK_SIZE - 1) / SPH_PARTICLE_BLOCK_SIZE;
+	m_threadPool.Run(numBlocks, [&](uint32_t block, uint32_t)
+	{
+		const auto end = (std::min)((block + 1) * SPH_PARTICLE_BLOCK_SIZE, numPoints);
+		for (auto p = block * SPH_PARTICLE_BLOCK_SIZE; p < end; ++p)
+			counts[p] = m_grid.QueryRadius(m_positions.data(), points[p], radii[p], maxNeighbors,
+				&neighbors[static_cast<size_t>(p) * maxNeighbors]);
+	});
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::EnableNeighborStats(bool enable)
+{
+	m_isNeighborStatsEnabled = enable;
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+const NeighborStats& SPHSolverCPU_T<N, TKernel, TEOS>::GetNeighborStats() const
+{
+	return m_neighborStats;
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::sortParticles()
+{
+	// Reorder the particles by cell, so that the neighbor cells are contiguous in memory, where the
+	// particles are binned by the integration already
+	const auto isDeterministic = m_desc.Execution == SPHSolverCPUTypes::EXECUTION_DETERMINISTIC;
+	const auto& sortedIndices = m_grid.BuildBinned(GetNumParticles(), m_threadPool,
+		isDeterministic ? m_particleIds.data() : nullptr);
+
+	forEachParticleBlock([&](uint32_t begin, uint32_t end, uint32_t, uint32_t)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			m_sortedParticles[i] = m_particles[sortedIndices[i]];
+			m_sortedParticleIds[i] = m_particleIds[sortedIndices[i]];
+			m_positions[i] = m_sortedParticles[i].Pos;
+		}
+	});
+
+	m_particles.swap(m_sortedParticles);
+	m_particleIds.swap(m_sortedParticleIds);
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::computeDensities()
+{
+	forEachCell([this](uint32_t c, typename Grid::NeighborCell* neighborCells, uint32_t)
+	{
+		const auto numNeighborCells = m_grid.GetNeighborCells(c, neighborCells);
+		for (auto i = m_grid.GetCellBegin(c); i < m_grid.GetCellEnd(c); ++i)
+		{
+			const auto pPos = &m_positions[i].x;
+
+			// Branch-free inner loop, where the kernel vanishes outside the support
+			auto density = 0.0f;
+			for (auto n = 0u; n < numNeighborCells; ++n)
+			{
+				const auto& cell = neighborCells[n];
+				Vector offset, disp;
+				for (uint8_t a = 0; a < N; ++a) (&offset.x)[a] = (&cell.Shift.x)[a] - pPos[a];
+				for (auto j = cell.Begin; j < cell.End; ++j)
+					density += m_kernel.Density(getDisplacement(disp, m_positions[j], offset));
+			}
+
+			m_densities[i] = m_mass * density;
+			m_pressures[i] = m_eos.Pressure(m_densities[i]);
+		}
+	});
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+template<bool IsCounted>
+void SPHSolverCPU_T<N, TKernel, TEOS>::computeAccelerations()
+{
+	// The counted variant is a separate instance, so the counters cost nothing when they are off. The
+	// neighbors are counted here rather than in the density pass, as both passes gather from the same
+	// stencil over the same positions, and the compare is a small share of the force of a pair. Each block
+	// of cells tallies into its own stats on the stack and merges them into the slot of its thread once,
+	// and the candidates and the stencil, which the particles of a cell share, are added once per cell.
+	if (IsCounted) m_neighborStatsCounters.Reset(m_threadPool.GetNumThreads());
+	const auto supportSq = m_desc.SmoothRadius * m_desc.SmoothRadius;
+
+	forEachCellBlock([this, supportSq](uint32_t cellBegin, uint32_t cellEnd, uint32_t thread)
+	{
+		typename Grid::NeighborCell neighborCells[Grid::NumStencilCells];
+		NeighborStats blockStats;
+		if (IsCounted) blockStats.Reset();
+
+		for (auto c = cellBegin; c < cellEnd; ++c)
+		{
+			const auto begin = m_grid.GetCellBegin(c);
+			const auto end = m_grid.GetCellEnd(c);
+			if (begin == end) continue;
+
+			const auto numNeighborCells = m_grid.GetNeighborCells(c, neighborCells);
+			for (auto i = begin; i < end; ++i)
+			{
+				const auto pPos = &m_positions[i].x;
+				const auto& velocity = m_particles[i].Velocity;
+				const auto pressure = m_pressures[i];
+
+				// Implements this equation:
+				// f_i = SUM_j(m * (p_i + p_j) / (2 * rho_j) * dW/dr / r * (x_j - x_i))
+				//     + SUM_j(m * mu * (v_j - v_i) / rho_j * LAPLACIAN(W_viscosity))
+				// The self term vanishes with the zero displacement and velocity difference.
+				Vector force = {};
+				uint32_t numNeighbors = 0;
+				for (auto n = 0u; n < numNeighborCells; ++n)
+				{
+					const auto& cell = neighborCells[n];
+					Vector offset, disp;
+					for (uint8_t a = 0; a < N; ++a) (&offset.x)[a] = (&cell.Shift.x)[a] - pPos[a];
+					for (auto j = cell.Begin; j < cell.End; ++j)
+					{
+						const auto r_sq = getDisplacement(disp, m_positions[j], offset);
+						const auto invAdjDensity = 1.0f / m_densities[j];
+
+						const auto pressureTerm = 0.5f * (pressure + m_pressures[j]) * invAdjDensity * m_kernel.Gradient(r_sq);
+						const auto viscosityTerm = m_desc.Viscosity * invAdjDensity * m_kernel.ViscosityLaplace(r_sq);
+						accumulateForce(force, pressureTerm, disp, viscosityTerm, m_particles[j].Velocity, velocity);
+						if (IsCounted) numNeighbors += r_sq < supportSq ? 1 : 0;
+					}
+				}
+
+				const auto scale = m_mass / m_densities[i];
+				const auto pForce = &force.x;
+				const auto pAcceleration = &m_accelerations[i].x;
+				for (uint8_t a = 0; a < N; ++a) pAcceleration[a] = scale * pForce[a];
+				if (IsCounted) blockStats.AddNeighbors(numNeighbors);
+			}
+
+			if (IsCounted)
+			{
+				auto numCandidates = 0u;
+				for (auto n = 0u; n < numNeighborCells; ++n) numCandidates += neighborCells[n].End - neighborCells[n].Begin;
+				blockStats.AddQueries(end - begin, numCandidates, numNeighborCells);
+			}
+		}
+
+		if (IsCounted) m_neighborStatsCounters.GetThreadStats(thread).Merge(blockStats);
+	});
+
+	if (IsCounted) m_neighborStatsCounters.Reduce(m_neighborStats);
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+void SPHSolverCPU_T<N, TKernel, TEOS>::integrate(float timeStep)
+{
+	const auto pMin = &m_desc.DomainMin.x;
+	const auto pMax = &m_desc.DomainMax.x;
+	const auto pGravity = &m_desc.Gravity.x;
+	const auto isDeterministic = m_desc.Execution == SPHSolverCPUTypes::EXECUTION_DETERMINISTIC;
+
+	std::fill(m_partialEnergies.begin(), m_partialEnergies.end(), 0.0f);
+	std::fill(m_partialChecksums.begin(), m_partialChecksums.end(), 0ull);
+
+	// The cells of the last step stay valid for the queries, while the particles are binned anew.
+	m_grid.ResetBins(GetNumParticles(), isDeterministic);
+
+	forEachParticleBlock([&](uint32_t begin, uint32_t end, uint32_t block, uint32_t thread)
+	{
+		auto energy = 0.0f;
+		auto checksum = 0ull;
+		for (auto i = begin; i < end; ++i)
+		{
+			auto& particle = m_particles[i];
+			const auto pAcceleration = &m_accelerations[i].x;
+			const auto pPos = &particle.Pos.x;
+			const auto pVelocity = &particle.Velocity.x;
+
+			for (uint8_t a = 0; a < N; ++a)
+			{
+				const auto isPeriodic = (m_desc.PeriodicAxes >> a) & 1;
+
+				// Apply the penalty force from the walls, which are open along the periodic axes
+				auto acceleration = pAcceleration[a] + pGravity[a];
+				if (!isPeriodic)
+					acceleration += m_desc.WallStiffness * ((std::max)(pMin[a] - pPos[a], 0.0f) - (std::max)(pPos[a] - pMax[a], 0.0f));
+
+				// Integrate
+				pVelocity[a] += timeStep * acceleration;
+				pPos[a] += timeStep * pVelocity[a];
+
+				// Wrap into the periodic domain
+				if (isPeriodic)
+				{
+					const auto size = pMax[a] - pMin[a];
+					pPos[a] -= std::floor((pPos[a] - pMin[a]) / size) * size;
+				}
+
+				energy += 0.5f * m_mass * pVelocity[a] * pVelocity[a];
+			}
+
+			// Bin the particle for the next step while it is in the cache.
+			m_grid.BinParticle(i, particle.Pos);
+
+			// The wrapping sum of the hashes by ID does not depend on the particle order.
+			checksum += hashParticle(m_particleIds[i], particle);
+		}
+
+		// Each block owns its partial result in the deterministic mode, and the thread accumulates its blocks
+		// in the fast mode, where the block-to-thread assignment varies from run to run.
+		const auto partial = isDeterministic ? block : thread;
+		m_partialEnergies[partial] += energy;
+		m_partialChecksums[partial] += checksum;
+	});
+
+	// Fixed-order reductions
+	m_kineticEnergy = 0.0f;
+	m_checksum = 0;
+	for (const auto& energy : m_partialEnergies) m_kineticEnergy += energy;
+	for (const auto& checksum : m_partialChecksums) m_checksum += checksum;
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+template<typename TFunc>
+void SPHSolverCPU_T<N, TKernel, TEOS>::forEachParticleBlock(const TFunc& func)
+{
+	const auto numParticles = GetNumParticles();
+	const auto numBlocks = (numParticles + SPH_PARTICLE_BLOCK_SIZE - 1) / SPH_PARTICLE_BLOCK_SIZE;
+	m_threadPool.Run(numBlocks, [&](uint32_t block, uint32_t thread)
+	{
+		const auto begin = block * SPH_PARTICLE_BLOCK_SIZE;
+		func(begin, (std::min)(begin + SPH_PARTICLE_BLOCK_SIZE, numParticles), block, thread);
+	});
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+template<typename TFunc>
+void SPHSolverCPU_T<N, TKernel, TEOS>::forEachCellBlock(const TFunc& func)
+{
+	// Each particle gathers from its neighbors, so the cells are independent of each other.
+	const auto numCells = m_grid.GetNumCells();
+	const auto numBlocks = (numCells + SPH_CELL_BLOCK_SIZE - 1) / SPH_CELL_BLOCK_SIZE;
+	m_threadPool.Run(numBlocks, [&](uint32_t block, uint32_t thread)
+	{
+		func(block * SPH_CELL_BLOCK_SIZE, (std::min)((block + 1) * SPH_CELL_BLOCK_SIZE, numCells), thread);
+	});
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+template<typename TFunc>
+void SPHSolverCPU_T<N, TKernel, TEOS>::forEachCell(const TFunc& func)
+{
+	forEachCellBlock([&](uint32_t cellBegin, uint32_t cellEnd, uint32_t thread)
+	{
+		typename Grid::NeighborCell neighborCells[Grid::NumStencilCells];
+		for (auto c = cellBegin; c < cellEnd; ++c)
+			if (m_grid.GetCellBegin(c) < m_grid.GetCellEnd(c)) func(c, neighborCells, thread);
+	});
+}
+
+template<uint8_t N, typename TKernel, typename TEOS>
+uint64_t SPHSolverCPU_T<N, TKernel, TEOS>::hashParticle(uint32_t id, const Particle& particle)
+{
+	// Mix the bits of the ID and the particle state (MurmurHash3 finalizer)
+	uint32_t words[sizeof(Particle) / sizeof(uint32_t)];
+	std::memcpy(words, &particle, sizeof(Particle));
+
+	auto hash = 0x9E3779B97F4A7C15ull * (id + 1ull);
+	for (const auto& word : words)
+	{
+		hash ^= word;
+		hash *= 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 33;
+	}
+
+	return hash;
+}
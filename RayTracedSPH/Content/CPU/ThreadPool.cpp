@@ -0,0 +1,97 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool() :
+	m_pFunc(nullptr),
+	m_numTasks(0),
+	m_nextTask(0),
+	m_numBusyWorkers(0),
+	m_generation(0),
+	m_isQuitting(false)
+{
+}
+
+ThreadPool::~ThreadPool()
+{
+	Init(1);
+}
+
+void ThreadPool::Init(uint32_t numThreads)
+{
+	// Stop the previous workers
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_isQuitting = true;
+	}
+	m_startCondition.notify_all();
+	for (auto& worker : m_workers) worker.join();
+	m_workers.clear();
+	m_isQuitting = false;
+
+	// The calling thread is thread 0.
+	if (numThreads == 0) numThreads = (max)(thread::hardware_concurrency(), 1u);
+	for (auto i = 1u; i < numThreads; ++i) m_workers.emplace_back(&ThreadPool::workerMain, this, i, m_generation);
+}
+
+void ThreadPool::Run(uint32_t numTasks, const TaskFunc& func)
+{
+	if (m_workers.empty() || numTasks <= 1)
+	{
+		for (auto i = 0u; i < numTasks; ++i) func(i, 0);
+
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_pFunc = &func;
+		m_numTasks = numTasks;
+		m_nextTask = 0;
+		m_numBusyWorkers = static_cast<uint32_t>(m_workers.size());
+		++m_generation;
+	}
+	m_startCondition.notify_all();
+
+	runTasks(0);
+
+	unique_lock<mutex> lock(m_mutex);
+	m_doneCondition.wait(lock, [this]() { return m_numBusyWorkers == 0; });
+	m_pFunc = nullptr;
+}
+
+uint32_t ThreadPool::GetNumThreads() const
+{
+	return static_cast<uint32_t>(m_workers.size() + 1);
+}
+
+void ThreadPool::workerMain(uint32_t thread, uint64_t generation)
+{
+	while (true)
+	{
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_startCondition.wait(lock, [&]() { return m_isQuitting || m_generation != generation; });
+			if (m_isQuitting) return;
+			generation = m_generation;
+		}
+
+		runTasks(thread);
+
+		{
+			lock_guard<mutex> lock(m_mutex);
+			--m_numBusyWorkers;
+		}
+		m_doneCondition.notify_one();
+	}
+}
+
+void ThreadPool::runTasks(uint32_t thread)
+{
+	for (auto task = m_nextTask++; task < m_numTasks; task = m_nextTask++) (*m_pFunc)(task, thread);
+}
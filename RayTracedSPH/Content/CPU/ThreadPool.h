@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads of the CPU solver. Run() hands out the tasks dynamically to the workers
+// and the calling thread, and returns when all of them are done, so a task must not depend on which
+// thread runs it unless the results are combined in a fixed order.
+class ThreadPool
+{
+public:
+	using TaskFunc = std::function<void(uint32_t task, uint32_t thread)>;
+
+	ThreadPool();
+	virtual ~ThreadPool();
+
+	// 0 threads means one per hardware thread
+	void Init(uint32_t numThreads);
+	void Run(uint32_t numTasks, const TaskFunc& func);
+
+	uint32_t GetNumThreads() const;
+
+protected:
+	void workerMain(uint32_t thread, uint64_t generation);
+	void runTasks(uint32_t thread);
+
+	std::vector<std::thread>	m_workers;
+	std::mutex					m_mutex;
+	std::condition_variable		m_startCondition;
+	std::condition_variable		m_doneCondition;
+
+	const TaskFunc*				m_pFunc;
+	uint32_t					m_numTasks;
+	std::atomic<uint32_t>		m_nextTask;
+	uint32_t					m_numBusyWorkers;
+	uint64_t					m_generation;
+	bool						m_isQuitting;
+};
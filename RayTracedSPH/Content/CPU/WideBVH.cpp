@@ -0,0 +1,124 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "WideBVH.h"
+
+using namespace std;
+using namespace DirectX;
+
+static float getArea(const ParticleBVH::Node& node)
+{
+	const auto x = node.Max.x - node.Min.x, y = node.Max.y - node.Min.y, z = node.Max.z - node.Min.z;
+
+	return x * y + y * z + z * x;
+}
+
+template<uint8_t W>
+WideBVH<W>::WideBVH() :
+	m_pBVH(nullptr)
+{
+}
+
+template<uint8_t W>
+WideBVH<W>::~WideBVH()
+{
+}
+
+template<uint8_t W>
+void WideBVH<W>::Collapse(const ParticleBVH& bvh)
+{
+	m_pBVH = &bvh;
+	const auto& binaryNodes = bvh.GetNodes();
+
+	m_nodes.clear();
+	m_nodes.reserve(binaryNodes.size() / (W - 1) + 1);
+	m_nodes.emplace_back();
+
+	// Each task fills a wide node with the children of a binary interior node. A root leaf, or the empty
+	// root that no query overlaps, is the single child of the wide root.
+	struct Task { uint32_t BinaryNode, WideNode; };
+	vector<Task> tasks(1, { 0, 0 });
+	while (!tasks.empty())
+	{
+		const auto task = tasks.back();
+		tasks.pop_back();
+
+		// Open the largest interior child until there are W children
+		uint32_t children[W];
+		uint32_t numChildren = 0;
+		const auto& binaryNode = binaryNodes[task.BinaryNode];
+		if (binaryNode.Count > 0 || bvh.GetNumClusters() == 0) children[numChildren++] = task.BinaryNode;
+		else
+		{
+			children[numChildren++] = binaryNode.Next;
+			children[numChildren++] = binaryNode.Next + 1;
+		}
+
+		while (numChildren < W)
+		{
+			auto largest = UINT32_MAX;
+			auto largestArea = -1.0f;
+			for (auto i = 0u; i < numChildren; ++i)
+			{
+				const auto& child = binaryNodes[children[i]];
+				if (child.Count == 0 && getArea(child) > largestArea)
+				{
+					largest = i;
+					largestArea = getArea(child);
+				}
+			}
+			if (largest == UINT32_MAX) break;
+
+			const auto next = binaryNodes[children[largest]].Next;
+			children[largest] = next;
+			children[numChildren++] = next + 1;
+		}
+
+		// Empty slots have inverted bounds.
+		for (uint8_t i = 0; i < W; ++i)
+		{
+			const auto& child = binaryNodes[i < numChildren ? children[i] : 0];
+			const auto isEmpty = i >= numChildren || bvh.GetNumClusters() == 0;
+			uint32_t childNode = 0;
+			if (!isEmpty && child.Count == 0)
+			{
+				// Interior child
+				childNode = static_cast<uint32_t>(m_nodes.size());
+				m_nodes.emplace_back();
+				tasks.push_back({ children[i], childNode });
+			}
+
+			auto& node = m_nodes[task.WideNode];
+			node.MinX[i] = isEmpty ? FLT_MAX : child.Min.x;
+			node.MinY[i] = isEmpty ? FLT_MAX : child.Min.y;
+			node.MinZ[i] = isEmpty ? FLT_MAX : child.Min.z;
+			node.MaxX[i] = isEmpty ? -FLT_MAX : child.Max.x;
+			node.MaxY[i] = isEmpty ? -FLT_MAX : child.Max.y;
+			node.MaxZ[i] = isEmpty ? -FLT_MAX : child.Max.z;
+			node.Children[i] = isEmpty ? 0 : (child.Count > 0 ? child.Next : childNode);
+			node.Counts[i] = isEmpty ? 0 : child.Count;
+		}
+	}
+}
+
+template<uint8_t W>
+const vector<typename WideBVH<W>::Node>& WideBVH<W>::GetNodes() const
+{
+	return m_nodes;
+}
+
+template<uint8_t W>
+const ParticleBVH* WideBVH<W>::GetBVH() const
+{
+	return m_pBVH;
+}
+
+template<uint8_t W>
+size_t WideBVH<W>::GetMemorySize() const
+{
+	return sizeof(Node) * m_nodes.size();
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,139 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <immintrin.h>
+#include "ParticleBVH.h"
+
+// W-wide BVH collapsed from the binary particle BVH, for the CPU traversal that takes the place of
+// the hardware traversal of TraceRay. The child bounds of each node are stored in SoA, so a point
+// query tests all the W children at once, with SSE for BVH4 and AVX for BVH8. The leaves keep
+// referring to the clusters of the binary BVH, which must outlive it.
+template<uint8_t W>
+class WideBVH
+{
+public:
+	struct Node
+	{
+		float MinX[W];
+		float MinY[W];
+		float MinZ[W];
+		float MaxX[W];
+		float MaxY[W];
+		float MaxZ[W];
+		uint32_t Children[W];	// Wide node for an interior child, or the first cluster for a leaf
+		uint32_t Counts[W];		// Number of clusters, 0 for an interior child or an empty slot
+	};
+
+	WideBVH();
+	virtual ~WideBVH();
+
+	void Collapse(const ParticleBVH& bvh);
+
+	// Call func(particleIndex, r_sq) for each particle within the radius of the point, counted in the
+	// neighbor stats if any, as ParticleBVH::Query does
+	template<typename TFunc>
+	void Query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats = nullptr,
+		NeighborStats* pNeighborStats = nullptr) const;
+
+	const std::vector<Node>& GetNodes() const;
+	const ParticleBVH* GetBVH() const;
+	size_t GetMemorySize() const;	// Of the wide nodes only, since the clusters are shared
+
+	// A visited node pushes up to W - 1 more nodes than it pops.
+	static const uint32_t StackSize = ParticleBVH::StackSize * (W - 1);
+
+protected:
+	template<typename TFunc>
+	void query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats) const;
+	uint32_t testChildren(const Node& node, const DirectX::XMFLOAT3& pos) const;
+
+	std::vector<Node>		m_nodes;
+	const ParticleBVH*		m_pBVH;
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+//--------------------------------------------------------------------------------------
+// Implementations
+//--------------------------------------------------------------------------------------
+
+template<uint8_t W>
+template<typename TFunc>
+void WideBVH<W>::Query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats,
+	NeighborStats* pNeighborStats) const
+{
+	if (pNeighborStats) ParticleBVH::CountQuery(func, pStats, *pNeighborStats,
+		[&](const auto& countedFunc, ParticleBVH::QueryStats* pQueryStats) { query(pos, countedFunc, pQueryStats); });
+	else query(pos, func, pStats);
+}
+
+template<uint8_t W>
+template<typename TFunc>
+void WideBVH<W>::query(const DirectX::XMFLOAT3& pos, const TFunc& func, ParticleBVH::QueryStats* pStats) const
+{
+	uint32_t stack[StackSize];
+	uint32_t stackSize = 0;
+	uint64_t nodesVisited = 0, clustersTested = 0;
+	if (!m_nodes.empty()) stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const auto& node = m_nodes[stack[--stackSize]];
+		++nodesVisited;
+
+		// The AABBs are inflated by the radius, so a child is a candidate if it contains the point.
+		for (auto mask = testChildren(node, pos); mask; mask &= mask - 1)
+		{
+			auto i = 0u;
+			while (!((mask >> i) & 1)) ++i;
+
+			const auto count = node.Counts[i];
+			if (count > 0)
+			{
+				for (auto j = 0u; j < count; ++j) m_pBVH->TestCluster(node.Children[i] + j, pos, func);
+				clustersTested += count;
+			}
+			else stack[stackSize++] = node.Children[i];
+		}
+	}
+
+	if (pStats)
+	{
+		pStats->NodesVisited += nodesVisited;
+		pStats->ClustersTested += clustersTested;
+		pStats->ParticlesTested += clustersTested * m_pBVH->GetClusterSize();
+	}
+}
+
+template<>
+inline uint32_t WideBVH<4>::testChildren(const Node& node, const DirectX::XMFLOAT3& pos) const
+{
+	const auto px = _mm_set1_ps(pos.x);
+	const auto py = _mm_set1_ps(pos.y);
+	const auto pz = _mm_set1_ps(pos.z);
+	const auto inX = _mm_and_ps(_mm_cmpge_ps(px, _mm_loadu_ps(node.MinX)), _mm_cmple_ps(px, _mm_loadu_ps(node.MaxX)));
+	const auto inY = _mm_and_ps(_mm_cmpge_ps(py, _mm_loadu_ps(node.MinY)), _mm_cmple_ps(py, _mm_loadu_ps(node.MaxY)));
+	const auto inZ = _mm_and_ps(_mm_cmpge_ps(pz, _mm_loadu_ps(node.MinZ)), _mm_cmple_ps(pz, _mm_loadu_ps(node.MaxZ)));
+
+	return _mm_movemask_ps(_mm_and_ps(_mm_and_ps(inX, inY), inZ));
+}
+
+template<>
+inline uint32_t WideBVH<8>::testChildren(const Node& node, const DirectX::XMFLOAT3& pos) const
+{
+	const auto px = _mm256_set1_ps(pos.x);
+	const auto py = _mm256_set1_ps(pos.y);
+	const auto pz = _mm256_set1_ps(pos.z);
+	const auto inX = _mm256_and_ps(_mm256_cmp_ps(px, _mm256_loadu_ps(node.MinX), _CMP_GE_OQ),
+		_mm256_cmp_ps(px, _mm256_loadu_ps(node.MaxX), _CMP_LE_OQ));
+	const auto inY = _mm256_and_ps(_mm256_cmp_ps(py, _mm256_loadu_ps(node.MinY), _CMP_GE_OQ),
+		_mm256_cmp_ps(py, _mm256_loadu_ps(node.MaxY), _CMP_LE_OQ));
+	const auto inZ = _mm256_and_ps(_mm256_cmp_ps(pz, _mm256_loadu_ps(node.MinZ), _CMP_GE_OQ),
+		_mm256_cmp_ps(pz, _mm256_loadu_ps(node.MaxZ), _CMP_LE_OQ));
+
+	return _mm256_movemask_ps(_mm256_and_ps(_mm256_and_ps(inX, inY), inZ));
+}
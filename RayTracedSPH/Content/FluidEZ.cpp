@@ -27,6 +27,19 @@ const float INIT_PARTICLE_VOLUME_CENTER[] =
 };
 const float PARTICLE_REST_DENSITY = 1000.0f;
 const float PARTICLE_SMOOTH_RADIUS = POOL_VOLUME_DIM / POOL_SPACE_DIVISION;
+const uint8_t PBF_NUM_ITERATIONS = 4;
+const float PARTICLE_SLEEP_SPEED = 0.05f;
+const float PARTICLE_SLEEP_ACCELERATION = 2.0f;
+const uint32_t PARTICLE_SLEEP_STEPS = 32;
+const float ADAPTIVE_MAX_MASS_RATIO = 8.0f;
+const float ADAPTIVE_SPLIT_DENSITY_RATIO = 0.85f;
+const float ADAPTIVE_MERGE_DENSITY_RATIO = 0.95f;
+const float VARIABLE_MIN_SMOOTH_RADIUS_RATIO = 0.8f;
+const float VARIABLE_MAX_SMOOTH_RADIUS_RATIO = 2.0f;
+const float VARIABLE_SMOOTH_RADIUS_RELAXATION = 0.25f;
+const uint32_t POOL_COMPACTION_PERIOD = 64;
+const float SDF_VOXEL_SIZE = 0.5f * PARTICLE_SMOOTH_RADIUS;
+const float SDF_BAND_WIDTH = 8.0f * PARTICLE_SMOOTH_RADIUS;
 
 struct CBSimulation
 {
@@ -38,7 +51,30 @@ struct CBSimulation
 	float ViscosityLaplaceCoef;
 	float WallStiffness;
 	uint32_t NumParticles; // Padding
-	XMFLOAT4 Planes[6];
+	XMFLOAT3 SDFOrigin;
+	float SDFInvVoxelSize;
+	XMFLOAT3 SDFAtlasInvSize;
+	float SDFBandWidth;
+	XMUINT3 SDFNumBricks;
+	float PBFRelaxation;
+	float PBFTensileK;
+	float PBFTensileInvDq;
+	float XSPHViscosity;
+	float SleepSpeedSq;
+	float SleepAccelerationSq;
+	uint32_t SleepSteps;
+	float MaxSmoothRadius;
+	float MaxMassRatio;
+	float SplitDensityRatio;
+	float MergeDensityRatio;
+	float SplitWallDist;
+	float MergeWallDist;
+	uint32_t DispatchRaysArgOffset;
+	XMFLOAT3 PeriodMin;
+	XMFLOAT3 PeriodSize;
+	uint32_t PeriodicAxes;
+	float MinSmoothRadius;
+	float SmoothRadiusRelaxation;
 };
 
 struct CBVisualization
@@ -50,12 +86,22 @@ struct CBPerFrame
 {
 	float TimeStep;
 	XMFLOAT3 Gravity;
+	XMFLOAT3 EmitterPos;
+	float EmitterRadius;
+	XMFLOAT3 EmitterVelocity;
+	uint32_t EmitCount;
+	XMFLOAT3 SinkMin;
+	uint32_t EmitSeed;
+	XMFLOAT3 SinkMax;
+	uint32_t KernelType;
 };
 
 struct Particle
 {
 	XMFLOAT3 Pos;
 	XMFLOAT3 Velocity;
+	float MassRatio;
+	float SmoothRadius;
 };
 
 struct ParticleAABB
@@ -65,7 +111,27 @@ struct ParticleAABB
 };
 
 FluidEZ::FluidEZ() :
-	m_instances()
+	m_instances(),
+	m_solverType(SOLVER_SPH),
+	m_timeStep(0.0f),
+	m_gravity(0.0f, 0.0f, 0.0f),
+	m_pParticleCounts(nullptr),
+	m_isSleepingEnabled(true),
+	m_wakeUpAll(true),
+	m_isAdaptive(false),
+	m_isSmoothRadiusVariable(false),
+	m_periodicAxes(0),
+	m_kernelType(KERNEL_ANALYTIC),
+	m_emitterPos(0.0f, 0.0f, 0.0f),
+	m_emitterVelocity(0.0f, -1.0f, 0.0f),
+	m_emitterRadius(0.0f),
+	m_emitRate(0.0f),
+	m_emitAccumulator(0.0f),
+	m_emitCount(0),
+	m_emitSeed(0),
+	m_sinkMin(FLT_MAX, FLT_MAX, FLT_MAX),
+	m_sinkMax(-FLT_MAX, -FLT_MAX, -FLT_MAX),
+	m_stepCount(0)
 {
 	m_shaderLib = ShaderLib::MakeUnique();
 }
@@ -75,27 +141,101 @@ FluidEZ::~FluidEZ()
 }
 
 bool FluidEZ::Init(RayTracing::EZ::CommandList* pCommandList, uint32_t width, uint32_t height,
-	vector<Resource::uptr>& uploaders, uint32_t numParticles)
+	vector<Resource::uptr>& uploaders, SolverType solverType, bool isAdaptive,
+	const wchar_t* boundaryMeshFileName, const wchar_t* obstacleMeshFileName, uint32_t numParticles,
+	uint32_t poolSize, uint8_t periodicAxes, bool isSmoothRadiusVariable)
 {
 	const auto pDevice = pCommandList->GetRTDevice();
 
 	m_viewport.x = static_cast<float>(width);
 	m_viewport.y = static_cast<float>(height);
-	m_numParticles = numParticles;
+	m_solverType = solverType;
+	m_isAdaptive = isAdaptive && solverType == SOLVER_SPH;
+	m_isSmoothRadiusVariable = isSmoothRadiusVariable && solverType == SOLVER_SPH;
+	m_periodicAxes = periodicAxes;
+	m_numInitParticles = numParticles;
+
+	// The SPH solver keeps the particles in a pool with spare free slots for the emitters.
+	m_numParticles = solverType == SOLVER_SPH ? (max)(numParticles, poolSize) : numParticles;
+
+	// Create the boundary SDF from the container mesh
+	m_boundary = make_unique<SDFBoundary>();
+	XUSG_N_RETURN(m_boundary->Init(pCommandList->AsCommandList(), uploaders,
+		SDF_VOXEL_SIZE, SDF_BAND_WIDTH, boundaryMeshFileName), false);
+
+	// Build the static BVH of the obstacle triangles
+	m_obstacles = make_unique<ObstacleBVH>();
+	XUSG_N_RETURN(m_obstacles->Init(pCommandList->AsCommandList(), uploaders, obstacleMeshFileName), false);
 
 	// Create resources with data upload
 	createParticleBuffers(pCommandList, uploaders);
 	createConstBuffers(pCommandList, uploaders);
+	XUSG_N_RETURN(createKernelTable(pCommandList, uploaders), false);
 
-	// Create density buffer
-	m_densityBuffer = TypedBuffer::MakeUnique();
-	XUSG_N_RETURN(m_densityBuffer->Create(pDevice, m_numParticles, sizeof(float), Format::R32_FLOAT,
-		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+	if (m_solverType == SOLVER_PBF)
+	{
+		// Create predicted particle buffer
+		m_predParticleBuffer = StructuredBuffer::MakeUnique();
+		XUSG_N_RETURN(m_predParticleBuffer->Create(pDevice, m_numParticles, sizeof(Particle),
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		// Create lambda buffer
+		m_lambdaBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_lambdaBuffer->Create(pDevice, m_numParticles, sizeof(float), Format::R32_FLOAT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		// Create position correction buffer
+		m_deltaPosBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_deltaPosBuffer->Create(pDevice, m_numParticles, sizeof(float[4]), Format::R32G32B32A32_FLOAT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+	}
+	else
+	{
+		// Create density buffer
+		m_densityBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_densityBuffer->Create(pDevice, m_numParticles, sizeof(float), Format::R32_FLOAT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		// Create the number density buffer, which the density pass writes for the variable smoothing radii
+		m_numberDensityBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_numberDensityBuffer->Create(pDevice, m_numParticles, sizeof(float), Format::R32_FLOAT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		// Create particle Acceleration buffer
+		m_accelerationBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_accelerationBuffer->Create(pDevice, m_numParticles, sizeof(uint16_t[4]), Format::R16G16B16A16_FLOAT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		// Create sleep counter buffer
+		m_sleepCounterBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_sleepCounterBuffer->Create(pDevice, m_numParticles, sizeof(uint32_t), Format::R32_UINT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		// Create active and alive particle counters and their read-back buffer with a slot per frame
+		m_particleCountBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_particleCountBuffer->Create(pDevice, 2, sizeof(uint32_t), Format::R32_UINT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		m_readBuffer = Buffer::MakeUnique();
+		XUSG_N_RETURN(m_readBuffer->Create(pDevice, sizeof(uint32_t[2][FrameCount]), ResourceFlag::DENY_SHADER_RESOURCE,
+			MemoryType::READBACK, 0, nullptr, 0, nullptr, MemoryFlag::NONE, L"ReadBuffer"), false);
+		m_pParticleCounts = static_cast<const uint32_t*>(m_readBuffer->Map(nullptr));
+
+		// Create the buffer of the minimum density ratios in the neighborhoods for detecting the free surface
+		m_minDensityRatioBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_minDensityRatioBuffer->Create(pDevice, m_numParticles, sizeof(float), Format::R32_FLOAT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+		XUSG_N_RETURN(createParticlePool(pCommandList, uploaders), false);
+	}
 
-	// Create particle Acceleration buffer
-	m_accelerationBuffer = TypedBuffer::MakeUnique();
-	XUSG_N_RETURN(m_accelerationBuffer->Create(pDevice, m_numParticles, sizeof(uint16_t[4]), Format::R16G16B16A16_FLOAT,
-		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+	if (m_isAdaptive)
+	{
+		// Create merge partner buffer
+		m_partnerBuffer = TypedBuffer::MakeUnique();
+		XUSG_N_RETURN(m_partnerBuffer->Create(pDevice, m_numParticles, sizeof(uint32_t), Format::R32_UINT,
+			ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+	}
 
 	XUSG_N_RETURN(buildAccelerationStructures(pCommandList), false);
 	XUSG_N_RETURN(pCommandList->CreatePipelineLayouts(nullptr, nullptr,
@@ -108,9 +248,29 @@ bool FluidEZ::Init(RayTracing::EZ::CommandList* pCommandList, uint32_t width, ui
 void FluidEZ::UpdateFrame(uint8_t frameIndex, float timeStep, CXMMATRIX viewProj, CXMVECTOR viewY)
 {
 	const auto gravity = -9.8f * viewY;
+	m_timeStep = timeStep;
+
+	// Settled particles are no longer at rest once the gravity turns.
+	if (!XMVector3NearEqual(gravity, XMLoadFloat3(&m_gravity), XMVectorReplicate(1.0e-4f))) m_wakeUpAll = true;
+	XMStoreFloat3(&m_gravity, gravity);
+
+	// Particles to emit in this step
+	m_emitAccumulator += m_emitRate * timeStep;
+	m_emitCount = static_cast<uint32_t>(m_emitAccumulator);
+	m_emitAccumulator -= m_emitCount;
+
 	const auto pCbPerFrame = static_cast<CBPerFrame*>(m_cbPerFrame->Map(frameIndex));
 	pCbPerFrame->TimeStep = timeStep;
 	XMStoreFloat3(&pCbPerFrame->Gravity, gravity);
+	pCbPerFrame->EmitterPos = m_emitterPos;
+	pCbPerFrame->EmitterRadius = m_emitterRadius;
+	pCbPerFrame->EmitterVelocity = m_emitterVelocity;
+	pCbPerFrame->EmitCount = m_emitCount;
+	pCbPerFrame->SinkMin = m_sinkMin;
+	pCbPerFrame->EmitSeed = m_emitSeed;
+	pCbPerFrame->SinkMax = m_sinkMax;
+	pCbPerFrame->KernelType = m_kernelType;
+	m_emitSeed += m_emitCount;
 
 	const auto pCbVisualization = static_cast<CBVisualization*>(m_cbVisualization->Map(frameIndex));
 	XMStoreFloat4x4(&pCbVisualization->ViewProj, XMMatrixTranspose(viewProj));
@@ -125,11 +285,8 @@ void FluidEZ::Render(RayTracing::EZ::CommandList* pCommandList, uint8_t frameInd
 
 void FluidEZ::Simulate(RayTracing::EZ::CommandList* pCommandList, uint8_t frameIndex)
 {
-	pCommandList->BuildBLAS(m_bottomLevelAS.get());
-	pCommandList->BuildTLAS(m_topLevelAS.get(), m_instances.get());
-
-	// Set TLAS
-	pCommandList->SetTopLevelAccelerationStructure(0, m_topLevelAS.get());
+	// PBF derives velocities from position changes, so a zero time step (paused) is skipped.
+	if (m_solverType == SOLVER_PBF && m_timeStep <= 0.0f) return;
 
 	// Set CBV
 	const XUSG::EZ::ResourceView cbvs[] =
@@ -139,9 +296,60 @@ void FluidEZ::Simulate(RayTracing::EZ::CommandList* pCommandList, uint8_t frameI
 	};
 	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::CBV, 0, static_cast<uint32_t>(size(cbvs)), cbvs);
 
-	computeDensity(pCommandList);
-	computeAcceleration(pCommandList);
-	integrate(pCommandList);
+	// PBF searches neighbors around the predicted positions
+	if (m_solverType == SOLVER_PBF) predictPositions(pCommandList);
+
+	pCommandList->BuildBLAS(m_bottomLevelAS.get());
+	pCommandList->BuildTLAS(m_topLevelAS.get(), m_instances.get());
+
+	// Set TLAS
+	pCommandList->SetTopLevelAccelerationStructure(0, m_topLevelAS.get());
+
+	if (m_solverType == SOLVER_PBF)
+	{
+		// Jacobi iterations of the density constraints
+		for (uint8_t i = 0; i < PBF_NUM_ITERATIONS; ++i)
+		{
+			computeLambdas(pCommandList);
+			computeDeltaPositions(pCommandList);
+			updatePositions(pCommandList);
+		}
+
+		applyViscosity(pCommandList);
+	}
+	else
+	{
+		// Only the live slots up to the high-water mark are dispatched.
+		updateDispatchArgs(pCommandList);
+
+		// Wake up all particles
+		const uint32_t clear[4] = {};
+		if (m_wakeUpAll || !m_isSleepingEnabled)
+			pCommandList->ClearUnorderedAccessViewUint(XUSG::EZ::GetUAV(m_sleepCounterBuffer.get()), clear);
+		pCommandList->ClearUnorderedAccessViewUint(XUSG::EZ::GetUAV(m_particleCountBuffer.get()), clear);
+		pCommandList->ClearUnorderedAccessViewUint(XUSG::EZ::GetUAV(m_aliveMaskBuffer.get()), clear);
+		m_wakeUpAll = false;
+
+		computeDensity(pCommandList);
+		computeAcceleration(pCommandList);
+		integrate(pCommandList);
+
+		// Merge interior particles in pairs, and split those near the free surface and the walls
+		if (m_isAdaptive)
+		{
+			pairParticles(pCommandList);
+			mergeParticles(pCommandList);
+			splitParticles(pCommandList);
+		}
+
+		// Emit particles into the free slots, and periodically compact the live particles
+		if (m_emitCount > 0) emitParticles(pCommandList);
+		if (++m_stepCount % POOL_COMPACTION_PERIOD == 0) compactParticles(pCommandList);
+
+		// Read back the active and the alive particle counts
+		pCommandList->CopyBufferRegion(m_readBuffer.get(), sizeof(uint32_t[2]) * frameIndex,
+			m_particleCountBuffer.get(), 0, sizeof(uint32_t[2]));
+	}
 }
 
 void FluidEZ::Visualize(RayTracing::EZ::CommandList* pCommandList, uint8_t frameIndex,
@@ -178,6 +386,53 @@ void FluidEZ::Visualize(RayTracing::EZ::CommandList* pCommandList, uint8_t frame
 	pCommandList->Draw(m_numParticles, 1, 0, 0);
 }
 
+void FluidEZ::EnableSleeping(bool enable)
+{
+	m_isSleepingEnabled = enable;
+}
+
+void FluidEZ::SetKernelType(KernelType kernelType)
+{
+	m_kernelType = kernelType;
+}
+
+void FluidEZ::SetEmitter(const XMFLOAT3& pos, const XMFLOAT3& velocity, float radius, float rate)
+{
+	m_emitterPos = pos;
+	m_emitterVelocity = velocity;
+	m_emitterRadius = radius;
+	m_emitRate = rate;
+}
+
+void FluidEZ::SetSink(const XMFLOAT3& minPt, const XMFLOAT3& maxPt)
+{
+	m_sinkMin = minPt;
+	m_sinkMax = maxPt;
+}
+
+uint32_t FluidEZ::GetNumParticles() const
+{
+	return m_numParticles;
+}
+
+uint32_t FluidEZ::GetNumActiveParticles(uint8_t frameIndex) const
+{
+	// The slot is valid once the GPU has completed the frame.
+	return m_pParticleCounts ? m_pParticleCounts[2 * frameIndex] : m_numParticles;
+}
+
+uint32_t FluidEZ::GetNumAliveParticles(uint8_t frameIndex) const
+{
+	// The slot is valid once the GPU has completed the frame.
+	return m_pParticleCounts ? m_pParticleCounts[2 * frameIndex + 1] : m_numParticles;
+}
+
+size_t FluidEZ::GetBVHMemorySize() const
+{
+	// The driver-reported sizes of the acceleration structures, excluding the AABB inputs and the scratch
+	return m_bottomLevelAS->GetResultDataMaxByteSize() + m_topLevelAS->GetResultDataMaxByteSize();
+}
+
 bool FluidEZ::createParticleBuffers(RayTracing::EZ::CommandList* pCommandList, vector<Resource::uptr>& uploaders)
 {
 	const auto pDevice = pCommandList->GetDevice();
@@ -187,9 +442,12 @@ bool FluidEZ::createParticleBuffers(RayTracing::EZ::CommandList* pCommandList, v
 	vector<ParticleAABB> particleAABBs(m_numParticles);
 
 	const auto smoothRadius = PARTICLE_SMOOTH_RADIUS;
-	const auto dimSize = static_cast<uint32_t>(ceil(std::cbrt(m_numParticles)));
+	const auto maxSmoothRadius = smoothRadius * (m_isAdaptive ? cbrt(ADAPTIVE_MAX_MASS_RATIO) : 1.0f) *
+		(m_isSmoothRadiusVariable ? VARIABLE_MAX_SMOOTH_RADIUS_RATIO : 1.0f);
+	const auto aabbExtent = 0.5f * (smoothRadius + maxSmoothRadius);
+	const auto dimSize = static_cast<uint32_t>(ceil(std::cbrt(m_numInitParticles)));
 	const auto slcSize = dimSize * dimSize;
-	for (auto i = 0u; i < m_numParticles; ++i)
+	for (auto i = 0u; i < m_numInitParticles; ++i)
 	{
 		const auto n = i % slcSize;
 		auto x = (n % dimSize) / static_cast<float>(dimSize);
@@ -201,21 +459,32 @@ bool FluidEZ::createParticleBuffers(RayTracing::EZ::CommandList* pCommandList, v
 
 		particles[i].Pos = XMFLOAT3(x, y, z);
 		particles[i].Velocity = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		particles[i].MassRatio = 1.0f;
+		particles[i].SmoothRadius = smoothRadius;
 
 		// AABB
-		particleAABBs[i].Min.x = x - smoothRadius;
-		particleAABBs[i].Max.x = x + smoothRadius;
-		particleAABBs[i].Min.y = y - smoothRadius;
-		particleAABBs[i].Max.y = y + smoothRadius;
+		particleAABBs[i].Min.x = x - aabbExtent;
+		particleAABBs[i].Max.x = x + aabbExtent;
+		particleAABBs[i].Min.y = y - aabbExtent;
+		particleAABBs[i].Max.y = y + aabbExtent;
 #if POINT_QUERY
-		particleAABBs[i].Min.z = z - smoothRadius;
-		particleAABBs[i].Max.z = z + smoothRadius;
+		particleAABBs[i].Min.z = z - aabbExtent;
+		particleAABBs[i].Max.z = z + aabbExtent;
 #else
-		particleAABBs[i].Min.z = z - smoothRadius * 0.5f;
-		particleAABBs[i].Max.z = z + smoothRadius * 0.5f;
+		particleAABBs[i].Min.z = z - aabbExtent * 0.5f;
+		particleAABBs[i].Max.z = z + aabbExtent * 0.5f;
 #endif
 	}
 
+	// The spare slots of the pool are dead, and their AABBs are inactive in the BVH.
+	for (auto i = m_numInitParticles; i < m_numParticles; ++i)
+	{
+		particles[i] = {};
+		particleAABBs[i].Min.x = particleAABBs[i].Max.x = NAN;
+		particleAABBs[i].Min.y = particleAABBs[i].Max.y = NAN;
+		particleAABBs[i].Min.z = particleAABBs[i].Max.z = NAN;
+	}
+
 	// Create particle buffer
 	m_particleBuffer = StructuredBuffer::MakeUnique();
 	XUSG_N_RETURN(m_particleBuffer->Create(pDevice, m_numParticles, sizeof(Particle),
@@ -240,6 +509,109 @@ bool FluidEZ::createParticleBuffers(RayTracing::EZ::CommandList* pCommandList, v
 	return true;
 }
 
+bool FluidEZ::createParticlePool(RayTracing::EZ::CommandList* pCommandList, vector<Resource::uptr>& uploaders)
+{
+	const auto pDevice = pCommandList->GetDevice();
+
+	// Create the free list of the particle slots, where the spare slots are pushed in the descending order
+	// so that the lowest ones are acquired first.
+	const auto numFreeSlots = m_numParticles - m_numInitParticles;
+	vector<uint32_t> freeList(m_numParticles);
+	for (auto i = 0u; i < numFreeSlots; ++i) freeList[i] = m_numParticles - 1 - i;
+
+	m_freeListBuffer = TypedBuffer::MakeUnique();
+	XUSG_N_RETURN(m_freeListBuffer->Create(pDevice, m_numParticles, sizeof(uint32_t), Format::R32_UINT,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_freeListBuffer->Upload(pCommandList->AsCommandList(), uploaders.back().get(),
+		freeList.data(), sizeof(uint32_t) * m_numParticles), false);
+
+	// Create the free count and the high-water mark of the live slots
+	const uint32_t poolCounts[] = { numFreeSlots, m_numInitParticles };
+	m_poolCountBuffer = TypedBuffer::MakeUnique();
+	XUSG_N_RETURN(m_poolCountBuffer->Create(pDevice, 2, sizeof(uint32_t), Format::R32_UINT,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_poolCountBuffer->Upload(pCommandList->AsCommandList(), uploaders.back().get(),
+		poolCounts, sizeof(poolCounts)), false);
+
+	// Create alive mask with a bit per slot, and the prefix sums of its words for the stream compaction
+	const auto numMaskWords = XUSG_DIV_UP(m_numParticles, GROUP_SIZE) * (GROUP_SIZE / 32);
+	m_aliveMaskBuffer = TypedBuffer::MakeUnique();
+	XUSG_N_RETURN(m_aliveMaskBuffer->Create(pDevice, numMaskWords, sizeof(uint32_t), Format::R32_UINT,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+	m_wordOffsetBuffer = TypedBuffer::MakeUnique();
+	XUSG_N_RETURN(m_wordOffsetBuffer->Create(pDevice, numMaskWords, sizeof(uint32_t), Format::R32_UINT,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+	// Create the compaction targets
+	m_compactParticleBuffer = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_compactParticleBuffer->Create(pDevice, m_numParticles, sizeof(Particle),
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+	m_compactSleepCounterBuffer = TypedBuffer::MakeUnique();
+	XUSG_N_RETURN(m_compactSleepCounterBuffer->Create(pDevice, m_numParticles, sizeof(uint32_t), Format::R32_UINT,
+		ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT), false);
+
+	// Create indirect dispatch arguments, a compute dispatch followed by the ray dispatches
+	m_dispatchArgBuffer = TypedBuffer::MakeUnique();
+	XUSG_N_RETURN(m_dispatchArgBuffer->Create(pDevice, (NUM_RT_DISPATCHES + 1) * DISPATCH_ARG_STRIDE / sizeof(uint32_t),
+		sizeof(uint32_t), Format::R32_UINT, ResourceFlag::ALLOW_UNORDERED_ACCESS, MemoryType::DEFAULT,
+		1, nullptr, 1, nullptr, MemoryFlag::NONE, L"DispatchArgs"), false);
+
+	IndirectArgument arg = {};
+	arg.Type = IndirectArgumentType::DISPATCH;
+	m_dispatchLayout = CommandLayout::MakeUnique();
+	XUSG_N_RETURN(m_dispatchLayout->Create(pDevice, sizeof(uint32_t[3]), 1, &arg), false);
+
+	arg.Type = IndirectArgumentType::DISPATCH_RAYS;
+	m_dispatchRaysLayout = CommandLayout::MakeUnique();
+	XUSG_N_RETURN(m_dispatchRaysLayout->Create(pDevice, DISPATCH_ARG_STRIDE, 1, &arg), false);
+
+	return true;
+}
+
+bool FluidEZ::createKernelTable(RayTracing::EZ::CommandList* pCommandList, vector<Resource::uptr>& uploaders)
+{
+	// Tabulate the kernels against q^2 = r^2 / h^2, where the values are scaled to the units of the analytic
+	// poly6, spiky and viscosity kernels so that the coefficients are shared.
+	vector<XMFLOAT4> kernels(KERNEL_TABLE_SIZE * NUM_KERNEL_TABLES);
+	for (auto i = 0u; i < KERNEL_TABLE_SIZE; ++i)
+	{
+		const auto q_sq = i / static_cast<float>(KERNEL_TABLE_SIZE - 1);
+		const auto q = sqrt(q_sq);
+		const auto d = 1.0f - q;
+		const auto d_sq = 1.0f - q_sq;
+
+		// Poly6 and spiky
+		kernels[i] = XMFLOAT4(d_sq * d_sq * d_sq, d * d, d, 0.0f);
+
+		// Wendland C4, with the viscosity Laplacian unchanged
+		// Implements this equation:
+		// W_C4(r, h) = 495 / (32 * pi * h^3) * (1 - q)^6 * (1 + 6 * q + 35 / 3 * q^2)
+		// GRAD(W_C4(r, h)) = -495 / (32 * pi * h^4) * 56 / 3 * q * (1 - q)^5 * (1 + 5 * q)
+		// The scales to poly6 and spiky are 22 / 7 and 77 / 12, respectively.
+		const auto d5 = d * d * d * d * d;
+		kernels[KERNEL_TABLE_SIZE + i] = XMFLOAT4(22.0f / 7.0f * d5 * d * (1.0f + 6.0f * q + 35.0f / 3.0f * q_sq),
+			77.0f / 12.0f * q * d5 * (1.0f + 5.0f * q), d, 0.0f);
+	}
+
+	// Create the kernel table texture with a row per kernel family, which is 4 KB each
+	m_kernelTable = Texture::MakeUnique();
+	XUSG_N_RETURN(m_kernelTable->Create(pCommandList->GetDevice(), KERNEL_TABLE_SIZE, NUM_KERNEL_TABLES,
+		Format::R32G32B32A32_FLOAT, 1, ResourceFlag::NONE, 1, 1, false, MemoryFlag::NONE, L"KernelTable"), false);
+
+	SubresourceData subresource;
+	subresource.pData = kernels.data();
+	subresource.RowPitch = sizeof(XMFLOAT4) * KERNEL_TABLE_SIZE;
+	subresource.SlicePitch = subresource.RowPitch * NUM_KERNEL_TABLES;
+	uploaders.emplace_back(Resource::MakeUnique());
+
+	return m_kernelTable->Upload(pCommandList->AsCommandList(), uploaders.back().get(), &subresource, 1,
+		ResourceState::NON_PIXEL_SHADER_RESOURCE);
+}
+
 bool FluidEZ::createConstBuffers(RayTracing::EZ::CommandList* pCommandList, vector<Resource::uptr>& uploaders)
 {
 	const auto pDevice = pCommandList->GetDevice();
@@ -262,19 +634,61 @@ bool FluidEZ::createConstBuffers(RayTracing::EZ::CommandList* pCommandList, vect
 		cbSimulation.RestDensity = PARTICLE_REST_DENSITY;
 		cbSimulation.WallStiffness = 3000.0f;
 		cbSimulation.NumParticles = m_numParticles;
-		cbSimulation.Planes[0] = XMFLOAT4(0.0f, 1.0f, 0.0f, 0.0f);
-		cbSimulation.Planes[1] = XMFLOAT4(0.0f, -1.0f, 0.0f, POOL_VOLUME_DIM);
-		cbSimulation.Planes[2] = XMFLOAT4(1.0f, 0.0f, 0.0f, 0.5f * POOL_VOLUME_DIM);
-		cbSimulation.Planes[3] = XMFLOAT4(-1.0f, 0.0f, 0.0f, 0.5f * POOL_VOLUME_DIM);
-		cbSimulation.Planes[4] = XMFLOAT4(0.0f, 0.0f, 1.0f, 0.5f * POOL_VOLUME_DIM);
-		cbSimulation.Planes[5] = XMFLOAT4(0.0f, 0.0f, -1.0f, 0.5f * POOL_VOLUME_DIM);
+
+		// Boundary SDF
+		cbSimulation.SDFOrigin = m_boundary->GetOrigin();
+		cbSimulation.SDFInvVoxelSize = 1.0f / m_boundary->GetVoxelSize();
+		cbSimulation.SDFAtlasInvSize = m_boundary->GetAtlasInvSize();
+		cbSimulation.SDFBandWidth = m_boundary->GetBandWidth();
+		cbSimulation.SDFNumBricks = m_boundary->GetNumBricks();
+
+		// Periodic boundaries wrap the container bounds.
+		XMFLOAT3 boundsMin, boundsMax;
+		m_boundary->GetBounds(boundsMin, boundsMax);
+		cbSimulation.PeriodMin = boundsMin;
+		cbSimulation.PeriodSize = XMFLOAT3(boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z);
+		cbSimulation.PeriodicAxes = m_periodicAxes;
 
 		const float initVolume = INIT_PARTICLE_VOLUME_DIM * INIT_PARTICLE_VOLUME_DIM * INIT_PARTICLE_VOLUME_DIM;
-		const float mass = cbSimulation.RestDensity * initVolume / m_numParticles;
+		const float mass = cbSimulation.RestDensity * initVolume / m_numInitParticles;
 		const float viscosity = 0.4f;
 		cbSimulation.DensityCoef = mass * 315.0f / (64.0f * XM_PI * pow(cbSimulation.SmoothRadius, 9.0f));
 		cbSimulation.PressureGradCoef = mass * -45.0f / (XM_PI * pow(cbSimulation.SmoothRadius, 6.0f));
 		cbSimulation.ViscosityLaplaceCoef = mass * viscosity * 45.0f / (XM_PI * pow(cbSimulation.SmoothRadius, 6.0f));
+
+		// Position based fluids
+		// The relaxation and the tensile strength are scaled to the magnitude of lambda
+		// (in m^2) for the default particle spacing.
+		const float tensileDq = 0.2f * cbSimulation.SmoothRadius;
+		cbSimulation.PBFRelaxation = 1.0e4f;
+		cbSimulation.PBFTensileK = 1.0e-7f;
+		cbSimulation.PBFTensileInvDq = 1.0f / (cbSimulation.SmoothRadius * cbSimulation.SmoothRadius - tensileDq * tensileDq);
+		cbSimulation.XSPHViscosity = 0.01f;
+
+		// Sleeping particles
+		cbSimulation.SleepSpeedSq = PARTICLE_SLEEP_SPEED * PARTICLE_SLEEP_SPEED;
+		cbSimulation.SleepAccelerationSq = PARTICLE_SLEEP_ACCELERATION * PARTICLE_SLEEP_ACCELERATION;
+		cbSimulation.SleepSteps = PARTICLE_SLEEP_STEPS;
+
+		// Adaptive particle resolution
+		// Particles are kept at the finest level within 2 (maximum) smoothing radii from the walls,
+		// and the margin of hysteresis avoids splitting and merging back and forth.
+		cbSimulation.MaxMassRatio = m_isAdaptive ? ADAPTIVE_MAX_MASS_RATIO : 1.0f;
+		const auto maxMassSmoothRadius = cbSimulation.SmoothRadius * cbrt(cbSimulation.MaxMassRatio);
+		cbSimulation.SplitDensityRatio = ADAPTIVE_SPLIT_DENSITY_RATIO;
+		cbSimulation.MergeDensityRatio = ADAPTIVE_MERGE_DENSITY_RATIO;
+		cbSimulation.SplitWallDist = 2.0f * maxMassSmoothRadius;
+		cbSimulation.MergeWallDist = 3.0f * maxMassSmoothRadius;
+
+		// Variable smoothing radii
+		// The radii follow the local number density, from slightly below the initial radius up to twice the
+		// mass-based maximum, which bounds the AABB extents in the BLAS, so the sparse spray keeps its neighbors.
+		cbSimulation.MaxSmoothRadius = maxMassSmoothRadius * (m_isSmoothRadiusVariable ? VARIABLE_MAX_SMOOTH_RADIUS_RATIO : 1.0f);
+		cbSimulation.MinSmoothRadius = cbSimulation.SmoothRadius * (m_isSmoothRadiusVariable ? VARIABLE_MIN_SMOOTH_RADIUS_RATIO : 1.0f);
+		cbSimulation.SmoothRadiusRelaxation = m_isSmoothRadiusVariable ? VARIABLE_SMOOTH_RADIUS_RELAXATION : 0.0f;
+
+		// Particle pool
+		cbSimulation.DispatchRaysArgOffset = static_cast<uint32_t>(pCommandList->GetDispatchRaysArgReservedOffset());
 	}
 
 	// Upload data to cbuffer
@@ -297,6 +711,33 @@ bool FluidEZ::createShaders()
 	XUSG_X_RETURN(m_shaders[CS_INTEGRATE], m_shaderLib->CreateShader(
 		Shader::Stage::CS, csIndex++, L"CSIntegrate.cso"), false);
 
+	XUSG_X_RETURN(m_shaders[CS_PBF_PREDICT], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSPBFPredict.cso"), false);
+	XUSG_X_RETURN(m_shaders[RT_PBF_LAMBDA], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"RTPBFLambda.cso"), false);
+	XUSG_X_RETURN(m_shaders[RT_PBF_DELTA_POS], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"RTPBFDeltaPos.cso"), false);
+	XUSG_X_RETURN(m_shaders[CS_PBF_UPDATE], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSPBFUpdate.cso"), false);
+	XUSG_X_RETURN(m_shaders[RT_PBF_VISCOSITY], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"RTPBFViscosity.cso"), false);
+
+	XUSG_X_RETURN(m_shaders[RT_PAIR_PARTICLES], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"RTPairParticles.cso"), false);
+	XUSG_X_RETURN(m_shaders[CS_MERGE_PARTICLES], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSMergeParticles.cso"), false);
+	XUSG_X_RETURN(m_shaders[CS_SPLIT_PARTICLES], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSSplitParticles.cso"), false);
+
+	XUSG_X_RETURN(m_shaders[CS_EMIT_PARTICLES], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSEmitParticles.cso"), false);
+	XUSG_X_RETURN(m_shaders[CS_SCAN_ALIVE_MASK], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSScanAliveMask.cso"), false);
+	XUSG_X_RETURN(m_shaders[CS_COMPACT_PARTICLES], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSCompactParticles.cso"), false);
+	XUSG_X_RETURN(m_shaders[CS_UPDATE_DISPATCH_ARGS], m_shaderLib->CreateShader(
+		Shader::Stage::CS, csIndex++, L"CSUpdateDispatchArgs.cso"), false);
+
 	XUSG_X_RETURN(m_shaders[VS_DRAW_PARTICLES], m_shaderLib->CreateShader(
 		Shader::Stage::VS, vsIndex++, L"VSDrawParticles.cso"), false);
 	XUSG_X_RETURN(m_shaders[PS_DRAW_PARTICLES], m_shaderLib->CreateShader(
@@ -345,19 +786,25 @@ void FluidEZ::computeDensity(RayTracing::EZ::CommandList* pCommandList)
 	static const wchar_t* shaderNames[] = { RaygenShaderName, IntersectionShaderName, AnyHitShaderName, MissShaderName };
 	pCommandList->RTSetShaderLibrary(0, m_shaders[RT_DENSITY], static_cast<uint32_t>(size(shaderNames)), shaderNames);
 	pCommandList->RTSetHitGroup(0, HitGroupName, nullptr, AnyHitShaderName, IntersectionShaderName, HitGroupType::PROCEDURAL_PRIMITIVE);
-	pCommandList->RTSetShaderConfig(sizeof(float), sizeof(float));
+	pCommandList->RTSetShaderConfig(sizeof(float[4]), sizeof(float[2]));
 	pCommandList->RTSetMaxRecursionDepth(1);
 
-	// Set UAV
-	const auto uav = XUSG::EZ::GetUAV(m_densityBuffer.get());
-	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+	// Set UAVs
+	const XUSG::EZ::ResourceView uavs[] =
+	{
+		XUSG::EZ::GetUAV(m_densityBuffer.get()),
+		XUSG::EZ::GetUAV(m_sleepCounterBuffer.get()),
+		XUSG::EZ::GetUAV(m_numberDensityBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
 
 	// Set SRV
 	const auto srv = XUSG::EZ::GetSRV(m_particleBuffer.get());
 	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
+	setKernelTable(pCommandList);
 
 	// Dispatch command
-	pCommandList->DispatchRays(m_numParticles, 1, 1, RaygenShaderName, &MissShaderName, 1);
+	dispatchRaysIndirect(pCommandList, 0);
 }
 
 void FluidEZ::computeAcceleration(RayTracing::EZ::CommandList* pCommandList)
@@ -366,23 +813,29 @@ void FluidEZ::computeAcceleration(RayTracing::EZ::CommandList* pCommandList)
 	static const void* shaders[] = { RaygenShaderName, IntersectionShaderName, AnyHitShaderName, MissShaderName };
 	pCommandList->RTSetShaderLibrary(0, m_shaders[RT_FORCE]);//, static_cast<uint32_t>(size(shaders)), shaders);
 	pCommandList->RTSetHitGroup(0, HitGroupName, nullptr, AnyHitShaderName, IntersectionShaderName, HitGroupType::PROCEDURAL_PRIMITIVE);
-	pCommandList->RTSetShaderConfig(sizeof(XMFLOAT4[2]), sizeof(XMFLOAT4));
+	pCommandList->RTSetShaderConfig(sizeof(XMFLOAT4[2]), sizeof(float[5]));
 	pCommandList->RTSetMaxRecursionDepth(1);
 
-	// Set UAV
-	const auto uav = XUSG::EZ::GetUAV(m_accelerationBuffer.get());
-	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+	// Set UAVs
+	const XUSG::EZ::ResourceView uavs[] =
+	{
+		XUSG::EZ::GetUAV(m_accelerationBuffer.get()),
+		XUSG::EZ::GetUAV(m_minDensityRatioBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
 
 	// Set SRVs
 	const XUSG::EZ::ResourceView srvs[] =
 	{
 		XUSG::EZ::GetSRV(m_particleBuffer.get()),
-		XUSG::EZ::GetSRV(m_densityBuffer.get())
+		XUSG::EZ::GetSRV(m_densityBuffer.get()),
+		XUSG::EZ::GetSRV(m_sleepCounterBuffer.get())
 	};
 	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, static_cast<uint32_t>(size(srvs)), srvs);
+	setKernelTable(pCommandList);
 
 	// Dispatch command
-	pCommandList->DispatchRays(m_numParticles, 1, 1, RaygenShaderName, &MissShaderName, 1);
+	dispatchRaysIndirect(pCommandList, 1);
 }
 
 void FluidEZ::integrate(RayTracing::EZ::CommandList* pCommandList)
@@ -394,14 +847,358 @@ void FluidEZ::integrate(RayTracing::EZ::CommandList* pCommandList)
 	const XUSG::EZ::ResourceView uavs[] =
 	{
 		XUSG::EZ::GetUAV(m_particleBuffer.get()),
+		XUSG::EZ::GetUAV(m_particleAABBBuffer.get()),
+		XUSG::EZ::GetUAV(m_sleepCounterBuffer.get()),
+		XUSG::EZ::GetUAV(m_particleCountBuffer.get()),
+		XUSG::EZ::GetUAV(m_aliveMaskBuffer.get()),
+		XUSG::EZ::GetUAV(m_freeListBuffer.get()),
+		XUSG::EZ::GetUAV(m_poolCountBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
+
+	// Set SRVs
+	const XUSG::EZ::ResourceView srvs[] =
+	{
+		XUSG::EZ::GetSRV(m_accelerationBuffer.get()),
+		XUSG::EZ::GetSRV(m_numberDensityBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, static_cast<uint32_t>(size(srvs)), srvs);
+
+	// Set boundary SDF and obstacles
+	setBoundary(pCommandList);
+
+	// Dispatch command
+	dispatchIndirect(pCommandList);
+}
+
+void FluidEZ::predictPositions(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	pCommandList->SetComputeShader(m_shaders[CS_PBF_PREDICT]);
+
+	// Set UAVs
+	const XUSG::EZ::ResourceView uavs[] =
+	{
+		XUSG::EZ::GetUAV(m_predParticleBuffer.get()),
 		XUSG::EZ::GetUAV(m_particleAABBBuffer.get())
 	};
 	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
 
 	// Set SRV
-	const auto srv = XUSG::EZ::GetSRV(m_accelerationBuffer.get());
+	const auto srv = XUSG::EZ::GetSRV(m_particleBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
+
+	// Set boundary SDF and obstacles
+	setBoundary(pCommandList);
+
+	// Dispatch command
+	pCommandList->Dispatch(XUSG_DIV_UP(m_numParticles, GROUP_SIZE), 1, 1);
+}
+
+void FluidEZ::computeLambdas(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	static const wchar_t* shaderNames[] = { RaygenShaderName, IntersectionShaderName, AnyHitShaderName, MissShaderName };
+	pCommandList->RTSetShaderLibrary(0, m_shaders[RT_PBF_LAMBDA], static_cast<uint32_t>(size(shaderNames)), shaderNames);
+	pCommandList->RTSetHitGroup(0, HitGroupName, nullptr, AnyHitShaderName, IntersectionShaderName, HitGroupType::PROCEDURAL_PRIMITIVE);
+	pCommandList->RTSetShaderConfig(sizeof(float[5]), sizeof(XMFLOAT4));
+	pCommandList->RTSetMaxRecursionDepth(1);
+
+	// Set UAV
+	const auto uav = XUSG::EZ::GetUAV(m_lambdaBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+
+	// Set SRV
+	const auto srv = XUSG::EZ::GetSRV(m_predParticleBuffer.get());
 	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
 
+	// Dispatch command
+	pCommandList->DispatchRays(m_numParticles, 1, 1, RaygenShaderName, &MissShaderName, 1);
+}
+
+void FluidEZ::computeDeltaPositions(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	static const wchar_t* shaderNames[] = { RaygenShaderName, IntersectionShaderName, AnyHitShaderName, MissShaderName };
+	pCommandList->RTSetShaderLibrary(0, m_shaders[RT_PBF_DELTA_POS], static_cast<uint32_t>(size(shaderNames)), shaderNames);
+	pCommandList->RTSetHitGroup(0, HitGroupName, nullptr, AnyHitShaderName, IntersectionShaderName, HitGroupType::PROCEDURAL_PRIMITIVE);
+	pCommandList->RTSetShaderConfig(sizeof(XMFLOAT4), sizeof(XMFLOAT4));
+	pCommandList->RTSetMaxRecursionDepth(1);
+
+	// Set UAV
+	const auto uav = XUSG::EZ::GetUAV(m_deltaPosBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+
+	// Set SRVs
+	const XUSG::EZ::ResourceView srvs[] =
+	{
+		XUSG::EZ::GetSRV(m_predParticleBuffer.get()),
+		XUSG::EZ::GetSRV(m_lambdaBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, static_cast<uint32_t>(size(srvs)), srvs);
+
+	// Dispatch command
+	pCommandList->DispatchRays(m_numParticles, 1, 1, RaygenShaderName, &MissShaderName, 1);
+}
+
+void FluidEZ::updatePositions(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	pCommandList->SetComputeShader(m_shaders[CS_PBF_UPDATE]);
+
+	// Set UAV
+	const auto uav = XUSG::EZ::GetUAV(m_predParticleBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+
+	// Set SRVs
+	const XUSG::EZ::ResourceView srvs[] =
+	{
+		XUSG::EZ::GetSRV(m_particleBuffer.get()),
+		XUSG::EZ::GetSRV(m_deltaPosBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, static_cast<uint32_t>(size(srvs)), srvs);
+
+	// Set boundary SDF and obstacles
+	setBoundary(pCommandList);
+
 	// Dispatch command
 	pCommandList->Dispatch(XUSG_DIV_UP(m_numParticles, GROUP_SIZE), 1, 1);
 }
+
+void FluidEZ::applyViscosity(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	static const wchar_t* shaderNames[] = { RaygenShaderName, IntersectionShaderName, AnyHitShaderName, MissShaderName };
+	pCommandList->RTSetShaderLibrary(0, m_shaders[RT_PBF_VISCOSITY], static_cast<uint32_t>(size(shaderNames)), shaderNames);
+	pCommandList->RTSetHitGroup(0, HitGroupName, nullptr, AnyHitShaderName, IntersectionShaderName, HitGroupType::PROCEDURAL_PRIMITIVE);
+	pCommandList->RTSetShaderConfig(sizeof(XMFLOAT3[2]), sizeof(float));
+	pCommandList->RTSetMaxRecursionDepth(1);
+
+	// Set UAV
+	const auto uav = XUSG::EZ::GetUAV(m_particleBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+
+	// Set SRV
+	const auto srv = XUSG::EZ::GetSRV(m_predParticleBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
+
+	// Dispatch command
+	pCommandList->DispatchRays(m_numParticles, 1, 1, RaygenShaderName, &MissShaderName, 1);
+}
+
+void FluidEZ::pairParticles(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	static const wchar_t* shaderNames[] = { RaygenShaderName, IntersectionShaderName, AnyHitShaderName, MissShaderName };
+	pCommandList->RTSetShaderLibrary(0, m_shaders[RT_PAIR_PARTICLES], static_cast<uint32_t>(size(shaderNames)), shaderNames);
+	pCommandList->RTSetHitGroup(0, HitGroupName, nullptr, AnyHitShaderName, IntersectionShaderName, HitGroupType::PROCEDURAL_PRIMITIVE);
+	pCommandList->RTSetShaderConfig(sizeof(float[3]), sizeof(float));
+	pCommandList->RTSetMaxRecursionDepth(1);
+
+	// Set UAV
+	const auto uav = XUSG::EZ::GetUAV(m_partnerBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+
+	// Set SRVs
+	const XUSG::EZ::ResourceView srvs[] =
+	{
+		XUSG::EZ::GetSRV(m_particleBuffer.get()),
+		XUSG::EZ::GetSRV(m_minDensityRatioBuffer.get()),
+		XUSG::EZ::GetSRV(m_sleepCounterBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, static_cast<uint32_t>(size(srvs)), srvs);
+
+	// Set boundary SDF and obstacles
+	setBoundary(pCommandList);
+
+	// Dispatch command
+	dispatchRaysIndirect(pCommandList, 2);
+}
+
+void FluidEZ::mergeParticles(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	pCommandList->SetComputeShader(m_shaders[CS_MERGE_PARTICLES]);
+
+	// Set UAVs
+	const XUSG::EZ::ResourceView uavs[] =
+	{
+		XUSG::EZ::GetUAV(m_particleBuffer.get()),
+		XUSG::EZ::GetUAV(m_particleAABBBuffer.get()),
+		XUSG::EZ::GetUAV(m_sleepCounterBuffer.get()),
+		XUSG::EZ::GetUAV(m_freeListBuffer.get()),
+		XUSG::EZ::GetUAV(m_poolCountBuffer.get()),
+		XUSG::EZ::GetUAV(m_aliveMaskBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
+
+	// Set SRV
+	const auto srv = XUSG::EZ::GetSRV(m_partnerBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
+
+	// Dispatch command
+	dispatchIndirect(pCommandList);
+}
+
+void FluidEZ::splitParticles(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	pCommandList->SetComputeShader(m_shaders[CS_SPLIT_PARTICLES]);
+
+	// Set UAVs
+	const XUSG::EZ::ResourceView uavs[] =
+	{
+		XUSG::EZ::GetUAV(m_particleBuffer.get()),
+		XUSG::EZ::GetUAV(m_particleAABBBuffer.get()),
+		XUSG::EZ::GetUAV(m_sleepCounterBuffer.get()),
+		XUSG::EZ::GetUAV(m_freeListBuffer.get()),
+		XUSG::EZ::GetUAV(m_poolCountBuffer.get()),
+		XUSG::EZ::GetUAV(m_aliveMaskBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
+
+	// Set SRV
+	const auto srv = XUSG::EZ::GetSRV(m_partnerBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
+
+	// Dispatch command
+	dispatchIndirect(pCommandList);
+}
+
+void FluidEZ::emitParticles(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	pCommandList->SetComputeShader(m_shaders[CS_EMIT_PARTICLES]);
+
+	// Set UAVs
+	const XUSG::EZ::ResourceView uavs[] =
+	{
+		XUSG::EZ::GetUAV(m_particleBuffer.get()),
+		XUSG::EZ::GetUAV(m_particleAABBBuffer.get()),
+		XUSG::EZ::GetUAV(m_sleepCounterBuffer.get()),
+		XUSG::EZ::GetUAV(m_freeListBuffer.get()),
+		XUSG::EZ::GetUAV(m_poolCountBuffer.get()),
+		XUSG::EZ::GetUAV(m_aliveMaskBuffer.get())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
+
+	// Dispatch command
+	pCommandList->Dispatch(XUSG_DIV_UP(m_emitCount, GROUP_SIZE), 1, 1);
+}
+
+void FluidEZ::compactParticles(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Scan the alive mask
+	{
+		// Set pipeline state
+		pCommandList->SetComputeShader(m_shaders[CS_SCAN_ALIVE_MASK]);
+
+		// Set UAVs
+		const XUSG::EZ::ResourceView uavs[] =
+		{
+			XUSG::EZ::GetUAV(m_wordOffsetBuffer.get()),
+			XUSG::EZ::GetUAV(m_poolCountBuffer.get())
+		};
+		pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
+
+		// Set SRV
+		const auto srv = XUSG::EZ::GetSRV(m_aliveMaskBuffer.get());
+		pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
+
+		// Dispatch command
+		pCommandList->Dispatch(1, 1, 1);
+	}
+
+	// Scatter the live particles to the front, and rebuild the free list with the tail
+	{
+		// Set pipeline state
+		pCommandList->SetComputeShader(m_shaders[CS_COMPACT_PARTICLES]);
+
+		// Set UAVs
+		const XUSG::EZ::ResourceView uavs[] =
+		{
+			XUSG::EZ::GetUAV(m_compactParticleBuffer.get()),
+			XUSG::EZ::GetUAV(m_particleAABBBuffer.get()),
+			XUSG::EZ::GetUAV(m_compactSleepCounterBuffer.get()),
+			XUSG::EZ::GetUAV(m_freeListBuffer.get())
+		};
+		pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, static_cast<uint32_t>(size(uavs)), uavs);
+
+		// Set SRVs
+		const XUSG::EZ::ResourceView srvs[] =
+		{
+			XUSG::EZ::GetSRV(m_particleBuffer.get()),
+			XUSG::EZ::GetSRV(m_sleepCounterBuffer.get()),
+			XUSG::EZ::GetSRV(m_aliveMaskBuffer.get()),
+			XUSG::EZ::GetSRV(m_wordOffsetBuffer.get()),
+			XUSG::EZ::GetSRV(m_poolCountBuffer.get())
+		};
+		pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, static_cast<uint32_t>(size(srvs)), srvs);
+
+		// Dispatch command
+		pCommandList->Dispatch(XUSG_DIV_UP(m_numParticles, GROUP_SIZE), 1, 1);
+	}
+
+	// Copy back
+	pCommandList->CopyBufferRegion(m_particleBuffer.get(), 0, m_compactParticleBuffer.get(), 0,
+		sizeof(Particle) * m_numParticles);
+	pCommandList->CopyBufferRegion(m_sleepCounterBuffer.get(), 0, m_compactSleepCounterBuffer.get(), 0,
+		sizeof(uint32_t) * m_numParticles);
+}
+
+void FluidEZ::updateDispatchArgs(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set pipeline state
+	pCommandList->SetComputeShader(m_shaders[CS_UPDATE_DISPATCH_ARGS]);
+
+	// Set UAV
+	const auto uav = XUSG::EZ::GetUAV(m_dispatchArgBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::UAV, 0, 1, &uav);
+
+	// Set SRV
+	const auto srv = XUSG::EZ::GetSRV(m_poolCountBuffer.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 0, 1, &srv);
+
+	// Dispatch command
+	pCommandList->Dispatch(1, 1, 1);
+}
+
+void FluidEZ::dispatchIndirect(RayTracing::EZ::CommandList* pCommandList)
+{
+	pCommandList->DispatchIndirect(m_dispatchLayout.get(), 1, m_dispatchArgBuffer.get());
+}
+
+void FluidEZ::dispatchRaysIndirect(RayTracing::EZ::CommandList* pCommandList, uint8_t slot)
+{
+	// Each ray dispatch has its own argument slot, since the command list fills in its shader tables.
+	pCommandList->DispatchRaysIndirect(m_dispatchRaysLayout.get(), 1, RaygenShaderName, &MissShaderName, 1,
+		m_dispatchArgBuffer.get(), DISPATCH_ARG_STRIDE * (slot + 1));
+}
+
+void FluidEZ::setBoundary(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set SRVs
+	const XUSG::EZ::ResourceView srvs[] =
+	{
+		XUSG::EZ::GetSRV(m_boundary->GetBrickIndices()),
+		XUSG::EZ::GetSRV(m_boundary->GetAtlas()),
+		XUSG::EZ::GetSRV(m_obstacles->GetNodes()),
+		XUSG::EZ::GetSRV(m_obstacles->GetTriangles())
+	};
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 8, static_cast<uint32_t>(size(srvs)), srvs);
+
+	// Set sampler
+	const auto sampler = SamplerPreset::LINEAR_CLAMP;
+	pCommandList->SetSamplerStates(Shader::Stage::CS, 0, 1, &sampler);
+}
+
+void FluidEZ::setKernelTable(RayTracing::EZ::CommandList* pCommandList)
+{
+	// Set SRV
+	const auto srv = XUSG::EZ::GetSRV(m_kernelTable.get());
+	pCommandList->SetResources(Shader::Stage::CS, DescriptorType::SRV, 12, 1, &srv);
+
+	// Set sampler
+	const auto sampler = SamplerPreset::LINEAR_CLAMP;
+	pCommandList->SetSamplerStates(Shader::Stage::CS, 1, 1, &sampler);
+}
@@ -7,15 +7,42 @@
 #include "Core/XUSG.h"
 #include "Helper/XUSGRayTracing-EZ.h"
 #include "RayTracing/XUSGRayTracing.h"
+#include "SDFBoundary.h"
+#include "ObstacleBVH.h"
 
 class FluidEZ
 {
 public:
+	enum SolverType : uint8_t
+	{
+		SOLVER_SPH,
+		SOLVER_PBF
+	};
+
+	enum PeriodicAxis : uint8_t
+	{
+		PERIODIC_X = (1 << 0),
+		PERIODIC_Y = (1 << 1),
+		PERIODIC_Z = (1 << 2)
+	};
+
+	enum KernelType : uint8_t
+	{
+		KERNEL_ANALYTIC,
+		KERNEL_TABLE,
+		KERNEL_TABLE_WENDLAND_C4,
+
+		NUM_KERNEL_TYPE
+	};
+
 	FluidEZ();
 	virtual ~FluidEZ();
 
 	bool Init(XUSG::RayTracing::EZ::CommandList* pCommandList, uint32_t width, uint32_t height,
-		std::vector<XUSG::Resource::uptr>& uploaders, uint32_t numParticles = 65536);
+		std::vector<XUSG::Resource::uptr>& uploaders, SolverType solverType = SOLVER_SPH,
+		bool isAdaptive = false, const wchar_t* boundaryMeshFileName = nullptr,
+		const wchar_t* obstacleMeshFileName = nullptr, uint32_t numParticles = 65536, uint32_t poolSize = 0,
+		uint8_t periodicAxes = 0, bool isSmoothRadiusVariable = false);
 
 	void UpdateFrame(uint8_t frameIndex, float timeStep, DirectX::CXMMATRIX viewProj, DirectX::CXMVECTOR viewY);
 	void Render(XUSG::RayTracing::EZ::CommandList* pCommandList, uint8_t frameIndex,
@@ -23,11 +50,22 @@ public:
 	void Simulate(XUSG::RayTracing::EZ::CommandList* pCommandList, uint8_t frameIndex);
 	void Visualize(XUSG::RayTracing::EZ::CommandList* pCommandList, uint8_t frameIndex,
 		XUSG::RenderTarget* pRenderTarget, XUSG::DepthStencil* pDepthStencil);
+	void EnableSleeping(bool enable);
+	void SetKernelType(KernelType kernelType);
+	void SetEmitter(const DirectX::XMFLOAT3& pos, const DirectX::XMFLOAT3& velocity, float radius, float rate);
+	void SetSink(const DirectX::XMFLOAT3& minPt, const DirectX::XMFLOAT3& maxPt);
+
+	uint32_t GetNumParticles() const;
+	uint32_t GetNumActiveParticles(uint8_t frameIndex) const;
+	uint32_t GetNumAliveParticles(uint8_t frameIndex) const;
+	size_t GetBVHMemorySize() const;	// Of the BLAS and TLAS, as the nodes KB of the CPU BVHs in SPHBenchmark
 
 	static const uint8_t FrameCount = 3;
 
 protected:
 	bool createParticleBuffers(XUSG::RayTracing::EZ::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
+	bool createParticlePool(XUSG::RayTracing::EZ::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
+	bool createKernelTable(XUSG::RayTracing::EZ::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
 	bool createConstBuffers(XUSG::RayTracing::EZ::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
 	bool createShaders();
 	bool buildAccelerationStructures(XUSG::RayTracing::EZ::CommandList* pCommandList);
@@ -36,17 +74,66 @@ protected:
 	void computeAcceleration(XUSG::RayTracing::EZ::CommandList* pCommandList);
 	void integrate(XUSG::RayTracing::EZ::CommandList* pCommandList);
 
+	// Position based fluids
+	void predictPositions(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void computeLambdas(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void computeDeltaPositions(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void updatePositions(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void applyViscosity(XUSG::RayTracing::EZ::CommandList* pCommandList);
+
+	// Adaptive particle resolution
+	void pairParticles(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void mergeParticles(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void splitParticles(XUSG::RayTracing::EZ::CommandList* pCommandList);
+
+	// Particle pool with emitters and sinks
+	void emitParticles(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void compactParticles(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void updateDispatchArgs(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void dispatchIndirect(XUSG::RayTracing::EZ::CommandList* pCommandList);
+	void dispatchRaysIndirect(XUSG::RayTracing::EZ::CommandList* pCommandList, uint8_t slot);
+
+	// Boundary SDF and obstacles
+	void setBoundary(XUSG::RayTracing::EZ::CommandList* pCommandList);
+
+	// Tabulated kernels
+	void setKernelTable(XUSG::RayTracing::EZ::CommandList* pCommandList);
+
 	XUSG::RayTracing::BottomLevelAS::uptr m_bottomLevelAS;
 	XUSG::RayTracing::TopLevelAS::uptr m_topLevelAS;
 
 	XUSG::StructuredBuffer::uptr	m_particleBuffer;
 	XUSG::VertexBuffer::uptr		m_particleAABBBuffer;
 	XUSG::TypedBuffer::uptr			m_densityBuffer;
+	XUSG::TypedBuffer::uptr			m_numberDensityBuffer;
 	XUSG::TypedBuffer::uptr			m_accelerationBuffer;
+	XUSG::TypedBuffer::uptr			m_sleepCounterBuffer;
+	XUSG::TypedBuffer::uptr			m_particleCountBuffer;
+	XUSG::Buffer::uptr				m_readBuffer;
+	XUSG::TypedBuffer::uptr			m_minDensityRatioBuffer;
+	XUSG::TypedBuffer::uptr			m_partnerBuffer;
+	XUSG::TypedBuffer::uptr			m_freeListBuffer;
+	XUSG::TypedBuffer::uptr			m_poolCountBuffer;
+	XUSG::TypedBuffer::uptr			m_aliveMaskBuffer;
+	XUSG::TypedBuffer::uptr			m_wordOffsetBuffer;
+	XUSG::StructuredBuffer::uptr	m_compactParticleBuffer;
+	XUSG::TypedBuffer::uptr			m_compactSleepCounterBuffer;
+	XUSG::TypedBuffer::uptr			m_dispatchArgBuffer;
+	XUSG::StructuredBuffer::uptr	m_predParticleBuffer;
+	XUSG::TypedBuffer::uptr			m_lambdaBuffer;
+	XUSG::TypedBuffer::uptr			m_deltaPosBuffer;
 	XUSG::ConstantBuffer::uptr		m_cbSimulation;
 	XUSG::ConstantBuffer::uptr		m_cbPerFrame;
 	XUSG::ConstantBuffer::uptr		m_cbVisualization;
 
+	XUSG::Texture::uptr				m_kernelTable;
+
+	std::unique_ptr<SDFBoundary>	m_boundary;
+	std::unique_ptr<ObstacleBVH>	m_obstacles;
+
+	XUSG::CommandLayout::uptr		m_dispatchLayout;
+	XUSG::CommandLayout::uptr		m_dispatchRaysLayout;
+
 	XUSG::RayTracing::GeometryBuffer m_geometry;
 	XUSG::Buffer::uptr m_instances;
 
@@ -62,6 +149,18 @@ protected:
 		RT_DENSITY,
 		RT_FORCE,
 		CS_INTEGRATE,
+		CS_PBF_PREDICT,
+		RT_PBF_LAMBDA,
+		RT_PBF_DELTA_POS,
+		CS_PBF_UPDATE,
+		RT_PBF_VISCOSITY,
+		RT_PAIR_PARTICLES,
+		CS_MERGE_PARTICLES,
+		CS_SPLIT_PARTICLES,
+		CS_EMIT_PARTICLES,
+		CS_SCAN_ALIVE_MASK,
+		CS_COMPACT_PARTICLES,
+		CS_UPDATE_DISPATCH_ARGS,
 		VS_DRAW_PARTICLES,
 		PS_DRAW_PARTICLES,
 
@@ -73,5 +172,31 @@ protected:
 
 	DirectX::XMFLOAT2		m_viewport;
 
+	SolverType				m_solverType;
 	uint32_t				m_numParticles;
+	uint32_t				m_numInitParticles;
+	float					m_timeStep;
+
+	// Sleeping particles
+	DirectX::XMFLOAT3		m_gravity;
+	const uint32_t*			m_pParticleCounts;
+	bool					m_isSleepingEnabled;
+	bool					m_wakeUpAll;
+
+	bool					m_isAdaptive;
+	bool					m_isSmoothRadiusVariable;
+	uint8_t					m_periodicAxes;
+	KernelType				m_kernelType;
+
+	// Emitters and sinks
+	DirectX::XMFLOAT3		m_emitterPos;
+	DirectX::XMFLOAT3		m_emitterVelocity;
+	float					m_emitterRadius;
+	float					m_emitRate;
+	float					m_emitAccumulator;
+	uint32_t				m_emitCount;
+	uint32_t				m_emitSeed;
+	DirectX::XMFLOAT3		m_sinkMin;
+	DirectX::XMFLOAT3		m_sinkMax;
+	uint32_t				m_stepCount;
 };
@@ -0,0 +1,58 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <fstream>
+#include "Core/XUSG.h"
+#include "ObjLoader.h"
+
+using namespace std;
+using namespace DirectX;
+
+bool ObjLoader::Load(const wchar_t* fileName, vector<XMFLOAT3>& vertices, vector<uint32_t>& indices)
+{
+	ifstream fileStream(fileName);
+	XUSG_N_RETURN(fileStream, false);
+
+	// Only the vertex positions and the faces are used.
+	const auto baseVertex = static_cast<uint32_t>(vertices.size());
+	const auto baseIndex = indices.size();
+	string line;
+	vector<uint32_t> face;
+	while (getline(fileStream, line))
+	{
+		istringstream lineStream(line);
+		string type;
+		lineStream >> type;
+
+		if (type == "v")
+		{
+			XMFLOAT3 v;
+			lineStream >> v.x >> v.y >> v.z;
+			vertices.emplace_back(v);
+		}
+		else if (type == "f")
+		{
+			// Indices may be in the forms of v, v/vt, v//vn, and v/vt/vn, and negative ones are relative.
+			string token;
+			face.clear();
+			while (lineStream >> token)
+			{
+				const auto index = stoi(token.substr(0, token.find('/')));
+				face.emplace_back(index < 0 ? static_cast<uint32_t>(vertices.size() + index) : baseVertex + index - 1);
+			}
+
+			// Triangulate the polygon as a fan
+			for (size_t i = 2; i < face.size(); ++i)
+			{
+				indices.emplace_back(face[0]);
+				indices.emplace_back(face[i - 1]);
+				indices.emplace_back(face[i]);
+			}
+		}
+	}
+
+	for (auto i = baseIndex; i < indices.size(); ++i) XUSG_N_RETURN(indices[i] < vertices.size(), false);
+
+	return indices.size() > baseIndex;
+}
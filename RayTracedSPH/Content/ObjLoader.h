@@ -0,0 +1,13 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+// Minimal Wavefront OBJ loader for the triangle meshes of the scene geometry
+class ObjLoader
+{
+public:
+	static bool Load(const wchar_t* fileName, std::vector<DirectX::XMFLOAT3>& vertices,
+		std::vector<uint32_t>& indices);
+};
@@ -0,0 +1,243 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "ObstacleBVH.h"
+#include "ObjLoader.h"
+
+using namespace std;
+using namespace DirectX;
+using namespace XUSG;
+
+const uint8_t BVH_NUM_BINS = 12;
+
+struct AABB
+{
+	XMFLOAT3 Min;
+	XMFLOAT3 Max;
+
+	AABB() : Min(FLT_MAX, FLT_MAX, FLT_MAX), Max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+
+	void Grow(const XMFLOAT3& p)
+	{
+		Min = XMFLOAT3((min)(Min.x, p.x), (min)(Min.y, p.y), (min)(Min.z, p.z));
+		Max = XMFLOAT3((max)(Max.x, p.x), (max)(Max.y, p.y), (max)(Max.z, p.z));
+	}
+
+	void Grow(const AABB& aabb)
+	{
+		Grow(aabb.Min);
+		Grow(aabb.Max);
+	}
+
+	float Area() const
+	{
+		const auto x = Max.x - Min.x, y = Max.y - Min.y, z = Max.z - Min.z;
+
+		return x < 0.0f ? 0.0f : x * y + y * z + z * x;
+	}
+};
+
+static float getAxis(const XMFLOAT3& v, uint8_t axis)
+{
+	return (&v.x)[axis];
+}
+
+ObstacleBVH::ObstacleBVH()
+{
+}
+
+ObstacleBVH::~ObstacleBVH()
+{
+}
+
+bool ObstacleBVH::Init(CommandList* pCommandList, vector<Resource::uptr>& uploaders, const wchar_t* meshFileName)
+{
+	// Without obstacles, the root is an empty box that no query overlaps.
+	vector<XMFLOAT3> vertices;
+	vector<uint32_t> indices;
+	if (meshFileName) XUSG_N_RETURN(ObjLoader::Load(meshFileName, vertices, indices), false);
+	build(vertices, indices);
+
+	return createBuffers(pCommandList, uploaders);
+}
+
+StructuredBuffer* ObstacleBVH::GetNodes() const
+{
+	return m_nodeBuffer.get();
+}
+
+StructuredBuffer* ObstacleBVH::GetTriangles() const
+{
+	return m_triangleBuffer.get();
+}
+
+void ObstacleBVH::build(const vector<XMFLOAT3>& vertices, const vector<uint32_t>& indices)
+{
+	const auto numTriangles = static_cast<uint32_t>(indices.size() / 3);
+
+	// Triangle bounds and centroids
+	vector<AABB> triAABBs(numTriangles);
+	vector<XMFLOAT3> centroids(numTriangles);
+	vector<uint32_t> triIds(numTriangles);
+	for (auto i = 0u; i < numTriangles; ++i)
+	{
+		const auto& v0 = vertices[indices[3 * i]];
+		const auto& v1 = vertices[indices[3 * i + 1]];
+		const auto& v2 = vertices[indices[3 * i + 2]];
+		triAABBs[i].Grow(v0);
+		triAABBs[i].Grow(v1);
+		triAABBs[i].Grow(v2);
+		centroids[i] = XMFLOAT3((v0.x + v1.x + v2.x) / 3.0f, (v0.y + v1.y + v2.y) / 3.0f, (v0.z + v1.z + v2.z) / 3.0f);
+		triIds[i] = i;
+	}
+
+	// Root
+	m_nodes.clear();
+	m_nodes.reserve((max)(2 * numTriangles, 1u));
+	m_nodes.push_back({ XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX), 0, XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX), numTriangles });
+
+	// Top-down build with the binned surface area heuristic
+	struct Task { uint32_t Node, First, Count, Depth; };
+	vector<Task> tasks;
+	if (numTriangles > 0) tasks.push_back({ 0, 0, numTriangles, 0 });
+	while (!tasks.empty())
+	{
+		const auto task = tasks.back();
+		tasks.pop_back();
+
+		AABB bounds, centroidBounds;
+		for (auto i = task.First; i < task.First + task.Count; ++i)
+		{
+			bounds.Grow(triAABBs[triIds[i]]);
+			centroidBounds.Grow(centroids[triIds[i]]);
+		}
+
+		auto& node = m_nodes[task.Node];
+		node.Min = bounds.Min;
+		node.Max = bounds.Max;
+		node.Next = task.First;
+		node.Count = task.Count;
+		if (task.Count <= MaxLeafSize || task.Depth >= MaxDepth) continue;
+
+		// The SAH splits may be lopsided, so the median splits take over once only they can still reach
+		// the leaf size within the max depth.
+		auto numMedianLevels = 0u;
+		for (auto count = task.Count; count > MaxLeafSize; count = (count + 1) / 2) ++numMedianLevels;
+		const auto isMedianSplit = task.Depth + numMedianLevels >= MaxDepth;
+
+		// Find the best split plane among the bin borders of all axes
+		auto bestCost = FLT_MAX;
+		uint8_t bestAxis = 0, bestSplit = 0;
+		for (uint8_t axis = 0; axis < 3 && !isMedianSplit; ++axis)
+		{
+			const auto cMin = getAxis(centroidBounds.Min, axis);
+			const auto extent = getAxis(centroidBounds.Max, axis) - cMin;
+			if (extent <= 0.0f) continue;
+
+			AABB binBounds[BVH_NUM_BINS];
+			uint32_t binCounts[BVH_NUM_BINS] = {};
+			const auto scale = BVH_NUM_BINS / extent;
+			for (auto i = task.First; i < task.First + task.Count; ++i)
+			{
+				const auto b = (min)(static_cast<uint8_t>((getAxis(centroids[triIds[i]], axis) - cMin) * scale),
+					static_cast<uint8_t>(BVH_NUM_BINS - 1));
+				binBounds[b].Grow(triAABBs[triIds[i]]);
+				++binCounts[b];
+			}
+
+			// Sweep from both sides
+			float leftAreas[BVH_NUM_BINS - 1];
+			uint32_t leftCounts[BVH_NUM_BINS - 1];
+			AABB left;
+			uint32_t leftCount = 0;
+			for (uint8_t b = 0; b < BVH_NUM_BINS - 1; ++b)
+			{
+				left.Grow(binBounds[b]);
+				leftCount += binCounts[b];
+				leftAreas[b] = left.Area();
+				leftCounts[b] = leftCount;
+			}
+
+			AABB right;
+			uint32_t rightCount = 0;
+			for (uint8_t b = BVH_NUM_BINS - 1; b > 0; --b)
+			{
+				right.Grow(binBounds[b]);
+				rightCount += binCounts[b];
+				const auto cost = leftCounts[b - 1] * leftAreas[b - 1] + rightCount * right.Area();
+				if (leftCounts[b - 1] > 0 && rightCount > 0 && cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+
+		// Partition the triangles, or halve them at the median along the widest axis of the centroids
+		auto mid = task.First + task.Count / 2;
+		if (isMedianSplit)
+		{
+			uint8_t axis = 0;
+			for (uint8_t a = 1; a < 3; ++a)
+				if (getAxis(centroidBounds.Max, a) - getAxis(centroidBounds.Min, a) >
+					getAxis(centroidBounds.Max, axis) - getAxis(centroidBounds.Min, axis)) axis = a;
+			nth_element(triIds.begin() + task.First, triIds.begin() + mid, triIds.begin() + task.First + task.Count,
+				[&](uint32_t a, uint32_t b) { return getAxis(centroids[a], axis) < getAxis(centroids[b], axis); });
+		}
+		else if (bestCost < FLT_MAX)
+		{
+			const auto cMin = getAxis(centroidBounds.Min, bestAxis);
+			const auto scale = BVH_NUM_BINS / (getAxis(centroidBounds.Max, bestAxis) - cMin);
+			const auto pMid = partition(triIds.begin() + task.First, triIds.begin() + task.First + task.Count,
+				[&](uint32_t t)
+				{
+					const auto b = (min)(static_cast<uint8_t>((getAxis(centroids[t], bestAxis) - cMin) * scale),
+						static_cast<uint8_t>(BVH_NUM_BINS - 1));
+
+					return b < bestSplit;
+				});
+			mid = static_cast<uint32_t>(pMid - triIds.begin());
+		}
+
+		// Children are adjacent
+		const auto leftChild = static_cast<uint32_t>(m_nodes.size());
+		m_nodes[task.Node].Next = leftChild;
+		m_nodes[task.Node].Count = 0;
+		m_nodes.emplace_back();
+		m_nodes.emplace_back();
+		tasks.push_back({ leftChild, task.First, mid - task.First, task.Depth + 1 });
+		tasks.push_back({ leftChild + 1, mid, task.First + task.Count - mid, task.Depth + 1 });
+	}
+
+	// Reorder the triangles into the leaf order
+	m_triangles.resize((max)(numTriangles, 1u), { XMFLOAT3(), XMFLOAT3(), XMFLOAT3() });
+	for (auto i = 0u; i < numTriangles; ++i)
+	{
+		const auto t = triIds[i];
+		m_triangles[i] = { vertices[indices[3 * t]], vertices[indices[3 * t + 1]], vertices[indices[3 * t + 2]] };
+	}
+}
+
+bool ObstacleBVH::createBuffers(CommandList* pCommandList, vector<Resource::uptr>& uploaders)
+{
+	const auto pDevice = pCommandList->GetDevice();
+
+	// Create node buffer
+	m_nodeBuffer = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_nodeBuffer->Create(pDevice, static_cast<uint32_t>(m_nodes.size()), sizeof(Node),
+		ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 0, nullptr, MemoryFlag::NONE, L"ObstacleBVHNodes"), false);
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_nodeBuffer->Upload(pCommandList, uploaders.back().get(), m_nodes.data(),
+		sizeof(Node) * m_nodes.size(), 0, ResourceState::COMMON, ResourceState::NON_PIXEL_SHADER_RESOURCE), false);
+
+	// Create triangle buffer
+	m_triangleBuffer = StructuredBuffer::MakeUnique();
+	XUSG_N_RETURN(m_triangleBuffer->Create(pDevice, static_cast<uint32_t>(m_triangles.size()), sizeof(Triangle),
+		ResourceFlag::NONE, MemoryType::DEFAULT, 1, nullptr, 0, nullptr, MemoryFlag::NONE, L"ObstacleTriangles"), false);
+	uploaders.emplace_back(Resource::MakeUnique());
+
+	return m_triangleBuffer->Upload(pCommandList, uploaders.back().get(), m_triangles.data(),
+		sizeof(Triangle) * m_triangles.size(), 0, ResourceState::COMMON, ResourceState::NON_PIXEL_SHADER_RESOURCE);
+}
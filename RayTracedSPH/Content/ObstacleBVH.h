@@ -0,0 +1,52 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Core/XUSG.h"
+
+// Static BVH over the triangles of the obstacle meshes, which is built once on the CPU
+// and traversed per particle in the integration passes for the closest triangle.
+class ObstacleBVH
+{
+public:
+	struct Node
+	{
+		DirectX::XMFLOAT3 Min;
+		uint32_t Next;		// Left child for an interior node, or the first triangle for a leaf
+		DirectX::XMFLOAT3 Max;
+		uint32_t Count;		// Number of triangles, 0 for an interior node
+	};
+
+	struct Triangle
+	{
+		DirectX::XMFLOAT3 V0;
+		DirectX::XMFLOAT3 V1;
+		DirectX::XMFLOAT3 V2;
+	};
+
+	ObstacleBVH();
+	virtual ~ObstacleBVH();
+
+	bool Init(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders,
+		const wchar_t* meshFileName = nullptr);
+
+	XUSG::StructuredBuffer* GetNodes() const;
+	XUSG::StructuredBuffer* GetTriangles() const;
+
+	static const uint8_t MaxLeafSize = 4;
+	// The traversal keeps a far child per level on a stack of OBSTACLE_STACK_SIZE (ObstacleCommon.hlsli)
+	// entries, so no leaf is deeper than that minus 1.
+	static const uint8_t MaxDepth = 31;
+
+protected:
+	void build(const std::vector<DirectX::XMFLOAT3>& vertices, const std::vector<uint32_t>& indices);
+	bool createBuffers(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
+
+	std::vector<Node>		m_nodes;
+	std::vector<Triangle>	m_triangles;
+
+	XUSG::StructuredBuffer::uptr m_nodeBuffer;
+	XUSG::StructuredBuffer::uptr m_triangleBuffer;
+};
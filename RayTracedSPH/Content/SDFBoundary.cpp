@@ -0,0 +1,452 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <fstream>
+#include <DirectXPackedVector.h>
+#include "SDFBoundary.h"
+#include "ObjLoader.h"
+#include "SharedConst.h"
+
+using namespace std;
+using namespace DirectX;
+using namespace DirectX::PackedVector;
+using namespace XUSG;
+
+const uint32_t SDF_CACHE_MAGIC = 0x46445342; // "BSDF"
+const uint32_t SDF_CACHE_VERSION = 1;
+const uint32_t SDF_BRICK_CELLS = SDF_BRICK_SIZE - 1;
+const uint32_t SDF_BRICK_VOXELS = SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE;
+const wchar_t* SDF_DEFAULT_CACHE_FILE_NAME = L"DefaultBoundary.sdf";
+
+struct SDFCacheHeader
+{
+	uint32_t Magic;
+	uint32_t Version;
+	uint64_t Hash;
+	XMFLOAT3 Origin;
+	float VoxelSize;
+	float BandWidth;
+	XMUINT3 NumBricks;
+	XMUINT3 NumAtlasBricks;
+};
+
+// Closest point on a triangle (Real-Time Collision Detection, 5.1.5)
+static float pointTriangleDistanceSq(FXMVECTOR p, FXMVECTOR a, FXMVECTOR b, GXMVECTOR c)
+{
+	const auto ab = b - a;
+	const auto ac = c - a;
+	const auto ap = p - a;
+	const auto d1 = XMVectorGetX(XMVector3Dot(ab, ap));
+	const auto d2 = XMVectorGetX(XMVector3Dot(ac, ap));
+	if (d1 <= 0.0f && d2 <= 0.0f) return XMVectorGetX(XMVector3LengthSq(ap));
+
+	const auto bp = p - b;
+	const auto d3 = XMVectorGetX(XMVector3Dot(ab, bp));
+	const auto d4 = XMVectorGetX(XMVector3Dot(ac, bp));
+	if (d3 >= 0.0f && d4 <= d3) return XMVectorGetX(XMVector3LengthSq(bp));
+
+	const auto vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return XMVectorGetX(XMVector3LengthSq(ap - d1 / (d1 - d3) * ab));
+
+	const auto cp = p - c;
+	const auto d5 = XMVectorGetX(XMVector3Dot(ab, cp));
+	const auto d6 = XMVectorGetX(XMVector3Dot(ac, cp));
+	if (d6 >= 0.0f && d5 <= d6) return XMVectorGetX(XMVector3LengthSq(cp));
+
+	const auto vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return XMVectorGetX(XMVector3LengthSq(ap - d2 / (d2 - d6) * ac));
+
+	const auto va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+		return XMVectorGetX(XMVector3LengthSq(bp - (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b)));
+
+	const auto denom = 1.0f / (va + vb + vc);
+
+	return XMVectorGetX(XMVector3LengthSq(ap - vb * denom * ab - vc * denom * ac));
+}
+
+// Signed area of the triangle (u, v, p) projected onto the yz-plane
+static float edgeFunctionYZ(const XMFLOAT3& u, const XMFLOAT3& v, float py, float pz)
+{
+	return (v.y - u.y) * (pz - u.z) - (v.z - u.z) * (py - u.y);
+}
+
+SDFBoundary::SDFBoundary() :
+	m_origin(0.0f, 0.0f, 0.0f),
+	m_numBricks(0, 0, 0),
+	m_numAtlasBricks(0, 0, 0),
+	m_voxelSize(0.0f),
+	m_bandWidth(0.0f)
+{
+}
+
+SDFBoundary::~SDFBoundary()
+{
+}
+
+bool SDFBoundary::Init(CommandList* pCommandList, vector<Resource::uptr>& uploaders,
+	float voxelSize, float bandWidth, const wchar_t* meshFileName)
+{
+	m_voxelSize = voxelSize;
+	m_bandWidth = bandWidth;
+
+	// Load the container mesh, or use the default box pool
+	if (meshFileName) XUSG_N_RETURN(ObjLoader::Load(meshFileName, m_vertices, m_indices), false);
+	else createDefaultMesh();
+
+	// Voxelize only if the cached SDF is missing or stale
+	const wstring cacheFileName = meshFileName ? wstring(meshFileName) + L".sdf" : SDF_DEFAULT_CACHE_FILE_NAME;
+	if (!loadCache(cacheFileName))
+	{
+		voxelize();
+		if (!saveCache(cacheFileName))
+			OutputDebugString((L"Warning: could not write the SDF cache " + cacheFileName + L".\n").c_str());
+	}
+
+	return createTextures(pCommandList, uploaders);
+}
+
+Texture3D* SDFBoundary::GetBrickIndices() const
+{
+	return m_brickIndexTexture.get();
+}
+
+Texture3D* SDFBoundary::GetAtlas() const
+{
+	return m_atlasTexture.get();
+}
+
+const XMFLOAT3& SDFBoundary::GetOrigin() const
+{
+	return m_origin;
+}
+
+const XMUINT3& SDFBoundary::GetNumBricks() const
+{
+	return m_numBricks;
+}
+
+XMFLOAT3 SDFBoundary::GetAtlasInvSize() const
+{
+	return XMFLOAT3(1.0f / (m_numAtlasBricks.x * SDF_BRICK_SIZE),
+		1.0f / (m_numAtlasBricks.y * SDF_BRICK_SIZE),
+		1.0f / (m_numAtlasBricks.z * SDF_BRICK_SIZE));
+}
+
+float SDFBoundary::GetVoxelSize() const
+{
+	return m_voxelSize;
+}
+
+float SDFBoundary::GetBandWidth() const
+{
+	return m_bandWidth;
+}
+
+void SDFBoundary::GetBounds(XMFLOAT3& minPt, XMFLOAT3& maxPt) const
+{
+	auto bMin = XMLoadFloat3(&m_vertices[0]);
+	auto bMax = bMin;
+	for (const auto& v : m_vertices)
+	{
+		bMin = XMVectorMin(XMLoadFloat3(&v), bMin);
+		bMax = XMVectorMax(XMLoadFloat3(&v), bMax);
+	}
+
+	XMStoreFloat3(&minPt, bMin);
+	XMStoreFloat3(&maxPt, bMax);
+}
+
+void SDFBoundary::createDefaultMesh()
+{
+	// The box pool of [-0.5, 0.5] x [0, 1] x [-0.5, 0.5]
+	for (uint8_t i = 0; i < 8; ++i)
+		m_vertices.emplace_back((i & 1) ? 0.5f : -0.5f, (i & 2) ? 1.0f : 0.0f, (i & 4) ? 0.5f : -0.5f);
+
+	m_indices =
+	{
+		0, 2, 3, 0, 3, 1,	// -z
+		4, 5, 7, 4, 7, 6,	// +z
+		0, 4, 6, 0, 6, 2,	// -x
+		1, 3, 7, 1, 7, 5,	// +x
+		0, 1, 5, 0, 5, 4,	// -y
+		2, 6, 7, 2, 7, 3	// +y
+	};
+}
+
+void SDFBoundary::voxelize()
+{
+	// Grid covering the mesh with a margin of the band width
+	auto bMin = XMLoadFloat3(&m_vertices[0]);
+	auto bMax = bMin;
+	for (const auto& v : m_vertices)
+	{
+		bMin = XMVectorMin(XMLoadFloat3(&v), bMin);
+		bMax = XMVectorMax(XMLoadFloat3(&v), bMax);
+	}
+
+	const auto margin = XMVectorReplicate(m_bandWidth + m_voxelSize);
+	const auto numCells = XMVectorCeiling((bMax - bMin + 2.0f * margin) / m_voxelSize);
+	XMStoreFloat3(&m_origin, bMin - margin);
+	XMStoreUInt3(&m_numBricks, XMVectorCeiling(numCells / static_cast<float>(SDF_BRICK_CELLS)));
+
+	const XMUINT3 gridSize(m_numBricks.x * SDF_BRICK_CELLS + 1,
+		m_numBricks.y * SDF_BRICK_CELLS + 1, m_numBricks.z * SDF_BRICK_CELLS + 1);
+	const auto getIndex = [&gridSize](uint32_t i, uint32_t j, uint32_t k)
+	{ return (k * gridSize.y + j) * gridSize.x + i; };
+
+	// Unsigned distances within the band
+	vector<float> distances(static_cast<size_t>(gridSize.x) * gridSize.y * gridSize.z, m_bandWidth);
+	const auto numTriangles = m_indices.size() / 3;
+	const auto origin = XMLoadFloat3(&m_origin);
+	const auto band = XMVectorReplicate(m_bandWidth);
+	const auto gridMax = XMVectorSet(gridSize.x - 1.0f, gridSize.y - 1.0f, gridSize.z - 1.0f, 0.0f);
+	for (size_t t = 0; t < numTriangles; ++t)
+	{
+		const auto a = XMLoadFloat3(&m_vertices[m_indices[3 * t]]);
+		const auto b = XMLoadFloat3(&m_vertices[m_indices[3 * t + 1]]);
+		const auto c = XMLoadFloat3(&m_vertices[m_indices[3 * t + 2]]);
+
+		XMUINT3 lo, hi;
+		XMStoreUInt3(&lo, XMVectorClamp(XMVectorFloor((XMVectorMin(XMVectorMin(a, b), c) - band - origin) / m_voxelSize),
+			XMVectorZero(), gridMax));
+		XMStoreUInt3(&hi, XMVectorClamp(XMVectorCeiling((XMVectorMax(XMVectorMax(a, b), c) + band - origin) / m_voxelSize),
+			XMVectorZero(), gridMax));
+
+		for (auto k = lo.z; k <= hi.z; ++k)
+			for (auto j = lo.y; j <= hi.y; ++j)
+				for (auto i = lo.x; i <= hi.x; ++i)
+				{
+					const auto p = origin + XMVectorSet(static_cast<float>(i), static_cast<float>(j), static_cast<float>(k), 0.0f) * m_voxelSize;
+					auto& dist = distances[getIndex(i, j, k)];
+					dist = (min)(sqrt(pointTriangleDistanceSq(p, a, b, c)), dist);
+				}
+	}
+
+	// Signs by the parity of the crossings along +x for each row of samples,
+	// where the rows are slightly perturbed to avoid hitting the mesh edges exactly.
+	const auto rowOffsetY = 1.0e-4f * m_voxelSize;
+	const auto rowOffsetZ = 1.7e-4f * m_voxelSize;
+	vector<vector<float>> crossings(static_cast<size_t>(gridSize.y) * gridSize.z);
+	for (size_t t = 0; t < numTriangles; ++t)
+	{
+		const auto& a = m_vertices[m_indices[3 * t]];
+		const auto& b = m_vertices[m_indices[3 * t + 1]];
+		const auto& c = m_vertices[m_indices[3 * t + 2]];
+		const auto area = edgeFunctionYZ(a, b, c.y, c.z);
+		if (area == 0.0f) continue; // Parallel to x
+
+		// Bin the triangle into the rows it covers
+		const auto jLo = static_cast<int>(floor(((min)((min)(a.y, b.y), c.y) - m_origin.y) / m_voxelSize));
+		const auto jHi = static_cast<int>(ceil(((max)((max)(a.y, b.y), c.y) - m_origin.y) / m_voxelSize));
+		const auto kLo = static_cast<int>(floor(((min)((min)(a.z, b.z), c.z) - m_origin.z) / m_voxelSize));
+		const auto kHi = static_cast<int>(ceil(((max)((max)(a.z, b.z), c.z) - m_origin.z) / m_voxelSize));
+		for (auto k = (max)(kLo, 0); k <= (min)(kHi, static_cast<int>(gridSize.z) - 1); ++k)
+			for (auto j = (max)(jLo, 0); j <= (min)(jHi, static_cast<int>(gridSize.y) - 1); ++j)
+			{
+				const auto y = m_origin.y + j * m_voxelSize + rowOffsetY;
+				const auto z = m_origin.z + k * m_voxelSize + rowOffsetZ;
+				const auto wa = edgeFunctionYZ(b, c, y, z) / area;
+				const auto wb = edgeFunctionYZ(c, a, y, z) / area;
+				const auto wc = edgeFunctionYZ(a, b, y, z) / area;
+				if (wa >= 0.0f && wb >= 0.0f && wc >= 0.0f)
+					crossings[k * gridSize.y + j].emplace_back(wa * a.x + wb * b.x + wc * c.x);
+			}
+	}
+
+	vector<float> phi(distances.size());
+	for (auto k = 0u; k < gridSize.z; ++k)
+		for (auto j = 0u; j < gridSize.y; ++j)
+		{
+			auto& rowCrossings = crossings[k * gridSize.y + j];
+			sort(rowCrossings.begin(), rowCrossings.end());
+
+			size_t n = 0;
+			for (auto i = 0u; i < gridSize.x; ++i)
+			{
+				const auto x = m_origin.x + i * m_voxelSize;
+				while (n < rowCrossings.size() && rowCrossings[n] < x) ++n;
+
+				const auto index = getIndex(i, j, k);
+				phi[index] = (n & 1) ? -distances[index] : distances[index];
+			}
+		}
+
+	// Store the bricks intersecting the narrow band only
+	const auto numBricks = m_numBricks.x * m_numBricks.y * m_numBricks.z;
+	m_brickIndices.resize(numBricks);
+
+	uint32_t numAtlasBricks = 0;
+	for (auto b = 0u; b < numBricks; ++b)
+	{
+		const auto bi = b % m_numBricks.x * SDF_BRICK_CELLS;
+		const auto bj = b / m_numBricks.x % m_numBricks.y * SDF_BRICK_CELLS;
+		const auto bk = b / (m_numBricks.x * m_numBricks.y) * SDF_BRICK_CELLS;
+
+		auto isInBand = false;
+		for (auto k = 0u; k < SDF_BRICK_SIZE && !isInBand; ++k)
+			for (auto j = 0u; j < SDF_BRICK_SIZE && !isInBand; ++j)
+				for (auto i = 0u; i < SDF_BRICK_SIZE && !isInBand; ++i)
+					isInBand = fabs(phi[getIndex(bi + i, bj + j, bk + k)]) < m_bandWidth;
+
+		m_brickIndices[b] = isInBand ? numAtlasBricks++ :
+			(phi[getIndex(bi, bj, bk)] < 0.0f ? SDF_EMPTY_INSIDE : SDF_EMPTY_OUTSIDE);
+	}
+
+	// Pack the stored bricks into a cubic atlas
+	m_numAtlasBricks.x = (max)(static_cast<uint32_t>(ceil(cbrt(numAtlasBricks))), 1u);
+	m_numAtlasBricks.y = (max)((min)(XUSG_DIV_UP(numAtlasBricks, m_numAtlasBricks.x), m_numAtlasBricks.x), 1u);
+	m_numAtlasBricks.z = (max)(XUSG_DIV_UP(numAtlasBricks, m_numAtlasBricks.x * m_numAtlasBricks.y), 1u);
+
+	const XMUINT3 atlasSize(m_numAtlasBricks.x * SDF_BRICK_SIZE,
+		m_numAtlasBricks.y * SDF_BRICK_SIZE, m_numAtlasBricks.z * SDF_BRICK_SIZE);
+	m_atlas.assign(static_cast<size_t>(atlasSize.x) * atlasSize.y * atlasSize.z * 4, 0);
+
+	const auto getPhi = [&](int i, int j, int k)
+	{
+		i = (min)((max)(i, 0), static_cast<int>(gridSize.x) - 1);
+		j = (min)((max)(j, 0), static_cast<int>(gridSize.y) - 1);
+		k = (min)((max)(k, 0), static_cast<int>(gridSize.z) - 1);
+
+		return phi[getIndex(i, j, k)];
+	};
+
+	for (auto b = 0u; b < numBricks; ++b)
+	{
+		const auto atlasIndex = m_brickIndices[b];
+		if (atlasIndex >= SDF_EMPTY_INSIDE) continue;
+
+		const int bi = b % m_numBricks.x * SDF_BRICK_CELLS;
+		const int bj = b / m_numBricks.x % m_numBricks.y * SDF_BRICK_CELLS;
+		const int bk = b / (m_numBricks.x * m_numBricks.y) * SDF_BRICK_CELLS;
+		const XMUINT3 atlasBrick(atlasIndex % m_numAtlasBricks.x,
+			atlasIndex / m_numAtlasBricks.x % m_numAtlasBricks.y,
+			atlasIndex / (m_numAtlasBricks.x * m_numAtlasBricks.y));
+		m_brickIndices[b] = atlasBrick.x | (atlasBrick.y << 10) | (atlasBrick.z << 20);
+
+		for (auto k = 0; k < SDF_BRICK_SIZE; ++k)
+			for (auto j = 0; j < SDF_BRICK_SIZE; ++j)
+				for (auto i = 0; i < SDF_BRICK_SIZE; ++i)
+				{
+					const auto x = bi + i, y = bj + j, z = bk + k;
+					const auto texel = ((atlasBrick.z * SDF_BRICK_SIZE + k) * atlasSize.y +
+						atlasBrick.y * SDF_BRICK_SIZE + j) * atlasSize.x + atlasBrick.x * SDF_BRICK_SIZE + i;
+
+					// Gradient by central differences
+					const auto invDist = 0.5f / m_voxelSize;
+					const auto gradX = (getPhi(x + 1, y, z) - getPhi(x - 1, y, z)) * invDist;
+					const auto gradY = (getPhi(x, y + 1, z) - getPhi(x, y - 1, z)) * invDist;
+					const auto gradZ = (getPhi(x, y, z + 1) - getPhi(x, y, z - 1)) * invDist;
+
+					m_atlas[4 * texel] = XMConvertFloatToHalf(gradX);
+					m_atlas[4 * texel + 1] = XMConvertFloatToHalf(gradY);
+					m_atlas[4 * texel + 2] = XMConvertFloatToHalf(gradZ);
+					m_atlas[4 * texel + 3] = XMConvertFloatToHalf(getPhi(x, y, z));
+				}
+	}
+}
+
+bool SDFBoundary::loadCache(const wstring& fileName)
+{
+	ifstream fileStream(fileName, ios::binary);
+	if (!fileStream) return false;
+
+	SDFCacheHeader header;
+	fileStream.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!fileStream || header.Magic != SDF_CACHE_MAGIC || header.Version != SDF_CACHE_VERSION ||
+		header.Hash != hashInputs()) return false;
+
+	m_origin = header.Origin;
+	m_numBricks = header.NumBricks;
+	m_numAtlasBricks = header.NumAtlasBricks;
+
+	m_brickIndices.resize(static_cast<size_t>(m_numBricks.x) * m_numBricks.y * m_numBricks.z);
+	m_atlas.resize(static_cast<size_t>(m_numAtlasBricks.x) * m_numAtlasBricks.y * m_numAtlasBricks.z * SDF_BRICK_VOXELS * 4);
+	fileStream.read(reinterpret_cast<char*>(m_brickIndices.data()), sizeof(uint32_t) * m_brickIndices.size());
+	fileStream.read(reinterpret_cast<char*>(m_atlas.data()), sizeof(uint16_t) * m_atlas.size());
+
+	return static_cast<bool>(fileStream);
+}
+
+bool SDFBoundary::saveCache(const wstring& fileName) const
+{
+	ofstream fileStream(fileName, ios::binary);
+	if (!fileStream) return false;
+
+	SDFCacheHeader header;
+	header.Magic = SDF_CACHE_MAGIC;
+	header.Version = SDF_CACHE_VERSION;
+	header.Hash = hashInputs();
+	header.Origin = m_origin;
+	header.VoxelSize = m_voxelSize;
+	header.BandWidth = m_bandWidth;
+	header.NumBricks = m_numBricks;
+	header.NumAtlasBricks = m_numAtlasBricks;
+
+	fileStream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	fileStream.write(reinterpret_cast<const char*>(m_brickIndices.data()), sizeof(uint32_t) * m_brickIndices.size());
+	fileStream.write(reinterpret_cast<const char*>(m_atlas.data()), sizeof(uint16_t) * m_atlas.size());
+
+	return static_cast<bool>(fileStream);
+}
+
+bool SDFBoundary::createTextures(CommandList* pCommandList, vector<Resource::uptr>& uploaders)
+{
+	const auto pDevice = pCommandList->GetDevice();
+
+	// Create brick index texture
+	m_brickIndexTexture = Texture3D::MakeUnique();
+	XUSG_N_RETURN(m_brickIndexTexture->Create(pDevice, m_numBricks.x, m_numBricks.y, m_numBricks.z,
+		Format::R32_UINT, ResourceFlag::NONE, 1, MemoryFlag::NONE, L"SDFBrickIndices"), false);
+
+	SubresourceData subresource;
+	subresource.pData = m_brickIndices.data();
+	subresource.RowPitch = sizeof(uint32_t) * m_numBricks.x;
+	subresource.SlicePitch = subresource.RowPitch * m_numBricks.y;
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_brickIndexTexture->Upload(pCommandList, uploaders.back().get(), &subresource, 1,
+		ResourceState::NON_PIXEL_SHADER_RESOURCE), false);
+
+	// Create brick atlas texture of the gradients and the signed distances
+	const XMUINT3 atlasSize(m_numAtlasBricks.x * SDF_BRICK_SIZE,
+		m_numAtlasBricks.y * SDF_BRICK_SIZE, m_numAtlasBricks.z * SDF_BRICK_SIZE);
+	m_atlasTexture = Texture3D::MakeUnique();
+	XUSG_N_RETURN(m_atlasTexture->Create(pDevice, atlasSize.x, atlasSize.y, atlasSize.z,
+		Format::R16G16B16A16_FLOAT, ResourceFlag::NONE, 1, MemoryFlag::NONE, L"SDFAtlas"), false);
+
+	subresource.pData = m_atlas.data();
+	subresource.RowPitch = sizeof(uint16_t[4]) * atlasSize.x;
+	subresource.SlicePitch = subresource.RowPitch * atlasSize.y;
+	uploaders.emplace_back(Resource::MakeUnique());
+	XUSG_N_RETURN(m_atlasTexture->Upload(pCommandList, uploaders.back().get(), &subresource, 1,
+		ResourceState::NON_PIXEL_SHADER_RESOURCE), false);
+
+	// The CPU copies are no longer needed.
+	m_brickIndices = vector<uint32_t>();
+	m_atlas = vector<uint16_t>();
+
+	return true;
+}
+
+uint64_t SDFBoundary::hashInputs() const
+{
+	// FNV-1a of the mesh and the voxelization parameters
+	uint64_t hash = 0xcbf29ce484222325;
+	const auto hashBytes = [&hash](const void* pData, size_t size)
+	{
+		const auto pBytes = static_cast<const uint8_t*>(pData);
+		for (size_t i = 0; i < size; ++i) hash = (hash ^ pBytes[i]) * 0x100000001b3;
+	};
+
+	const uint32_t brickSize = SDF_BRICK_SIZE;
+	hashBytes(m_vertices.data(), sizeof(XMFLOAT3) * m_vertices.size());
+	hashBytes(m_indices.data(), sizeof(uint32_t) * m_indices.size());
+	hashBytes(&m_voxelSize, sizeof(float));
+	hashBytes(&m_bandWidth, sizeof(float));
+	hashBytes(&brickSize, sizeof(uint32_t));
+
+	return hash;
+}
@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Core/XUSG.h"
+
+// Sparse narrow-band signed distance field of the container, which is negative inside.
+// It is voxelized once from a closed triangle mesh and cached to disk.
+class SDFBoundary
+{
+public:
+	SDFBoundary();
+	virtual ~SDFBoundary();
+
+	bool Init(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders,
+		float voxelSize, float bandWidth, const wchar_t* meshFileName = nullptr);
+
+	XUSG::Texture3D* GetBrickIndices() const;
+	XUSG::Texture3D* GetAtlas() const;
+
+	const DirectX::XMFLOAT3& GetOrigin() const;
+	const DirectX::XMUINT3& GetNumBricks() const;
+	DirectX::XMFLOAT3 GetAtlasInvSize() const;
+	float GetVoxelSize() const;
+	float GetBandWidth() const;
+	void GetBounds(DirectX::XMFLOAT3& minPt, DirectX::XMFLOAT3& maxPt) const;
+
+protected:
+	void createDefaultMesh();
+	void voxelize();
+	bool loadCache(const std::wstring& fileName);
+	bool saveCache(const std::wstring& fileName) const;
+	bool createTextures(XUSG::CommandList* pCommandList, std::vector<XUSG::Resource::uptr>& uploaders);
+
+	uint64_t hashInputs() const;
+
+	std::vector<DirectX::XMFLOAT3>	m_vertices;
+	std::vector<uint32_t>			m_indices;
+
+	std::vector<uint32_t>			m_brickIndices;
+	std::vector<uint16_t>			m_atlas;
+
+	XUSG::Texture3D::uptr			m_brickIndexTexture;
+	XUSG::Texture3D::uptr			m_atlasTexture;
+
+	DirectX::XMFLOAT3				m_origin;
+	DirectX::XMUINT3				m_numBricks;
+	DirectX::XMUINT3				m_numAtlasBricks;
+	float							m_voxelSize;
+	float							m_bandWidth;
+};
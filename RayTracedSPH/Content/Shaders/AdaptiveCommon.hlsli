@@ -0,0 +1,38 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SDFCommon.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Constants
+//--------------------------------------------------------------------------------------
+static const uint NO_PARTNER = 0xffffffff;
+static const uint SPLIT_REQUEST = 0xfffffffe;
+
+//--------------------------------------------------------------------------------------
+// Smoothing radius of a particle with the given mass
+//--------------------------------------------------------------------------------------
+float CalculateSmoothRadius(float massRatio)
+{
+	// Keeps the number of neighbors constant at the rest density: h ~ m^(1/3)
+	return g_smoothRadius * pow(massRatio, 1.0 / 3.0);
+}
+
+//--------------------------------------------------------------------------------------
+// Interior particles far from the free surface and the walls can be merged in pairs.
+//--------------------------------------------------------------------------------------
+bool CanMerge(Particle particle, float minDensityRatio)
+{
+	return particle.MassRatio > 0.0 && particle.MassRatio * 2.0 <= g_maxMassRatio &&
+		minDensityRatio > g_mergeDensityRatio && GetWallDistance(particle.Pos) > g_mergeWallDist;
+}
+
+//--------------------------------------------------------------------------------------
+// Coarse particles near the free surface or the walls are split to the finest level.
+//--------------------------------------------------------------------------------------
+bool NeedsSplit(Particle particle, float minDensityRatio)
+{
+	return particle.MassRatio > 1.0 &&
+		(minDensityRatio < g_splitDensityRatio || GetWallDistance(particle.Pos) < g_splitWallDist);
+}
@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<Particle> g_rwCompactParticles : register (u0);
+RWStructuredBuffer<ParticleAABB> g_rwParticleAABBs : register (u1);
+RWBuffer<uint> g_rwCompactSleepCounters : register (u2);
+RWBuffer<uint> g_rwFreeList : register (u3);
+StructuredBuffer<Particle> g_roParticles : register (t0);
+Buffer<uint> g_roSleepCounters : register (t1);
+Buffer<uint> g_roAliveMask : register (t2);
+Buffer<uint> g_roWordOffsets : register (t3);
+Buffer<uint> g_roPoolCounts : register (t4);
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	if (DTid >= g_numParticles) return;
+
+	// Scatter the live particle to its rank among the live ones
+	const uint word = g_roAliveMask[DTid >> 5];
+	const uint bit = 1u << (DTid & 31);
+	if (word & bit)
+	{
+		const uint dst = g_roWordOffsets[DTid >> 5] + countbits(word & (bit - 1));
+		const Particle particle = g_roParticles[DTid];
+		g_rwCompactParticles[dst] = particle;
+		g_rwParticleAABBs[dst] = CalculateParticleAABB(particle);
+		g_rwCompactSleepCounters[dst] = g_roSleepCounters[DTid];
+	}
+
+	// The tail is dead, and its slots are pushed in the descending order,
+	// so that the lowest ones are acquired first.
+	const uint numAlive = g_roPoolCounts[1];
+	if (DTid >= numAlive)
+	{
+		const float nan = asfloat(0x7fc00000);
+		ParticleAABB deadAABB;
+		deadAABB.Min = nan;
+		deadAABB.Max = nan;
+
+		Particle deadParticle = (Particle)0;
+		g_rwCompactParticles[DTid] = deadParticle;
+		g_rwParticleAABBs[DTid] = deadAABB;
+		g_rwCompactSleepCounters[DTid] = 0;
+		g_rwFreeList[g_numParticles - 1 - DTid] = DTid;
+	}
+}
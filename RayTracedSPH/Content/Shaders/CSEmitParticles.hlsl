@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbPerFrame : register (b1)
+{
+	float	g_timeStep;
+	float3	g_gravity;
+	float3	g_emitterPos;
+	float	g_emitterRadius;
+	float3	g_emitterVelocity;
+	uint	g_emitCount;
+	float3	g_sinkMin;
+	uint	g_emitSeed;
+	float3	g_sinkMax;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<Particle> g_rwParticles : register (u0);
+RWStructuredBuffer<ParticleAABB> g_rwParticleAABBs : register (u1);
+RWBuffer<uint> g_rwSleepCounters : register (u2);
+RWBuffer<uint> g_rwFreeList : register (u3);
+RWBuffer<uint> g_rwPoolCounts : register (u4);	// 0: free count, 1: high-water mark of the live slots
+RWBuffer<uint> g_rwAliveMask : register (u5);
+
+//--------------------------------------------------------------------------------------
+// Pseudo-random position on the emitter disk, which faces the emitting velocity
+//--------------------------------------------------------------------------------------
+float3 GetEmitPosition(uint seed)
+{
+	const uint hash = WangHash(seed);
+	const float r = g_emitterRadius * sqrt((hash & 0xffff) / 65535.0);
+	const float theta = 6.2831853 * (hash >> 16) / 65536.0;
+
+	const float3 n = normalize(g_emitterVelocity);
+	const float3 t = normalize(abs(n.y) < 0.99 ? cross(n, float3(0.0, 1.0, 0.0)) : cross(n, float3(1.0, 0.0, 0.0)));
+	const float3 b = cross(n, t);
+
+	return g_emitterPos + r * (cos(theta) * t + sin(theta) * b);
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	if (DTid >= g_emitCount) return;
+
+	// Acquire a free slot, and give it back if the pool is full.
+	uint top;
+	InterlockedAdd(g_rwPoolCounts[0], 0xffffffff, top);
+	if (int(top) <= 0)
+	{
+		InterlockedAdd(g_rwPoolCounts[0], 1);
+		return;
+	}
+	const uint slot = g_rwFreeList[top - 1];
+
+	Particle particle;
+	particle.Pos = GetEmitPosition(g_emitSeed + DTid);
+	particle.Velocity = g_emitterVelocity;
+	particle.MassRatio = 1.0;
+	particle.SmoothRadius = g_smoothRadius;
+
+	// Update
+	g_rwParticles[slot] = particle;
+	g_rwParticleAABBs[slot] = CalculateParticleAABB(particle);
+	g_rwSleepCounters[slot] = 0;
+	InterlockedOr(g_rwAliveMask[slot >> 5], 1u << (slot & 31));
+	InterlockedMax(g_rwPoolCounts[1], slot + 1);
+}
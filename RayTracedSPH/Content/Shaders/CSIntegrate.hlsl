@@ -3,6 +3,8 @@
 //--------------------------------------------------------------------------------------
 
 #include "Common.hlsli"
+#include "SDFCommon.hlsli"
+#include "ObstacleCommon.hlsli"
 #include "SharedConst.h"
 
 //--------------------------------------------------------------------------------------
@@ -12,6 +14,13 @@ cbuffer cbPerFrame : register (b1)
 {
 	float	g_timeStep;
 	float3	g_gravity;
+	float3	g_emitterPos;
+	float	g_emitterRadius;
+	float3	g_emitterVelocity;
+	uint	g_emitCount;
+	float3	g_sinkMin;
+	uint	g_emitSeed;
+	float3	g_sinkMax;
 };
 
 //--------------------------------------------------------------------------------------
@@ -19,21 +28,72 @@ cbuffer cbPerFrame : register (b1)
 //--------------------------------------------------------------------------------------
 RWStructuredBuffer<Particle> g_rwParticles : register (u0);
 RWStructuredBuffer<ParticleAABB> g_rwParticleAABBs : register (u1);
+RWBuffer<uint> g_rwSleepCounters : register (u2);
+RWBuffer<uint> g_rwParticleCounts : register (u3);
+RWBuffer<uint> g_rwAliveMask : register (u4);
+RWBuffer<uint> g_rwFreeList : register (u5);
+RWBuffer<uint> g_rwPoolCounts : register (u6);
 Buffer<float3> g_roAccelerations : register (t0);
+Buffer<float> g_roNumberDensities : register (t1);
 
-[numthreads(GROUP_SIZE, 1, 1)]
-void main(uint DTid : SV_DispatchThreadID)
+groupshared uint g_numActiveParticles;
+groupshared uint g_numAliveParticles;
+groupshared uint g_aliveMask[GROUP_SIZE / 32];
+
+//--------------------------------------------------------------------------------------
+// Remove a particle that has entered the sink, and release its slot
+//--------------------------------------------------------------------------------------
+bool Sink(uint index, Particle particle)
 {
-	Particle particle = g_rwParticles[DTid];
-	float3 acceleration = g_roAccelerations[DTid];
+	if (any(particle.Pos < g_sinkMin || particle.Pos > g_sinkMax)) return false;
 
-	// Apply the forces from the map walls
-	[unroll]
-	for (uint i = 0; i < 6; ++i)
-	{
-		float dist = dot(float4(particle.Pos, 1.0), g_planes[i]);
-		acceleration += min(dist, 0) * -g_wallStiffness * g_planes[i].xyz;
-	}
+	// The AABB of a dead particle is inactive in the BVH.
+	const float nan = asfloat(0x7fc00000);
+	ParticleAABB deadAABB;
+	deadAABB.Min = nan;
+	deadAABB.Max = nan;
+	particle.MassRatio = 0.0;
+
+	g_rwParticles[index] = particle;
+	g_rwParticleAABBs[index] = deadAABB;
+
+	uint slot;
+	InterlockedAdd(g_rwPoolCounts[0], 1, slot);
+	g_rwFreeList[slot] = index;
+
+	return true;
+}
+
+//--------------------------------------------------------------------------------------
+// Adapt the smoothing radius to the local number density of the density pass
+//--------------------------------------------------------------------------------------
+float UpdateSmoothRadius(uint index, float smoothRadius)
+{
+	// Implements this equation:
+	// h_i = h_0 * (rho_0 / (m_0 * SUM_j(W(r_ij, h_ij))))^(1/3)
+	// which keeps the neighbor count near the one at the rest spacing, relaxed over the steps since the
+	// number density depends on h itself. The range is bounded by the AABB extents of the BLAS.
+	const float numberDensity = max(g_roNumberDensities[index], 1.0e-3 * g_restDensity);
+	const float targetRadius = g_smoothRadius * pow(g_restDensity / numberDensity, 1.0 / 3.0);
+	smoothRadius = lerp(smoothRadius, targetRadius, g_smoothRadiusRelaxation);
+
+	return clamp(smoothRadius, g_minSmoothRadius, g_maxSmoothRadius);
+}
+
+//--------------------------------------------------------------------------------------
+// Integrate an active particle
+//--------------------------------------------------------------------------------------
+Particle Integrate(uint index, Particle particle, uint sleepCounter)
+{
+	float3 acceleration = g_roAccelerations[index];
+
+	// Apply the penalty force from the boundary SDF
+	const float4 boundary = SampleBoundary(particle.Pos);
+	acceleration += max(boundary.w, 0.0) * -g_wallStiffness * boundary.xyz;
+
+	// Apply the penalty force from the closest obstacle within the smoothing radius
+	const float4 contact = FindClosestObstacle(particle.Pos, g_smoothRadius);
+	acceleration += (g_smoothRadius - contact.w) * g_wallStiffness * contact.xyz;
 
 	// Apply gravity
 	acceleration += g_gravity;
@@ -41,12 +101,61 @@ void main(uint DTid : SV_DispatchThreadID)
 	// Integrate
 	particle.Velocity += g_timeStep * acceleration;
 	particle.Pos += g_timeStep * particle.Velocity;
+	particle.Pos = WrapPeriodic(particle.Pos);
+	if (g_smoothRadiusRelaxation > 0.0) particle.SmoothRadius = UpdateSmoothRadius(index, particle.SmoothRadius);
+
+	const ParticleAABB aabb = CalculateParticleAABB(particle);
 
-	ParticleAABB aabb;
-	aabb.Min = particle.Pos - g_smoothRadius;
-	aabb.Max = particle.Pos + g_smoothRadius;
+	// Count the calm steps, the particle falls asleep after the last one if its neighbors are settled.
+	const bool isCalm = dot(particle.Velocity, particle.Velocity) < g_sleepSpeedSq &&
+		dot(acceleration, acceleration) < g_sleepAccelerationSq;
 
 	// Update
-	g_rwParticles[DTid] = particle;
-	g_rwParticleAABBs[DTid] = aabb;
+	g_rwParticles[index] = particle;
+	g_rwParticleAABBs[index] = aabb;
+	g_rwSleepCounters[index] = isCalm ? min(sleepCounter + 1, g_sleepSteps - 1) : 0;
+
+	return particle;
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID, uint GTid : SV_GroupIndex)
+{
+	if (GTid == 0)
+	{
+		g_numActiveParticles = 0;
+		g_numAliveParticles = 0;
+	}
+	if (GTid < GROUP_SIZE / 32) g_aliveMask[GTid] = 0;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Dead and sleeping particles are skipped.
+	Particle particle = g_rwParticles[DTid];
+	if (DTid < g_numParticles && particle.MassRatio > 0.0)
+	{
+		const uint sleepCounter = g_rwSleepCounters[DTid];
+		if (sleepCounter < g_sleepSteps)
+		{
+			particle = Integrate(DTid, particle, sleepCounter);
+			InterlockedAdd(g_numActiveParticles, 1);
+		}
+
+		if (!Sink(DTid, particle))
+		{
+			InterlockedOr(g_aliveMask[GTid >> 5], 1u << (GTid & 31));
+			InterlockedAdd(g_numAliveParticles, 1);
+		}
+	}
+
+	GroupMemoryBarrierWithGroupSync();
+
+	// The words of the alive mask are owned by the groups.
+	if (GTid < GROUP_SIZE / 32) g_rwAliveMask[(DTid - GTid) / 32 + GTid] = g_aliveMask[GTid];
+
+	// Count the active and the alive particles
+	if (GTid == 0)
+	{
+		InterlockedAdd(g_rwParticleCounts[0], g_numActiveParticles);
+		InterlockedAdd(g_rwParticleCounts[1], g_numAliveParticles);
+	}
 }
@@ -0,0 +1,59 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "AdaptiveCommon.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<Particle> g_rwParticles : register (u0);
+RWStructuredBuffer<ParticleAABB> g_rwParticleAABBs : register (u1);
+RWBuffer<uint> g_rwSleepCounters : register (u2);
+RWBuffer<uint> g_rwFreeList : register (u3);
+RWBuffer<uint> g_rwPoolCounts : register (u4);	// 0: free count, 1: high-water mark of the live slots
+RWBuffer<uint> g_rwAliveMask : register (u5);
+Buffer<uint> g_roPartners : register (t0);
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	// Only mutual partners are merged, and the one with the lower index survives.
+	const uint partner = g_roPartners[DTid];
+	if (partner >= g_numParticles || partner < DTid) return;
+	if (g_roPartners[partner] != DTid) return;
+
+	Particle particle = g_rwParticles[DTid];
+	Particle adjParticle = g_rwParticles[partner];
+
+	// Conserve the mass, the center of mass, and the momentum
+	// The partner may be a periodic image across a periodic face.
+	const float massRatio = particle.MassRatio + adjParticle.MassRatio;
+	const float3 disp = GetMinImageDisplacement(adjParticle.Pos - particle.Pos);
+	particle.Pos = WrapPeriodic(particle.Pos + adjParticle.MassRatio / massRatio * disp);
+	particle.Velocity = (particle.MassRatio * particle.Velocity + adjParticle.MassRatio * adjParticle.Velocity) / massRatio;
+	particle.MassRatio = massRatio;
+	particle.SmoothRadius = CalculateSmoothRadius(massRatio);
+
+	// The AABB of a dead particle is inactive in the BVH.
+	const float nan = asfloat(0x7fc00000);
+	ParticleAABB deadAABB;
+	deadAABB.Min = nan;
+	deadAABB.Max = nan;
+	adjParticle.MassRatio = 0.0;
+
+	// Update
+	g_rwParticles[DTid] = particle;
+	g_rwParticleAABBs[DTid] = CalculateParticleAABB(particle);
+	g_rwSleepCounters[DTid] = 0;
+	g_rwParticles[partner] = adjParticle;
+	g_rwParticleAABBs[partner] = deadAABB;
+
+	// Release the slot of the merged particle
+	uint slot;
+	InterlockedAnd(g_rwAliveMask[partner >> 5], ~(1u << (partner & 31)));
+	InterlockedAdd(g_rwPoolCounts[0], 1, slot);
+	g_rwFreeList[slot] = partner;
+}
@@ -0,0 +1,49 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "PBFCommon.hlsli"
+#include "SDFCommon.hlsli"
+#include "ObstacleCommon.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbPerFrame : register (b1)
+{
+	float	g_timeStep;
+	float3	g_gravity;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<Particle> g_rwPredParticles : register (u0);
+RWStructuredBuffer<ParticleAABB> g_rwParticleAABBs : register (u1);
+StructuredBuffer<Particle> g_roParticles : register (t0);
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	Particle particle = g_roParticles[DTid];
+
+	// Apply gravity
+	particle.Velocity += g_timeStep * g_gravity;
+
+	// Predict position
+	particle.Pos += g_timeStep * particle.Velocity;
+	particle.Pos = WrapPeriodic(particle.Pos);
+	particle.Pos = ProjectOutOfObstacles(particle.Pos, g_smoothRadius);
+	particle.Pos = ProjectOntoBoundary(particle.Pos);
+
+	// Neighbors are searched once per step around the predicted positions
+	ParticleAABB aabb;
+	aabb.Min = particle.Pos - g_smoothRadius;
+	aabb.Max = particle.Pos + g_smoothRadius;
+
+	// Update
+	g_rwPredParticles[DTid] = particle;
+	g_rwParticleAABBs[DTid] = aabb;
+}
@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "PBFCommon.hlsli"
+#include "SDFCommon.hlsli"
+#include "ObstacleCommon.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbPerFrame : register (b1)
+{
+	float	g_timeStep;
+	float3	g_gravity;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<Particle> g_rwPredParticles : register (u0);
+StructuredBuffer<Particle> g_roParticles : register (t0);
+Buffer<float3> g_roDeltaPositions : register (t1);
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	Particle particle = g_rwPredParticles[DTid];
+
+	// Apply the Jacobi position correction
+	particle.Pos += g_roDeltaPositions[DTid];
+	particle.Pos = ProjectOutOfObstacles(particle.Pos, g_smoothRadius);
+	particle.Pos = ProjectOntoBoundary(particle.Pos);
+	particle.Pos = WrapPeriodic(particle.Pos);
+
+	// Update velocity from the corrected displacement, which may cross a periodic face
+	particle.Velocity = GetMinImageDisplacement(particle.Pos - g_roParticles[DTid].Pos) / g_timeStep;
+
+	g_rwPredParticles[DTid] = particle;
+}
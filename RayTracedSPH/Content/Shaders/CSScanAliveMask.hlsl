@@ -0,0 +1,57 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWBuffer<uint> g_rwWordOffsets : register (u0);
+RWBuffer<uint> g_rwPoolCounts : register (u1);	// 0: free count, 1: high-water mark of the live slots
+Buffer<uint> g_roAliveMask : register (t0);
+
+groupshared uint g_sums[SCAN_GROUP_SIZE];
+
+//--------------------------------------------------------------------------------------
+// Exclusive prefix sum of the alive particles over the mask words in a single group
+//--------------------------------------------------------------------------------------
+[numthreads(SCAN_GROUP_SIZE, 1, 1)]
+void main(uint GTid : SV_GroupIndex)
+{
+	// Each thread takes a contiguous chunk of the words.
+	const uint numWords = (g_numParticles + 31) / 32;
+	const uint chunkSize = (numWords + SCAN_GROUP_SIZE - 1) / SCAN_GROUP_SIZE;
+	const uint first = GTid * chunkSize;
+	const uint last = min(first + chunkSize, numWords);
+
+	uint sum = 0;
+	for (uint i = first; i < last; ++i) sum += countbits(g_roAliveMask[i]);
+	g_sums[GTid] = sum;
+	GroupMemoryBarrierWithGroupSync();
+
+	// Inclusive scan of the chunk sums
+	for (uint offset = 1; offset < SCAN_GROUP_SIZE; offset <<= 1)
+	{
+		const uint adjSum = GTid >= offset ? g_sums[GTid - offset] : 0;
+		GroupMemoryBarrierWithGroupSync();
+		g_sums[GTid] += adjSum;
+		GroupMemoryBarrierWithGroupSync();
+	}
+
+	uint wordOffset = g_sums[GTid] - sum;
+	for (uint j = first; j < last; ++j)
+	{
+		g_rwWordOffsets[j] = wordOffset;
+		wordOffset += countbits(g_roAliveMask[j]);
+	}
+
+	// After the compaction, the live particles are dense and the rest are all free.
+	if (GTid == SCAN_GROUP_SIZE - 1)
+	{
+		const uint numAlive = g_sums[GTid];
+		g_rwPoolCounts[0] = g_numParticles - numAlive;
+		g_rwPoolCounts[1] = numAlive;
+	}
+}
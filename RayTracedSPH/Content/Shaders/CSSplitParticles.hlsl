@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "AdaptiveCommon.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<Particle> g_rwParticles : register (u0);
+RWStructuredBuffer<ParticleAABB> g_rwParticleAABBs : register (u1);
+RWBuffer<uint> g_rwSleepCounters : register (u2);
+RWBuffer<uint> g_rwFreeList : register (u3);
+RWBuffer<uint> g_rwPoolCounts : register (u4);	// 0: free count, 1: high-water mark of the live slots
+RWBuffer<uint> g_rwAliveMask : register (u5);
+Buffer<uint> g_roPartners : register (t0);
+
+//--------------------------------------------------------------------------------------
+// Pseudo-random unit direction per particle
+//--------------------------------------------------------------------------------------
+float3 GetSplitDirection(uint index)
+{
+	const uint seed = WangHash(index);
+	const float3 dir = float3(seed & 0x3ff, (seed >> 10) & 0x3ff, (seed >> 20) & 0x3ff) / 1023.0 - 0.5;
+
+	return dot(dir, dir) > 0.0 ? normalize(dir) : float3(1.0, 0.0, 0.0);
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint DTid : SV_DispatchThreadID)
+{
+	// The requests were made before any slot got reused, so newly split particles never show up here.
+	if (g_roPartners[DTid] != SPLIT_REQUEST) return;
+
+	// Acquire a free slot, and give it back if the free list has been used up.
+	uint top;
+	InterlockedAdd(g_rwPoolCounts[0], 0xffffffff, top);
+	if (int(top) <= 0)
+	{
+		InterlockedAdd(g_rwPoolCounts[0], 1);
+		return;
+	}
+	const uint slot = g_rwFreeList[top - 1];
+	InterlockedOr(g_rwAliveMask[slot >> 5], 1u << (slot & 31));
+	InterlockedMax(g_rwPoolCounts[1], slot + 1);
+
+	// Split into 2 halves of the mass with the same velocity, which conserves the mass and the momentum,
+	// and place them symmetrically about the original center of mass.
+	Particle particle = g_rwParticles[DTid];
+	particle.MassRatio *= 0.5;
+	particle.SmoothRadius = CalculateSmoothRadius(particle.MassRatio);
+
+	// About half of the rest spacing of the smaller particles
+	const float3 offset = 0.375 * particle.SmoothRadius * GetSplitDirection(DTid);
+	Particle newParticle = particle;
+	particle.Pos = WrapPeriodic(particle.Pos + offset);
+	newParticle.Pos = WrapPeriodic(newParticle.Pos - offset);
+
+	// Update
+	g_rwParticles[DTid] = particle;
+	g_rwParticleAABBs[DTid] = CalculateParticleAABB(particle);
+	g_rwSleepCounters[DTid] = 0;
+	g_rwParticles[slot] = newParticle;
+	g_rwParticleAABBs[slot] = CalculateParticleAABB(newParticle);
+	g_rwSleepCounters[slot] = 0;
+}
@@ -0,0 +1,36 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "Common.hlsli"
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWBuffer<uint> g_rwDispatchArgs : register (u0);
+Buffer<uint> g_roPoolCounts : register (t0);
+
+//--------------------------------------------------------------------------------------
+// Indirect dispatches cover the live slots only, up to the high-water mark.
+//--------------------------------------------------------------------------------------
+[numthreads(1, 1, 1)]
+void main()
+{
+	const uint numSlots = g_roPoolCounts[1];
+
+	// Compute dispatch
+	g_rwDispatchArgs[0] = (numSlots + GROUP_SIZE - 1) / GROUP_SIZE;
+	g_rwDispatchArgs[1] = 1;
+	g_rwDispatchArgs[2] = 1;
+
+	// Ray dispatches, where the shader tables are filled in by the command list
+	[unroll]
+	for (uint i = 1; i <= NUM_RT_DISPATCHES; ++i)
+	{
+		const uint base = (DISPATCH_ARG_STRIDE * i + g_dispatchRaysArgOffset) / 4;
+		g_rwDispatchArgs[base] = numSlots;
+		g_rwDispatchArgs[base + 1] = 1;
+		g_rwDispatchArgs[base + 2] = 1;
+	}
+}
@@ -9,6 +9,8 @@ struct Particle
 {
 	float3 Pos;
 	float3 Velocity;
+	float MassRatio;	// In units of the initial particle mass, 0 for a dead particle
+	float SmoothRadius;
 };
 
 struct ParticleAABB
@@ -31,5 +33,94 @@ cbuffer cbSimulation : register (b0)
 	float	g_wallStiffness;
 	uint	g_numParticles;
 
-	float4	g_planes[6];
+	float3	g_sdfOrigin;
+	float	g_sdfInvVoxelSize;
+	float3	g_sdfAtlasInvSize;
+	float	g_sdfBandWidth;
+	uint3	g_sdfNumBricks;
+
+	float	g_pbfRelaxation;
+	float	g_pbfTensileK;
+	float	g_pbfTensileInvDq;
+	float	g_xsphViscosity;
+
+	float	g_sleepSpeedSq;
+	float	g_sleepAccelerationSq;
+	uint	g_sleepSteps;
+	float	g_maxSmoothRadius;
+
+	float	g_maxMassRatio;
+	float	g_splitDensityRatio;
+	float	g_mergeDensityRatio;
+	float	g_splitWallDist;
+	float	g_mergeWallDist;
+	uint	g_dispatchRaysArgOffset;
+	float3	g_periodMin;
+	float3	g_periodSize;
+	uint	g_periodicAxes;	// Bit mask of the axes with periodic boundaries
+
+	float	g_minSmoothRadius;
+	float	g_smoothRadiusRelaxation;	// 0 for the smoothing radii set by the mass only
 };
+
+//--------------------------------------------------------------------------------------
+// Get the support radius of a particle pair, which is symmetric
+//--------------------------------------------------------------------------------------
+float GetPairSmoothRadius(float smoothRadius, float adjSmoothRadius)
+{
+	return 0.5 * (smoothRadius + adjSmoothRadius);
+}
+
+//--------------------------------------------------------------------------------------
+// Calculate the AABB of a particle, which covers all pairs it can be involved in
+//--------------------------------------------------------------------------------------
+ParticleAABB CalculateParticleAABB(Particle particle)
+{
+	const float extent = GetPairSmoothRadius(particle.SmoothRadius, g_maxSmoothRadius);
+
+	ParticleAABB aabb;
+	aabb.Min = particle.Pos - extent;
+	aabb.Max = particle.Pos + extent;
+
+	return aabb;
+}
+
+//--------------------------------------------------------------------------------------
+// Get the mask of the periodic axes
+//--------------------------------------------------------------------------------------
+float3 GetPeriodicMask()
+{
+	return (g_periodicAxes >> uint3(0, 1, 2)) & 1;
+}
+
+//--------------------------------------------------------------------------------------
+// Wrap the position into the periodic domain along the periodic axes
+//--------------------------------------------------------------------------------------
+float3 WrapPeriodic(float3 pos)
+{
+	const float3 wrapped = pos - floor((pos - g_periodMin) / g_periodSize) * g_periodSize;
+
+	return lerp(pos, wrapped, GetPeriodicMask());
+}
+
+//--------------------------------------------------------------------------------------
+// Get the displacement to the nearest periodic image along the periodic axes
+//--------------------------------------------------------------------------------------
+float3 GetMinImageDisplacement(float3 disp)
+{
+	return disp - GetPeriodicMask() * round(disp / g_periodSize) * g_periodSize;
+}
+
+//--------------------------------------------------------------------------------------
+// Wang hash
+//--------------------------------------------------------------------------------------
+uint WangHash(uint seed)
+{
+	seed = (seed ^ 61) ^ (seed >> 16);
+	seed *= 9;
+	seed ^= seed >> 4;
+	seed *= 0x27d4eb2d;
+	seed ^= seed >> 15;
+
+	return seed;
+}
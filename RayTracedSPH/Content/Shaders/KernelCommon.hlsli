@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Constant buffer
+//--------------------------------------------------------------------------------------
+cbuffer cbPerFrame : register (b1)
+{
+	float	g_timeStep;
+	float3	g_gravity;
+	float3	g_emitterPos;
+	float	g_emitterRadius;
+	float3	g_emitterVelocity;
+	uint	g_emitCount;
+	float3	g_sinkMin;
+	uint	g_emitSeed;
+	float3	g_sinkMax;
+	uint	g_kernelType;	// Analytic, or the row + 1 of the kernel table
+};
+
+//--------------------------------------------------------------------------------------
+// Kernel table
+//--------------------------------------------------------------------------------------
+Texture2D g_txKernelTable : register (t12);
+
+SamplerState g_smpKernelTable : register (s1);
+
+//--------------------------------------------------------------------------------------
+// Look up the kernels at r^2 / h^2 with linear interpolation, whose values are scaled
+// to the units of the analytic poly6, spiky and viscosity kernels
+// x: (h^2 - r^2)^3 / h^6, y: (h - r)^2 / h^2, z: (h - r) / h
+//--------------------------------------------------------------------------------------
+float3 LookupKernels(float r_sq, float h)
+{
+	const float u = (r_sq / (h * h) * (KERNEL_TABLE_SIZE - 1) + 0.5) / KERNEL_TABLE_SIZE;
+	const float v = (g_kernelType - 0.5) / NUM_KERNEL_TABLES;
+
+	return g_txKernelTable.SampleLevel(g_smpKernelTable, float2(u, v), 0.0).xyz;
+}
@@ -0,0 +1,140 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#define OBSTACLE_STACK_SIZE 32
+
+//--------------------------------------------------------------------------------------
+// Structs
+//--------------------------------------------------------------------------------------
+struct ObstacleNode
+{
+	float3 Min;
+	uint Next;	// Left child for an interior node, or the first triangle for a leaf
+	float3 Max;
+	uint Count;	// Number of triangles, 0 for an interior node
+};
+
+struct ObstacleTriangle
+{
+	float3 V0;
+	float3 V1;
+	float3 V2;
+};
+
+//--------------------------------------------------------------------------------------
+// Obstacle BVH buffers
+//--------------------------------------------------------------------------------------
+StructuredBuffer<ObstacleNode> g_roObstacleNodes : register (t10);
+StructuredBuffer<ObstacleTriangle> g_roObstacleTriangles : register (t11);
+
+//--------------------------------------------------------------------------------------
+// Squared distance from the point to the node box, which is 0 inside
+//--------------------------------------------------------------------------------------
+float GetNodeDistanceSq(ObstacleNode node, float3 pos)
+{
+	const float3 d = max(max(node.Min - pos, pos - node.Max), 0.0);
+
+	return dot(d, d);
+}
+
+//--------------------------------------------------------------------------------------
+// Closest point on a triangle (Real-Time Collision Detection, 5.1.5)
+//--------------------------------------------------------------------------------------
+float3 ClosestPointOnTriangle(float3 p, ObstacleTriangle tri)
+{
+	const float3 ab = tri.V1 - tri.V0;
+	const float3 ac = tri.V2 - tri.V0;
+	const float3 ap = p - tri.V0;
+	const float d1 = dot(ab, ap);
+	const float d2 = dot(ac, ap);
+	if (d1 <= 0.0 && d2 <= 0.0) return tri.V0;
+
+	const float3 bp = p - tri.V1;
+	const float d3 = dot(ab, bp);
+	const float d4 = dot(ac, bp);
+	if (d3 >= 0.0 && d4 <= d3) return tri.V1;
+
+	const float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) return tri.V0 + d1 / (d1 - d3) * ab;
+
+	const float3 cp = p - tri.V2;
+	const float d5 = dot(ab, cp);
+	const float d6 = dot(ac, cp);
+	if (d6 >= 0.0 && d5 <= d6) return tri.V2;
+
+	const float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) return tri.V0 + d2 / (d2 - d6) * ac;
+
+	const float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0)
+		return tri.V1 + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (tri.V2 - tri.V1);
+
+	const float denom = 1.0 / (va + vb + vc);
+
+	return tri.V0 + vb * denom * ab + vc * denom * ac;
+}
+
+//--------------------------------------------------------------------------------------
+// Find the closest obstacle triangle within the radius
+// xyz: contact normal pointing to the particle, w: distance (radius if none)
+//--------------------------------------------------------------------------------------
+float4 FindClosestObstacle(float3 pos, float radius)
+{
+	float4 contact = float4(0.0.xxx, radius);
+	float bestDistSq = radius * radius;
+
+	// Particles far from all obstacles leave at the root. The build limits the depth to the stack size.
+	uint stack[OBSTACLE_STACK_SIZE];
+	uint stackSize = 0;
+	if (GetNodeDistanceSq(g_roObstacleNodes[0], pos) < bestDistSq) stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const ObstacleNode node = g_roObstacleNodes[stack[--stackSize]];
+
+		if (node.Count > 0)
+		{
+			// Leaf
+			for (uint i = 0; i < node.Count; ++i)
+			{
+				const ObstacleTriangle tri = g_roObstacleTriangles[node.Next + i];
+				const float3 disp = pos - ClosestPointOnTriangle(pos, tri);
+				const float distSq = dot(disp, disp);
+				if (distSq < bestDistSq)
+				{
+					// Fall back to the face normal when the particle is exactly on the triangle
+					const float3 n = distSq > 0.0 ? disp : cross(tri.V1 - tri.V0, tri.V2 - tri.V0);
+					bestDistSq = distSq;
+					contact = float4(normalize(n), sqrt(distSq));
+				}
+			}
+		}
+		else
+		{
+			// Visit the nearer child first to shrink the search radius early
+			const float distSqL = GetNodeDistanceSq(g_roObstacleNodes[node.Next], pos);
+			const float distSqR = GetNodeDistanceSq(g_roObstacleNodes[node.Next + 1], pos);
+			const bool isRightNearer = distSqR < distSqL;
+			const uint nearChild = isRightNearer ? node.Next + 1 : node.Next;
+			const uint farChild = isRightNearer ? node.Next : node.Next + 1;
+			const float nearDistSq = min(distSqL, distSqR);
+			const float farDistSq = max(distSqL, distSqR);
+
+			if (farDistSq < bestDistSq && stackSize < OBSTACLE_STACK_SIZE) stack[stackSize++] = farChild;
+			if (nearDistSq < bestDistSq && stackSize < OBSTACLE_STACK_SIZE) stack[stackSize++] = nearChild;
+		}
+	}
+
+	return contact;
+}
+
+//--------------------------------------------------------------------------------------
+// Project the position out of the obstacles by the radius
+//--------------------------------------------------------------------------------------
+float3 ProjectOutOfObstacles(float3 pos, float radius)
+{
+	const float4 contact = FindClosestObstacle(pos, radius);
+
+	return pos + (radius - contact.w) * contact.xyz;
+}
@@ -0,0 +1,17 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+//--------------------------------------------------------------------------------------
+// Density-constraint gradient calculation
+//--------------------------------------------------------------------------------------
+float3 CalculateConstraintGrad(float r, float3 disp)
+{
+	const float d = g_smoothRadius - r;
+	// Implements this equation (the neighbor term of GRAD_i(C_i), which is -GRAD_j(C_i)):
+	// particleMass / rho_0 * GRAD(W_spikey(r, h))
+	// GRAD(W_spikey(r, h)) = -45 / (pi * h^6) * (h - r)^2
+	// g_pressureGradCoef = particleMass * -45.0f / (PI * g_smoothRadius^6)
+
+	return r > 0.0 ? -g_pressureGradCoef / g_restDensity * d * d * disp / r : 0.0;
+}
@@ -34,6 +34,48 @@ RayDesc GenerateRay(Particle particle)
 	return ray;
 }
 
+//--------------------------------------------------------------------------------------
+// Get the shift of the ray origin to the periodic image across each periodic face
+// within the radius, which is 0 along the other axes
+//--------------------------------------------------------------------------------------
+float3 GetPeriodicShift(float3 pos, float radius)
+{
+	const float3 nearMin = pos - g_periodMin < radius;
+	const float3 nearMax = g_periodMin + g_periodSize - pos < radius;
+
+	return GetPeriodicMask() * (nearMin - nearMax) * g_periodSize;
+}
+
+//--------------------------------------------------------------------------------------
+// Shift the ray origin to one of the up to 7 periodic images, where the bits of the
+// image select the shifted axes
+//--------------------------------------------------------------------------------------
+bool ShiftToPeriodicImage(uint image, float3 shift, inout float3 origin)
+{
+	const float3 isShifted = (image >> uint3(0, 1, 2)) & 1;
+	const float3 hasShift = shift != 0.0;
+	origin += isShifted * shift;
+
+	return dot(isShifted, hasShift) == dot(isShifted, 1.0);
+}
+
+//--------------------------------------------------------------------------------------
+// Trace the ray of the particle, and its periodic images near the periodic faces
+//--------------------------------------------------------------------------------------
+#define TRACE_NEIGHBOR_RAYS(particle, ray, payload) \
+	TraceRay(g_bvhParticles, RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, ~0, 0, 1, 0, ray, payload); \
+	if (g_periodicAxes) \
+	{ \
+		const float3 shift = GetPeriodicShift(particle.Pos, \
+			GetPairSmoothRadius(particle.SmoothRadius, g_maxSmoothRadius)); \
+		for (uint image = 1; image < 8; ++image) \
+		{ \
+			RayDesc imageRay = ray; \
+			if (ShiftToPeriodicImage(image, shift, imageRay.Origin)) \
+				TraceRay(g_bvhParticles, RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, ~0, 0, 1, 0, imageRay, payload); \
+		} \
+	}
+
 //--------------------------------------------------------------------------------------
 // Get THit 
 //--------------------------------------------------------------------------------------
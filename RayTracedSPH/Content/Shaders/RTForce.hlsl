@@ -3,6 +3,7 @@
 //--------------------------------------------------------------------------------------
 
 #include "RTCommon.hlsli"
+#include "KernelCommon.hlsli"
 
 //--------------------------------------------------------------------------------------
 // Structs
@@ -12,19 +13,23 @@ struct RayPayload
 	float Pressure;
 	float3 Force;
 	float3 Velocity;
+	float MinDensity;
 };
 
 struct HitAttributes
 {
 	float3 Disp;
 	float R_sq;
+	float H;
 };
 
 //--------------------------------------------------------------------------------------
-// Buffer
+// Buffers
 //--------------------------------------------------------------------------------------
 RWBuffer<float3> g_rwAccelerations : register (u0);
+RWBuffer<float> g_rwMinDensityRatios : register (u1);
 Buffer<float> g_roDensities : register (t1);
+Buffer<uint> g_roSleepCounters : register (t2);
 
 //--------------------------------------------------------------------------------------
 // Pressure calculation
@@ -45,7 +50,13 @@ float CalculatePressure(float density)
 void raygenMain()
 {
 	const uint index = DispatchRaysIndex().x;
+
+	// A sleeping particle is not integrated.
+	if (g_roSleepCounters[index] >= g_sleepSteps) return;
+
 	const Particle particle = g_roParticles[index];
+	if (particle.MassRatio <= 0.0) return;
+
 	const float density = g_roDensities[index];
 	const RayDesc ray = GenerateRay(particle);
 
@@ -54,9 +65,13 @@ void raygenMain()
 	payload.Pressure = CalculatePressure(density);
 	payload.Velocity = particle.Velocity;
 	payload.Force = 0.0;
-	TraceRay(g_bvhParticles, RAY_FLAG_SKIP_CLOSEST_HIT_SHADER, ~0, 0, 1, 0, ray, payload);
+	payload.MinDensity = density;
+	TRACE_NEIGHBOR_RAYS(particle, ray, payload);
 
 	g_rwAccelerations[index] = density > 0.0 ? payload.Force / density : 0.0;
+
+	// The kernel deficiency around the free surface lowers the densities of the particles nearby.
+	g_rwMinDensityRatios[index] = payload.MinDensity / g_restDensity;
 }
 
 //--------------------------------------------------------------------------------------
@@ -70,11 +85,12 @@ void intersectionMain()
 	const float r_sq = dot(disp, disp);
 	const uint hitIndex = PrimitiveIndex();
 	const uint index = DispatchRaysIndex().x;
+	const float h = GetPairSmoothRadius(g_roParticles[index].SmoothRadius, g_roParticles[hitIndex].SmoothRadius);
 
-	if (r_sq < g_smoothRadius * g_smoothRadius 
+	if (r_sq < h * h
 		&& index != hitIndex)
 	{
-		const HitAttributes attr = { disp, r_sq };
+		const HitAttributes attr = { disp, r_sq, h };
 		ReportHit(thit, /*hitKind*/ 0, attr);
 	}
 }
@@ -82,29 +98,31 @@ void intersectionMain()
 //--------------------------------------------------------------------------------------
 // Pressure gradient calculation
 //--------------------------------------------------------------------------------------
-float3 CalculateGradPressure(float r, float d, float pressure, float adjPressure, float adjDensity, float3 disp)
+float3 CalculateGradPressure(float gradScale, float coefScale, float pressure, float adjPressure, float adjDensity, float3 disp)
 {
 	const float avgPressure = 0.5 * (adjPressure + pressure);
 	// Implements this equation:
 	// W_spkiey(r, h) = 15 / (pi * h^6) * (h - r)^3
 	// GRAD(W_spikey(r, h)) = -45 / (pi * h^6) * (h - r)^2
 	// g_pressureGradCoef = particleMass * -45.0f / (PI * g_smoothRadius^6)
+	// gradScale = (h - r)^2 / r
 
-	return g_pressureGradCoef * avgPressure * d * d * disp / (adjDensity * r);
+	return g_pressureGradCoef * coefScale * avgPressure * gradScale * disp / adjDensity;
 }
 
 //--------------------------------------------------------------------------------------
 // Velocity Laplacian calculation
 //--------------------------------------------------------------------------------------
-float3 CalculateVelocityLaplace(float d, float3 velocity, float3 adjVelocity, float adjDensity)
+float3 CalculateVelocityLaplace(float laplaceScale, float coefScale, float3 velocity, float3 adjVelocity, float adjDensity)
 {
 	float3 velDisp = (adjVelocity - velocity);
 	// Implements this equation:
 	// W_viscosity(r, h) = 15 / (2 * pi * h^3) * (-r^3 / (2 * h^3) + r^2 / h^2 + h / (2 * r) - 1)
 	// LAPLACIAN(W_viscosity(r, h)) = 45 / (pi * h^6) * (h - r)
 	// g_viscosityLaplaceCoef = particleMass * viscosity * 45.0f / (PI * g_smoothRadius^6)
+	// laplaceScale = h - r
 
-	return g_viscosityLaplaceCoef * d * velDisp / adjDensity;
+	return g_viscosityLaplaceCoef * coefScale * laplaceScale * velDisp / adjDensity;
 }
 
 //--------------------------------------------------------------------------------------
@@ -116,16 +134,37 @@ void anyHitMain(inout RayPayload payload, HitAttributes attr)
 	const uint hitIndex = PrimitiveIndex();
 	const Particle hitParticle = g_roParticles[hitIndex];
 
-	const float r = sqrt(attr.R_sq);
-	const float d = g_smoothRadius - r;
+	// The kernel table leaves a single rsqrt per pair.
+	float gradScale, laplaceScale;
+	if (g_kernelType != KERNEL_ANALYTIC)
+	{
+		const float3 kernels = LookupKernels(attr.R_sq, attr.H);
+		gradScale = attr.H * attr.H * kernels.y * rsqrt(attr.R_sq);
+		laplaceScale = attr.H * kernels.z;
+	}
+	else
+	{
+		const float r = sqrt(attr.R_sq);
+		const float d = attr.H - r;
+		gradScale = d * d / r;
+		laplaceScale = d;
+	}
+
 	const float hitDensity = g_roDensities[hitIndex];
 	const float hitPressure = CalculatePressure(hitDensity);
 
+	// Both coefficients scale with the mass of the neighbor and 1 / h^6 of the pair.
+	const float hScale = g_smoothRadius / attr.H;
+	const float hScale3 = hScale * hScale * hScale;
+	const float coefScale = hitParticle.MassRatio * hScale3 * hScale3;
+
 	// Pressure term
-	payload.Force += CalculateGradPressure(r, d, payload.Pressure, hitPressure, hitDensity, attr.Disp);
+	payload.Force += CalculateGradPressure(gradScale, coefScale, payload.Pressure, hitPressure, hitDensity, attr.Disp);
 
 	// Viscosity term
-	payload.Force += CalculateVelocityLaplace(d, payload.Velocity, hitParticle.Velocity, hitDensity);
+	payload.Force += CalculateVelocityLaplace(laplaceScale, coefScale, payload.Velocity, hitParticle.Velocity, hitDensity);
+
+	payload.MinDensity = min(payload.MinDensity, hitDensity);
 
 	IgnoreHit();
 }
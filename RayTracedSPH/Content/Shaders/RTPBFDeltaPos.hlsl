@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "RTCommon.hlsli"
+#include "PBFCommon.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Structs
+//--------------------------------------------------------------------------------------
+struct RayPayload
+{
+	float3 DeltaPos;
+	float Lambda;
+};
+
+struct HitAttributes
+{
+	float3 Disp;
+	float R_sq;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWBuffer<float3> g_rwDeltaPositions : register (u0);
+Buffer<float> g_roLambdas : register (t1);
+
+//--------------------------------------------------------------------------------------
+// Ray generation
+//--------------------------------------------------------------------------------------
+[shader("raygeneration")]
+void raygenMain()
+{
+	const uint index = DispatchRaysIndex().x;
+	const Particle particle = g_roParticles[index];
+	const RayDesc ray = GenerateRay(particle);
+
+	// Trace the ray.
+	RayPayload payload;
+	payload.DeltaPos = 0.0;
+	payload.Lambda = g_roLambdas[index];
+	TRACE_NEIGHBOR_RAYS(particle, ray, payload);
+
+	g_rwDeltaPositions[index] = payload.DeltaPos;
+}
+
+//--------------------------------------------------------------------------------------
+// Ray intersection
+//--------------------------------------------------------------------------------------
+[shader("intersection")]
+void intersectionMain()
+{
+	const float thit = GetTHit();
+	const float3 disp = CalculateParticleDisplacement(thit);
+	const float r_sq = dot(disp, disp);
+	const uint hitIndex = PrimitiveIndex();
+	const uint index = DispatchRaysIndex().x;
+
+	if (r_sq < g_smoothRadius * g_smoothRadius
+		&& index != hitIndex)
+	{
+		const HitAttributes attr = { disp, r_sq };
+		ReportHit(thit, /*hitKind*/ 0, attr);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Tensile-instability correction
+//--------------------------------------------------------------------------------------
+float CalculateTensileCorrection(float r_sq)
+{
+	// Implements this equation:
+	// s_corr = -k * (W_poly6(r, h) / W_poly6(dq, h))^4
+	// g_pbfTensileInvDq = 1.0f / (g_smoothRadius^2 - dq^2)
+	const float d_sq = (g_smoothRadius * g_smoothRadius - r_sq) * g_pbfTensileInvDq;
+	const float ratio = d_sq * d_sq * d_sq;
+	const float ratio_sq = ratio * ratio;
+
+	return -g_pbfTensileK * ratio_sq * ratio_sq;
+}
+
+//--------------------------------------------------------------------------------------
+// Ray any hit
+//--------------------------------------------------------------------------------------
+[shader("anyhit")]
+void anyHitMain(inout RayPayload payload, HitAttributes attr)
+{
+	const float hitLambda = g_roLambdas[PrimitiveIndex()];
+	const float scorr = CalculateTensileCorrection(attr.R_sq);
+
+	// Implements this equation:
+	// dp_i = 1 / rho_0 * SUM_j((lambda_i + lambda_j + s_corr) * particleMass * GRAD(W_spikey(r, h)))
+	payload.DeltaPos += (payload.Lambda + hitLambda + scorr) * CalculateConstraintGrad(sqrt(attr.R_sq), attr.Disp);
+
+	IgnoreHit();
+}
+
+//--------------------------------------------------------------------------------------
+// Ray miss
+//--------------------------------------------------------------------------------------
+[shader("miss")]
+void missMain(inout RayPayload payload)
+{
+}
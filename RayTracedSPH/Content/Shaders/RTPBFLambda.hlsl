@@ -0,0 +1,110 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "RTCommon.hlsli"
+#include "PBFCommon.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Structs
+//--------------------------------------------------------------------------------------
+struct RayPayload
+{
+	float Density;
+	float3 GradSum;
+	float GradSqSum;
+};
+
+struct HitAttributes
+{
+	float3 Disp;
+	float R_sq;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffer
+//--------------------------------------------------------------------------------------
+RWBuffer<float> g_rwLambdas : register (u0);
+
+//--------------------------------------------------------------------------------------
+// Ray generation
+//--------------------------------------------------------------------------------------
+[shader("raygeneration")]
+void raygenMain()
+{
+	const uint index = DispatchRaysIndex().x;
+	const Particle particle = g_roParticles[index];
+	const RayDesc ray = GenerateRay(particle);
+
+	// Trace the ray.
+	RayPayload payload;
+	payload.Density = 0.0;
+	payload.GradSum = 0.0;
+	payload.GradSqSum = 0.0;
+	TRACE_NEIGHBOR_RAYS(particle, ray, payload);
+
+	// Implements this equation:
+	// lambda_i = -C_i / (SUM_k(|GRAD_k(C_i)|^2) + epsilon), where C_i = rho_i / rho_0 - 1
+	// Only compression is corrected to avoid clumping at the free surface.
+	const float constraint = max(payload.Density / g_restDensity - 1.0, 0.0);
+	const float gradSqSum = dot(payload.GradSum, payload.GradSum) + payload.GradSqSum;
+
+	g_rwLambdas[index] = -constraint / (gradSqSum + g_pbfRelaxation);
+}
+
+//--------------------------------------------------------------------------------------
+// Ray intersection
+//--------------------------------------------------------------------------------------
+[shader("intersection")]
+void intersectionMain()
+{
+	const float thit = GetTHit();
+	const float3 disp = CalculateParticleDisplacement(thit);
+	const float r_sq = dot(disp, disp);
+
+	if (r_sq < g_smoothRadius * g_smoothRadius)
+	{
+		const HitAttributes attr = { disp, r_sq };
+		ReportHit(thit, /*hitKind*/ 0, attr);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Density calculation
+//--------------------------------------------------------------------------------------
+float CalculateDensity(float r_sq)
+{
+	// Implements this equation:
+	// W_poly6(r, h) = 315 / (64 * pi * h^9) * (h^2 - r^2)^3
+	// g_densityCoef = particleMass * 315.0f / (64.0f * PI * g_smoothRadius^9)
+	const float d_sq = g_smoothRadius * g_smoothRadius - r_sq;
+
+	return g_densityCoef * d_sq * d_sq * d_sq;
+}
+
+//--------------------------------------------------------------------------------------
+// Ray any hit
+//--------------------------------------------------------------------------------------
+[shader("anyhit")]
+void anyHitMain(inout RayPayload payload, HitAttributes attr)
+{
+	payload.Density += CalculateDensity(attr.R_sq);
+
+	// Constraint gradients (the particle itself contributes no gradient)
+	if (PrimitiveIndex() != DispatchRaysIndex().x)
+	{
+		const float3 grad = CalculateConstraintGrad(sqrt(attr.R_sq), attr.Disp);
+		payload.GradSum += grad;
+		payload.GradSqSum += dot(grad, grad);
+	}
+
+	IgnoreHit();
+}
+
+//--------------------------------------------------------------------------------------
+// Ray miss
+//--------------------------------------------------------------------------------------
+[shader("miss")]
+void missMain(inout RayPayload payload)
+{
+}
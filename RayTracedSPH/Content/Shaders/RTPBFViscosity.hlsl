@@ -0,0 +1,99 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "RTCommon.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Structs
+//--------------------------------------------------------------------------------------
+struct RayPayload
+{
+	float3 Velocity;
+	float3 DeltaVelocity;
+};
+
+struct HitAttributes
+{
+	float R_sq;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffer
+//--------------------------------------------------------------------------------------
+RWStructuredBuffer<Particle> g_rwParticles : register (u0);
+
+//--------------------------------------------------------------------------------------
+// Ray generation
+//--------------------------------------------------------------------------------------
+[shader("raygeneration")]
+void raygenMain()
+{
+	const uint index = DispatchRaysIndex().x;
+	Particle particle = g_roParticles[index];
+	const RayDesc ray = GenerateRay(particle);
+
+	// Trace the ray.
+	RayPayload payload;
+	payload.Velocity = particle.Velocity;
+	payload.DeltaVelocity = 0.0;
+	TRACE_NEIGHBOR_RAYS(particle, ray, payload);
+
+	// Commit the predicted particle with the XSPH-smoothed velocity
+	particle.Velocity += g_xsphViscosity * payload.DeltaVelocity;
+	g_rwParticles[index] = particle;
+}
+
+//--------------------------------------------------------------------------------------
+// Ray intersection
+//--------------------------------------------------------------------------------------
+[shader("intersection")]
+void intersectionMain()
+{
+	const float thit = GetTHit();
+	const float3 disp = CalculateParticleDisplacement(thit);
+	const float r_sq = dot(disp, disp);
+	const uint hitIndex = PrimitiveIndex();
+	const uint index = DispatchRaysIndex().x;
+
+	if (r_sq < g_smoothRadius * g_smoothRadius
+		&& index != hitIndex)
+	{
+		const HitAttributes attr = { r_sq };
+		ReportHit(thit, /*hitKind*/ 0, attr);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// XSPH velocity calculation
+//--------------------------------------------------------------------------------------
+float3 CalculateXSPHVelocity(float r_sq, float3 velocity, float3 adjVelocity)
+{
+	const float d_sq = g_smoothRadius * g_smoothRadius - r_sq;
+	// Implements this equation:
+	// dv_i = c * SUM_j(particleMass / rho_0 * (v_j - v_i) * W_poly6(r, h))
+	// g_densityCoef = particleMass * 315.0f / (64.0f * PI * g_smoothRadius^9)
+
+	return g_densityCoef / g_restDensity * d_sq * d_sq * d_sq * (adjVelocity - velocity);
+}
+
+//--------------------------------------------------------------------------------------
+// Ray any hit
+//--------------------------------------------------------------------------------------
+[shader("anyhit")]
+void anyHitMain(inout RayPayload payload, HitAttributes attr)
+{
+	const Particle hitParticle = g_roParticles[PrimitiveIndex()];
+
+	payload.DeltaVelocity += CalculateXSPHVelocity(attr.R_sq, payload.Velocity, hitParticle.Velocity);
+
+	IgnoreHit();
+}
+
+//--------------------------------------------------------------------------------------
+// Ray miss
+//--------------------------------------------------------------------------------------
+[shader("miss")]
+void missMain(inout RayPayload payload)
+{
+}
@@ -0,0 +1,110 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "RTCommon.hlsli"
+#include "AdaptiveCommon.hlsli"
+
+//--------------------------------------------------------------------------------------
+// Structs
+//--------------------------------------------------------------------------------------
+struct RayPayload
+{
+	float MinDistSq;
+	uint Partner;
+	float MassRatio;
+};
+
+struct HitAttributes
+{
+	float R_sq;
+};
+
+//--------------------------------------------------------------------------------------
+// Buffers
+//--------------------------------------------------------------------------------------
+RWBuffer<uint> g_rwPartners : register (u0);
+Buffer<float> g_roMinDensityRatios : register (t1);
+Buffer<uint> g_roSleepCounters : register (t2);
+
+//--------------------------------------------------------------------------------------
+// Ray generation
+//--------------------------------------------------------------------------------------
+[shader("raygeneration")]
+void raygenMain()
+{
+	const uint index = DispatchRaysIndex().x;
+	const Particle particle = g_roParticles[index];
+	const float minDensityRatio = g_roMinDensityRatios[index];
+
+	// Dead and sleeping particles are neither split nor merged.
+	uint partner = NO_PARTNER;
+	if (g_roSleepCounters[index] < g_sleepSteps)
+	{
+		if (NeedsSplit(particle, minDensityRatio)) partner = SPLIT_REQUEST;
+		else if (CanMerge(particle, minDensityRatio))
+		{
+			const RayDesc ray = GenerateRay(particle);
+
+			// Trace the ray for the nearest neighbor of the same mass that can be merged as well.
+			RayPayload payload;
+			payload.MinDistSq = 3.402823466e+38;
+			payload.Partner = NO_PARTNER;
+			payload.MassRatio = particle.MassRatio;
+			TRACE_NEIGHBOR_RAYS(particle, ray, payload);
+
+			partner = payload.Partner;
+		}
+	}
+
+	g_rwPartners[index] = partner;
+}
+
+//--------------------------------------------------------------------------------------
+// Ray intersection
+//--------------------------------------------------------------------------------------
+[shader("intersection")]
+void intersectionMain()
+{
+	const float thit = GetTHit();
+	const float3 disp = CalculateParticleDisplacement(thit);
+	const float r_sq = dot(disp, disp);
+	const uint hitIndex = PrimitiveIndex();
+	const uint index = DispatchRaysIndex().x;
+	const float h = GetPairSmoothRadius(g_roParticles[index].SmoothRadius, g_roParticles[hitIndex].SmoothRadius);
+
+	if (r_sq < h * h
+		&& index != hitIndex)
+	{
+		const HitAttributes attr = { r_sq };
+		ReportHit(thit, /*hitKind*/ 0, attr);
+	}
+}
+
+//--------------------------------------------------------------------------------------
+// Ray any hit
+//--------------------------------------------------------------------------------------
+[shader("anyhit")]
+void anyHitMain(inout RayPayload payload, HitAttributes attr)
+{
+	const uint hitIndex = PrimitiveIndex();
+	const Particle hitParticle = g_roParticles[hitIndex];
+
+	if (attr.R_sq < payload.MinDistSq && hitParticle.MassRatio == payload.MassRatio &&
+		g_roSleepCounters[hitIndex] < g_sleepSteps &&
+		CanMerge(hitParticle, g_roMinDensityRatios[hitIndex]))
+	{
+		payload.MinDistSq = attr.R_sq;
+		payload.Partner = hitIndex;
+	}
+
+	IgnoreHit();
+}
+
+//--------------------------------------------------------------------------------------
+// Ray miss
+//--------------------------------------------------------------------------------------
+[shader("miss")]
+void missMain(inout RayPayload payload)
+{
+}
@@ -0,0 +1,59 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include "SharedConst.h"
+
+//--------------------------------------------------------------------------------------
+// Boundary SDF textures
+//--------------------------------------------------------------------------------------
+Texture3D<uint> g_txBrickIndices : register (t8);
+Texture3D g_txSDFAtlas : register (t9);
+
+SamplerState g_smpLinear : register (s0);
+
+//--------------------------------------------------------------------------------------
+// Sample the boundary SDF, which is negative inside the container
+// xyz: gradient, w: signed distance
+//--------------------------------------------------------------------------------------
+float4 SampleBoundary(float3 pos)
+{
+	// The walls across the periodic axes are open, so the field is sampled at the mid-plane.
+	pos = lerp(pos, g_periodMin + 0.5 * g_periodSize, GetPeriodicMask());
+
+	// Locate the brick, where the bricks share their border samples
+	const uint cellsPerBrick = SDF_BRICK_SIZE - 1;
+	const float3 maxCoord = g_sdfNumBricks * cellsPerBrick;
+	const float3 coord = clamp((pos - g_sdfOrigin) * g_sdfInvVoxelSize, 0.0, maxCoord);
+	const uint3 brick = min(uint3(coord) / cellsPerBrick, g_sdfNumBricks - 1);
+	const uint brickIdx = g_txBrickIndices[brick];
+
+	// Bricks outside the narrow band are not stored.
+	if (brickIdx >= SDF_EMPTY_INSIDE)
+		return float4(0.0.xxx, brickIdx == SDF_EMPTY_INSIDE ? -g_sdfBandWidth : g_sdfBandWidth);
+
+	// Trilinear lookup of the gradient and the distance in the brick atlas
+	const uint3 atlasBrick = uint3(brickIdx & 0x3ff, (brickIdx >> 10) & 0x3ff, brickIdx >> 20);
+	const float3 atlasCoord = atlasBrick * SDF_BRICK_SIZE + (coord - brick * cellsPerBrick) + 0.5;
+
+	return g_txSDFAtlas.SampleLevel(g_smpLinear, atlasCoord * g_sdfAtlasInvSize, 0.0);
+}
+
+//--------------------------------------------------------------------------------------
+// Distance to the container walls, which is positive inside
+//--------------------------------------------------------------------------------------
+float GetWallDistance(float3 pos)
+{
+	return -SampleBoundary(pos).w;
+}
+
+//--------------------------------------------------------------------------------------
+// Project the position back into the container along the SDF gradient
+//--------------------------------------------------------------------------------------
+float3 ProjectOntoBoundary(float3 pos)
+{
+	const float4 boundary = SampleBoundary(pos);
+	const float gradLen = length(boundary.xyz);
+
+	return boundary.w > 0.0 && gradLen > 0.0 ? pos - boundary.w / gradLen * boundary.xyz : pos;
+}
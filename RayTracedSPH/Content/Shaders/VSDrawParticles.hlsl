@@ -18,5 +18,8 @@ float4 main(uint vid : SV_VERTEXID) : SV_POSITION
 {
 	const Particle particle = g_roParticles[vid];
 
+	// Cull dead particles
+	if (particle.MassRatio <= 0.0) return -1.0;
+
 	return mul(float4(particle.Pos, 1.0), g_viewProj);
 }
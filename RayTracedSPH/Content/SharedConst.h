@@ -4,3 +4,15 @@
 
 #define POINT_QUERY	1
 #define GROUP_SIZE	64
+
+#define SDF_BRICK_SIZE		8
+#define SDF_EMPTY_INSIDE	0xfffffffe
+#define SDF_EMPTY_OUTSIDE	0xffffffff
+
+#define SCAN_GROUP_SIZE		1024
+#define DISPATCH_ARG_STRIDE	256
+#define NUM_RT_DISPATCHES	3
+
+#define KERNEL_ANALYTIC		0
+#define KERNEL_TABLE_SIZE	256
+#define NUM_KERNEL_TABLES	2
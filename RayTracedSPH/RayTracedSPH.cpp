@@ -29,8 +29,19 @@ RayTracedSPH::RayTracedSPH(uint32_t width, uint32_t height, std::wstring name) :
 	m_viewport(0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height)),
 	m_scissorRect(0, 0, static_cast<long>(width), static_cast<long>(height)),
 	m_deviceType(DEVICE_DISCRETE),
+	m_solverType(FluidEZ::SOLVER_SPH),
+	m_isAdaptive(false),
+	m_isSmoothRadiusVariable(false),
+	m_isFlowing(false),
+	m_periodicAxes(0),
 	m_showFPS(true),
 	m_isPaused(false),
+	m_isSleeping(true),
+	m_kernelType(FluidEZ::KERNEL_ANALYTIC),
+	m_pTimestamps(nullptr),
+	m_timestampFreq(1.0),
+	m_simTimes(),
+	m_kernelSimTimes(),
 	m_tracking(false),
 	m_screenShot(0)
 {
@@ -180,7 +191,38 @@ void RayTracedSPH::LoadAssets()
 	vector<Resource::uptr> uploaders(0);
 	m_fluid = make_unique<FluidEZ>();
 	XUSG_N_RETURN(m_fluid->Init(m_commandListEZ.get(), m_width, m_height,
-		uploaders), ThrowIfFailed(E_FAIL));
+		uploaders, m_solverType, m_isAdaptive,
+		m_boundaryMeshFileName.empty() ? nullptr : m_boundaryMeshFileName.c_str(),
+		m_obstacleMeshFileName.empty() ? nullptr : m_obstacleMeshFileName.c_str(),
+		m_isFlowing ? 32768 : 65536, m_isFlowing ? 65536 : 0, m_periodicAxes, m_isSmoothRadiusVariable),
+		ThrowIfFailed(E_FAIL));
+
+	// Inflow from the left wall, and outflow through a drain on the floor near the right wall
+	if (m_isFlowing)
+	{
+		m_fluid->SetEmitter(XMFLOAT3(-0.45f, 0.7f, 0.0f), XMFLOAT3(1.0f, 0.0f, 0.0f), 0.05f, 1200.0f);
+		m_fluid->SetSink(XMFLOAT3(0.35f, 0.0f, -0.5f), XMFLOAT3(0.5f, 0.1f, 0.5f));
+	}
+
+	// Create timestamp queries with a pair per frame for timing the simulation
+	{
+		D3D12_QUERY_HEAP_DESC queryHeapDesc = {};
+		queryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+		queryHeapDesc.Count = 2 * FrameCount;
+		const auto pDevice = static_cast<ID3D12Device*>(m_device->GetHandle());
+		ThrowIfFailed(pDevice->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&m_queryHeap)));
+
+		m_timestampBuffer = Buffer::MakeUnique();
+		XUSG_N_RETURN(m_timestampBuffer->Create(m_device.get(), sizeof(uint64_t[2 * FrameCount]),
+			ResourceFlag::DENY_SHADER_RESOURCE, MemoryType::READBACK, 0, nullptr, 0, nullptr,
+			MemoryFlag::NONE, L"TimestampBuffer"), ThrowIfFailed(E_FAIL));
+		m_pTimestamps = static_cast<const uint64_t*>(m_timestampBuffer->Map(nullptr));
+
+		uint64_t timestampFreq;
+		const auto pCommandQueue = static_cast<ID3D12CommandQueue*>(m_commandQueue->GetHandle());
+		ThrowIfFailed(pCommandQueue->GetTimestampFrequency(&timestampFreq));
+		m_timestampFreq = static_cast<double>(timestampFreq);
+	}
 
 	// Close the command list and execute it to begin the initial GPU setup.
 	XUSG_N_RETURN(m_commandListEZ->Close(), ThrowIfFailed(E_FAIL));
@@ -237,7 +279,9 @@ void RayTracedSPH::OnUpdate()
 	const auto proj = XMLoadFloat4x4(&m_proj);
 	const auto viewY = XMVectorSet(m_view._12, m_view._22, m_view._32, 1.0f);
 
-	m_fluid->UpdateFrame(m_frameIndex, (min)(timeStep, 1.0f / 320.0f), view * proj, viewY);
+	// PBF is stable at frame-sized time steps, so only long stalls are clamped for preview-quality runs.
+	const auto maxTimeStep = m_solverType == FluidEZ::SOLVER_PBF ? 1.0f / 30.0f : 1.0f / 320.0f;
+	m_fluid->UpdateFrame(m_frameIndex, (min)(timeStep, maxTimeStep), view * proj, viewY);
 }
 
 // Render the scene.
@@ -275,6 +319,14 @@ void RayTracedSPH::OnKeyUp(uint8_t key)
 	case VK_F1:
 		m_showFPS = !m_showFPS;
 		break;
+	case 'S':
+		m_isSleeping = !m_isSleeping;
+		m_fluid->EnableSleeping(m_isSleeping);
+		break;
+	case 'K':
+		m_kernelType = static_cast<FluidEZ::KernelType>((m_kernelType + 1) % FluidEZ::NUM_KERNEL_TYPE);
+		m_fluid->SetKernelType(m_kernelType);
+		break;
 	case VK_F11:
 		m_screenShot = 1;
 		break;
@@ -374,6 +426,19 @@ void RayTracedSPH::ParseCommandLineArgs(wchar_t* argv[], int argc)
 	{
 		if (isArgMatched(i, L"warp")) m_deviceType = DEVICE_WARP;
 		else if (isArgMatched(i, L"uma")) m_deviceType = DEVICE_UMA;
+		else if (isArgMatched(i, L"pbf")) m_solverType = FluidEZ::SOLVER_PBF;
+		else if (isArgMatched(i, L"adaptive")) m_isAdaptive = true;
+		else if (isArgMatched(i, L"variableh")) m_isSmoothRadiusVariable = true;
+		else if (isArgMatched(i, L"flow")) m_isFlowing = true;
+		else if (isArgMatched(i, L"periodic") && hasNextArgValue(i))
+		{
+			const wstring axes = argv[++i];
+			if (axes.find(L'x') != wstring::npos) m_periodicAxes |= FluidEZ::PERIODIC_X;
+			if (axes.find(L'y') != wstring::npos) m_periodicAxes |= FluidEZ::PERIODIC_Y;
+			if (axes.find(L'z') != wstring::npos) m_periodicAxes |= FluidEZ::PERIODIC_Z;
+		}
+		else if (isArgMatched(i, L"mesh") && hasNextArgValue(i)) m_boundaryMeshFileName = argv[++i];
+		else if (isArgMatched(i, L"obstacles") && hasNextArgValue(i)) m_obstacleMeshFileName = argv[++i];
 	}
 }
 
@@ -398,8 +463,15 @@ void RayTracedSPH::PopulateCommandList()
 	pCommandList->ClearRenderTargetView(rtv, clearColor);
 	pCommandList->ClearDepthStencilView(dsv, ClearFlag::DEPTH, 1.0f);
 
-	// Fluid rendering (simulation and visualization)
-	m_fluid->Render(pCommandList, m_frameIndex, pRenderTarget, m_depth.get());
+	// Fluid simulation, timed on the GPU
+	pCommandList->EndQuery(m_queryHeap.get(), QueryType::TIMESTAMP, 2 * m_frameIndex);
+	m_fluid->Simulate(pCommandList, m_frameIndex);
+	pCommandList->EndQuery(m_queryHeap.get(), QueryType::TIMESTAMP, 2 * m_frameIndex + 1);
+	pCommandList->ResolveQueryData(m_queryHeap.get(), QueryType::TIMESTAMP, 2 * m_frameIndex, 2,
+		m_timestampBuffer.get(), sizeof(uint64_t[2]) * m_frameIndex);
+
+	// Fluid visualization
+	m_fluid->Visualize(pCommandList, m_frameIndex, pRenderTarget, m_depth.get());
 
 	// Screen-shot helper
 	if (m_screenShot == 1)
@@ -485,9 +557,15 @@ double RayTracedSPH::CalculateFrameStats(float* pTimeStep)
 {
 	static auto frameCnt = 0u;
 	static auto previousTime = 0.0;
+	static auto simTime = 0.0, activeRatio = 0.0;
 	const auto totalTime = m_timer.GetTotalSeconds();
 	++frameCnt;
 
+	// Accumulate the simulation stats of the completed frame whose slots are reused next
+	const auto pTimestamps = &m_pTimestamps[2 * m_frameIndex];
+	if (pTimestamps[1] > pTimestamps[0]) simTime += (pTimestamps[1] - pTimestamps[0]) / m_timestampFreq;
+	activeRatio += m_fluid->GetNumActiveParticles(m_frameIndex) / static_cast<double>(m_fluid->GetNumParticles());
+
 	const auto timeStep = totalTime - previousTime;
 
 	// Compute averages over one second period.
@@ -495,14 +573,49 @@ double RayTracedSPH::CalculateFrameStats(float* pTimeStep)
 	{
 		const auto fps = static_cast<float>(frameCnt / timeStep);	// Normalize to an exact second.
 
+		// Simulation time in ms, the speedup of sleeping is against the latest run without it.
+		const auto avgSimTime = 1000.0 * simTime / frameCnt;
+		const auto avgActiveRatio = activeRatio / frameCnt;
+		m_simTimes[m_isSleeping] = avgSimTime;
+		m_kernelSimTimes[m_kernelType] = avgSimTime;
+
 		frameCnt = 0;
 		previousTime = totalTime;
+		simTime = 0.0;
+		activeRatio = 0.0;
 
 		wstringstream windowText;
 		windowText << L"    fps: ";
 		if (m_showFPS) windowText << setprecision(2) << fixed << fps;
 		else windowText << L"[F1]";
 
+		windowText << L"    sim: " << setprecision(2) << fixed << avgSimTime << L" ms";
+		if (m_solverType == FluidEZ::SOLVER_SPH)
+		{
+			windowText << L"    active: " << setprecision(1) << 100.0 * avgActiveRatio << L"%";
+			if (m_isSleeping && m_simTimes[0] > 0.0 && avgSimTime > 0.0)
+				windowText << L" (speedup: " << setprecision(2) << m_simTimes[0] / avgSimTime << L"x)";
+			windowText << L"    [S] sleeping " << (m_isSleeping ? L"on" : L"off");
+
+			// The kernel evaluations are compared against the latest run with the analytic kernels.
+			static const wchar_t* kernelNames[] = { L"analytic", L"table", L"table (Wendland C4)" };
+			windowText << L"    [K] kernels: " << kernelNames[m_kernelType];
+			if (m_kernelType != FluidEZ::KERNEL_ANALYTIC && m_kernelSimTimes[0] > 0.0 && avgSimTime > 0.0)
+				windowText << L" (speedup: " << setprecision(2) << m_kernelSimTimes[0] / avgSimTime << L"x)";
+		}
+
+		// The total mass is conserved, so a uniform run at the finest resolution needs all the initial particles.
+		if (m_isAdaptive && m_solverType == FluidEZ::SOLVER_SPH)
+			windowText << L"    particles: " << m_fluid->GetNumAliveParticles(m_frameIndex)
+				<< L" (uniform: " << m_fluid->GetNumParticles() << L")";
+		else if (m_isFlowing && m_solverType == FluidEZ::SOLVER_SPH)
+			windowText << L"    particles: " << m_fluid->GetNumAliveParticles(m_frameIndex)
+				<< L" (pool: " << m_fluid->GetNumParticles() << L")";
+
+		const auto bvhMemorySize = m_fluid->GetBVHMemorySize();
+		windowText << L"    BVH: " << setprecision(2) << bvhMemorySize / (1024.0 * 1024.0) << L" MB ("
+			<< setprecision(1) << static_cast<double>(bvhMemorySize) / m_fluid->GetNumParticles() << L" B/particle)";
+
 		windowText << L"    [F11] screen shot";
 
 		SetCustomWindowText(windowText.str().c_str());
@@ -83,9 +83,26 @@ private:
 
 	// Application state
 	DeviceType	m_deviceType;
+	FluidEZ::SolverType m_solverType;
+	bool		m_isAdaptive;
+	bool		m_isSmoothRadiusVariable;
+	bool		m_isFlowing;
+	uint8_t		m_periodicAxes;
+	std::wstring m_boundaryMeshFileName;
+	std::wstring m_obstacleMeshFileName;
 	StepTimer	m_timer;
 	bool		m_showFPS;
 	bool		m_isPaused;
+	bool		m_isSleeping;
+	FluidEZ::KernelType m_kernelType;
+
+	// GPU timing of the simulation
+	XUSG::com_ptr<ID3D12QueryHeap> m_queryHeap;
+	XUSG::Buffer::uptr	m_timestampBuffer;
+	const uint64_t*		m_pTimestamps;
+	double				m_timestampFreq;
+	double				m_simTimes[2];
+	double				m_kernelSimTimes[FluidEZ::NUM_KERNEL_TYPE];
 
 	// User camera interactions
 	bool m_tracking;
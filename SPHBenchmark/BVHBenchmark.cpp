@@ -0,0 +1,402 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include "CPU/BrickedBVH.h"
+#include "CPU/CompressedBVH.h"
+#include "CPU/ThreadPool.h"
+#include "CPU/WideBVH.h"
+#include "BenchmarkCommon.h"
+#include "BVHBenchmark.h"
+
+using namespace std;
+using namespace DirectX;
+
+static const uint32_t g_clusterSizes[] = { 1, 4, 8, 16 };
+
+bool RunClusterBenchmark(const vector<XMFLOAT3>& positions, float radius, uint32_t numRepeats)
+{
+	const auto numParticles = static_cast<uint32_t>(positions.size());
+	cout << "Particle BVH leaf clusters: " << numParticles << " particles, radius " << radius << endl;
+	cout << right << setw(8) << "cluster" << setw(12) << "build ms" << setw(12) << "memory KB" << setw(12) << "query ms"
+		<< setw(12) << "nodes/q" << setw(12) << "tests/q" << setw(12) << "hits/q" << endl;
+
+	uint64_t referenceHits = 0;
+	for (const auto& clusterSize : g_clusterSizes)
+	{
+		ParticleBVH bvh;
+		const auto buildMs = MeasureMilliseconds(numRepeats, [&]() { bvh.Build(positions.data(), numParticles, radius, clusterSize); });
+
+		// One point query per particle, the same as the ray-traced neighbor search
+		ParticleBVH::QueryStats stats = {};
+		uint64_t numHits = 0;
+		const auto queryMs = MeasureMilliseconds([&]()
+		{
+			for (const auto& pos : positions) bvh.Query(pos, [&numHits](uint32_t, float) { ++numHits; }, &stats);
+		});
+
+		// Every cluster size must find the same neighbors.
+		if (clusterSize == g_clusterSizes[0]) referenceHits = numHits;
+		else if (numHits != referenceHits)
+		{
+			cerr << "Cluster size " << clusterSize << " found " << numHits << " neighbors instead of " << referenceHits << endl;
+
+			return false;
+		}
+
+		cout << setw(8) << clusterSize << fixed << setprecision(2) << setw(12) << buildMs
+			<< setw(12) << bvh.GetMemorySize() / 1024.0 << setw(12) << queryMs
+			<< setw(12) << static_cast<double>(stats.NodesVisited) / numParticles
+			<< setw(12) << static_cast<double>(stats.ParticlesTested) / numParticles
+			<< setw(12) << static_cast<double>(numHits) / numParticles << endl;
+	}
+
+	return true;
+}
+
+bool RunBuilderBenchmark(const vector<XMFLOAT3>& positions, float radius, uint32_t maxThreads, uint32_t numRepeats)
+{
+	const auto numParticles = static_cast<uint32_t>(positions.size());
+	const auto clusterSize = 4u;
+	if (maxThreads == 0) maxThreads = (max)(thread::hardware_concurrency(), 1u);
+
+	cout << "Particle BVH builders: " << numParticles << " particles, radius " << radius << ", clusters of " << clusterSize << endl;
+	cout << left << setw(10) << "builder" << right << setw(8) << "threads" << setw(12) << "build ms" << setw(12) << "SAH cost"
+		<< setw(12) << "query ms" << setw(12) << "nodes/q" << setw(12) << "hits/q" << endl;
+
+	uint64_t referenceHits = 0;
+	const auto runBuilder = [&](const char* name, ParticleBVH::BuildMethod method, uint32_t numThreads)
+	{
+		ThreadPool threadPool;
+		if (numThreads > 1) threadPool.Init(numThreads);
+		const auto pThreadPool = numThreads > 1 ? &threadPool : nullptr;
+
+		ParticleBVH bvh;
+		const auto buildMs = MeasureMilliseconds(numRepeats, [&]()
+		{
+			bvh.Build(positions.data(), numParticles, radius, clusterSize, 0.0f, method, pThreadPool);
+		});
+
+		ParticleBVH::QueryStats stats = {};
+		uint64_t numHits = 0;
+		const auto queryMs = MeasureMilliseconds([&]()
+		{
+			for (const auto& pos : positions) bvh.Query(pos, [&numHits](uint32_t, float) { ++numHits; }, &stats);
+		});
+
+		cout << left << setw(10) << name << right << setw(8) << numThreads << fixed << setprecision(2) << setw(12) << buildMs
+			<< setw(12) << bvh.GetSAHCost() << setw(12) << queryMs
+			<< setw(12) << static_cast<double>(stats.NodesVisited) / numParticles
+			<< setw(12) << static_cast<double>(numHits) / numParticles << endl;
+
+		// Every builder must find the same neighbors.
+		if (method == ParticleBVH::BUILD_MEDIAN) referenceHits = numHits;
+		else if (numHits != referenceHits)
+		{
+			cerr << name << " found " << numHits << " neighbors instead of " << referenceHits << endl;
+
+			return false;
+		}
+
+		return true;
+	};
+
+	if (!runBuilder("median", ParticleBVH::BUILD_MEDIAN, 1)) return false;
+	if (!runBuilder("SAH", ParticleBVH::BUILD_SAH, 1)) return false;
+	for (auto numThreads = 1u; numThreads < 2 * maxThreads; numThreads *= 2)
+		if (!runBuilder("LBVH", ParticleBVH::BUILD_LBVH, (min)(numThreads, maxThreads))) return false;
+
+	return true;
+}
+
+bool RunWideBenchmark(const vector<XMFLOAT3>& positions, float radius)
+{
+	const auto numParticles = static_cast<uint32_t>(positions.size());
+	const auto clusterSize = 4u;
+
+	ParticleBVH bvh;
+	bvh.Build(positions.data(), numParticles, radius, clusterSize, 0.0f, ParticleBVH::BUILD_LBVH);
+
+	cout << "Wide particle BVH: " << numParticles << " particles, radius " << radius << ", clusters of " << clusterSize << endl;
+	cout << left << setw(10) << "BVH" << right << setw(12) << "collapse ms" << setw(12) << "nodes KB" << setw(12) << "B/particle" << setw(12) << "query ms"
+		<< setw(12) << "M queries/s" << setw(12) << "nodes/q" << setw(12) << "boxes/q" << setw(12) << "hits/q" << setw(12) << "max hits" << endl;
+
+	uint64_t referenceHits = 0;
+	auto isReference = true;
+	const auto printQueries = [&](const char* name, uint32_t boxesPerNode, double collapseMs, size_t memorySize, const auto& query)
+	{
+		ParticleBVH::QueryStats stats = {};
+		uint64_t numHits = 0;
+		const auto queryMs = MeasureMilliseconds([&]()
+		{
+			for (const auto& pos : positions) query(pos, [&numHits](uint32_t, float) { ++numHits; }, &stats, nullptr);
+		});
+
+		// Count the neighbors of each query in a separate pass, which the timing leaves out
+		NeighborStats neighborStats = {};
+		for (const auto& pos : positions) query(pos, [](uint32_t, float) {}, nullptr, &neighborStats);
+
+		cout << left << setw(10) << name << right << fixed << setprecision(2) << setw(12) << collapseMs
+			<< setw(12) << memorySize / 1024.0 << setw(12) << static_cast<double>(memorySize) / numParticles
+			<< setw(12) << queryMs << setw(12) << numParticles / (1000.0 * queryMs)
+			<< setw(12) << static_cast<double>(stats.NodesVisited) / numParticles
+			<< setw(12) << static_cast<double>(stats.NodesVisited * boxesPerNode) / numParticles
+			<< setw(12) << static_cast<double>(numHits) / numParticles << setw(12) << neighborStats.MaxNeighbors << endl;
+
+		// The wide and compressed BVHs must find the same neighbors.
+		if (isReference) referenceHits = numHits;
+		else if (numHits != referenceHits)
+		{
+			cerr << name << " found " << numHits << " neighbors instead of " << referenceHits << endl;
+
+			return false;
+		}
+		isReference = false;
+
+		return true;
+	};
+
+	// The binary traversal counts each child box it tests as a visited node.
+	if (!printQueries("binary", 1, 0.0, sizeof(ParticleBVH::Node) * bvh.GetNodes().size(),
+		[&](const XMFLOAT3& pos, const auto& func, ParticleBVH::QueryStats* pStats, NeighborStats* pNeighborStats)
+		{ bvh.Query(pos, func, pStats, pNeighborStats); })) return false;
+
+	BVH4 bvh4;
+	const auto collapse4Ms = MeasureMilliseconds([&]() { bvh4.Collapse(bvh); });
+	if (!printQueries("BVH4", 4, collapse4Ms, bvh4.GetMemorySize(),
+		[&](const XMFLOAT3& pos, const auto& func, ParticleBVH::QueryStats* pStats, NeighborStats* pNeighborStats)
+		{ bvh4.Query(pos, func, pStats, pNeighborStats); })) return false;
+
+	BVH8 bvh8;
+	const auto collapse8Ms = MeasureMilliseconds([&]() { bvh8.Collapse(bvh); });
+	if (!printQueries("BVH8", 8, collapse8Ms, bvh8.GetMemorySize(),
+		[&](const XMFLOAT3& pos, const auto& func, ParticleBVH::QueryStats* pStats, NeighborStats* pNeighborStats)
+		{ bvh8.Query(pos, func, pStats, pNeighborStats); })) return false;
+
+	// The compression time adds to the collapse.
+	CompressedBVH4 compressedBVH4;
+	const auto compress4Ms = collapse4Ms + MeasureMilliseconds([&]() { compressedBVH4.Compress(bvh4); });
+	if (!printQueries("CBVH4", 4, compress4Ms, compressedBVH4.GetMemorySize(),
+		[&](const XMFLOAT3& pos, const auto& func, ParticleBVH::QueryStats* pStats, NeighborStats* pNeighborStats)
+		{ compressedBVH4.Query(pos, func, pStats, pNeighborStats); })) return false;
+
+	CompressedBVH8 compressedBVH8;
+	const auto compress8Ms = collapse8Ms + MeasureMilliseconds([&]() { compressedBVH8.Compress(bvh8); });
+
+	return printQueries("CBVH8", 8, compress8Ms, compressedBVH8.GetMemorySize(),
+		[&](const XMFLOAT3& pos, const auto& func, ParticleBVH::QueryStats* pStats, NeighborStats* pNeighborStats)
+		{ compressedBVH8.Query(pos, func, pStats, pNeighborStats); });
+}
+
+bool RunStacklessBenchmark(const vector<XMFLOAT3>& positions, float radius, uint32_t maxThreads)
+{
+	const auto numParticles = static_cast<uint32_t>(positions.size());
+	const auto clusterSize = 4u;
+	const auto blockSize = 1024u;
+	if (maxThreads == 0) maxThreads = (max)(thread::hardware_concurrency(), 1u);
+
+	ParticleBVH bvh;
+	bvh.Build(positions.data(), numParticles, radius, clusterSize, 0.0f, ParticleBVH::BUILD_LBVH);
+
+	cout << "Stackless point queries: " << numParticles << " particles, radius " << radius << ", clusters of " << clusterSize
+		<< ", stack of " << sizeof(uint32_t) * ParticleBVH::StackSize << " bytes" << endl;
+	cout << left << setw(10) << "traversal" << right << setw(8) << "threads" << setw(12) << "query ms" << setw(12) << "M queries/s"
+		<< setw(12) << "nodes/q" << setw(12) << "hits/q" << endl;
+
+	uint64_t referenceHits = 0;
+	auto isReference = true;
+	for (auto numThreads = 1u; numThreads < 2 * maxThreads; numThreads *= 2)
+	{
+		ThreadPool threadPool;
+		threadPool.Init((min)(numThreads, maxThreads));
+
+		for (const auto traversal : { ParticleBVH::TRAVERSAL_STACK, ParticleBVH::TRAVERSAL_STACKLESS })
+		{
+			bvh.SetTraversal(traversal);
+
+			// Each thread adds the counts of a block to its own slot.
+			vector<ParticleBVH::QueryStats> threadStats(threadPool.GetNumThreads(), ParticleBVH::QueryStats());
+			vector<uint64_t> threadHits(threadPool.GetNumThreads(), 0);
+			const auto queryMs = MeasureMilliseconds([&]()
+			{
+				threadPool.Run((numParticles + blockSize - 1) / blockSize, [&](uint32_t block, uint32_t thread)
+				{
+					ParticleBVH::QueryStats stats = {};
+					uint64_t numHits = 0;
+					const auto end = (min)((block + 1) * blockSize, numParticles);
+					for (auto i = block * blockSize; i < end; ++i)
+						bvh.Query(positions[i], [&numHits](uint32_t, float) { ++numHits; }, &stats);
+					threadStats[thread].NodesVisited += stats.NodesVisited;
+					threadHits[thread] += numHits;
+				});
+			});
+
+			uint64_t nodesVisited = 0, numHits = 0;
+			for (const auto& stats : threadStats) nodesVisited += stats.NodesVisited;
+			for (const auto& hits : threadHits) numHits += hits;
+
+			cout << left << setw(10) << (traversal == ParticleBVH::TRAVERSAL_STACK ? "stack" : "stackless") << right
+				<< setw(8) << threadPool.GetNumThreads() << fixed << setprecision(2) << setw(12) << queryMs
+				<< setw(12) << numParticles / (1000.0 * queryMs) << setw(12) << static_cast<double>(nodesVisited) / numParticles
+				<< setw(12) << static_cast<double>(numHits) / numParticles << endl;
+
+			// Both traversals must find the same neighbors.
+			if (isReference) referenceHits = numHits;
+			else if (numHits != referenceHits)
+			{
+				cerr << "The stackless traversal found " << numHits << " neighbors instead of " << referenceHits << endl;
+
+				return false;
+			}
+			isReference = false;
+		}
+	}
+
+	return true;
+}
+
+bool RunPacketBenchmark(const vector<XMFLOAT3>& positions, float radius)
+{
+	const auto numParticles = static_cast<uint32_t>(positions.size());
+	const auto clusterSize = 4u;
+
+	ParticleBVH bvh;
+	bvh.Build(positions.data(), numParticles, radius, clusterSize, 0.0f, ParticleBVH::BUILD_LBVH);
+
+	// The Morton order from the clusters, and a shuffled one
+	vector<uint32_t> sortedOrder;
+	sortedOrder.reserve(numParticles);
+	for (const auto& i : bvh.GetParticleIndices()) if (i != UINT32_MAX) sortedOrder.push_back(i);
+	auto shuffledOrder = sortedOrder;
+	shuffle(shuffledOrder.begin(), shuffledOrder.end(), mt19937(12345));
+
+	cout << "Packet point queries: " << numParticles << " particles, radius " << radius << ", clusters of " << clusterSize << endl;
+	cout << left << setw(10) << "order" << right << setw(8) << "packet" << setw(12) << "query ms" << setw(12) << "M queries/s"
+		<< setw(12) << "fetches/q" << setw(12) << "hits/q" << endl;
+
+	const uint32_t packetSizes[] = { 1, 8, ParticleBVH::MaxPacketSize };
+	uint64_t referenceHits = 0;
+	for (const auto pOrder : { &sortedOrder, &shuffledOrder })
+	{
+		const auto& order = *pOrder;
+		vector<XMFLOAT3> points(numParticles);
+		for (auto i = 0u; i < numParticles; ++i) points[i] = positions[order[i]];
+
+		for (const auto& packetSize : packetSizes)
+		{
+			// Node fetches are shared by the points of a packet.
+			ParticleBVH::QueryStats stats = {};
+			uint64_t numHits = 0;
+			const auto queryMs = MeasureMilliseconds([&]()
+			{
+				if (packetSize == 1)
+					for (const auto& pos : points) bvh.Query(pos, [&numHits](uint32_t, float) { ++numHits; }, &stats);
+				else for (auto i = 0u; i < numParticles; i += packetSize)
+					bvh.QueryPacket(&points[i], (min)(packetSize, numParticles - i),
+						[&numHits](uint32_t, uint32_t, float) { ++numHits; }, &stats);
+			});
+
+			cout << left << setw(10) << (pOrder == &sortedOrder ? "Morton" : "shuffled") << right << setw(8) << packetSize
+				<< fixed << setprecision(2) << setw(12) << queryMs << setw(12) << numParticles / (1000.0 * queryMs)
+				<< setw(12) << static_cast<double>(stats.NodesVisited) / numParticles
+				<< setw(12) << static_cast<double>(numHits) / numParticles << endl;
+
+			// Every mode must find the same neighbors.
+			if (referenceHits == 0) referenceHits = numHits;
+			else if (numHits != referenceHits)
+			{
+				cerr << "Packets of " << packetSize << " found " << numHits << " neighbors instead of " << referenceHits << endl;
+
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+bool RunBrickBenchmark(const SPHSolverCPU::Desc& desc, uint32_t numSteps)
+{
+	const auto solver = SPHSolverCPU::MakeUnique(SPHSolverCPU::KERNEL_POLY6_SPIKY, SPHSolverCPU::EOS_TAIT);
+	if (!solver->Init(desc)) return false;
+
+	// Bricks of 8 smoothing radii, and the AABBs fattened by a quarter radius to skip the refits of slow bricks
+	const auto radius = desc.SmoothRadius;
+	const auto clusterSize = 4u;
+	BrickedBVH brickedBVH;
+	brickedBVH.Init(desc.DomainMin, desc.DomainMax, 8.0f * radius, radius, 0.25f * radius, clusterSize);
+
+	const auto numParticles = solver->GetNumParticles();
+	cout << "Bricked particle BVH: " << numParticles << " particles, " << numSteps << " steps, "
+		<< brickedBVH.GetNumBricks() << " bricks" << endl;
+
+	ParticleBVH fullBVH;
+	vector<XMFLOAT3> positions(numParticles);
+	double fullMs = 0.0, brickedMs = 0.0;
+	uint64_t numRebuilt = 0, numRefit = 0, numSkipped = 0, numSkippedParticles = 0;
+	for (auto i = 0u; i < numSteps; ++i)
+	{
+		solver->Simulate(1.0f / 320.0f);
+		const auto pParticles = solver->GetParticles();
+		for (auto j = 0u; j < numParticles; ++j) positions[j] = pParticles[j].Pos;
+
+		fullMs += MeasureMilliseconds([&]() { fullBVH.Build(positions.data(), numParticles, radius, clusterSize); });
+		brickedMs += MeasureMilliseconds([&]()
+		{
+			const auto& stats = brickedBVH.Update(positions.data(), numParticles);
+			numRebuilt += stats.NumRebuilt;
+			numRefit += stats.NumRefit;
+			numSkipped += stats.NumSkipped;
+			numSkippedParticles += stats.NumSkippedParticles;
+		});
+	}
+
+	cout << right << setw(10) << "" << setw(12) << "build ms" << setw(12) << "memory KB" << setw(12) << "query ms"
+		<< setw(12) << "nodes/q" << setw(12) << "hits/q" << setw(12) << "max hits" << endl;
+
+	// Both must find the same neighbors on the last step.
+	const auto printQueries = [&](const char* name, double buildMs, size_t memorySize, const auto& query)
+	{
+		ParticleBVH::QueryStats stats = {};
+		uint64_t numHits = 0;
+		const auto queryMs = MeasureMilliseconds([&]()
+		{
+			for (const auto& pos : positions) query(pos, [&numHits](uint32_t, float) { ++numHits; }, &stats, nullptr);
+		});
+
+		NeighborStats neighborStats = {};
+		for (const auto& pos : positions) query(pos, [](uint32_t, float) {}, nullptr, &neighborStats);
+
+		cout << left << setw(10) << name << right << fixed << setprecision(2) << setw(12) << buildMs / numSteps
+			<< setw(12) << memorySize / 1024.0 << setw(12) << queryMs
+			<< setw(12) << static_cast<double>(stats.NodesVisited) / numParticles
+			<< setw(12) << static_cast<double>(numHits) / numParticles << setw(12) << neighborStats.MaxNeighbors << endl;
+
+		return numHits;
+	};
+
+	const auto fullHits = printQueries("full", fullMs, fullBVH.GetMemorySize(),
+		[&](const XMFLOAT3& pos, const auto& func, ParticleBVH::QueryStats* pStats, NeighborStats* pNeighborStats)
+		{ fullBVH.Query(pos, func, pStats, pNeighborStats); });
+	const auto brickedHits = printQueries("bricked", brickedMs, brickedBVH.GetMemorySize(),
+		[&](const XMFLOAT3& pos, const auto& func, ParticleBVH::QueryStats* pStats, NeighborStats* pNeighborStats)
+		{ brickedBVH.Query(pos, func, pStats, pNeighborStats); });
+
+	cout << "Bricks per step: " << fixed << setprecision(1) << static_cast<double>(numRebuilt) / numSteps << " rebuilt, "
+		<< static_cast<double>(numRefit) / numSteps << " refit, " << static_cast<double>(numSkipped) / numSteps << " skipped, whose "
+		<< static_cast<double>(numSkippedParticles) / numSteps << " particles still update their positions" << endl;
+
+	if (brickedHits != fullHits)
+	{
+		cerr << "The bricked BVH found " << brickedHits << " neighbors instead of " << fullHits << endl;
+
+		return false;
+	}
+
+	return true;
+}
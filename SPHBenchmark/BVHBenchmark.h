@@ -0,0 +1,26 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CPU/SPHSolverCPU.h"
+
+// Benchmarks of the particle BVH on a snapshot of the particle positions
+bool RunClusterBenchmark(const std::vector<DirectX::XMFLOAT3>& positions, float radius, uint32_t numRepeats);
+
+// Build time of the parallel linear BVH up to the thread count (0 for all), against the median-split and SAH builds
+bool RunBuilderBenchmark(const std::vector<DirectX::XMFLOAT3>& positions, float radius, uint32_t maxThreads, uint32_t numRepeats);
+
+// Point queries on the binary BVH against its collapsed BVH4 and BVH8, with full-precision and quantized nodes
+bool RunWideBenchmark(const std::vector<DirectX::XMFLOAT3>& positions, float radius);
+
+// Stackless traversal with the skip links against the stack-based one, from 1 thread up to the thread count (0 for all)
+bool RunStacklessBenchmark(const std::vector<DirectX::XMFLOAT3>& positions, float radius, uint32_t maxThreads);
+
+// Packets of 8 and 16 point queries against the single queries, in the Morton order and shuffled
+bool RunPacketBenchmark(const std::vector<DirectX::XMFLOAT3>& positions, float radius);
+
+// Per-step rebuild of the bricked particle BVH against a full rebuild while the solver runs
+bool RunBrickBenchmark(const SPHSolverCPU::Desc& desc, uint32_t numSteps);
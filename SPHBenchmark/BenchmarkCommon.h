@@ -0,0 +1,25 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Wall-clock time of func in milliseconds, averaged over the repeats
+template<typename TFunc>
+double MeasureMilliseconds(uint32_t numRepeats, const TFunc& func)
+{
+	const auto start = std::chrono::high_resolution_clock::now();
+	for (auto i = 0u; i < numRepeats; ++i) func();
+	const auto end = std::chrono::high_resolution_clock::now();
+
+	return 1000.0 * std::chrono::duration<double>(end - start).count() / numRepeats;
+}
+
+template<typename TFunc>
+double MeasureMilliseconds(const TFunc& func)
+{
+	return MeasureMilliseconds(1, func);
+}
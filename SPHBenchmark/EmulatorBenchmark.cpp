@@ -0,0 +1,238 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <iomanip>
+#include <iostream>
+#include "CPU/RTDensity.h"
+#include "CPU/RTForce.h"
+#include "BenchmarkCommon.h"
+#include "EmulatorBenchmark.h"
+
+using namespace std;
+using namespace DirectX;
+using namespace RTEmulation;
+
+struct EmulatorResult
+{
+	vector<float> Densities;
+	vector<float3> Accelerations;
+	TraversalStats DensityStats;
+	TraversalStats ForceStats;
+	NeighborStats DensityNeighbors;
+	double DensityMs;
+	double ForceMs;
+};
+
+// Bind the same constants as FluidEZ for the scene
+template<typename TShader>
+static void setConstants(TShader& shader, const SPHSolverCPU::Desc& desc, const vector<Particle>& particles,
+	const AccelerationStructure& accelerationStructure, bool isPointQuery)
+{
+	const auto h = desc.SmoothRadius;
+	const auto fluidVolume = (desc.FluidMax.x - desc.FluidMin.x) * (desc.FluidMax.y - desc.FluidMin.y) * (desc.FluidMax.z - desc.FluidMin.z);
+	const auto mass = desc.RestDensity * fluidVolume / desc.NumParticles;
+
+	shader.g_smoothRadius = h;
+	shader.g_pressureStiffness = desc.PressureStiffness;
+	shader.g_restDensity = desc.RestDensity;
+	shader.g_densityCoef = mass * 315.0f / (64.0f * XM_PI * pow(h, 9.0f));
+	shader.g_pressureGradCoef = mass * -45.0f / (XM_PI * pow(h, 6.0f));
+	shader.g_viscosityLaplaceCoef = mass * desc.Viscosity * 45.0f / (XM_PI * pow(h, 6.0f));
+	shader.g_sleepSpeedSq = 0.0f;
+	shader.g_sleepSteps = UINT32_MAX;	// No sleeping
+	shader.g_maxSmoothRadius = h;
+	shader.g_periodMin = desc.DomainMin;
+	shader.g_periodSize = float3(desc.DomainMax) - float3(desc.DomainMin);
+	shader.g_periodicAxes = desc.PeriodicAxes;
+	shader.g_kernelType = KERNEL_ANALYTIC;
+	shader.g_isPointQuery = isPointQuery;
+	shader.g_roParticles = particles.data();
+	shader.g_bvhParticles = &accelerationStructure;
+	shader.g_txKernelTable = nullptr;
+}
+
+static void runShaders(const SPHSolverCPU::Desc& desc, const vector<Particle>& particles,
+	const AccelerationStructure& accelerationStructure, bool isPointQuery, EmulatorResult& result)
+{
+	const auto numParticles = static_cast<uint32_t>(particles.size());
+	vector<uint32_t> sleepCounters(numParticles, 0);
+	vector<float> minDensityRatios(numParticles), numberDensities(numParticles);
+	result.Densities.assign(numParticles, 0.0f);
+	result.Accelerations.assign(numParticles, float3(0.0f));
+	result.DensityStats = {};
+	result.ForceStats = {};
+	result.DensityNeighbors.Reset();
+
+	RTDensity::Shader density;
+	setConstants(density, desc, particles, accelerationStructure, isPointQuery);
+	density.g_rwDensities = result.Densities.data();
+	density.g_rwSleepCounters = sleepCounters.data();
+	density.g_rwNumberDensities = numberDensities.data();
+	result.DensityMs = MeasureMilliseconds([&]() { density.DispatchRays(numParticles, &result.DensityStats, &result.DensityNeighbors); });
+
+	RTForce::Shader force;
+	setConstants(force, desc, particles, accelerationStructure, isPointQuery);
+	force.g_rwAccelerations = result.Accelerations.data();
+	force.g_rwMinDensityRatios = minDensityRatios.data();
+	force.g_roDensities = result.Densities.data();
+	force.g_roSleepCounters = sleepCounters.data();
+	result.ForceMs = MeasureMilliseconds([&]() { force.DispatchRays(numParticles, &result.ForceStats); });
+}
+
+static void printPass(const char* pass, const char* mode, double ms, const TraversalStats& stats, uint32_t numParticles)
+{
+	const auto perRay = [&stats](uint64_t count) { return stats.NumRays > 0 ? static_cast<double>(count) / stats.NumRays : 0.0; };
+
+	cout << left << setw(10) << pass << setw(10) << mode << right << fixed << setprecision(2) << setw(12) << ms
+		<< setw(12) << numParticles / (1000.0 * ms) << setw(12) << perRay(stats.NumBoxTests)
+		<< setw(14) << perRay(stats.NumIntersections) << setw(12) << perRay(stats.NumAnyHits) << endl;
+}
+
+bool RunEmulatorBenchmark(const vector<XMFLOAT3>& positions, const vector<XMFLOAT3>& velocities, const SPHSolverCPU::Desc& desc)
+{
+	const auto numParticles = static_cast<uint32_t>(positions.size());
+	vector<Particle> particles(numParticles);
+	for (auto i = 0u; i < numParticles; ++i) particles[i] = { positions[i], velocities[i], 1.0f, desc.SmoothRadius };
+
+	// The AABBs extend by the pair smoothing radius with the largest particle.
+	AccelerationStructure accelerationStructure;
+	accelerationStructure.Build(positions.data(), numParticles, desc.SmoothRadius);
+
+	EmulatorResult pointResult, segmentResult;
+	runShaders(desc, particles, accelerationStructure, true, pointResult);
+	runShaders(desc, particles, accelerationStructure, false, segmentResult);
+
+	cout << "DXR emulation of RTDensity and RTForce: " << numParticles << " particles" << endl;
+	cout << left << setw(10) << "pass" << setw(10) << "ray" << right << setw(12) << "ms" << setw(12) << "M rays/s"
+		<< setw(12) << "boxes/ray" << setw(14) << "intersect/ray" << setw(12) << "any-hit/ray" << endl;
+	printPass("density", "point", pointResult.DensityMs, pointResult.DensityStats, numParticles);
+	printPass("density", "segment", segmentResult.DensityMs, segmentResult.DensityStats, numParticles);
+	printPass("force", "point", pointResult.ForceMs, pointResult.ForceStats, numParticles);
+	printPass("force", "segment", segmentResult.ForceMs, segmentResult.ForceStats, numParticles);
+
+	// The sphere test of intersectionMain rejects the AABB candidates beyond the smoothing radius.
+	for (const auto pResult : { &pointResult, &segmentResult })
+	{
+		const auto& stats = pResult->DensityNeighbors;
+		cout << "Density " << (pResult == &pointResult ? "point" : "segment") << " rays: " << fixed << setprecision(2)
+			<< static_cast<double>(stats.NumNeighbors) / stats.NumQueries << " neighbors (max " << stats.MaxNeighbors << "), "
+			<< static_cast<double>(stats.GetNumRejected()) / stats.NumQueries << " rejected AABB candidates per ray" << endl;
+	}
+
+	// Both ray modes must report the same pairs, where only the rounding of the ray origin differs.
+	auto maxDensityError = 0.0f, maxAccelerationError = 0.0f, maxReferenceError = 0.0f;
+	for (auto i = 0u; i < numParticles; ++i)
+	{
+		const auto& density = pointResult.Densities[i];
+		maxDensityError = (max)(maxDensityError, fabs(segmentResult.Densities[i] - density) / density);
+
+		const auto& acceleration = pointResult.Accelerations[i];
+		const auto diff = segmentResult.Accelerations[i] - acceleration;
+		maxAccelerationError = (max)(maxAccelerationError, sqrt(dot(diff, diff) / (max)(dot(acceleration, acceleration), 1.0f)));
+	}
+
+	// Direct poly6 sum over the same neighbors, without the periodic images
+	if (!desc.PeriodicAxes)
+	{
+		ParticleBVH bvh;
+		bvh.Build(positions.data(), numParticles, desc.SmoothRadius, 4);
+		RTDensity::Shader density;
+		setConstants(density, desc, particles, accelerationStructure, true);
+		const auto hSq = desc.SmoothRadius * desc.SmoothRadius;
+		for (auto i = 0u; i < numParticles; ++i)
+		{
+			auto reference = 0.0f;
+			bvh.Query(positions[i], [&](uint32_t, float r_sq)
+			{
+				const auto d_sq = hSq - r_sq;
+				reference += density.g_densityCoef * d_sq * d_sq * d_sq;
+			});
+			maxReferenceError = (max)(maxReferenceError, fabs(pointResult.Densities[i] - reference) / reference);
+		}
+	}
+
+	cout << scientific << setprecision(2) << "Max relative error: density " << maxDensityError
+		<< " and acceleration " << maxAccelerationError << " between the ray modes, density " << maxReferenceError
+		<< " against the direct sum" << endl;
+
+	const auto tolerance = 1.0e-3f;
+	if (maxDensityError > tolerance || maxAccelerationError > tolerance || maxReferenceError > tolerance)
+	{
+		cerr << "The emulated shaders disagree beyond the tolerance of " << tolerance << endl;
+
+		return false;
+	}
+
+	return true;
+}
+
+bool RunRayModeBenchmark(const vector<XMFLOAT3>& positions, const vector<XMFLOAT3>& velocities,
+	const SPHSolverCPU::Desc& desc, const char* sceneName, bool isHeaderPrinted)
+{
+	const auto numParticles = static_cast<uint32_t>(positions.size());
+	vector<Particle> particles(numParticles);
+	for (auto i = 0u; i < numParticles; ++i) particles[i] = { positions[i], velocities[i], 1.0f, desc.SmoothRadius };
+
+	if (isHeaderPrinted)
+	{
+		cout << "Point queries versus ray segments in the RTDensity port" << endl;
+		cout << left << setw(8) << "scene" << right << setw(10) << "particles" << "  " << left << setw(9) << "ray"
+			<< setw(8) << "AABB" << right << setw(10) << "build ms" << setw(10) << "SAH cost" << setw(11) << "M rays/s"
+			<< setw(11) << "nodes/ray" << setw(15) << "intersect/ray" << setw(12) << "false/ray" << setw(10) << "hits/ray" << endl;
+	}
+
+	// The GPU segment mode builds the half-height AABBs at the initialization only, while the refits
+	// of CSIntegrate use the full cubes, so both layouts are measured.
+	struct Variant { const char* Ray; const char* AABB; bool IsPointQuery; bool IsHalfHeight; };
+	const Variant variants[] =
+	{
+		{ "point", "full", true, false },
+		{ "segment", "full", false, false },
+		{ "segment", "half", false, true }
+	};
+
+	vector<float> referenceDensities;
+	auto maxDensityError = 0.0f;
+	for (const auto& variant : variants)
+	{
+		AccelerationStructure accelerationStructure;
+		const auto buildMs = MeasureMilliseconds([&]()
+		{
+			accelerationStructure.Build(positions.data(), numParticles, desc.SmoothRadius, variant.IsHalfHeight);
+		});
+
+		vector<float> densities(numParticles, 0.0f), numberDensities(numParticles, 0.0f);
+		vector<uint32_t> sleepCounters(numParticles, 0);
+		TraversalStats stats = {};
+		RTDensity::Shader density;
+		setConstants(density, desc, particles, accelerationStructure, variant.IsPointQuery);
+		density.g_rwDensities = densities.data();
+		density.g_rwSleepCounters = sleepCounters.data();
+		density.g_rwNumberDensities = numberDensities.data();
+		const auto ms = MeasureMilliseconds([&]() { density.DispatchRays(numParticles, &stats); });
+
+		// Intersection calls that do not report a hit are the false positives of the AABBs.
+		const auto perRay = [&stats](uint64_t count) { return stats.NumRays > 0 ? static_cast<double>(count) / stats.NumRays : 0.0; };
+		cout << left << setw(8) << sceneName << right << setw(10) << numParticles << "  " << left << setw(9) << variant.Ray
+			<< setw(8) << variant.AABB << right << fixed << setprecision(2) << setw(10) << buildMs
+			<< setw(10) << accelerationStructure.GetBVH().GetSAHCost() << setw(11) << numParticles / (1000.0 * ms)
+			<< setw(11) << perRay(stats.NumBoxTests) << setw(15) << perRay(stats.NumIntersections)
+			<< setw(12) << perRay(stats.NumIntersections - stats.NumAnyHits) << setw(10) << perRay(stats.NumAnyHits) << endl;
+
+		// All variants must find the same neighbors.
+		if (referenceDensities.empty()) referenceDensities = move(densities);
+		else for (auto i = 0u; i < numParticles; ++i)
+			maxDensityError = (max)(maxDensityError, fabs(densities[i] - referenceDensities[i]) / referenceDensities[i]);
+	}
+
+	const auto tolerance = 1.0e-3f;
+	if (maxDensityError > tolerance)
+	{
+		cerr << "The ray modes disagree on the densities by " << scientific << setprecision(2) << maxDensityError << endl;
+
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,19 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+#include "CPU/SPHSolverCPU.h"
+
+// Runs the C++ ports of RTDensity and RTForce through the DXR emulation with POINT_QUERY = 1 and 0
+// on a snapshot of the particles, and validates them against each other and a direct density sum
+bool RunEmulatorBenchmark(const std::vector<DirectX::XMFLOAT3>& positions, const std::vector<DirectX::XMFLOAT3>& velocities,
+	const SPHSolverCPU::Desc& desc);
+
+// Compares the point queries (POINT_QUERY = 1) with the z-oriented ray segments (POINT_QUERY = 0) over the
+// full and half-height particle AABBs for the RTDensity port, and reports the nodes visited, the intersection
+// calls and false positives per ray and the ray throughput for the scene
+bool RunRayModeBenchmark(const std::vector<DirectX::XMFLOAT3>& positions, const std::vector<DirectX::XMFLOAT3>& velocities,
+	const SPHSolverCPU::Desc& desc, const char* sceneName, bool isHeaderPrinted);
@@ -0,0 +1,373 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "CPU/SPHSolverCPU.h"
+#include "BVHBenchmark.h"
+#include "EmulatorBenchmark.h"
+#include "ProbeBenchmark.h"
+#include "QueryBenchmark.h"
+
+using namespace std;
+using namespace DirectX;
+
+// The same scene as the GPU solver: a block of fluid in the corner of the unit box pool
+static SPHSolverCPU::Desc getSceneDesc3D(uint32_t numParticles, uint8_t periodicAxes)
+{
+	SPHSolverCPU::Desc desc;
+	desc.NumParticles = numParticles;
+	desc.SmoothRadius = 1.0f / 50.0f;
+	desc.RestDensity = 1000.0f;
+	desc.PressureStiffness = 200.0f;
+	desc.Viscosity = 0.4f;
+	desc.WallStiffness = 3000.0f;
+	desc.Gravity = XMFLOAT3(0.0f, -9.8f, 0.0f);
+	desc.DomainMin = XMFLOAT3(-0.5f, 0.0f, -0.5f);
+	desc.DomainMax = XMFLOAT3(0.5f, 1.0f, 0.5f);
+	desc.FluidMin = XMFLOAT3(-0.48f, 0.4f, -0.12f);
+	desc.FluidMax = XMFLOAT3(0.12f, 1.0f, 0.48f);
+	desc.PeriodicAxes = periodicAxes;
+	desc.Execution = SPHSolverCPU::EXECUTION_FAST;
+	desc.NumThreads = 0;
+
+	return desc;
+}
+
+// The xy-slice of the same scene with the square walls, which is scaled up to hold the particles
+// at the same initial spacing and smoothing radius as the 3D scene by default
+static SPHSolverCPU2D::Desc getSceneDesc2D(uint32_t numParticles, uint8_t periodicAxes)
+{
+	const auto scale = ceil(sqrt(static_cast<float>(numParticles))) / 32.0f;
+
+	SPHSolverCPU2D::Desc desc;
+	desc.NumParticles = numParticles;
+	desc.SmoothRadius = 1.0f / 50.0f;
+	desc.RestDensity = 1000.0f;
+	desc.PressureStiffness = 200.0f;
+	desc.Viscosity = 0.4f;
+	desc.WallStiffness = 3000.0f;
+	desc.Gravity = XMFLOAT2(0.0f, -9.8f);
+	desc.DomainMin = XMFLOAT2(-0.5f * scale, 0.0f);
+	desc.DomainMax = XMFLOAT2(0.5f * scale, scale);
+	desc.FluidMin = XMFLOAT2(-0.48f * scale, 0.4f * scale);
+	desc.FluidMax = XMFLOAT2(0.12f * scale, scale);
+	desc.PeriodicAxes = periodicAxes & (SPHSolverCPU2D::PERIODIC_X | SPHSolverCPU2D::PERIODIC_Y);
+	desc.Execution = SPHSolverCPU2D::EXECUTION_FAST;
+	desc.NumThreads = 0;
+
+	return desc;
+}
+
+struct RunResult
+{
+	double Seconds;
+	vector<uint64_t> Checksums;	// One per timed step
+	NeighborStats Neighbors;	// Of the last step
+};
+
+template<uint8_t N>
+static bool runSolver(SPHSolverCPUTypes::KernelType kernelType, SPHSolverCPUTypes::EOSType eosType,
+	const typename SPHSolverCPUBase<N>::Desc& desc, uint32_t numSteps, uint32_t numWarmUpSteps, RunResult& result,
+	bool isNeighborStatsEnabled = false)
+{
+	const auto timeStep = 1.0f / 320.0f;
+
+	// The specialization is picked once here, and the steps run without any dispatch on the types.
+	const auto solver = SPHSolverCPUBase<N>::MakeUnique(kernelType, eosType);
+	if (!solver->Init(desc)) return false;
+	solver->EnableNeighborStats(isNeighborStatsEnabled);
+
+	result.Checksums.clear();
+	result.Checksums.reserve(numSteps);
+	for (auto i = 0u; i < numWarmUpSteps; ++i) solver->Simulate(timeStep);
+
+	const auto start = chrono::high_resolution_clock::now();
+	for (auto i = 0u; i < numSteps; ++i)
+	{
+		solver->Simulate(timeStep);
+		result.Checksums.push_back(solver->GetChecksum());
+	}
+	const auto end = chrono::high_resolution_clock::now();
+	result.Seconds = chrono::duration<double>(end - start).count();
+	result.Neighbors = solver->GetNeighborStats();
+
+	return true;
+}
+
+static void printNeighborStats(const NeighborStats& stats)
+{
+	const auto perQuery = [&stats](uint64_t count) { return static_cast<double>(count) / (max)(stats.NumQueries, static_cast<uint64_t>(1)); };
+	cout << "  neighbors/particle " << setprecision(2) << perQuery(stats.NumNeighbors) << " (max " << stats.MaxNeighbors
+		<< "), candidates " << perQuery(stats.NumCandidates) << ", rejected " << perQuery(stats.GetNumRejected())
+		<< ", cells " << perQuery(stats.NumNodesVisited) << endl;
+
+	// Percentage of the particles in each non-empty bin of the neighbor counts
+	cout << "  histogram";
+	for (auto i = 0u; i < NeighborStats::NumHistogramBins; ++i)
+	{
+		if (!stats.Histogram[i]) continue;
+		const auto lower = i * NeighborStats::HistogramBinWidth;
+		cout << "  " << lower;
+		if (i + 1 < NeighborStats::NumHistogramBins) cout << "-" << lower + NeighborStats::HistogramBinWidth - 1;
+		else cout << "+";
+		cout << ": " << setprecision(1) << 100.0 * perQuery(stats.Histogram[i]) << "%";
+	}
+	cout << endl;
+}
+
+template<uint8_t N>
+static bool runBenchmark(SPHSolverCPUTypes::KernelType kernelType, SPHSolverCPUTypes::EOSType eosType,
+	const typename SPHSolverCPUBase<N>::Desc& desc, uint32_t numSteps, uint32_t numWarmUpSteps,
+	bool isDeterminismChecked, bool isChecksumPrinted, bool isNeighborStatsPrinted)
+{
+	RunResult result;
+	if (!runSolver<N>(kernelType, eosType, desc, numSteps, numWarmUpSteps, result)) return false;
+
+	const auto msPerStep = 1000.0 * result.Seconds / numSteps;
+	const auto throughput = static_cast<double>(desc.NumParticles) * numSteps / result.Seconds;
+
+	cout << left << setw(16) << SPHSolverCPUTypes::GetKernelName(kernelType) << setw(10) << SPHSolverCPUTypes::GetEOSName(eosType)
+		<< right << fixed << setprecision(2) << setw(12) << msPerStep << " ms/step"
+		<< setw(12) << throughput / 1.0e6 << " M particle-steps/s" << endl;
+
+	// Compare the deterministic mode with the fast one, and against itself on a single thread
+	if (isDeterminismChecked)
+	{
+		auto deterministicDesc = desc;
+		deterministicDesc.Execution = SPHSolverCPUTypes::EXECUTION_DETERMINISTIC;
+		RunResult deterministicResult, referenceResult;
+		if (!runSolver<N>(kernelType, eosType, deterministicDesc, numSteps, numWarmUpSteps, deterministicResult)) return false;
+
+		deterministicDesc.NumThreads = 1;
+		if (!runSolver<N>(kernelType, eosType, deterministicDesc, numSteps, numWarmUpSteps, referenceResult)) return false;
+
+		const auto deterministicMsPerStep = 1000.0 * deterministicResult.Seconds / numSteps;
+		const auto isReproducible = deterministicResult.Checksums == referenceResult.Checksums;
+		cout << left << setw(26) << "  deterministic" << right << setw(12) << deterministicMsPerStep << " ms/step"
+			<< setw(11) << showpos << 100.0 * (deterministicMsPerStep / msPerStep - 1.0) << noshowpos << "% over fast, "
+			<< (isReproducible ? "matches" : "DIFFERS FROM") << " 1 thread" << endl;
+
+		if (isChecksumPrinted) result.Checksums = deterministicResult.Checksums;
+		if (!isReproducible) return false;
+	}
+
+	// Run again with the neighbor counters, which are meant to stay on in production. The runs with the
+	// counters off and on are interleaved and repeated, so that the drift of the clock and the caches hits
+	// both runs of each pair alike, and the overhead is the median over the pairs.
+	if (isNeighborStatsPrinted)
+	{
+		const uint32_t numRepeats = 5;
+		vector<double> onMsPerStep, overheads;
+		RunResult offResult, countedResult;
+		for (auto i = 0u; i < numRepeats; ++i)
+		{
+			if (!runSolver<N>(kernelType, eosType, desc, numSteps, numWarmUpSteps, offResult)) return false;
+			if (!runSolver<N>(kernelType, eosType, desc, numSteps, numWarmUpSteps, countedResult, true)) return false;
+			onMsPerStep.push_back(1000.0 * countedResult.Seconds / numSteps);
+			overheads.push_back(countedResult.Seconds / offResult.Seconds - 1.0);
+		}
+
+		const auto median = [](vector<double>& values)
+		{
+			nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+
+			return values[values.size() / 2];
+		};
+		cout << left << setw(26) << "  neighbor stats" << right << setw(12) << median(onMsPerStep) << " ms/step"
+			<< setw(11) << showpos << 100.0 * median(overheads) << noshowpos << "% over off, median of "
+			<< numRepeats << " interleaved pairs" << endl;
+		printNeighborStats(countedResult.Neighbors);
+		cout << fixed;
+	}
+
+	if (isChecksumPrinted)
+		for (auto i = 0u; i < numSteps; ++i)
+			cout << "  step " << setw(6) << numWarmUpSteps + i << "  checksum " << hex << setw(16)
+			<< setfill('0') << result.Checksums[i] << setfill(' ') << dec << endl;
+
+	return true;
+}
+
+template<uint8_t N>
+static bool runBenchmarks(const typename SPHSolverCPUBase<N>::Desc& desc, int kernelType, int eosType,
+	uint32_t numSteps, bool isDeterminismChecked, bool isChecksumPrinted, bool isNeighborStatsPrinted)
+{
+	cout << "CPU SPH " << static_cast<uint32_t>(N) << "D: " << desc.NumParticles << " particles, " << numSteps << " steps, "
+		<< sizeof(typename SPHSolverCPUBase<N>::Particle) << " bytes/particle state, threads: ";
+	if (desc.NumThreads > 0) cout << desc.NumThreads << endl;
+	else cout << "all" << endl;
+
+	for (auto k = 0; k < SPHSolverCPUTypes::NUM_KERNEL_TYPE; ++k)
+	{
+		if (kernelType >= 0 && k != kernelType) continue;
+		for (auto e = 0; e < SPHSolverCPUTypes::NUM_EOS_TYPE; ++e)
+		{
+			if (eosType >= 0 && e != eosType) continue;
+			if (!runBenchmark<N>(static_cast<SPHSolverCPUTypes::KernelType>(k), static_cast<SPHSolverCPUTypes::EOSType>(e),
+				desc, numSteps, numSteps / 10, isDeterminismChecked, isChecksumPrinted, isNeighborStatsPrinted)) return false;
+		}
+	}
+
+	return true;
+}
+
+static vector<XMFLOAT3> simulateSnapshot(const SPHSolverCPU::Desc& desc, uint32_t numSteps, vector<XMFLOAT3>* pVelocities = nullptr)
+{
+	const auto solver = SPHSolverCPU::MakeUnique(SPHSolverCPU::KERNEL_POLY6_SPIKY, SPHSolverCPU::EOS_TAIT);
+	vector<XMFLOAT3> positions;
+	if (!solver->Init(desc)) return positions;
+
+	for (auto i = 0u; i < numSteps; ++i) solver->Simulate(1.0f / 320.0f);
+
+	const auto pParticles = solver->GetParticles();
+	positions.resize(solver->GetNumParticles());
+	for (auto i = 0u; i < solver->GetNumParticles(); ++i) positions[i] = pParticles[i].Pos;
+
+	if (pVelocities)
+	{
+		pVelocities->resize(solver->GetNumParticles());
+		for (auto i = 0u; i < solver->GetNumParticles(); ++i) (*pVelocities)[i] = pParticles[i].Velocity;
+	}
+
+	return positions;
+}
+
+int main(int argc, char* argv[])
+{
+	uint32_t numParticles = 32768;
+	uint32_t numSteps = 100;
+	uint8_t periodicAxes = 0;
+	uint32_t numThreads = 0;
+	bool is2D = false;
+	bool isDeterminismChecked = false;
+	bool isChecksumPrinted = false;
+	bool isNeighborStatsPrinted = false;
+	bool isBVHBenchmarked = false;
+	bool isBrickBenchmarked = false;
+	bool isBuilderBenchmarked = false;
+	bool isWideBenchmarked = false;
+	bool isPacketBenchmarked = false;
+	bool isStacklessBenchmarked = false;
+	bool isEmulated = false;
+	bool isRayModeBenchmarked = false;
+	bool isProbed = false;
+	bool isQueried = false;
+	int kernelType = -1;
+	int eosType = -1;
+
+	for (auto i = 1; i < argc; ++i)
+	{
+		const auto hasNextArgValue = i + 1 < argc;
+		if (!strcmp(argv[i], "-particles") && hasNextArgValue) numParticles = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "-steps") && hasNextArgValue) numSteps = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "-threads") && hasNextArgValue) numThreads = stoul(argv[++i]);
+		else if (!strcmp(argv[i], "-2d")) is2D = true;
+		else if (!strcmp(argv[i], "-deterministic")) isDeterminismChecked = true;
+		else if (!strcmp(argv[i], "-checksums")) isChecksumPrinted = true;
+		else if (!strcmp(argv[i], "-stats")) isNeighborStatsPrinted = true;
+		else if (!strcmp(argv[i], "-bvh")) isBVHBenchmarked = true;
+		else if (!strcmp(argv[i], "-bricks")) isBrickBenchmarked = true;
+		else if (!strcmp(argv[i], "-lbvh")) isBuilderBenchmarked = true;
+		else if (!strcmp(argv[i], "-wide")) isWideBenchmarked = true;
+		else if (!strcmp(argv[i], "-packet")) isPacketBenchmarked = true;
+		else if (!strcmp(argv[i], "-stackless")) isStacklessBenchmarked = true;
+		else if (!strcmp(argv[i], "-emulate")) isEmulated = true;
+		else if (!strcmp(argv[i], "-pointquery")) isRayModeBenchmarked = true;
+		else if (!strcmp(argv[i], "-probe")) isProbed = true;
+		else if (!strcmp(argv[i], "-knn")) isQueried = true;
+		else if (!strcmp(argv[i], "-kernel") && hasNextArgValue)
+		{
+			const string name = argv[++i];
+			if (name == "poly6") kernelType = SPHSolverCPU::KERNEL_POLY6_SPIKY;
+			else if (name == "cubic") kernelType = SPHSolverCPU::KERNEL_CUBIC_SPLINE;
+			else if (name == "wendland") kernelType = SPHSolverCPU::KERNEL_WENDLAND_C4;
+		}
+		else if (!strcmp(argv[i], "-eos") && hasNextArgValue)
+		{
+			const string name = argv[++i];
+			if (name == "tait") eosType = SPHSolverCPU::EOS_TAIT;
+			else if (name == "linear") eosType = SPHSolverCPU::EOS_LINEAR;
+		}
+		else if (!strcmp(argv[i], "-periodic") && hasNextArgValue)
+		{
+			const string axes = argv[++i];
+			if (axes.find('x') != string::npos) periodicAxes |= SPHSolverCPU::PERIODIC_X;
+			if (axes.find('y') != string::npos) periodicAxes |= SPHSolverCPU::PERIODIC_Y;
+			if (axes.find('z') != string::npos) periodicAxes |= SPHSolverCPU::PERIODIC_Z;
+		}
+	}
+
+	// Run the chosen combination, or all of them
+	if (is2D)
+	{
+		auto desc = getSceneDesc2D(numParticles, periodicAxes);
+		desc.NumThreads = numThreads;
+
+		return runBenchmarks<2>(desc, kernelType, eosType, numSteps, isDeterminismChecked, isChecksumPrinted, isNeighborStatsPrinted) ? 0 : 1;
+	}
+
+	auto desc = getSceneDesc3D(numParticles, periodicAxes);
+	desc.NumThreads = numThreads;
+
+	if (isBVHBenchmarked || isBuilderBenchmarked || isWideBenchmarked || isPacketBenchmarked || isStacklessBenchmarked)
+	{
+		// Query the particles after they have settled for the steps
+		const auto positions = simulateSnapshot(desc, numSteps);
+		if (isBVHBenchmarked && !RunClusterBenchmark(positions, desc.SmoothRadius, 5)) return 1;
+		if (isBuilderBenchmarked && !RunBuilderBenchmark(positions, desc.SmoothRadius, numThreads, 5)) return 1;
+		if (isWideBenchmarked && !RunWideBenchmark(positions, desc.SmoothRadius)) return 1;
+		if (isStacklessBenchmarked && !RunStacklessBenchmark(positions, desc.SmoothRadius, numThreads)) return 1;
+
+		return !isPacketBenchmarked || RunPacketBenchmark(positions, desc.SmoothRadius) ? 0 : 1;
+	}
+
+	if (isBrickBenchmarked) return RunBrickBenchmark(desc, numSteps) ? 0 : 1;
+
+	if (isEmulated)
+	{
+		vector<XMFLOAT3> velocities;
+		const auto positions = simulateSnapshot(desc, numSteps, &velocities);
+
+		return RunEmulatorBenchmark(positions, velocities, desc) ? 0 : 1;
+	}
+
+	// As many random probes as particles
+	if (isProbed) return RunProbeBenchmark(desc, numSteps, numParticles) ? 0 : 1;
+
+	// The 16 nearest neighbors and the variable radii at every 4th particle
+	if (isQueried) return RunQueryBenchmark(desc, numSteps, numParticles / 4, 16) ? 0 : 1;
+
+	if (isRayModeBenchmarked)
+	{
+		// Sweep the particle counts over the initial block and the flow after the steps, where the
+		// smaller blocks are lower to keep the same spacing
+		struct Scene { const char* Name; uint32_t NumSteps; };
+		const Scene scenes[] = { { "block", 0 }, { "flow", numSteps } };
+		auto isHeaderPrinted = true;
+		for (auto n = (max)(numParticles / 4, 1u); n <= numParticles; n *= 2)
+		{
+			auto sweepDesc = getSceneDesc3D(n, periodicAxes);
+			sweepDesc.FluidMin.y = desc.FluidMax.y - (desc.FluidMax.y - desc.FluidMin.y) * n / numParticles;
+			sweepDesc.NumThreads = numThreads;
+			for (const auto& scene : scenes)
+			{
+				vector<XMFLOAT3> velocities;
+				const auto positions = simulateSnapshot(sweepDesc, scene.NumSteps, &velocities);
+				if (!RunRayModeBenchmark(positions, velocities, sweepDesc, scene.Name, isHeaderPrinted)) return 1;
+				isHeaderPrinted = false;
+			}
+		}
+
+		return 0;
+	}
+
+	return runBenchmarks<3>(desc, kernelType, eosType, numSteps, isDeterminismChecked, isChecksumPrinted, isNeighborStatsPrinted) ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "CPU/SPHKernels.h"
+#include "BenchmarkCommon.h"
+#include "ProbeBenchmark.h"
+
+using namespace std;
+using namespace DirectX;
+
+bool RunProbeBenchmark(const SPHSolverCPU::Desc& desc, uint32_t numSteps, uint32_t numProbes)
+{
+	const auto timeStep = 1.0f / 320.0f;
+	const auto solver = SPHSolverCPU::MakeUnique(SPHSolverCPU::KERNEL_POLY6_SPIKY, SPHSolverCPU::EOS_TAIT);
+	if (!solver->Init(desc)) return false;
+
+	// The probes see the positions of the density pass, which are those before the last step.
+	vector<XMFLOAT3> positions(desc.NumParticles);
+	for (auto i = 0u; i + 1 < numSteps; ++i) solver->Simulate(timeStep);
+	for (auto i = 0u; i < desc.NumParticles; ++i) positions[i] = solver->GetParticles()[i].Pos;
+	const auto stepMs = MeasureMilliseconds([&]() { solver->Simulate(timeStep); });
+
+	// A column of sensors in the middle of the initial block, then the random probes in the domain
+	const uint32_t numSensors = 16;
+	vector<XMFLOAT3> points(numSensors + numProbes);
+	const auto sensorX = 0.5f * (desc.FluidMin.x + desc.FluidMax.x);
+	const auto sensorZ = 0.5f * (desc.FluidMin.z + desc.FluidMax.z);
+	for (auto i = 0u; i < numSensors; ++i)
+		points[i] = XMFLOAT3(sensorX, desc.DomainMin.y + (desc.DomainMax.y - desc.DomainMin.y) * (i + 0.5f) / numSensors, sensorZ);
+
+	mt19937 rng(12345);
+	uniform_real_distribution<float> dist(0.0f, 1.0f);
+	for (auto i = numSensors; i < points.size(); ++i)
+		points[i] = XMFLOAT3(desc.DomainMin.x + (desc.DomainMax.x - desc.DomainMin.x) * dist(rng),
+			desc.DomainMin.y + (desc.DomainMax.y - desc.DomainMin.y) * dist(rng),
+			desc.DomainMin.z + (desc.DomainMax.z - desc.DomainMin.z) * dist(rng));
+
+	// The samples are written in place, into the array the caller owns.
+	vector<SPHSolverCPU::ProbeSample> samples(points.size());
+	const auto numPoints = static_cast<uint32_t>(points.size());
+	const auto probeMs = MeasureMilliseconds([&]() { solver->Probe(points.data(), numPoints, samples.data()); });
+
+	cout << "Probes after " << numSteps << " steps: " << desc.NumParticles << " particles, " << numPoints << " probes in "
+		<< fixed << setprecision(2) << probeMs << " ms (" << numPoints / (1000.0 * probeMs) << " M probes/s), step "
+		<< stepMs << " ms" << endl;
+	cout << right << setw(10) << "sensor y" << setw(12) << "density" << setw(12) << "pressure" << setw(12) << "speed" << endl;
+	for (auto i = 0u; i < numSensors; ++i)
+	{
+		const auto& sample = samples[i];
+		const auto& v = sample.Velocity;
+		cout << setw(10) << points[i].y << setw(12) << sample.Density << setw(12) << sample.Pressure
+			<< setw(12) << sqrt(v.x * v.x + v.y * v.y + v.z * v.z) << endl;
+	}
+
+	// Direct poly6 sum over all the particles, without the periodic images
+	if (desc.PeriodicAxes) return true;
+
+	const auto fluidVolume = (desc.FluidMax.x - desc.FluidMin.x) * (desc.FluidMax.y - desc.FluidMin.y) * (desc.FluidMax.z - desc.FluidMin.z);
+	const auto mass = desc.RestDensity * fluidVolume / desc.NumParticles;
+	const KernelPoly6Spiky<3> kernel(desc.SmoothRadius);
+	const auto numChecked = (min)(numPoints, numSensors + 256u);
+	auto maxError = 0.0f;
+	for (auto i = 0u; i < numChecked; ++i)
+	{
+		auto reference = 0.0f;
+		for (const auto& pos : positions)
+		{
+			const auto dx = pos.x - points[i].x, dy = pos.y - points[i].y, dz = pos.z - points[i].z;
+			reference += mass * kernel.Density(dx * dx + dy * dy + dz * dz);
+		}
+		maxError = (max)(maxError, fabs(samples[i].Density - reference) / (max)(reference, desc.RestDensity));
+	}
+
+	cout << scientific << setprecision(2) << "Max density error against the direct sum: " << maxError << endl;
+
+	const auto tolerance = 1.0e-4f;
+	if (maxError > tolerance)
+	{
+		cerr << "The probed densities disagree beyond the tolerance of " << tolerance << endl;
+
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,11 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPU/SPHSolverCPU.h"
+
+// Samples a column of sensors and a batch of random probes in the tank after the steps, and validates
+// the probed densities against a direct sum over all the particles
+bool RunProbeBenchmark(const SPHSolverCPU::Desc& desc, uint32_t numSteps, uint32_t numProbes);
@@ -0,0 +1,190 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "CPU/ParticleBVH.h"
+#include "CPU/ThreadPool.h"
+#include "BenchmarkCommon.h"
+#include "QueryBenchmark.h"
+
+using namespace std;
+using namespace DirectX;
+
+static float getDistanceSq(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+	const auto dx = b.x - a.x, dy = b.y - a.y, dz = b.z - a.z;
+
+	return dx * dx + dy * dy + dz * dz;
+}
+
+bool RunQueryBenchmark(const SPHSolverCPU::Desc& desc, uint32_t numSteps, uint32_t numQueries, uint32_t k)
+{
+	const auto timeStep = 1.0f / 320.0f;
+	const auto solver = SPHSolverCPU::MakeUnique(SPHSolverCPU::KERNEL_POLY6_SPIKY, SPHSolverCPU::EOS_TAIT);
+	if (!solver->Init(desc)) return false;
+
+	// The queries see the positions of the density pass, which are those before the last step, in the
+	// particle order after it. The grid is built by the step, so at least one step is needed.
+	const auto numParticles = desc.NumParticles;
+	numSteps = (max)(numSteps, 1u);
+	vector<XMFLOAT3> positionsById(numParticles), positions(numParticles);
+	for (auto i = 0u; i + 1 < numSteps; ++i) solver->Simulate(timeStep);
+	for (auto i = 0u; i < numParticles; ++i) positionsById[solver->GetParticleIds()[i]] = solver->GetParticles()[i].Pos;
+	solver->Simulate(timeStep);
+	for (auto i = 0u; i < numParticles; ++i) positions[i] = positionsById[solver->GetParticleIds()[i]];
+
+	// The queries at evenly strided particles, as for the surface detection, with the radii from half
+	// to twice the smoothing radius
+	numQueries = (min)(numQueries, numParticles);
+	const auto h = desc.SmoothRadius;
+	const auto maxRadius = 4.0f * h;
+	const uint32_t maxNeighbors = 256;
+	vector<XMFLOAT3> points(numQueries);
+	vector<float> radii(numQueries);
+	mt19937 rng(12345);
+	uniform_real_distribution<float> dist(0.5f * h, 2.0f * h);
+	for (auto i = 0u; i < numQueries; ++i)
+	{
+		points[i] = positions[static_cast<size_t>(i) * numParticles / numQueries];
+		radii[i] = dist(rng);
+	}
+
+	// The BVH needs its own build, while the grid is the one of the step.
+	ThreadPool threadPool;
+	threadPool.Init(desc.NumThreads);
+	ParticleBVH bvh;
+	const auto buildMs = MeasureMilliseconds([&]()
+	{
+		bvh.Build(positions.data(), numParticles, h, 4, 0.0f, ParticleBVH::BUILD_LBVH, &threadPool);
+	});
+
+	struct Result
+	{
+		vector<NearestNeighbor> KNN;
+		vector<uint32_t> KNNCounts;
+		vector<NearestNeighbor> Radius;
+		vector<uint32_t> RadiusCounts;
+		double KNNMs;
+		double RadiusMs;
+	};
+
+	Result results[2];
+	for (auto& result : results)
+	{
+		result.KNN.resize(static_cast<size_t>(numQueries) * k);
+		result.KNNCounts.resize(numQueries);
+		result.Radius.resize(static_cast<size_t>(numQueries) * maxNeighbors);
+		result.RadiusCounts.resize(numQueries);
+	}
+
+	auto& gridResult = results[0];
+	gridResult.KNNMs = MeasureMilliseconds([&]()
+	{
+		solver->QueryKNN(points.data(), numQueries, k, maxRadius, gridResult.KNN.data(), gridResult.KNNCounts.data());
+	});
+	gridResult.RadiusMs = MeasureMilliseconds([&]()
+	{
+		solver->QueryRadius(points.data(), radii.data(), numQueries, maxNeighbors, gridResult.Radius.data(), gridResult.RadiusCounts.data());
+	});
+
+	auto& bvhResult = results[1];
+	bvhResult.KNNMs = MeasureMilliseconds([&]()
+	{
+		bvh.QueryKNN(points.data(), numQueries, k, maxRadius, bvhResult.KNN.data(), bvhResult.KNNCounts.data(), &threadPool);
+	});
+	bvhResult.RadiusMs = MeasureMilliseconds([&]()
+	{
+		bvh.QueryRadius(points.data(), radii.data(), numQueries, maxNeighbors, bvhResult.Radius.data(),
+			bvhResult.RadiusCounts.data(), &threadPool);
+	});
+
+	cout << "Neighbor queries after " << numSteps << " steps: " << numParticles << " particles, " << numQueries
+		<< " queries, k = " << k << ", radii from " << 0.5f * h << " to " << 2.0f * h << ", BVH build "
+		<< fixed << setprecision(2) << buildMs << " ms" << endl;
+	cout << right << setw(10) << "index" << setw(12) << "k-NN ms" << setw(12) << "M q/s" << setw(12) << "radius ms"
+		<< setw(12) << "M q/s" << setw(12) << "hits/q" << endl;
+	const char* names[] = { "grid", "BVH" };
+	for (auto r = 0u; r < 2; ++r)
+	{
+		const auto& result = results[r];
+		uint64_t numHits = 0;
+		for (const auto& count : result.RadiusCounts) numHits += count;
+		cout << setw(10) << names[r] << setw(12) << result.KNNMs << setw(12) << numQueries / (1000.0 * result.KNNMs)
+			<< setw(12) << result.RadiusMs << setw(12) << numQueries / (1000.0 * result.RadiusMs)
+			<< setw(12) << static_cast<double>(numHits) / numQueries << endl;
+	}
+
+	// Brute force over all the particles, without the periodic images
+	if (desc.PeriodicAxes) return true;
+
+	// The grid, the SIMD lanes of the BVH and the brute force compute r^2 in different orders, which may
+	// differ in the last bits with FMA contraction, so the distances match within a relative tolerance,
+	// and the near ties may swap their ranks.
+	const auto tolerance = 1.0e-5f;
+	const auto isNear = [tolerance](float a, float b) { return abs(a - b) <= tolerance * (max)(a, b); };
+
+	const auto numChecked = (min)(numQueries, 256u);
+	auto numMismatches = 0u;
+	vector<NearestNeighbor> candidates;
+	vector<uint32_t> indices;
+	for (auto q = 0u; q < numChecked; ++q)
+	{
+		const auto radiusSq = radii[q] * radii[q];
+		candidates.clear();
+		auto numSurelyInRadius = 0u, numMaybeInRadius = 0u;
+		for (auto i = 0u; i < numParticles; ++i)
+		{
+			const auto r_sq = getDistanceSq(points[q], positions[i]);
+			if (r_sq < maxRadius * maxRadius) candidates.push_back({ i, r_sq });
+			if (r_sq < radiusSq * (1.0f - tolerance)) ++numSurelyInRadius;
+			if (r_sq < radiusSq * (1.0f + tolerance)) ++numMaybeInRadius;
+		}
+
+		const auto numNearest = (min)(static_cast<uint32_t>(candidates.size()), k);
+		partial_sort(candidates.begin(), candidates.begin() + numNearest, candidates.end());
+
+		// The k nearest neighbors are unique and sorted from the nearest, and the radius queries stop at
+		// the max number of neighbors in any order.
+		for (const auto& result : results)
+		{
+			const auto numFound = result.RadiusCounts[q];
+			auto isMatched = result.KNNCounts[q] == numNearest &&
+				numFound >= (min)(numSurelyInRadius, maxNeighbors) && numFound <= (min)(numMaybeInRadius, maxNeighbors);
+
+			indices.clear();
+			for (auto i = 0u; isMatched && i < numNearest; ++i)
+			{
+				const auto& neighbor = result.KNN[static_cast<size_t>(q) * k + i];
+				const auto r_sq = getDistanceSq(points[q], positions[neighbor.Index]);
+				isMatched = isNear(r_sq, candidates[i].R_sq) && isNear(neighbor.R_sq, r_sq);
+				indices.push_back(neighbor.Index);
+			}
+			sort(indices.begin(), indices.end());
+			isMatched = isMatched && adjacent_find(indices.begin(), indices.end()) == indices.end();
+
+			for (auto i = 0u; isMatched && i < numFound; ++i)
+			{
+				const auto& neighbor = result.Radius[static_cast<size_t>(q) * maxNeighbors + i];
+				isMatched = getDistanceSq(points[q], positions[neighbor.Index]) < radiusSq * (1.0f + tolerance);
+			}
+			if (!isMatched) ++numMismatches;
+		}
+	}
+
+	if (numMismatches > 0)
+	{
+		cerr << numMismatches << " queries disagree with the brute-force search" << endl;
+
+		return false;
+	}
+
+	cout << "The first " << numChecked << " queries of both match the brute-force search" << endl;
+
+	return true;
+}
@@ -0,0 +1,12 @@
+//--------------------------------------------------------------------------------------
+// Copyright (c) XU, Tianchen. All rights reserved.
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "CPU/SPHSolverCPU.h"
+
+// Runs the batched k-nearest-neighbor and variable-radius queries at a subset of the particles after the
+// steps, over the neighbor grid of the solver and over a BVH of the same positions, and validates both
+// against a brute-force search
+bool RunQueryBenchmark(const SPHSolverCPU::Desc& desc, uint32_t numSteps, uint32_t numQueries, uint32_t k);